@@ -255,6 +255,13 @@ int genwqe_card_execute_ddcb(card_handle_t card, struct genwqe_ddcb_cmd *req);
 int genwqe_card_execute_raw_ddcb(card_handle_t card,
 				 struct genwqe_ddcb_cmd *req);
 
+/**
+ * @brief	DDCBs of this process currently retried because the
+ *		DDCB queue of their card was full (EBUSY).
+ * @return	number of DDCBs waiting for a queue slot
+ */
+unsigned int genwqe_card_get_waiting(void);
+
 /** Genwqe register access */
 uint64_t genwqe_card_read_reg64(card_handle_t card, uint32_t offs, int *rc);
 uint32_t genwqe_card_read_reg32(card_handle_t card, uint32_t offs, int *rc);
@@ -36,6 +36,7 @@ extern "C" {
 #include <stdint.h>
 #include <string.h>
 #include <pthread.h>
+#include <asm/byteorder.h>
 #include <linux/types.h>
 
 /*****************************************************************************/
@@ -44,6 +45,7 @@ extern "C" {
 
 #define DDCB_TYPE_GENWQE		0x0000
 #define DDCB_TYPE_CAPI			0x0002
+#define DDCB_TYPE_SW			0x0004 /* executed on host CPUs */
 
 #define ACCEL_REDUNDANT			-1 /* special: redundant card */
 
@@ -54,6 +56,7 @@ extern "C" {
 #define DDCB_MODE_ASYNC			0x0008 /* ... */
 #define DDCB_MODE_NONBLOCK		0x0010 /* non blocking, -EBUSY */
 #define DDCB_MODE_POLLING		0x0020 /* polling */
+#define DDCB_MODE_ADAPTIVE		0x0040 /* poll if busy, irq if idle */
 #define DDCB_MODE_MASTER		0x08000000
 	/* Open Master Context, Slave is default, CAPI ony */
 
@@ -75,6 +78,7 @@ extern "C" {
 #define DDCB_ERR_IRQTIMEOUT		-418
 #define DDCB_ERR_EVENTFAIL		-419
 #define DDCB_ERR_SELECTFAIL		-420  /* e.g. socket problems in sim */
+#define DDCB_ERR_INPROGRESS		-421  /* async DDCB not yet finished */
 
 /* Genwqe chip Units */
 #define DDCB_ACFUNC_SLU			0x00  /* chip service layer unit */
@@ -185,6 +189,22 @@ typedef struct ddcb_cmd {
 	};
 } ddcb_cmd_t;
 
+/**
+ * Input bytes a DDCB refers to, used to judge the load of a queue.
+ * The application commands (inflate, deflate, memcopy) keep the input
+ * length at DDCB offset 0x28, others are counted as 0 bytes.
+ */
+static inline uint64_t ddcb_cmd_in_bytes(const struct ddcb_cmd *cmd)
+{
+	uint32_t len;
+
+	if (cmd->acfunc != DDCB_ACFUNC_APP)
+		return 0;
+
+	memcpy(&len, &cmd->asiv[8], sizeof(len));
+	return __be32_to_cpu(len);
+}
+
 static inline void ddcb_cmd_init(struct ddcb_cmd *cmd)
 {
 	__u64 tstamp;
@@ -224,6 +244,39 @@ accel_t accel_open(int card_no, unsigned int card_type, unsigned int mode,
 
 int accel_close(accel_t card);
 
+/**
+ * @brief Size the card table and the hardware DDCB queues of an
+ * accelerator type. The queues are allocated when a card is opened
+ * first, so this must be called before that. The environment
+ * variables DDCB_CARDS and DDCB_QUEUE_DEPTH provide the defaults.
+ *
+ * @param [in] card_type   accelerator type, e.g. DDCB_TYPE_CAPI
+ * @param [in] num_cards   cards 0..num_cards-1 can be opened, 0 keeps it
+ * @param [in] queue_depth DDCBs per hardware queue, 0 keeps it
+ * @return	           DDCB_OK on success or negative error code.
+ */
+int accel_set_limits(unsigned int card_type, unsigned int num_cards,
+		     unsigned int queue_depth);
+int accel_get_limits(unsigned int card_type, unsigned int *num_cards,
+		     unsigned int *queue_depth);
+
+/**
+ * @brief Backpressure of an accelerator type. Counts DDCBs of this
+ * process from submission until completion and how many of those
+ * still wait for a free hardware queue slot. Callers which can do
+ * the work on the CPU can use it to avoid queueing behind a
+ * saturated card. The wait is estimated from DDCB turnaround times,
+ * which are measured from the first call on.
+ *
+ * @param [in] card_type   accelerator type, e.g. DDCB_TYPE_CAPI
+ * @param [out] queued     DDCBs submitted but not yet completed
+ * @param [out] waiting    DDCBs of those without a hardware slot
+ * @param [out] wait_usec  estimated wait of a new DDCB for a slot
+ * @return	           DDCB_OK on success or negative error code.
+ */
+int accel_get_load(unsigned int card_type, unsigned int *queued,
+		   unsigned int *waiting, uint64_t *wait_usec);
+
 /**
  * @brief Genwqe generic DDCB execution interface.
  * The execution request will block until finished or a timeout occurs.
@@ -237,6 +290,114 @@ int accel_close(accel_t card);
 int accel_ddcb_execute(accel_t card, struct ddcb_cmd *req, int *card_rc,
 		       int *card_errno);
 
+/**
+ * @brief Completion callback for asynchronous DDCB execution. It is
+ * called from the completion context of the accelerator, e.g. the
+ * CAPI DDCB done thread. It must not block and must not wait for other
+ * DDCBs on the same card. The request is released once the callback
+ * returns.
+ *
+ * @param [in] card      card handle
+ * @param [in] req       finished DDCB execution request
+ * @param [in] rc        DDCB_OK or negative error code, same as
+ *                       accel_ddcb_execute() would have returned
+ * @param [in] priv      private data passed to accel_ddcb_submit()
+ */
+typedef void (*ddcb_callback_t)(accel_t card, struct ddcb_cmd *req,
+				int rc, void *priv);
+
+/**
+ * @brief Enqueue DDCB execution request without waiting for its
+ * completion. The request and all buffers it refers to must stay
+ * valid until it finished. If a callback is given, it is called on
+ * completion. Otherwise the request must be reaped with
+ * accel_ddcb_poll() or accel_ddcb_wait().
+ *
+ * @param [in] card      card handle
+ * @param [inout] req    DDCB execution request
+ * @param [in] cb        completion callback or NULL
+ * @param [in] priv      private data for the callback
+ * @return	         DDCB_OK if the request was enqueued or negative
+ *                       error code.
+ */
+int accel_ddcb_submit(accel_t card, struct ddcb_cmd *req,
+		      ddcb_callback_t cb, void *priv);
+
+/**
+ * @brief Check if an asynchronous DDCB execution request is finished.
+ *
+ * @param [in] card      card handle
+ * @param [inout] req    DDCB execution request passed to submit
+ * @return	         DDCB_ERR_INPROGRESS if still running, else the
+ *                       result accel_ddcb_execute() would have returned.
+ *                       The request is released in this case.
+ */
+int accel_ddcb_poll(accel_t card, struct ddcb_cmd *req, int *card_rc,
+		    int *card_errno);
+
+/**
+ * @brief Block until an asynchronous DDCB execution request is
+ * finished. Same return codes as accel_ddcb_execute().
+ */
+int accel_ddcb_wait(accel_t card, struct ddcb_cmd *req, int *card_rc,
+		    int *card_errno);
+
+/**
+ * @brief Get an eventfd which is signalled whenever an asynchronous
+ * DDCB execution request on this card handle finished. The file
+ * descriptor is owned by the card handle and closed on accel_close().
+ * Read it to reset the counter, then use accel_ddcb_poll().
+ *
+ * @param [in] card      card handle
+ * @return	         file descriptor or negative error code.
+ */
+int accel_ddcb_eventfd(accel_t card);
+
+/**
+ * In-place DDCB execution. Instead of building the request in
+ * req->asiv, which the backend copies into its hardware queue, the
+ * caller fills the ASIV directly in a reserved queue slot and reads
+ * the ASV from there after completion. Backends without an own queue
+ * in user memory let the slot refer to req->asiv and req->asv.
+ *
+ * The slot blocks later DDCBs of the queue until it is committed, and
+ * its queue entry until it is released. Fill it right away, release it
+ * as soon as the ASV was read and do not reserve a second one before.
+ */
+struct ddcb_slot {
+	void *asiv;		/* DDCB_ASIV_LENGTH_ATS bytes, cleared */
+	const void *asv;	/* DDCB_ASV_LENGTH bytes after commit */
+
+	/* private */
+	void *card_slot;	/* backend queue slot or NULL */
+	uint64_t ticket;
+};
+
+/**
+ * @brief Reserve a queue slot to build a DDCB in place.
+ * @param [in]  card     card handle
+ * @param [out] slot     reserved slot
+ * @param [in]  req      request the header fields are taken from
+ * @return               DDCB_OK on success or negative error code.
+ */
+int accel_ddcb_reserve(accel_t card, struct ddcb_slot *slot,
+		       struct ddcb_cmd *req);
+
+/**
+ * @brief Execute the DDCB in the slot and wait for it. acfunc, cmd,
+ * cmdopts, ats, asiv_length and asv_length come from req, the status
+ * fields (retc, attn, progress, timestamps) are returned in req. Same
+ * return codes as accel_ddcb_execute(). slot->asv stays valid until
+ * accel_ddcb_release().
+ */
+int accel_ddcb_commit(accel_t card, struct ddcb_slot *slot,
+		      struct ddcb_cmd *req, int *card_rc, int *card_errno);
+
+/**
+ * @brief Give a committed slot back to the queue.
+ */
+void accel_ddcb_release(accel_t card, struct ddcb_slot *slot);
+
 /* Register access */
 uint64_t accel_read_reg64(accel_t card, uint32_t offs, int *card_rc);
 uint32_t accel_read_reg32(accel_t card, uint32_t offs, int *card_rc);
@@ -379,6 +540,36 @@ struct ddcb_accel_funcs {
 
 	/* private */
 	void *priv_data;
+
+	/*
+	 * Members behind priv_data are only used if the registered
+	 * table is large enough to hold them, see
+	 * ddcb_register_accelerator_size().
+	 */
+
+	/* Optional: enqueue without waiting, done() gets the same
+	   return code ddcb_execute would have returned. If missing,
+	   libddcb executes the request synchronously on submit. */
+	int (* ddcb_submit)(void *card_data, struct ddcb_cmd *req,
+			    void (* done)(void *priv, int card_rc),
+			    void *priv);
+
+	/* Optional: card table and queue sizes, see accel_set_limits() */
+	int (* card_set_limits)(unsigned int num_cards,
+				unsigned int queue_depth);
+	int (* card_get_limits)(unsigned int *num_cards,
+				unsigned int *queue_depth);
+
+	/* Optional: in-place DDCBs, see accel_ddcb_reserve(). If
+	   missing, libddcb builds and executes them in req. */
+	int (* ddcb_reserve)(void *card_data, struct ddcb_slot *slot);
+	int (* ddcb_commit)(void *card_data, struct ddcb_slot *slot,
+			    struct ddcb_cmd *req);
+	void (* ddcb_release)(void *card_data, struct ddcb_slot *slot);
+
+	/* Optional: DDCBs waiting for a hardware queue slot, see
+	   accel_get_load(). 0 is assumed if missing. */
+	unsigned int (* card_get_waiting)(void);
 };
 
 
@@ -396,8 +587,18 @@ int accel_dump_statistics(struct ddcb_accel_funcs *accel, FILE *fp);
  * a library constructor.
  *
  * @param [in] accel     accelerator function table
+ * @param [in] size      size of the table, members behind it are unused
+ */
+int ddcb_register_accelerator_size(struct ddcb_accel_funcs *accel,
+				   size_t size);
+
+/*
+ * Backends built against a header without the size end their table
+ * at priv_data. Newer ones pass the size of their table.
  */
 int ddcb_register_accelerator(struct ddcb_accel_funcs *accel);
+#define ddcb_register_accelerator(accel) \
+	ddcb_register_accelerator_size((accel), sizeof(*(accel)))
 
 #ifdef __cplusplus
 }
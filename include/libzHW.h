@@ -123,6 +123,15 @@ extern "C" {
  */
 #define ZEDC_FLG_SKIP_LAST_DICT	(1 << 2) /* flag: try to omit last dict */
 
+/*
+ * The ONE_SHOT flag is for callers passing complete input and output
+ * with ZEDC_FINISH, e.g. compress() and uncompress(). The DDCB never
+ * saves the dictionary and is not repeated. If it does not complete
+ * the stream, inflate/deflate return ZEDC_BUF_ERROR and the stream
+ * cannot be continued.
+ */
+#define ZEDC_FLG_ONE_SHOT	(1 << 3) /* flag: complete in one DDCB */
+
 /**
  * We might have addresses within the ASIV data. Those need to be
  * replaced by valid DMA addresses to the buffer, sg-list or
@@ -279,12 +288,17 @@ typedef struct zedc_stream_s {
 	int		header_added;	/* deflate: header was added */
 	int		trailer_added;	/* deflate: trailer was added */
 	int havedict;			/* inflate/deflate: have dictionary */
+	int ddcb_busy;			/* deflate: submitted, not waited for */
 
 	/* temporary workspace (dict, tree, scratch) */
 	struct zedc_wsp *wsp;		/* workspace for deflate and inflate */
 	int		wsp_page;	/**< toggeling workspace page */
 	enum zedc_mtype dma_type[3];    /* dma types for in, out, ws */
 
+	/* ZEDC_FLG_SKIP_LAST_DICT predictor */
+	uint32_t	skip_ratio;	/* out/in of earlier DDCBs, 0: none */
+	int		skip_misses;	/* DDCBs repeated with SAVE_DICT */
+
 	/* GZIP/ZLIB specific parameters */
 	uint32_t	file_size;	/**< GZIP input file size */
 	uint32_t	file_adler32;	/**< checksum from GZIP Trailer */
@@ -393,6 +407,35 @@ void *zedc_memalign(zedc_handle_t zedc, size_t size, enum zedc_mtype mtype);
 int  zedc_free(zedc_handle_t zedc, void *ptr, size_t size,
 	       enum zedc_mtype mtype);
 
+/*
+ * Pooled DMA memory: buffers returned with zedc_pool_free() are kept
+ * per card, size and memory type for reuse by later streams. Pooling
+ * is off until zedc_pool_set_depth() sets the number of buffers kept.
+ */
+void  zedc_pool_set_depth(unsigned int depth);
+void *zedc_pool_alloc(zedc_handle_t zedc, size_t size, enum zedc_mtype mtype);
+int   zedc_pool_free(zedc_handle_t zedc, void *ptr, size_t size,
+		     enum zedc_mtype mtype);
+void  zedc_pool_stats(unsigned long *hits, unsigned long *misses);
+
+/*
+ * Pin cache: zedc_pin_cached() pins whole pages once per handle and
+ * buffer, zedc_unpin_cached() must drop them before the memory is
+ * freed. Pins are dropped too when the handle is closed.
+ */
+int  zedc_pin_cached(zedc_handle_t zedc, const void *addr, size_t size,
+		     int dir);
+void zedc_unpin_cached(const void *addr, size_t size);
+void zedc_pin_stats(unsigned long *hits, unsigned long *misses);
+
+/*
+ * ZEDC_FLG_SKIP_LAST_DICT: Z_FINISH DDCBs which completed without
+ * saving the dictionary, DDCBs which had to be repeated and the
+ * hardware time in usec spent on the repeated ones.
+ */
+void zedc_skip_dict_stats(unsigned long *hits, unsigned long *misses,
+			  unsigned long *wasted_usec);
+
 /* Error Handling and Information */
 int  zedc_pstatus(struct zedc_stream_s *strm, const char *task);
 int  zedc_clearerr(zedc_handle_t zedc);
@@ -451,8 +494,45 @@ int zedc_deflatePending(zedc_streamp strm, unsigned *pending, int *bits);
 int zedc_deflate(zedc_streamp strm, int flush);
 int zedc_deflateEnd(zedc_streamp strm);
 
+/**
+ * Split zedc_deflate() for pipelining: zedc_deflate_submit() starts
+ * the DDCB and returns while the card works on it, zedc_deflate_wait()
+ * collects the result and returns what zedc_deflate() would have
+ * returned. If no DDCB was needed, zedc_deflate_submit() returns the
+ * final result right away and zedc_deflate_busy() is 0. next_in,
+ * next_out and the buffers they point to must not be touched in
+ * between. Only one DDCB per stream can be in flight, since each one
+ * continues the dictionary of the previous one.
+ */
+int zedc_deflate_submit(zedc_streamp strm, int flush);
+int zedc_deflate_wait(zedc_streamp strm);
+int zedc_deflate_busy(zedc_streamp strm);
+
 int zedc_deflateSetHeader(zedc_streamp strm, gzedc_headerp head);
 
+/*
+ * BGZF, the blocked gzip format of BAM files, consists of gzip members
+ * with up to 64 KiB each. Their header carries the member size in a
+ * "BC" extra field. zedc_bgzf_compress() compresses a batch of such
+ * independent blocks with one chain of DDCBs, instead of a
+ * deflateInit/deflate/deflateEnd cycle and a hardware round trip per
+ * block. Each out buffer must hold ZEDC_BGZF_MAX_BLOCK bytes, out_len
+ * returns the size of the complete BGZF block. Blocks which do not
+ * compress are stored. An empty block yields the BGZF EOF marker.
+ */
+#define ZEDC_BGZF_BLOCK_SIZE	0xff00	/* max. input per block */
+#define ZEDC_BGZF_MAX_BLOCK	0x10000	/* max. size of a BGZF block */
+
+struct zedc_bgzf_block {
+	const uint8_t *in;		/* uncompressed data */
+	unsigned int in_len;		/* <= ZEDC_BGZF_BLOCK_SIZE */
+	uint8_t *out;			/* ZEDC_BGZF_MAX_BLOCK bytes */
+	unsigned int out_len;		/* BGZF block size */
+};
+
+int zedc_bgzf_compress(zedc_handle_t zedc, struct zedc_bgzf_block *blk,
+		       unsigned int n);
+
 /****************************************************************************
  * Decompression
  ***************************************************************************/
@@ -476,6 +556,17 @@ int zedc_inflateEnd(zedc_streamp strm);
 
 int zedc_inflateGetHeader(zedc_streamp strm, gzedc_headerp head);
 
+/**
+ * Inflate state between two DDCBs, to restart inflate later at the
+ * same input position, e.g. for random access. Only taken at input
+ * byte boundaries after the header and with no output pending.
+ */
+#define ZEDC_SNAPSHOT_MAX	(48 + ZEDC_TREE_LEN + 0x8000)
+
+int zedc_inflateSnapshot(zedc_streamp strm, uint8_t *buf, unsigned int *len);
+int zedc_inflateRestore(zedc_streamp strm, const uint8_t *buf,
+			unsigned int len);
+
 /** miscellaneous */
 int zedc_inflateSaveBuffers(zedc_streamp strm, const char *prefix);
 void zedc_lib_debug(int onoff);	/* debug outputs on/off */
@@ -17,6 +17,9 @@
 #ifndef __ZADDONS_H__
 #define __ZADDONS_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
 /*
  * Extensions of our hardware accelerated zlib implementation. Use
  * with care, since they are not part of the official zlib.h
@@ -35,6 +38,12 @@ enum zlib_impl {
 	ZLIB_FLAG_OMIT_LAST_DICT = 0x40,   /* Useful for cases like Genomics */
 	ZLIB_FLAG_USE_POLLING = 0x80,  /* Use polling mode only for CAPI */
 	ZLIB_FLAG_DISABLE_CV_FOR_Z_STREAM_END = 0x100,
+	ZLIB_FLAG_USE_ADAPTIVE_POLLING = 0x200, /* CAPI: poll while busy */
+	ZLIB_FLAG_LEASE_BUFFERS = 0x400, /* ibuf/obuf only while in use */
+	ZLIB_FLAG_PIPELINE = 0x800,	   /* deflate: overlap copy and DDCB */
+	ZLIB_FLAG_PARALLEL = 0x1000,	   /* deflate: segments in parallel */
+	ZLIB_FLAG_COST_MODEL = 0x2000,	   /* route streams by measured cost */
+	ZLIB_FLAG_SPILL = 0x4000,	   /* software if the card is saturated */
 };
 
 /**
@@ -64,13 +73,180 @@ void zlib_set_deflate_impl(enum zlib_impl impl);
 /**
  * zlib_set_accelerator() - Set accelerator type to be used
  *
- * @accel:          GENWQE or CAPI
+ * @accel:          GENWQE, CAPI or SW
  * @card_no:        card id or -1 for automatic card selection
  *
  * We support different types of hardware acceleration
  * devices. Examples are our PCIe based GenWQE accelerator or the CAPI
- * implementation for IBM System p.
+ * implementation for IBM System p. SW executes the DDCBs on the host
+ * CPUs and is useful for testing on systems without accelerator.
  */
 void zlib_set_accelerator(const char *accel, int card_no);
 
+/**
+ * zlib_register_buffer() - Register buffer for use without copies
+ *
+ * @addr:           start of the buffer
+ * @size:           size of the buffer
+ * @writable:       1 if hardware may write into it, e.g. output buffers
+ *
+ * Hardware streams copy caller data through internal DMA buffers
+ * unless the caller's buffers are large. Registered buffers are
+ * always used directly and pinned only once. All pages are touched
+ * on registration. The buffer must be unregistered before it is
+ * freed.
+ *
+ * Return: Z_OK, Z_MEM_ERROR or Z_STREAM_ERROR.
+ */
+int zlib_register_buffer(void *addr, size_t size, int writable);
+
+/**
+ * zlib_unregister_buffer() - Undo zlib_register_buffer()
+ *
+ * @addr:           start of the buffer as registered
+ * @size:           size of the buffer as registered
+ *
+ * Return: Z_OK or Z_STREAM_ERROR if it was not registered.
+ */
+int zlib_unregister_buffer(void *addr, size_t size);
+
+/**
+ * zlib_dma_malloc() - Allocate a buffer suited for hardware DMA
+ *
+ * @size:           size of the buffer
+ *
+ * The memory is registered as with zlib_register_buffer(). With
+ * ZLIB_FLAG_USE_FLAT_BUFFERS and ZLIB_FLAG_CACHE_HANDLES it is
+ * contiguous memory from the driver, otherwise page aligned memory.
+ * Free it with zlib_dma_free().
+ */
+void *zlib_dma_malloc(size_t size);
+void zlib_dma_free(void *ptr, size_t size);
+
+/**
+ * zlib_gunzip_parallel() - Decompress a multi-member gzip file
+ *
+ * @fd_in:          file descriptor to read the gzip members from
+ * @fd_out:         file descriptor to write the uncompressed data to
+ * @threads:        members inflated concurrently, 0 for the default
+ *
+ * Files written by parallel compressors consist of many gzip
+ * members. Those are found by their headers and inflated on separate
+ * streams, i.e. separate DDCB slots, or cards with ZLIB_CARD=RED.
+ * The output is written in order. Memory use depends on @threads,
+ * not on the file size. Single member files work too, but are
+ * inflated sequentially.
+ *
+ * Return: Z_OK, Z_DATA_ERROR, Z_MEM_ERROR or Z_ERRNO.
+ */
+int zlib_gunzip_parallel(int fd_in, int fd_out, unsigned int threads);
+
+/**
+ * zlib_bgzf_open() - Index a BGZF buffer for parallel inflate
+ *
+ * @buf:            BGZF data, e.g. an mmapped BAM file
+ * @len:            size of @buf
+ * @threads:        blocks inflated concurrently, 0 for the default
+ *
+ * BGZF consists of gzip members with up to 64 KiB, each carrying its
+ * size in a "BC" extra field. The block sizes and ISIZE trailers are
+ * read without inflating anything. Blocks are then inflated with one
+ * DDCB each, many of them concurrently. @buf must stay valid until
+ * zlib_bgzf_close().
+ *
+ * Return: the reader or NULL if @buf is not BGZF or memory is short.
+ */
+struct zlib_bgzf;
+struct zlib_bgzf *zlib_bgzf_open(const void *buf, size_t len,
+				 unsigned int threads);
+void zlib_bgzf_close(struct zlib_bgzf *bgzf);
+
+/* Number of blocks and uncompressed size of all of them */
+unsigned long zlib_bgzf_blocks(struct zlib_bgzf *bgzf);
+uint64_t zlib_bgzf_size(struct zlib_bgzf *bgzf);
+
+/**
+ * zlib_bgzf_block() - Offsets of block @idx
+ *
+ * @coffs:          offset of the block in the BGZF buffer
+ * @uoffs:          offset of its data in the uncompressed data
+ * @ulen:           size of its uncompressed data
+ *
+ * A BAM virtual offset is (@coffs << 16) | offset in the block.
+ *
+ * Return: Z_OK or Z_STREAM_ERROR if @idx is out of range.
+ */
+int zlib_bgzf_block(struct zlib_bgzf *bgzf, unsigned long idx,
+		    uint64_t *coffs, uint64_t *uoffs, unsigned int *ulen);
+
+/* Block holding uncompressed offset @uoffs, zlib_bgzf_blocks() if none */
+unsigned long zlib_bgzf_find(struct zlib_bgzf *bgzf, uint64_t uoffs);
+
+/**
+ * zlib_bgzf_inflate() - Inflate blocks for random access
+ *
+ * @first:          first block
+ * @n:              number of blocks
+ * @out:            receives the uncompressed data of the blocks in order
+ * @out_size:       size of @out
+ *
+ * Return: Z_OK, Z_BUF_ERROR if @out is too small, Z_DATA_ERROR,
+ * Z_MEM_ERROR or Z_STREAM_ERROR.
+ */
+int zlib_bgzf_inflate(struct zlib_bgzf *bgzf, unsigned long first,
+		      unsigned long n, void *out, size_t out_size);
+
+/**
+ * zlib_bgzf_read() - Inflate all blocks in order to @fd_out
+ *
+ * Return: Z_OK, Z_DATA_ERROR, Z_MEM_ERROR or Z_ERRNO.
+ */
+int zlib_bgzf_read(struct zlib_bgzf *bgzf, int fd_out);
+
+/**
+ * zlib_index_build() - Index a compressed file for random access
+ *
+ * @fd:             file to index, read with pread() from offset 0
+ * @windowBits:     as for inflateInit2(), e.g. 31 for gzip
+ * @span:           uncompressed bytes between access points, 0 for
+ *                  the default of 1 MiB
+ * @index:          receives the index, free it with zlib_index_free()
+ *
+ * The file is inflated once in hardware. Every @span bytes the
+ * inflate state is saved together with its compressed and
+ * uncompressed offsets. Multi-member gzip files are indexed across
+ * all members. This needs the hardware implementation, there is no
+ * software fallback.
+ *
+ * Return: Z_OK, Z_DATA_ERROR, Z_MEM_ERROR, Z_STREAM_ERROR or Z_ERRNO.
+ */
+struct zlib_index;
+int zlib_index_build(int fd, int windowBits, uint64_t span,
+		     struct zlib_index **index);
+void zlib_index_free(struct zlib_index *idx);
+
+/* Number of access points and uncompressed size of the file */
+unsigned long zlib_index_points(struct zlib_index *idx);
+uint64_t zlib_index_size(struct zlib_index *idx);
+
+/* Save an index to @fd or load it, snapshots are kept deflated */
+int zlib_index_write(struct zlib_index *idx, int fd);
+int zlib_index_read(int fd, struct zlib_index **index);
+
+/**
+ * zlib_index_extract() - Read uncompressed data at any offset
+ *
+ * @fd:             the indexed file
+ * @offset:         uncompressed offset to read from
+ * @buf:            receives up to @len bytes
+ *
+ * Hardware inflate is restarted at the last access point before
+ * @offset, so at most @span bytes are inflated in vain.
+ *
+ * Return: bytes read, less than @len only at the end of the data,
+ * or a negative Z_* error code.
+ */
+long zlib_index_extract(struct zlib_index *idx, int fd, uint64_t offset,
+			void *buf, size_t len);
+
 #endif	/* __ZADDONS_H__ */
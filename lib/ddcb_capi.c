@@ -36,6 +36,7 @@
 #include <signal.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <sched.h>
 
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -54,7 +55,14 @@
 #include "afu_regs.h"
 
 #define CONFIG_DDCB_TIMEOUT	5  /* max time for a DDCB to be executed */
-#define	NUM_DDCBS		4  /* DDCB queue length */
+#define CONFIG_DDCB_POLL_IDLE	500 /* usec to poll before waiting for irq */
+#define CONFIG_DDCB_LOAD_BYTES	(64 * 1024) /* per DDCB load in redundant mode */
+#define CONFIG_DDCB_CONTEXTS	1  /* AFU contexts per card, DDCB_CONTEXTS */
+#define CONFIG_DDCB_CARDS	4  /* number of CAPI cards, DDCB_CARDS */
+#define	NUM_DDCBS		4  /* DDCB queue length, DDCB_QUEUE_DEPTH */
+#define MAX_DDCBS		256 /* max DDCB queue length of the AFU */
+#define NUM_CONTEXTS		16 /* max AFU contexts per card and process */
+#define MAX_CARDS		64 /* max number of CAPI cards in system */
 
 extern int libddcb_verbose;
 extern FILE *libddcb_fd_out;
@@ -96,11 +104,14 @@ static void *__ddcb_done_thread(void *card_data);
 
 /**
  * Each CAPI compression card has one AFU, which provides one ddcb
- * queue per process. Multiple threads within one process share the
- * ddcb queue. Locking is needed to ensure that this works race free.
+ * queue per AFU context. A process opens up to DDCB_CONTEXTS contexts
+ * per card, each with its own queue and completion thread. A handle
+ * is bound to one of them by the thread id of its opener, threads of
+ * the same shard share the ddcb queue.
  */
 struct ttxs {
 	struct	dev_ctx	*ctx;	/* Pointer to Card Context */
+	int	ctx_no;		/* Context (shard) on each card */
 	int	compl_code;	/* Completion Code */
 	sem_t	wait_sem;
 	int	seqnum;		/* Seq Number when done */
@@ -112,14 +123,25 @@ struct ttxs {
 	struct	ttxs	*verify;
 };
 
-/* Thread wait Queue, allocate one entry per ddcb */
-enum waitq_status { DDCB_FREE, DDCB_IN, DDCB_OUT, DDCB_ERR };
+/*
+ * Thread wait Queue, allocate one entry per ddcb. A slot moves
+ * FREE -> READY (filled by submitter) -> IN (started) -> FREE (done
+ * thread). In-place DDCBs go IN -> OUT and become FREE when the owner
+ * released them. Transitions are published with release and observed
+ * with acquire semantics, the queue lock is not needed for that.
+ */
+enum waitq_status { DDCB_FREE, DDCB_IN, DDCB_OUT, DDCB_ERR, DDCB_READY };
 struct  tx_waitq {
 	enum	waitq_status	status;
 	struct	ddcb_cmd	*cmd;
 	struct	ttxs	*ttx;	/* back Pointer to active ttx */
 	int	seqnum;		/* a copy of ddcb_seqnum at start time */
 	bool	thread_wait;	/* A thread is waiting to */
+	void	(* done)(void *priv, int compl_code); /* async completion */
+	void	*done_priv;
+	int	*chain_rc;	/* first error of a DDCB chain or NULL */
+	bool	inplace;	/* built in place, owner releases it */
+	uint64_t bytes;		/* input bytes, for load accounting */
 	uint64_t q_in_time;	/* Time in msec when i added this ddcb */
 };
 
@@ -131,11 +153,22 @@ struct  tx_waitq {
  */
 struct dev_ctx {
 	ddcb_t *ddcb;			/* ddcb queue */
-	struct tx_waitq waitq[NUM_DDCBS];
+	size_t ddcb_size;		/* size of hugepage mapping or 0 */
+	struct tx_waitq *waitq;		/* one entry per ddcb */
 	unsigned int completed_tasks[NUM_DDCBS+1]; /* used for DDCB_DEBUG=1 */
 	unsigned int completed_ddcbs;	/* used for DDCB_DEBUG=1 */
 	unsigned int process_irqs;	/* used for DDCB_DEBUG=1 */
+	uint64_t	poll_usec;	/* adaptive: time spent polling */
+	uint64_t	irq_usec;	/* adaptive: time waiting for irq */
+	unsigned int	poll_sleeps;	/* adaptive: polling -> irq */
+	unsigned int	out_ddcbs;	/* queued DDCBs, atomic */
+	uint64_t	out_bytes;	/* input bytes of queued DDCBs, atomic */
+	uint64_t	dispatched_ddcbs;	/* statistics, atomic */
+	uint64_t	dispatched_bytes;	/* statistics, atomic */
+	uint64_t	occupancy;	/* sum of queued DDCBs at submit, atomic */
+	unsigned int	max_occupancy;	/* most DDCBs queued at once */
 	int card_no;			/* Same card number as in ttx */
+	int ctx_no;			/* AFU context on this card */
 	unsigned int mode;
 	pthread_mutex_t	lock;
 	int		clients;	/* Thread open counter */
@@ -145,13 +178,17 @@ struct dev_ctx {
 	long cr_device;			/* config record device id */
 	long cr_vendor;			/* config record vendor id */
 	long api_version_compatible;
-	uint16_t	ddcb_seqnum;
+	uint16_t	ddcb_seqnum;	/* Seq of ticket 0 */
 	uint16_t	ddcb_free1;	/* Not used */
 	unsigned int	ddcb_num;	/* How deep is my ddcb queue */
 	int		ddcb_out;	/* ddcb Output (done) index */
 	int		ddcb_in;	/* ddcb Input index */
+	uint64_t	ddcb_ticket;	/* Next ticket to reserve, atomic */
+	uint64_t	ddcb_started;	/* Next ticket to start */
+	int		ddcb_starting;	/* Owner flag for ddcb_started */
 	struct		cxl_event	event;	/* last AFU event */
 	int		tout;		/* Timeout Value for compeltion */
+	int		poll_idle;	/* adaptive: usec idle until irq */
 	pthread_t	ddcb_done_tid;
 	sem_t		open_done_sem;	/* open done */
 	uint64_t	app_id;		/* a copy of MMIO_APP_VERSION_REG */
@@ -160,10 +197,24 @@ struct dev_ctx {
 	struct		dev_ctx		*verify;	/* Verify field */
 };
 
-#define NUM_CARDS 4 /* max number of CAPI cards in system */
-
-static ddcb_t my_ddcbs[NUM_CARDS][NUM_DDCBS] __attribute__((aligned(64*1024)));
-static struct dev_ctx my_ctx[NUM_CARDS];
+/*
+ * The card table is allocated on the first open, the DDCB queues when
+ * the AFU context is opened. Limits can be changed until then.
+ */
+static pthread_mutex_t my_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dev_ctx *my_ctx;		/* [num_cards][num_contexts] */
+static unsigned int num_cards = CONFIG_DDCB_CARDS;
+static unsigned int ddcb_depth = NUM_DDCBS;
+static int num_contexts = CONFIG_DDCB_CONTEXTS;
+static bool ddcb_hugepages = false;
+static int ddcb_tout = CONFIG_DDCB_TIMEOUT;
+static int ddcb_poll_idle = CONFIG_DDCB_POLL_IDLE;
+static unsigned int ddcb_waiting;	/* threads waiting for a free DDCB */
+
+static inline struct dev_ctx *__ctx(unsigned int card_no, int ctx_no)
+{
+	return &my_ctx[card_no * num_contexts + ctx_no];
+}
 
 static inline uint64_t get_msec(void)
 {
@@ -173,6 +224,14 @@ static inline uint64_t get_msec(void)
 	return t.tv_sec * 1000 + t.tv_usec/1000;
 }
 
+static inline uint64_t get_usec(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+	return t.tv_sec * 1000000 + t.tv_usec;
+}
+
 /*	Add trace function by setting RT_TRACE */
 //#define RT_TRACE
 #ifdef RT_TRACE
@@ -238,9 +297,9 @@ static void rt_trace_dump(void) {}
 
 #endif
 
-/*	Command to ddcb */
+/*	Command to ddcb, without the ASIV for in-place DDCBs */
 static inline void cmd_2_ddcb(ddcb_t *pddcb, struct ddcb_cmd *cmd,
-			      uint16_t seqnum, bool use_irq)
+			      uint16_t seqnum, bool use_irq, bool inplace)
 {
 	pddcb->pre = DDCB_PRESET_PRE;
 	pddcb->cmdopts_16 = __cpu_to_be16(cmd->cmdopts);
@@ -248,7 +307,8 @@ static inline void cmd_2_ddcb(ddcb_t *pddcb, struct ddcb_cmd *cmd,
 	pddcb->acfunc = cmd->acfunc;	/* functional unit */
 	pddcb->psp = (((cmd->asiv_length / 8) << 4) | ((cmd->asv_length / 8)));
 	pddcb->n.ats_64 = __cpu_to_be64(cmd->ats);
-	memcpy(&pddcb->n.asiv[0], &cmd->asiv[0], DDCB_ASIV_LENGTH_ATS);
+	if (!inplace)
+		memcpy(&pddcb->n.asiv[0], &cmd->asiv[0], DDCB_ASIV_LENGTH_ATS);
 	pddcb->icrc_hsi_shi_32 = __cpu_to_be32(0x00000000); /* for crc */
 	/* Write seqnum into reserved area, check for this seqnum is done in ddcb_2_cmd() */
 	pddcb->rsvd_0e = __cpu_to_be16(seqnum);
@@ -269,11 +329,13 @@ static inline void cmd_2_ddcb(ddcb_t *pddcb, struct ddcb_cmd *cmd,
 /**
  * Copy DDCB ASV to request struct. There is no endian conversion
  * made, since data structure in ASV is still unknown here
- * return true if the receiced ddcb is good.
+ * return true if the receiced ddcb is good. In-place DDCBs keep the
+ * ASV in the queue.
  */
-static bool ddcb_2_cmd(ddcb_t *ddcb, struct ddcb_cmd *cmd)
+static bool ddcb_2_cmd(ddcb_t *ddcb, struct ddcb_cmd *cmd, bool inplace)
 {
-	memcpy(&cmd->asv[0], (void *) &ddcb->asv[0], cmd->asv_length);
+	if (!inplace)
+		memcpy(&cmd->asv[0], (void *) &ddcb->asv[0], cmd->asv_length);
 
 	/* copy status flags of the variant part */
 	cmd->vcrc = __be16_to_cpu(ddcb->vcrc_16);
@@ -346,12 +408,83 @@ static void __setup_waitq(struct dev_ctx *ctx)
 	unsigned int i;
 	struct tx_waitq *q;
 
-	for (i = 0, q = &ctx->waitq[0]; i < ctx->ddcb_num; i++, q++) {
+	for (i = 0, q = ctx->waitq; i < ctx->ddcb_num; i++, q++) {
 		q->status = DDCB_FREE;
 		q->cmd = NULL;
 		q->ttx = NULL;
 		q->thread_wait = false;
+		q->done = NULL;
+		q->done_priv = NULL;
+		q->chain_rc = NULL;
+		q->inplace = false;
+	}
+}
+
+/* Default hugepage size in bytes or 0 if unknown */
+static size_t __hugepage_size(void)
+{
+	FILE *fp;
+	char line[128];
+	unsigned long kb = 0;
+
+	fp = fopen("/proc/meminfo", "r");
+	if (fp == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp) != NULL)
+		if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+			break;
+	fclose(fp);
+	return kb * 1024;
+}
+
+/**
+ * Allocate the DDCB queue and its wait queue. With DDCB_HUGEPAGES=1
+ * the queue is put into a hugepage, if that fails normal pages are
+ * used.
+ */
+static int __ddcb_queue_alloc(struct dev_ctx *ctx)
+{
+	size_t size = ctx->ddcb_num * sizeof(ddcb_t), hsize;
+	void *ptr = MAP_FAILED;
+
+	ctx->waitq = calloc(ctx->ddcb_num, sizeof(*ctx->waitq));
+	if (NULL == ctx->waitq)
+		return DDCB_ERR_ENOMEM;
+
+	hsize = ddcb_hugepages ? __hugepage_size() : 0;
+	if (hsize) {
+		hsize = (size + hsize - 1) & ~(hsize - 1);
+		ptr = mmap(NULL, hsize, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr == MAP_FAILED)
+			VERBOSE1("    [%s] AFU[%d] no hugepage: %s\n", __func__,
+				 ctx->card_no, strerror(errno));
+	}
+	if (ptr != MAP_FAILED) {
+		ctx->ddcb_size = hsize;
+	} else {
+		if (posix_memalign(&ptr, 64 * 1024, size) != 0) {
+			free(ctx->waitq);
+			ctx->waitq = NULL;
+			return DDCB_ERR_ENOMEM;
+		}
+		memset(ptr, 0, size);
+		ctx->ddcb_size = 0;
 	}
+	ctx->ddcb = ptr;
+	return DDCB_OK;
+}
+
+static void __ddcb_queue_free(struct dev_ctx *ctx)
+{
+	if (ctx->ddcb_size)
+		munmap(ctx->ddcb, ctx->ddcb_size);
+	else
+		free(ctx->ddcb);
+	free(ctx->waitq);
+	ctx->ddcb = NULL;
+	ctx->ddcb_size = 0;
+	ctx->waitq = NULL;
 }
 
 /**
@@ -372,21 +505,28 @@ static int __afu_open(struct dev_ctx *ctx)
 	if (ctx->afu_h)
 		return DDCB_OK;
 
+	rc = __ddcb_queue_alloc(ctx);
+	if (DDCB_OK != rc)
+		return rc;
+
 	if (DDCB_MODE_MASTER & ctx->mode)
 		sprintf(device, "/dev/cxl/afu%d.0m", ctx->card_no);
 	else	sprintf(device, "/dev/cxl/afu%d.0s", ctx->card_no);
-	VERBOSE1("       [%s] AFU[%d] Enter Open: %s DDCBs @ %p\n", __func__,
-		ctx->card_no, device, &ctx->ddcb[0]);
+	VERBOSE1("       [%s] AFU[%d] Enter Open: %s %d DDCBs @ %p\n",
+		 __func__, ctx->card_no, device, ctx->ddcb_num, &ctx->ddcb[0]);
 
-	ctx->ddcb_num = NUM_DDCBS;
 	ctx->ddcb_seqnum = 0xf00d;	/* Starting Seq */
 	ctx->ddcb_in = 0;		/* ddcb Input Index */
 	ctx->ddcb_out = 0;		/* ddcb Output Index */
+	ctx->ddcb_ticket = 0;
+	ctx->ddcb_started = 0;
+	ctx->ddcb_starting = 0;
 
 	rc0 = sem_init(&ctx->free_sem, 0, ctx->ddcb_num);
 	if (rc0 != 0) {
 		VERBOSE0("    [%s] initializing free_sem failed %d %s ...\n",
 			 __func__, rc0, strerror(errno));
+		__ddcb_queue_free(ctx);
 		return DDCB_ERRNO;
 	}
 
@@ -497,6 +637,7 @@ static int __afu_open(struct dev_ctx *ctx)
  err_exit:
 	VERBOSE1("       [%s] AFU[%d] ERROR: rc: %d errno: %d %s\n", __func__,
 		ctx->card_no, rc, errno, strerror(errno));
+	__ddcb_queue_free(ctx);
 	return rc;
 }
 
@@ -563,6 +704,7 @@ static inline int __afu_close(struct dev_ctx *ctx, bool force)
 	cxl_mmio_unmap(afu_h);
 	cxl_afu_free(afu_h);
 	ctx->afu_h = NULL;
+	__ddcb_queue_free(ctx);
 
 	VERBOSE1("        [%s] AFU[%d:%d] Exit rc: %d\n", __func__,
 		ctx->card_no, ctx->cid_id, rc);
@@ -705,6 +847,44 @@ static void __client_dec(struct dev_ctx *ctx)
 	pthread_mutex_unlock(&ctx->lock);
 }
 
+/* Allocate the card table on first open, keep it until exit */
+static int __ctx_table_alloc(void)
+{
+	int rc = DDCB_OK, ctx_no;
+	unsigned int card_no;
+	struct dev_ctx *tab, *ctx;
+
+	pthread_mutex_lock(&my_lock);
+	if (my_ctx != NULL)
+		goto out;
+
+	tab = calloc(num_cards * num_contexts, sizeof(*tab));
+	if (NULL == tab) {
+		rc = DDCB_ERR_ENOMEM;
+		goto out;
+	}
+	for (card_no = 0; card_no < num_cards; card_no++) {
+		for (ctx_no = 0; ctx_no < num_contexts; ctx_no++) {
+			ctx = &tab[card_no * num_contexts + ctx_no];
+			ctx->card_no = card_no;
+			ctx->ctx_no = ctx_no;
+			ctx->ddcb_num = ddcb_depth;
+			ctx->tout = ddcb_tout;
+			ctx->poll_idle = ddcb_poll_idle;
+			if (pthread_mutex_init(&ctx->lock, NULL) != 0) {
+				VERBOSE0("ERROR: initializing mutex failed!\n");
+				free(tab);
+				rc = DDCB_ERRNO;
+				goto out;
+			}
+		}
+	}
+	__atomic_store_n(&my_ctx, tab, __ATOMIC_RELEASE);
+ out:
+	pthread_mutex_unlock(&my_lock);
+	return rc;
+}
+
 static void *card_open(int card_no, unsigned int mode, int *card_rc,
 		       uint64_t appl_id __attribute__((unused)),
 		       uint64_t appl_id_mask __attribute__((unused)))
@@ -717,11 +897,15 @@ static void *card_open(int card_no, unsigned int mode, int *card_rc,
 		card_no, mode);
 
 	if ((card_no != ACCEL_REDUNDANT) &&
-	    ((card_no < 0) || (card_no >= NUM_CARDS))) {
+	    ((card_no < 0) || (card_no >= (int)num_cards))) {
 		rc = DDCB_ERR_INVAL;
 		goto card_open_exit;
 	}
 
+	rc = __ctx_table_alloc();
+	if (rc != DDCB_OK)
+		goto card_open_exit;
+
 	/* Allocate Thread Context */
 	ttx = calloc(1, sizeof(*ttx));
 	if (!ttx) {
@@ -734,7 +918,8 @@ static void *card_open(int card_no, unsigned int mode, int *card_rc,
 	ttx->card_no = card_no;	/* Save only right now */
 	ttx->app_id = appl_id;
 	ttx->app_id_mask = appl_id_mask;
-	ttx->card_next = rand() % NUM_CARDS;  /* start always random */
+	ttx->card_next = rand() % num_cards;  /* start always random */
+	ttx->ctx_no = gettid() % num_contexts;	/* shard by thread */
 	ttx->mode = mode;
 	ttx->verify = ttx;
 
@@ -743,7 +928,8 @@ static void *card_open(int card_no, unsigned int mode, int *card_rc,
 	 * and to any card in redundant mode.
 	 */
 	if (ttx->card_no != ACCEL_REDUNDANT) {
-		ttx->ctx = &my_ctx[card_no];  /* select card context */
+		/* select card context */
+		ttx->ctx = __ctx(card_no, ttx->ctx_no);
 		rc = __client_inc(ttx->ctx, mode);
 		if (rc != DDCB_OK) {
 			free(ttx);
@@ -751,11 +937,13 @@ static void *card_open(int card_no, unsigned int mode, int *card_rc,
 		}
 	} else {
 		/* open all possible cards */
-		for (i = 0; i < NUM_CARDS; i++) {
-			rc = __client_inc(&my_ctx[ttx->card_next], mode);
+		for (i = 0; i < num_cards; i++) {
+			struct dev_ctx *ctx = __ctx(ttx->card_next, ttx->ctx_no);
+
+			rc = __client_inc(ctx, mode);
 			if (rc == DDCB_OK)  /* remember last one which is ok */
-				ttx->ctx = &my_ctx[ttx->card_next];
-			ttx->card_next = (ttx->card_next + 1) %	NUM_CARDS;
+				ttx->ctx = ctx;
+			ttx->card_next = (ttx->card_next + 1) %	num_cards;
 		}
 	}
 
@@ -784,8 +972,8 @@ static int card_close(void *card_data)
 	if (ttx->card_no != ACCEL_REDUNDANT)
 		__client_dec(ttx->ctx);
 	else
-		for (i = 0; i < NUM_CARDS; i++)
-			__client_dec(&my_ctx[i]);
+		for (i = 0; i < num_cards; i++)
+			__client_dec(__ctx(i, ttx->ctx_no));
 
 	ttx->verify = NULL;
 	free(ttx);
@@ -803,18 +991,142 @@ static void start_ddcb(struct	cxl_afu_h *afu_h, int seq)
 	cxl_mmio_write64(afu_h, MMIO_DDCBQ_COMMAND_REG, reg);
 }
 
+/* Pure polling does not need DDCB completion interrupts */
+static inline bool __ddcb_use_irq(struct dev_ctx *ctx)
+{
+	return ((ctx->mode & DDCB_MODE_POLLING) &&
+		!(ctx->mode & DDCB_MODE_ADAPTIVE)) ? false : true;
+}
+
+/**
+ * Start all filled DDCBs in ticket order. The hardware expects the
+ * sequence numbers in order, so only one thread at a time rings the
+ * doorbell. Others just publish their slot and leave; the current
+ * owner picks them up or they are seen in the recheck after the owner
+ * dropped the flag.
+ */
+static void __ddcb_start_ready(struct dev_ctx *ctx)
+{
+	uint64_t s;
+	int seq;
+	struct tx_waitq *txq;
+
+	do {
+		if (__atomic_exchange_n(&ctx->ddcb_starting, 1,
+					__ATOMIC_SEQ_CST))
+			return;
+
+		for (s = ctx->ddcb_started; ; s++) {
+			txq = &ctx->waitq[s % ctx->ddcb_num];
+			if (__atomic_load_n(&txq->status, __ATOMIC_ACQUIRE) !=
+			    DDCB_READY)
+				break;
+
+			/* Once IN, the slot might complete and be reused */
+			seq = txq->seqnum;
+			__atomic_store_n(&txq->status, DDCB_IN,
+					 __ATOMIC_RELEASE);
+			start_ddcb(ctx->afu_h, seq);
+		}
+		ctx->ddcb_started = s;
+		ctx->ddcb_in = (int)(s % ctx->ddcb_num);
+
+		__atomic_store_n(&ctx->ddcb_starting, 0, __ATOMIC_SEQ_CST);
+	} while (__atomic_load_n(&txq->status, __ATOMIC_SEQ_CST) ==
+		 DDCB_READY);
+}
+
+/*
+ * Reserve the next DDCB slot. Holding free_sem guarantees that the
+ * DDCB which used this slot before us is completed. The owner of an
+ * in-place DDCB might still read its ASV though, wait for the release.
+ */
+static uint64_t __ddcb_slot_get(struct dev_ctx *ctx)
+{
+	uint64_t ticket;
+	struct tx_waitq *txq;
+
+	if (sem_trywait(&ctx->free_sem) != 0) {
+		__atomic_add_fetch(&ddcb_waiting, 1, __ATOMIC_RELAXED);
+		TEMP_FAILURE_RETRY(sem_wait(&ctx->free_sem));
+		__atomic_sub_fetch(&ddcb_waiting, 1, __ATOMIC_RELAXED);
+	}
+	ticket = __atomic_fetch_add(&ctx->ddcb_ticket, 1, __ATOMIC_RELAXED);
+	txq = &ctx->waitq[ticket % ctx->ddcb_num];
+	while (__atomic_load_n(&txq->status, __ATOMIC_ACQUIRE) != DDCB_FREE)
+		sched_yield();
+
+	return ticket;
+}
+
+/* Fill the reserved slot, the caller publishes it with __ddcb_slot_ready() */
+static struct tx_waitq *__ddcb_slot_fill(struct ttxs *ttx,
+					 struct dev_ctx *ctx, uint64_t ticket,
+					 struct ddcb_cmd *cmd, bool inplace)
+{
+	int idx = (int)(ticket % ctx->ddcb_num);
+	int seq = (uint16_t)(ctx->ddcb_seqnum + ticket);
+	ddcb_t *ddcb = &ctx->ddcb[idx];
+	struct tx_waitq *txq = &ctx->waitq[idx];
+	unsigned int queued, max;
+	uint32_t len;
+
+	txq->ttx = ttx;			/* set ttx pointer into txq */
+	txq->cmd = cmd;			/* my command to txq */
+	txq->seqnum = seq;		/* Save seq Number */
+	txq->inplace = inplace;
+	txq->q_in_time = get_msec();	/* Save now time in msec */
+	if (!inplace)
+		txq->bytes = ddcb_cmd_in_bytes(cmd);
+	else if (cmd->acfunc == DDCB_ACFUNC_APP) {
+		memcpy(&len, &ddcb->n.asiv[8], sizeof(len));
+		txq->bytes = __be32_to_cpu(len);
+	} else
+		txq->bytes = 0;
+	queued = __atomic_add_fetch(&ctx->out_ddcbs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx->occupancy, queued, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&ctx->max_occupancy, __ATOMIC_RELAXED);
+	while ((queued > max) &&
+	       !__atomic_compare_exchange_n(&ctx->max_occupancy, &max, queued,
+					    true, __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;	/* max was reloaded, retry while ours is larger */
+	__atomic_add_fetch(&ctx->out_bytes, txq->bytes, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx->dispatched_ddcbs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx->dispatched_bytes, txq->bytes,
+			   __ATOMIC_RELAXED);
+	rt_trace(0x00a0, seq, idx, ttx);
+	VERBOSE1("[%s] AFU[%d:%d] seq: 0x%x slot: %d cmd: %p\n", __func__,
+		ctx->card_no, ctx->cid_id, seq, idx, cmd);
+
+	cmd_2_ddcb(ddcb, cmd, seq, __ddcb_use_irq(ctx), inplace);
+	return txq;
+}
+
+static inline void __ddcb_slot_ready(struct dev_ctx *ctx,
+				     struct tx_waitq *txq)
+{
+	__atomic_store_n(&txq->status, DDCB_READY, __ATOMIC_SEQ_CST);
+	__ddcb_start_ready(ctx);
+}
+
 /**
- * Set command into next DDCB Slot
+ * Set command into next DDCB Slot. If done is given, do not block the
+ * caller but call done from the DDCB done thread when the last DDCB
+ * of the chain is finished. The first error of a chain is reported
+ * for its last DDCB, kept on our stack for synchronous chains and in
+ * a small allocation, freed by the done thread, for asynchronous ones.
  */
-static int __ddcb_execute_multi(void *card_data, struct ddcb_cmd *cmd)
+static int __ddcb_execute_multi(void *card_data, struct ddcb_cmd *cmd,
+				void (* done)(void *priv, int compl_code),
+				void *priv)
 {
 	struct	ttxs	*ttx = (struct ttxs*)card_data;
 	struct	dev_ctx	*ctx = NULL;
 	struct	tx_waitq *txq = NULL;
-	ddcb_t	*ddcb;
-	int	idx = 0;
-	int	seq, val;
+	uint64_t ticket = 0;
 	struct	ddcb_cmd *my_cmd;
+	int	sync_rc = DDCB_OK, *chain_rc = NULL;
 
 	if (NULL == ttx)
 		return DDCB_ERR_INVAL;
@@ -827,87 +1139,205 @@ static int __ddcb_execute_multi(void *card_data, struct ddcb_cmd *cmd)
 		return DDCB_ERR_INVAL;
 	my_cmd = cmd;
 
+	if (cmd->next_addr) {
+		if (done) {
+			chain_rc = malloc(sizeof(*chain_rc));
+			if (NULL == chain_rc)
+				return DDCB_ERR_ENOMEM;
+			*chain_rc = DDCB_OK;
+		} else
+			chain_rc = &sync_rc;
+	}
+
 	while (my_cmd) {
-		sem_getvalue(&ctx->free_sem, &val);
-		TEMP_FAILURE_RETRY(sem_wait(&ctx->free_sem));
+		ticket = __ddcb_slot_get(ctx);
+		txq = __ddcb_slot_fill(ttx, ctx, ticket, my_cmd, false);
+		txq->chain_rc = chain_rc;
 
-		pthread_mutex_lock(&ctx->lock);
-
-		idx = ctx->ddcb_in;
-		ddcb = &ctx->ddcb[idx];
-		txq = &ctx->waitq[idx];
-		txq->ttx = ttx;			/* set ttx pointer into txq */
-		txq->status = DDCB_IN;
-		seq = (int)ctx->ddcb_seqnum;	/* Get seq */
-		txq->cmd = my_cmd;		/* my command to txq */
-		txq->seqnum = ctx->ddcb_seqnum;	/* Save seq Number */
-		txq->q_in_time = get_msec();	/* Save now time in msec */
-		ctx->ddcb_seqnum++;		/* Next seq */
-		rt_trace(0x00a0, seq, idx, ttx);
-		VERBOSE1("[%s] AFU[%d:%d] seq: 0x%x slot: %d cmd: %p\n", __func__,
-			ctx->card_no, ctx->cid_id, seq, idx, my_cmd);
-		/* Increment ddcb_in and warp back to 0 */
-		ctx->ddcb_in = (ctx->ddcb_in + 1) % ctx->ddcb_num;
-
-		cmd_2_ddcb(ddcb, my_cmd, seq,
-			   (ctx->mode & DDCB_MODE_POLLING) ? false : true);
-
-		start_ddcb(ctx->afu_h, seq);
-		/* Get  Next cmd and continue if there is one */
+		/* Get Next cmd before the slot can complete */
 		my_cmd = (struct ddcb_cmd *)my_cmd->next_addr;
-		if (NULL == my_cmd)
-			txq->thread_wait = true;
+		if (NULL == my_cmd) {
+			if (done) {
+				txq->done = done;
+				txq->done_priv = priv;
+			} else
+				txq->thread_wait = true;
+		}
 
-		pthread_mutex_unlock(&ctx->lock);
+		__ddcb_slot_ready(ctx, txq);
 	}
 
+	if (done)
+		return DDCB_OK;
+
 	/* Block Caller */
 	VERBOSE2("[%s] Wait ttx: %p\n", __func__, ttx);
 	TEMP_FAILURE_RETRY(sem_wait(&ttx->wait_sem));
-	rt_trace(0x00af, ttx->seqnum, idx, ttx);
+	rt_trace(0x00af, ttx->seqnum, (int)(ticket % ctx->ddcb_num), ttx);
 	VERBOSE2("[%s] return ttx: %p\n", __func__, ttx);
 	return ttx->compl_code;	/* Give Completion code back to caller */
 }
 
+/**
+ * Pick the least loaded card in redundant mode. The load of a card is
+ * the number of input bytes its queued DDCBs refer to plus a fixed
+ * amount per DDCB, such that many small requests count as well. All
+ * contexts of a card add to its load, the request goes to the context
+ * of our shard. The search starts behind the card used last, to
+ * spread equal loads.
+ */
+static void __ddcb_select_card(struct ttxs *ttx, struct ddcb_cmd *cmd)
+{
+	unsigned int i, card_no, best = num_cards;
+	int ctx_no;
+	uint64_t load, best_load = UINT64_MAX, bytes = 0;
+	struct dev_ctx *ctx;
+
+	if (ttx->card_no != ACCEL_REDUNDANT)
+		return;
+
+	for (; cmd != NULL; cmd = (struct ddcb_cmd *)cmd->next_addr)
+		bytes += ddcb_cmd_in_bytes(cmd) + CONFIG_DDCB_LOAD_BYTES;
+
+	for (i = 1; i <= num_cards; i++) {
+		card_no = (ttx->card_next + i) % num_cards;
+		ctx = __ctx(card_no, ttx->ctx_no);
+
+		if ((ctx->afu_h == NULL) || (ctx->afu_rc != DDCB_OK))
+			continue;	/* not open or broken */
+
+		for (load = 0, ctx_no = 0; ctx_no < num_contexts; ctx_no++) {
+			ctx = __ctx(card_no, ctx_no);
+			load += __atomic_load_n(&ctx->out_bytes,
+						__ATOMIC_RELAXED) +
+				(uint64_t)__atomic_load_n(&ctx->out_ddcbs,
+							  __ATOMIC_RELAXED) *
+				CONFIG_DDCB_LOAD_BYTES;
+		}
+		if (load < best_load) {
+			best_load = load;
+			best = card_no;
+		}
+	}
+	if (best == num_cards)
+		return;
+
+	VERBOSE2("[%s] AFU[%d] load: %lld + %lld bytes\n", __func__,
+		 best, (long long)best_load, (long long)bytes);
+	ttx->card_next = best;
+	ttx->ctx = __ctx(best, ttx->ctx_no);
+}
+
 static int ddcb_execute(void *card_data, struct ddcb_cmd *cmd)
 {
 	int rc;
-	unsigned int i;
 	struct ttxs *ttx = (struct ttxs*)card_data;
 
-	if (ttx->card_no == ACCEL_REDUNDANT) {
-		for (i = 0; i < NUM_CARDS; i++) {
-			ttx->card_next = (ttx->card_next + 1) % NUM_CARDS;
+	__ddcb_select_card(ttx, cmd);
+	rc = __ddcb_execute_multi(card_data, cmd, NULL, NULL);
+	if (DDCB_OK != rc)
+		errno = EBADF;	/* Return Invalid exchange */
 
-			if (my_ctx[ttx->card_next].afu_h != NULL) {
-				ttx->ctx = &my_ctx[ttx->card_next];
-				break;
-			}
-		}
-	}
+	return rc;
+}
+
+static int ddcb_submit(void *card_data, struct ddcb_cmd *cmd,
+		       void (* done)(void *priv, int compl_code), void *priv)
+{
+	int rc;
+	struct ttxs *ttx = (struct ttxs*)card_data;
 
-	rc = __ddcb_execute_multi(card_data, cmd);
+	if ((NULL == ttx) || (NULL == done))
+		return DDCB_ERR_INVAL;
+
+	__ddcb_select_card(ttx, cmd);
+	rc = __ddcb_execute_multi(card_data, cmd, done, priv);
 	if (DDCB_OK != rc)
 		errno = EBADF;	/* Return Invalid exchange */
 
 	return rc;
 }
 
+/**
+ * In-place DDCBs: the ASIV is filled by the caller directly in the
+ * queue slot, the ASV is read from there. Only single DDCBs, no
+ * chains.
+ */
+static int ddcb_reserve(void *card_data, struct ddcb_slot *slot)
+{
+	struct ttxs *ttx = (struct ttxs*)card_data;
+	struct dev_ctx *ctx;
+	uint64_t ticket;
+	ddcb_t *ddcb;
+
+	if ((NULL == ttx) || (ttx->verify != ttx))
+		return DDCB_ERR_INVAL;
+
+	__ddcb_select_card(ttx, NULL);
+	ctx = ttx->ctx;
+	if (DDCB_MODE_MASTER & ctx->mode)	/* no DMA in Master Mode */
+		return DDCB_ERR_INVAL;
+
+	ticket = __ddcb_slot_get(ctx);
+	ddcb = &ctx->ddcb[ticket % ctx->ddcb_num];
+	memset(&ddcb->n.asiv[0], 0, DDCB_ASIV_LENGTH_ATS);
+	slot->asiv = &ddcb->n.asiv[0];
+	slot->asv = &ddcb->asv[0];
+	slot->card_slot = ctx;
+	slot->ticket = ticket;
+	return DDCB_OK;
+}
+
+static int ddcb_commit(void *card_data, struct ddcb_slot *slot,
+		       struct ddcb_cmd *req)
+{
+	struct ttxs *ttx = (struct ttxs*)card_data;
+	struct dev_ctx *ctx = (struct dev_ctx *)slot->card_slot;
+	struct tx_waitq *txq;
+
+	txq = __ddcb_slot_fill(ttx, ctx, slot->ticket, req, true);
+	txq->thread_wait = true;
+	__ddcb_slot_ready(ctx, txq);
+
+	TEMP_FAILURE_RETRY(sem_wait(&ttx->wait_sem));
+	if (DDCB_OK != ttx->compl_code)
+		errno = EBADF;	/* Return Invalid exchange */
+
+	return ttx->compl_code;
+}
+
+static void ddcb_release(void *card_data __attribute__((unused)),
+			 struct ddcb_slot *slot)
+{
+	struct dev_ctx *ctx = (struct dev_ctx *)slot->card_slot;
+	struct tx_waitq *txq = &ctx->waitq[slot->ticket % ctx->ddcb_num];
+
+	__atomic_store_n(&txq->status, DDCB_FREE, __ATOMIC_RELEASE);
+}
+
+/**
+ * Only the DDCB done thread consumes completions, so ddcb_out is
+ * private to it. The slot is handed back to the submitters by the
+ * release store of DDCB_FREE followed by posting free_sem.
+ */
 static bool __ddcb_done_post(struct dev_ctx *ctx, int compl_code)
 {
 	int	idx, elapsed_time;
 	ddcb_t	*ddcb;
 	struct	tx_waitq	*txq;
 	struct	ttxs		*ttx = NULL;
+	bool	thread_wait, inplace;
+	void	(* done)(void *priv, int compl_code);
+	void	*done_priv;
+	int	*chain_rc;
 
-	pthread_mutex_lock(&ctx->lock);
 	idx = ctx->ddcb_out;
 	ddcb = &ctx->ddcb[idx];
 	txq = &ctx->waitq[idx];
 
 	/* Check if Nothing to do, goto exit and wait again */
-	if (DDCB_IN != txq->status)
-		goto post_exit_stop;
+	if (DDCB_IN != __atomic_load_n(&txq->status, __ATOMIC_ACQUIRE))
+		return false;
 
 	elapsed_time = (int)(get_msec() - txq->q_in_time);
 
@@ -919,7 +1349,7 @@ static bool __ddcb_done_post(struct dev_ctx *ctx, int compl_code)
 				idx, compl_code, ddcb->retc_16, elapsed_time);
 		/* Select Timeout and no data received */
 		if (elapsed_time < (ctx->tout * 1000))
-			goto post_exit_cont;	/* Continue until timeout */
+			return true;	/* Continue until timeout */
 
 		VERBOSE2("\t[%s] AFU[%d:%d] seq: 0x%x slot: %d timeout "
 			"after %d msec\n", __func__,
@@ -933,7 +1363,7 @@ static bool __ddcb_done_post(struct dev_ctx *ctx, int compl_code)
 		VERBOSE2("\t[%s] AFU[%d:%d] seq: 0x%x slot: %d "
 			 "retc: 0 wait\n", __func__,
 			 ctx->card_no, ctx->cid_id, txq->seqnum, idx);
-		goto post_exit_stop;
+		return false;
 	}
 
 	if (libddcb_verbose > 3) {
@@ -946,7 +1376,8 @@ static bool __ddcb_done_post(struct dev_ctx *ctx, int compl_code)
 	}
 
 	/* Copy the ddcb back to cmd, and check for error */
-	if (false == ddcb_2_cmd(ddcb, txq->cmd)) {
+	inplace = txq->inplace;
+	if (false == ddcb_2_cmd(ddcb, txq->cmd, inplace)) {
 		/* Overwrite compl_code only if not set before */
 		if (DDCB_OK != compl_code)
 			compl_code = DDCB_ERR_EXEC_DDCB;
@@ -963,28 +1394,49 @@ static bool __ddcb_done_post(struct dev_ctx *ctx, int compl_code)
 			ctx->card_no, ctx->cid_id, txq->seqnum, idx,
 			compl_code, ddcb->retc_16, elapsed_time);
 
+	/* Take what we need, the slot can be reused once it is free */
+	__atomic_sub_fetch(&ctx->out_ddcbs, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&ctx->out_bytes, txq->bytes, __ATOMIC_RELAXED);
 	ttx = txq->ttx;
-	ttx->compl_code = compl_code;
+	thread_wait = txq->thread_wait;
+	done = txq->done;		/* Asynchronous request */
+	done_priv = txq->done_priv;
+	chain_rc = txq->chain_rc;
+	txq->thread_wait = false;
+	txq->done = NULL;
+	txq->done_priv = NULL;
+	txq->chain_rc = NULL;
 	rt_trace(0x0011, txq->seqnum, idx, ttx);
+
+	/* Chains report their first error with the last DDCB */
+	if (chain_rc) {
+		if (DDCB_OK == *chain_rc)
+			*chain_rc = compl_code;
+		if (thread_wait || done)
+			compl_code = *chain_rc;
+		if (done)
+			__free(chain_rc);
+	}
+	/* Only for a waiter, others may wait on the same ttx */
+	if (thread_wait)
+		ttx->compl_code = compl_code;
+
+	/* Increment and wrap back to start */
+	ctx->ddcb_out = (ctx->ddcb_out + 1) % ctx->ddcb_num;
+	__atomic_store_n(&txq->status, inplace ? DDCB_OUT : DDCB_FREE,
+			 __ATOMIC_RELEASE);
 	sem_post(&ctx->free_sem);
-	if (txq->thread_wait) {
-		rt_trace(0x0012, txq->seqnum, idx, ttx);
+
+	if (thread_wait) {
+		rt_trace(0x0012, ttx->seqnum, idx, ttx);
 		VERBOSE1("\t[%s] AFU[%d:%d] Post: %p\n", __func__,
 			ctx->card_no, ctx->cid_id, ttx);
 		sem_post(&ttx->wait_sem);
-		txq->thread_wait = false;
 	}
+	if (done)
+		done(done_priv, compl_code);
 
-	/* Increment and wrap back to start */
-	ctx->ddcb_out = (ctx->ddcb_out + 1) % ctx->ddcb_num;
-	txq->status = DDCB_FREE;
-
-  post_exit_cont:
-	pthread_mutex_unlock(&ctx->lock);
 	return true;		/* Continue Loop */
-  post_exit_stop:
-	pthread_mutex_unlock(&ctx->lock);
-	return false;		/* Stop Loop */
 }
 
 /**
@@ -1049,119 +1501,210 @@ static int __ddcb_process_polling(struct dev_ctx *ctx)
 	return 0;
 }
 
+/**
+ * Read one event from the AFU and process it. Used by the interrupt
+ * and the adaptive work loops.
+ */
+static int __ddcb_process_event(struct dev_ctx *ctx)
+{
+	int rc;
+
+	ctx->process_irqs++;	/* Increment stat conuter */
+	rc = cxl_read_event(ctx->afu_h, &ctx->event);
+	if (0 != rc) {
+		VERBOSE0("\tERROR: cxl_read_event rc: %d errno: %d\n",
+			 rc, errno);
+		return -1;
+	}
+	VERBOSE2("\tcxl_read_event(...) = %d for context: %d "
+		 "type: %d size: %d\n", rc, ctx->cid_id,
+		 ctx->event.header.type, ctx->event.header.size);
+
+	switch (ctx->event.header.type) {
+	case CXL_EVENT_AFU_INTERRUPT: {
+		unsigned int tasks = 0;
+
+		/* Process all ddcb's */
+		VERBOSE2("\tCXL_EVENT_AFU_INTERRUPT: flags: 0x%x "
+			 "irq: 0x%x\n",
+			ctx->event.irq.flags,
+			ctx->event.irq.irq);
+
+		while (__ddcb_done_post(ctx, DDCB_OK))
+			tasks++;
+		ctx->completed_ddcbs += tasks;
+		if (tasks < NUM_DDCBS)
+			ctx->completed_tasks[tasks]++;
+		else	ctx->completed_tasks[NUM_DDCBS]++;
+		break;
+	}
+	case CXL_EVENT_DATA_STORAGE:
+		rt_trace(0xbbbb, ctx->ddcb_out, ctx->ddcb_in, NULL);
+		VERBOSE0("\tCXL_EVENT_DATA_STORAGE: flags: 0x%x "
+			 "addr: 0x%016llx dsisr: 0x%016llx\n",
+			ctx->event.fault.flags,
+			(long long)ctx->event.fault.addr,
+			(long long)ctx->event.fault.dsisr);
+		afu_print_status(ctx->afu_h, libddcb_fd_out);
+		afu_dump_queue(ctx);
+		rt_trace_dump();
+		while (__ddcb_done_post(ctx, DDCB_ERR_EVENTFAIL)) {
+			/* empty */
+		}
+		break;
+	case CXL_EVENT_AFU_ERROR:
+		VERBOSE0("\tCXL_EVENT_AFU_ERROR: flags: 0x%x "
+			 "error: 0x%016llx\n",
+			ctx->event.afu_error.flags,
+			(long long)ctx->event.afu_error.error);
+		afu_print_status(ctx->afu_h, libddcb_fd_out);
+		while (__ddcb_done_post(ctx, DDCB_ERR_EVENTFAIL)) {
+			/* empty */
+		}
+		break;
+	default:
+		VERBOSE0("\tcxl_read_event() %d unknown header type\n",
+			ctx->event.header.type);
+		__ddcb_done_post(ctx, DDCB_ERR_EVENTFAIL);
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * Wait up to usec for an AFU event and process it. Returns 1 if an
+ * event was processed, 0 on timeout and -1 if select() failed.
+ */
+static int __ddcb_wait_event(struct dev_ctx *ctx, long usec)
+{
+	int rc;
+	fd_set	set;
+	struct	timeval timeout;
+
+	FD_ZERO(&set);
+	FD_SET(ctx->afu_fd, &set);
+
+	timeout.tv_sec = usec / 1000000;
+	timeout.tv_usec = usec % 1000000;
+
+	rc = select(ctx->afu_fd + 1, &set, NULL, NULL, &timeout);
+	if (0 == rc)
+		return 0;
+	if ((rc == -1) && (errno == EINTR)) {
+		VERBOSE0("WARNING: select returned -1 "
+			 "and errno was EINTR, retrying\n");
+		return -1;
+	}
+	rt_trace(0x0010, 0, 0, 0);
+
+	/*
+	 * FIXME I wonder if we must exit in this
+	 * case. select() returning a negative value is
+	 * clearly a critical issue. Only if errno == EINTR,
+	 * we should rety.
+	 *
+	 * At least we should wakeup potential DDCB execution
+	 * requestors, such that the error will be passed to
+	 * the layers above and the application can be stopped
+	 * if needed.
+	 */
+	if (rc < 0) {
+		VERBOSE0("ERROR: waiting for interrupt! rc: %d\n", rc);
+		afu_print_status(ctx->afu_h, libddcb_fd_out);
+		while (__ddcb_done_post(ctx, DDCB_ERR_SELECTFAIL)) {
+			/* empty */
+		}
+		return -1;
+	}
+
+	__ddcb_process_event(ctx);
+	return 1;
+}
+
 /**
  * Process DDCB queue results using completion processing with
  * interrupt.
  */
 static int __ddcb_process_irqs(struct dev_ctx *ctx)
 {
-	int rc;
-
 	VERBOSE1("[%s] AFU[%d:%d] Enter interrupt work loop\n", __func__,
 		ctx->card_no, ctx->cid_id);
 	while (1) {
-		fd_set	set;
-		struct	timeval timeout;
+		/* Timeout will Post error code only if context is active */
+		if (0 == __ddcb_wait_event(ctx, 100 * 1000))	/* 100 msec */
+			__ddcb_done_post(ctx, DDCB_ERR_IRQTIMEOUT);
+	}
 
-		FD_ZERO(&set);
-		FD_SET(ctx->afu_fd, &set);
+	return 0;
+}
 
-		/* Set timeout to "tout" seconds */
-		timeout.tv_sec = 0; // ctx->tout;
-		timeout.tv_usec = 100 * 1000;	/* 100 msec */
+/**
+ * Process DDCB queue results by polling as long as DDCBs get
+ * submitted or complete, and by waiting for interrupts once the queue
+ * was idle for poll_idle usec. DDCBs always request an interrupt in
+ * this mode, such that a sleeping thread is woken by the next
+ * completion.
+ */
+static int __ddcb_process_adaptive(struct dev_ctx *ctx)
+{
+	int rc;
+	unsigned int tasks;
+	uint64_t now, last, enter, seen, ticket;
 
-		rc = select(ctx->afu_fd + 1, &set, NULL, NULL, &timeout);
-		if (0 == rc) {
-			/* Timeout will Post error code only if context is active */
-			__ddcb_done_post(ctx, DDCB_ERR_IRQTIMEOUT);
-			continue;
-		}
-		if ((rc == -1) && (errno == EINTR)) {
-			VERBOSE0("WARNING: select returned -1 "
-				 "and errno was EINTR, retrying\n");
-			continue;
-		}
-		rt_trace(0x0010, 0, 0, 0);
+	VERBOSE1("[%s] AFU[%d:%d] Enter adaptive work loop idle: %d usec\n",
+		 __func__, ctx->card_no, ctx->cid_id, ctx->poll_idle);
 
-		/*
-		 * FIXME I wonder if we must exit in this
-		 * case. select() returning a negative value is
-		 * clearly a critical issue. Only if errno == EINTR,
-		 * we should rety.
-		 *
-		 * At least we should wakeup potential DDCB execution
-		 * requestors, such that the error will be passed to
-		 * the layers above and the application can be stopped
-		 * if needed.
-		 */
-		if (rc < 0) {
-			VERBOSE0("ERROR: waiting for interrupt! rc: %d\n", rc);
-			afu_print_status(ctx->afu_h, libddcb_fd_out);
-			while (__ddcb_done_post(ctx, DDCB_ERR_SELECTFAIL)) {
-				/* empty */
+	seen = __atomic_load_n(&ctx->ddcb_ticket, __ATOMIC_RELAXED);
+	last = enter = get_usec();
+	while (1) {
+		pthread_testcancel();
+
+		tasks = 0;
+		while (__ddcb_done_post(ctx, DDCB_OK))
+			tasks++;
+
+		now = get_usec();
+		ticket = __atomic_load_n(&ctx->ddcb_ticket, __ATOMIC_RELAXED);
+		if ((tasks != 0) || (ticket != seen)) {
+			if (tasks != 0) {
+				ctx->completed_ddcbs += tasks;
+				if (tasks < NUM_DDCBS)
+					ctx->completed_tasks[tasks]++;
+				else
+					ctx->completed_tasks[NUM_DDCBS]++;
 			}
+			seen = ticket;
+			last = now;
 			continue;
 		}
-
-		ctx->process_irqs++;	/* Increment stat conuter */
-		rc = cxl_read_event(ctx->afu_h, &ctx->event);
-		if (0 != rc) {
-			VERBOSE0("\tERROR: cxl_read_event rc: %d errno: %d\n",
-				 rc, errno);
+		if ((now - last) < (uint64_t)ctx->poll_idle)
 			continue;
+
+		/* Idle: account polling time and go to sleep */
+		ctx->poll_usec += now - enter;
+		ctx->poll_sleeps++;
+		enter = now;
+
+		/* Drop interrupts raised while we were polling */
+		while (1 == __ddcb_wait_event(ctx, 0)) {
+			/* empty */
 		}
-		VERBOSE2("\tcxl_read_event(...) = %d for context: %d "
-			 "type: %d size: %d\n", rc, ctx->cid_id,
-			 ctx->event.header.type, ctx->event.header.size);
-
-		switch (ctx->event.header.type) {
-		case CXL_EVENT_AFU_INTERRUPT: {
-			unsigned int tasks = 0;
-
-			/* Process all ddcb's */
-			VERBOSE2("\tCXL_EVENT_AFU_INTERRUPT: flags: 0x%x "
-				 "irq: 0x%x\n",
-				ctx->event.irq.flags,
-				ctx->event.irq.irq);
-
-			while (__ddcb_done_post(ctx, DDCB_OK))
-				tasks++;
-			ctx->completed_ddcbs += tasks;
-			if (tasks < NUM_DDCBS)
-				ctx->completed_tasks[tasks]++;
-			else	ctx->completed_tasks[NUM_DDCBS]++;
-			break;
-		}
-		case CXL_EVENT_DATA_STORAGE:
-			rt_trace(0xbbbb, ctx->ddcb_out, ctx->ddcb_in, NULL);
-			VERBOSE0("\tCXL_EVENT_DATA_STORAGE: flags: 0x%x "
-				 "addr: 0x%016llx dsisr: 0x%016llx\n",
-				ctx->event.fault.flags,
-				(long long)ctx->event.fault.addr,
-				(long long)ctx->event.fault.dsisr);
-			afu_print_status(ctx->afu_h, libddcb_fd_out);
-			afu_dump_queue(ctx);
-			rt_trace_dump();
-			while (__ddcb_done_post(ctx, DDCB_ERR_EVENTFAIL)) {
-				/* empty */
-			}
-			break;
-		case CXL_EVENT_AFU_ERROR:
-			VERBOSE0("\tCXL_EVENT_AFU_ERROR: flags: 0x%x "
-				 "error: 0x%016llx\n",
-				ctx->event.afu_error.flags,
-				(long long)ctx->event.afu_error.error);
-			afu_print_status(ctx->afu_h, libddcb_fd_out);
-			while (__ddcb_done_post(ctx, DDCB_ERR_EVENTFAIL)) {
-				/* empty */
-			}
-			break;
-		default:
-			VERBOSE0("\tcxl_read_event() %d unknown header type\n",
-				ctx->event.header.type);
-			__ddcb_done_post(ctx, DDCB_ERR_EVENTFAIL);
-			break;
+
+		/* Completions whose interrupt we just dropped */
+		if (!__ddcb_done_post(ctx, DDCB_OK)) {
+			do {
+				rc = __ddcb_wait_event(ctx, 100 * 1000);
+				if (0 == rc)
+					__ddcb_done_post(ctx,
+							 DDCB_ERR_IRQTIMEOUT);
+			} while (rc != 1);
 		}
+
+		now = get_usec();
+		ctx->irq_usec += now - enter;
+		seen = __atomic_load_n(&ctx->ddcb_ticket, __ATOMIC_RELAXED);
+		last = enter = now;
 	}
 
 	return 0;
@@ -1212,7 +1755,9 @@ static void *__ddcb_done_thread(void *card_data)
 			sleep(1);
 		}
 	}
-	if (DDCB_MODE_POLLING & ctx->mode)
+	if (DDCB_MODE_ADAPTIVE & ctx->mode)
+		__ddcb_process_adaptive(ctx);
+	else if (DDCB_MODE_POLLING & ctx->mode)
 		__ddcb_process_polling(ctx);
 	else
 		__ddcb_process_irqs(ctx);
@@ -1416,27 +1961,88 @@ static void __dev_dump(struct dev_ctx *ctx, FILE *fp)
 
 	/* Keep this in a single print so we do not get mixed lines
 	   from other process */
-	fprintf(fp, "  AFU[%d:%d] irqs: %d] Completed DDCBs: %lld\n"
+	fprintf(fp, "  AFU[%d:%d] ctx: %d irqs: %d] Completed DDCBs: %lld\n"
 		    "  Stats: %d(wait), %d(x1), %d(x2), %d(x3), %d(x4 an more)\n",
-		ctx->card_no, ctx->cid_id, ctx->process_irqs,
+		ctx->card_no, ctx->cid_id, ctx->ctx_no, ctx->process_irqs,
 		(long long)ctx->completed_ddcbs,
 		(int)ctx->completed_tasks[0],
 		(int)ctx->completed_tasks[1],
 		(int)ctx->completed_tasks[2],
 		(int)ctx->completed_tasks[3],
 		(int)ctx->completed_tasks[4]);
+
+	fprintf(fp, "  Dispatched: %lld DDCBs %lld bytes, queued: %d DDCBs "
+		"%lld bytes\n",
+		(long long)ctx->dispatched_ddcbs,
+		(long long)ctx->dispatched_bytes,
+		ctx->out_ddcbs, (long long)ctx->out_bytes);
+
+	if (ctx->dispatched_ddcbs)
+		fprintf(fp, "  Occupancy: %.2f avg %d max of %d DDCBs\n",
+			(double)ctx->occupancy / ctx->dispatched_ddcbs,
+			__atomic_load_n(&ctx->max_occupancy, __ATOMIC_RELAXED),
+			ctx->ddcb_num);
+
+	if (ctx->mode & DDCB_MODE_ADAPTIVE)
+		fprintf(fp, "  Adaptive: %lld usec polling, %lld usec irq wait, "
+			"%d times idle\n",
+			(long long)ctx->poll_usec, (long long)ctx->irq_usec,
+			ctx->poll_sleeps);
 }
 
 static int _accel_dump_statistics(FILE *fp)
 {
 	unsigned int card_no;
+	int ctx_no;
+
+	if (my_ctx == NULL)
+		return 0;	/* never opened */
 
-	for (card_no = 0; card_no < NUM_CARDS; card_no++)
-		__dev_dump(&my_ctx[card_no], fp);
+	for (card_no = 0; card_no < num_cards; card_no++)
+		for (ctx_no = 0; ctx_no < num_contexts; ctx_no++)
+			__dev_dump(__ctx(card_no, ctx_no), fp);
 
 	return 0;
 }
 
+/* Limits can only be changed as long as no card was opened */
+static int card_set_limits(unsigned int cards, unsigned int depth)
+{
+	int rc = DDCB_OK;
+
+	if ((cards > MAX_CARDS) || (depth > MAX_DDCBS)) {
+		VERBOSE0("[%s] ERROR: max %d cards and %d DDCBs per queue\n",
+			 __func__, MAX_CARDS, MAX_DDCBS);
+		return DDCB_ERR_INVAL;
+	}
+
+	pthread_mutex_lock(&my_lock);
+	if (my_ctx != NULL)
+		rc = DDCB_ERR_INVAL;	/* too late, queues are set up */
+	else {
+		if (cards)
+			num_cards = cards;
+		if (depth)
+			ddcb_depth = depth;
+	}
+	pthread_mutex_unlock(&my_lock);
+	return rc;
+}
+
+static int card_get_limits(unsigned int *cards, unsigned int *depth)
+{
+	if (cards)
+		*cards = num_cards;
+	if (depth)
+		*depth = ddcb_depth;
+	return DDCB_OK;
+}
+
+static unsigned int card_get_waiting(void)
+{
+	return __atomic_load_n(&ddcb_waiting, __ATOMIC_RELAXED);
+}
+
 static struct ddcb_accel_funcs accel_funcs = {
 	.card_type = DDCB_TYPE_CAPI,
 	.card_name = "CAPI",
@@ -1469,37 +2075,46 @@ static struct ddcb_accel_funcs accel_funcs = {
 	.time_close = 0,
 
 	.priv_data = NULL,
+
+	/* extensions */
+	.ddcb_submit = ddcb_submit,
+	.card_set_limits = card_set_limits,
+	.card_get_limits = card_get_limits,
+	.ddcb_reserve = ddcb_reserve,
+	.ddcb_commit = ddcb_commit,
+	.ddcb_release = ddcb_release,
+	.card_get_waiting = card_get_waiting,
 };
 
 static void capi_card_init(void) __attribute__((constructor));
 static void capi_card_init(void)
 {
-	int rc, tout = CONFIG_DDCB_TIMEOUT;
-	unsigned int card_no;
 	const char *ttt = getenv("DDCB_TIMEOUT");
+	const char *idle = getenv("DDCB_POLL_IDLE");
+	const char *ctxs = getenv("DDCB_CONTEXTS");
+	const char *cards = getenv("DDCB_CARDS");
+	const char *depth = getenv("DDCB_QUEUE_DEPTH");
+	const char *huge = getenv("DDCB_HUGEPAGES");
 
 	rt_trace_init();
 
 	if (ttt)
-		tout = strtoul(ttt, (char **) NULL, 0);
-
-	for (card_no = 0; card_no < NUM_CARDS; card_no++) {
-		struct dev_ctx *ctx = &my_ctx[card_no];
-
-		ctx->card_no = card_no;
-		ctx->app_id = 0x0;
-		ctx->afu_h = NULL;
-		ctx->ddcb_done_tid = 0;
-		ctx->ddcb = my_ddcbs[card_no];
-		ctx->ddcb_num = NUM_DDCBS;
-		ctx->tout = tout;
-
-		rc = pthread_mutex_init(&ctx->lock, NULL);
-		if (0 != rc) {
-			VERBOSE0("ERROR: initializing mutex failed!\n");
-			return;
-		}
+		ddcb_tout = strtoul(ttt, (char **) NULL, 0);
+	if (idle)
+		ddcb_poll_idle = strtoul(idle, (char **) NULL, 0);
+	if (ctxs) {
+		num_contexts = strtol(ctxs, (char **) NULL, 0);
+		if (num_contexts < 1)
+			num_contexts = 1;
+		if (num_contexts > NUM_CONTEXTS)
+			num_contexts = NUM_CONTEXTS;
 	}
+	if (cards || depth)
+		card_set_limits(cards ? strtoul(cards, (char **) NULL, 0) : 0,
+				depth ? strtoul(depth, (char **) NULL, 0) : 0);
+	if (huge)
+		ddcb_hugepages = strtol(huge, (char **) NULL, 0) != 0;
+
 	ddcb_register_accelerator(&accel_funcs);
 }
 
@@ -1507,10 +2122,12 @@ static void capi_card_exit(void) __attribute__((destructor));
 static void capi_card_exit(void)
 {
 	unsigned int card_no;
+	int ctx_no;
 
-	for (card_no = 0; card_no < NUM_CARDS; card_no++) {
-		struct dev_ctx *ctx = &my_ctx[card_no];
+	if (my_ctx == NULL)
+		return;		/* never opened */
 
-		card_dev_close(ctx);
-	}
+	for (card_no = 0; card_no < num_cards; card_no++)
+		for (ctx_no = 0; ctx_no < num_contexts; ctx_no++)
+			card_dev_close(__ctx(card_no, ctx_no));
 }
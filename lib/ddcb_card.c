@@ -47,6 +47,35 @@
 #include <libddcb.h>		/* outside interface */
 #include <libcard.h>		/* internal implementation */
 
+/*
+ * The GenWQE driver executes DDCBs with a blocking ioctl only. To
+ * offer asynchronous execution, a small set of threads issues the
+ * ioctls on behalf of the submitter. Each of them keeps one DDCB in
+ * the hardware queue. The threads are started on first use.
+ */
+#define CONFIG_ASYNC_THREADS	32	/* default, see DDCB_ASYNC_THREADS */
+#define ASYNC_THREADS_MAX	128
+
+struct card_areq {
+	void *card_data;
+	struct ddcb_cmd *req;
+	void (* done)(void *priv, int card_rc);
+	void *priv;
+	struct card_areq *next;
+};
+
+static struct card_async {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct card_areq *head, *tail;
+	bool stop;
+	unsigned int num_threads;
+	pthread_t tid[ASYNC_THREADS_MAX];
+} card_async = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
 static void *card_open(int card_no, unsigned int mode, int *card_rc,
 		       uint64_t appl_id, uint64_t appl_id_mask)
 {
@@ -64,6 +93,88 @@ static int ddcb_execute(void *card_data, struct ddcb_cmd *req)
 					(struct genwqe_ddcb_cmd *)req);
 }
 
+static void *async_thread(void *data)
+{
+	struct card_async *a = (struct card_async *)data;
+	struct card_areq *r;
+	int rc;
+
+	pthread_mutex_lock(&a->lock);
+	while (1) {
+		while (!a->stop && (a->head == NULL))
+			pthread_cond_wait(&a->cond, &a->lock);
+
+		r = a->head;
+		if (r == NULL)		/* stop requested and queue empty */
+			break;
+		a->head = r->next;
+		if (a->head == NULL)
+			a->tail = NULL;
+		pthread_mutex_unlock(&a->lock);
+
+		rc = ddcb_execute(r->card_data, r->req);
+		r->done(r->priv, rc);
+		free(r);
+
+		pthread_mutex_lock(&a->lock);
+	}
+	pthread_mutex_unlock(&a->lock);
+	return NULL;
+}
+
+/* Must be called with lock held */
+static int __async_start(struct card_async *a)
+{
+	unsigned int i, num = CONFIG_ASYNC_THREADS;
+	const char *env = getenv("DDCB_ASYNC_THREADS");
+
+	if (env != NULL)
+		num = strtoul(env, NULL, 0);
+	if (num == 0)
+		num = 1;
+	if (num > ASYNC_THREADS_MAX)
+		num = ASYNC_THREADS_MAX;
+
+	for (i = 0; i < num; i++) {
+		if (pthread_create(&a->tid[i], NULL, async_thread, a) != 0)
+			break;
+	}
+	a->num_threads = i;
+	return (i == 0) ? DDCB_ERRNO : DDCB_OK;
+}
+
+static int ddcb_submit(void *card_data, struct ddcb_cmd *req,
+		       void (* done)(void *priv, int card_rc), void *priv)
+{
+	struct card_async *a = &card_async;
+	struct card_areq *r;
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return DDCB_ERR_ENOMEM;
+
+	r->card_data = card_data;
+	r->req = req;
+	r->done = done;
+	r->priv = priv;
+
+	pthread_mutex_lock(&a->lock);
+	if ((a->num_threads == 0) && (__async_start(a) != DDCB_OK)) {
+		pthread_mutex_unlock(&a->lock);
+		free(r);
+		return DDCB_ERRNO;
+	}
+	if (a->tail)
+		a->tail->next = r;
+	else
+		a->head = r;
+	a->tail = r;
+	pthread_cond_signal(&a->cond);
+	pthread_mutex_unlock(&a->lock);
+
+	return DDCB_OK;
+}
+
 static const char *_card_strerror(void *card_data __attribute__((unused)),
 				  int card_rc)
 {
@@ -159,6 +270,11 @@ static int card_free(void *card_data, void *ptr, size_t size)
 	return genwqe_card_free(card_data, ptr, size);
 }
 
+static unsigned int card_get_waiting(void)
+{
+	return genwqe_card_get_waiting();
+}
+
 static int _card_dump_statistics(FILE *fp)
 {
 	return genwqe_dump_statistics(fp);
@@ -196,6 +312,10 @@ static struct ddcb_accel_funcs accel_funcs = {
 	.time_close = 0,
 
 	.priv_data = NULL,
+
+	/* extensions */
+	.ddcb_submit = ddcb_submit,
+	.card_get_waiting = card_get_waiting,
 };
 
 static void genwqe_card_init(void) __attribute__((constructor));
@@ -205,3 +325,21 @@ static void genwqe_card_init(void)
 {
 	ddcb_register_accelerator(&accel_funcs);
 }
+
+static void genwqe_card_exit(void) __attribute__((destructor));
+
+/* destructor */
+static void genwqe_card_exit(void)
+{
+	struct card_async *a = &card_async;
+	unsigned int i;
+
+	pthread_mutex_lock(&a->lock);
+	a->stop = true;
+	pthread_cond_broadcast(&a->cond);
+	pthread_mutex_unlock(&a->lock);
+
+	for (i = 0; i < a->num_threads; i++)
+		pthread_join(a->tid[i], NULL);
+	a->num_threads = 0;
+}
@@ -0,0 +1,1674 @@
+/*
+ * Copyright 2016, International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Software DDCB execution implementation.
+ *
+ * This accelerator type executes DDCBs on the host CPUs instead of
+ * sending them to a GenWQE or CAPI card. It understands the generic
+ * ECHO command and the zEDC application commands inflate, deflate
+ * and memcopy, including the save & restore state which libzHW
+ * passes in and out through the ASIV/ASV fields. With it the
+ * complete DDCB based stack (libzHW, libzADC, the tools) can be
+ * exercised on machines without accelerator card.
+ *
+ * The emulated card owns a pool of worker threads. DDCB chains are
+ * queued by the submitting threads and are executed in submission
+ * order by the next free worker. The submitter sleeps until its
+ * chain is done, like it does for real hardware.
+ *
+ * The deflate implementation continues the fixed Huffman block which
+ * libzHW keeps open between DDCBs. Like the first generation zEDC
+ * unit it does not produce dynamic Huffman blocks, the
+ * DDCB_OPT_DEFL_IBUF_INDIR request is ignored.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <malloc.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <asm/byteorder.h>
+
+#include <libddcb.h>
+#include <deflate_ddcb.h>
+#include <memcopy_ddcb.h>
+
+#define CONFIG_SW_THREADS	8	/* default max. number of workers */
+#define SW_THREADS_MAX		64
+
+#define SW_APP_ID		GENWQE_APPL_ID_GZIP2
+
+/* Attention codes reported by the emulation */
+#define SW_ATTN_ILLEGAL_CMD	0xE001	/* unknown acfunc/command */
+#define SW_ATTN_ILLEGAL_PARM	0xE002	/* buffer addresses missing */
+#define SW_ATTN_DATA_ERROR	0x8010	/* invalid deflate data */
+#define SW_ATTN_NEED_DICT	0x801A	/* distance too far back */
+
+/* RFC1951 parameters */
+#define SW_WSIZE		32768	/* window size */
+#define SW_MIN_MATCH		3
+#define SW_MAX_MATCH		258
+#define SW_HASH_BITS		15
+#define SW_HASH_SIZE		(1 << SW_HASH_BITS)
+#define SW_MAX_CHAIN		32	/* search depth for deflate */
+#define SW_NICE_MATCH		128	/* stop searching if reached */
+#define SW_MAXBITS		15	/* max Huffman code length */
+#define SW_FAST_BITS		10	/* inflate lookup table size */
+#define SW_OBYTES_MAX		(ZEDC_ONUMBYTES_v1 + ZEDC_ONUMBYTES_EXTRA)
+
+extern int libddcb_verbose;
+extern FILE *libddcb_fd_out;
+
+static inline pid_t sw_gettid(void)
+{
+	return (pid_t)syscall(SYS_gettid);
+}
+
+#define VERBOSE0(fmt, ...) do {						\
+		if (libddcb_fd_out)					\
+			fprintf(libddcb_fd_out, "%08x.%08x: " fmt,	\
+				getpid(), sw_gettid(), ## __VA_ARGS__);	\
+	} while (0)
+
+#define VERBOSE1(fmt, ...) do {						\
+		if (libddcb_fd_out && (libddcb_verbose > 0))		\
+			fprintf(libddcb_fd_out, "%08x.%08x: " fmt,	\
+				getpid(), sw_gettid(), ## __VA_ARGS__);	\
+	} while (0)
+
+/**
+ * Huffman decoding table. Codes up to SW_FAST_BITS are resolved with
+ * a single lookup, longer ones by walking the canonical code.
+ */
+struct sw_huff {
+	uint16_t fast[1 << SW_FAST_BITS]; /* (sym << 4) | len, 0: slow */
+	uint16_t count[SW_MAXBITS + 1];
+	uint16_t symbol[288];
+};
+
+/**
+ * Per worker thread state. The buffers are large enough that we do
+ * not like to have them on the stack or allocated per DDCB.
+ */
+struct sw_worker {
+	struct sw_card *card;
+	pthread_t tid;
+	int32_t *head;			/* deflate hash heads */
+	int32_t *prev;			/* deflate hash chains */
+	struct sw_huff lit;		/* inflate dynamic tables */
+	struct sw_huff dist;
+	uint8_t obytes[SW_MAX_MATCH];	/* inflate output overflow */
+};
+
+/* A submitted DDCB chain waiting for execution */
+struct sw_req {
+	struct ddcb_cmd *cmd;
+	int rc;
+	sem_t done;
+	void (* done_cb)(void *priv, int rc); /* async, instead of done */
+	void *done_priv;
+	struct sw_req *next;
+};
+
+/**
+ * There is exactly one emulated card. All handles share its worker
+ * pool, which is started with the first open and stopped with the
+ * last close.
+ */
+struct sw_card {
+	pthread_mutex_t olock;		/* serializes open/close */
+	pthread_mutex_t lock;		/* protects queue and counters */
+	pthread_cond_t cond;
+	struct sw_req *head, *tail;
+	unsigned int waiting;		/* requests no worker picked up */
+	bool stop;
+
+	unsigned int clients;
+	unsigned int num_threads;
+	struct sw_worker *workers;
+
+	uint64_t work_time;		/* usec spent executing DDCBs */
+	unsigned long long completed_ddcbs;
+	unsigned long long failed_ddcbs;
+	unsigned long long cmd_count[4]; /* echo, infl, defl, memcopy */
+};
+
+/* Handle returned by card_open */
+struct sw_ttx {
+	struct sw_card *card;
+	int card_no;
+	unsigned int mode;
+	struct sw_ttx *verify;
+};
+
+static struct sw_card sw_card = {
+	.olock = PTHREAD_MUTEX_INITIALIZER,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static unsigned int sw_threads = CONFIG_SW_THREADS;
+
+static uint32_t crc_table[256];
+static struct sw_huff fixed_lit, fixed_dist;
+
+/* Fixed Huffman codes for deflate, bit reversed for output */
+static uint16_t fixed_lcode[288];
+static uint8_t fixed_llen[288];
+static uint8_t fixed_dcode[30];
+static uint8_t len_code[SW_MAX_MATCH + 1];
+static uint8_t dist_code[512];
+
+static const uint16_t len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const uint8_t clen_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static inline uint64_t get_usec(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+	return t.tv_sec * 1000000 + t.tv_usec;
+}
+
+static inline void *be64_to_ptr(uint64_t addr)
+{
+	return (void *)(unsigned long)__be64_to_cpu(addr);
+}
+
+static uint32_t sw_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	crc = ~crc;
+	while (len--)
+		crc = crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+#define ADLER_BASE	65521	/* largest prime smaller than 65536 */
+#define ADLER_NMAX	5552	/* max. bytes before s2 can overflow */
+
+static uint32_t sw_adler32(uint32_t adler, const uint8_t *buf, size_t len)
+{
+	uint32_t s1 = adler & 0xffff;
+	uint32_t s2 = adler >> 16;
+	size_t n;
+
+	while (len) {
+		n = len < ADLER_NMAX ? len : ADLER_NMAX;
+		len -= n;
+		while (n--) {
+			s1 += *buf++;
+			s2 += s1;
+		}
+		s1 %= ADLER_BASE;
+		s2 %= ADLER_BASE;
+	}
+	return (s2 << 16) | s1;
+}
+
+static unsigned int bit_reverse(unsigned int code, unsigned int len)
+{
+	unsigned int r = 0;
+
+	while (len--) {
+		r = (r << 1) | (code & 1);
+		code >>= 1;
+	}
+	return r;
+}
+
+/*****************************************************************************/
+/** Deflate								     */
+/*****************************************************************************/
+
+/**
+ * Output bits. Once the output buffer is full the remaining bytes
+ * are collected in ovf and returned to libzHW via the obits fields.
+ */
+struct sw_bitw {
+	uint8_t *out;
+	uint32_t out_len;
+	uint32_t o;
+	uint8_t ovf[SW_OBYTES_MAX];
+	unsigned int ovn;
+	uint64_t bb;
+	unsigned int bn;
+};
+
+static inline void bitw_put(struct sw_bitw *w, uint32_t bits, unsigned int n)
+{
+	w->bb |= (uint64_t)bits << w->bn;
+	w->bn += n;
+	while (w->bn >= 8) {
+		if (w->o < w->out_len)
+			w->out[w->o++] = (uint8_t)w->bb;
+		else
+			w->ovf[w->ovn++] = (uint8_t)w->bb;
+		w->bb >>= 8;
+		w->bn -= 8;
+	}
+}
+
+/**
+ * Input for the match finder: the dictionary followed by the input
+ * buffer. Positions are counted from the start of the dictionary.
+ */
+struct sw_defl_src {
+	const uint8_t *dict;
+	uint32_t dlen;
+	const uint8_t *in;
+	uint32_t total;			/* dlen + input length */
+};
+
+static inline uint8_t src_byte(const struct sw_defl_src *s, uint32_t v)
+{
+	return (v < s->dlen) ? s->dict[v] : s->in[v - s->dlen];
+}
+
+static inline uint32_t src_hash(const struct sw_defl_src *s, uint32_t v)
+{
+	uint32_t h;
+
+	if (v >= s->dlen)
+		h = (s->in[v - s->dlen] << 16) | (s->in[v - s->dlen + 1] << 8) |
+			s->in[v - s->dlen + 2];
+	else
+		h = (src_byte(s, v) << 16) | (src_byte(s, v + 1) << 8) |
+			src_byte(s, v + 2);
+
+	return (h * 2654435761u) >> (32 - SW_HASH_BITS);
+}
+
+static inline void src_insert(struct sw_worker *w,
+			      const struct sw_defl_src *s, uint32_t v)
+{
+	uint32_t h;
+
+	if (v + SW_MIN_MATCH > s->total)
+		return;
+
+	h = src_hash(s, v);
+	w->prev[v & (SW_WSIZE - 1)] = w->head[h];
+	w->head[h] = (int32_t)v;
+}
+
+static unsigned int src_longest_match(struct sw_worker *w,
+				      const struct sw_defl_src *s,
+				      uint32_t v, uint32_t *dist)
+{
+	unsigned int chain = SW_MAX_CHAIN, best = 0, len, max_len;
+	uint32_t limit = (v > SW_WSIZE) ? v - SW_WSIZE : 0;
+	int32_t cand;
+	const uint8_t *cur = s->in + (v - s->dlen);
+
+	max_len = s->total - v;
+	if (max_len > SW_MAX_MATCH)
+		max_len = SW_MAX_MATCH;
+	if (max_len < SW_MIN_MATCH)
+		return 0;
+
+	cand = w->head[src_hash(s, v)];
+	while ((cand >= 0) && ((uint32_t)cand >= limit) && chain--) {
+		uint32_t c = (uint32_t)cand;
+
+		if (c >= s->dlen) {
+			const uint8_t *p = s->in + (c - s->dlen);
+
+			if (p[best] == cur[best])
+				for (len = 0; len < max_len &&
+					     p[len] == cur[len]; len++)
+					;
+			else
+				len = 0;
+		} else {
+			for (len = 0; len < max_len &&
+				     src_byte(s, c + len) == cur[len]; len++)
+				;
+		}
+		if (len > best) {
+			best = len;
+			*dist = v - c;
+			if (best >= max_len || best >= SW_NICE_MATCH)
+				break;
+		}
+		cand = w->prev[c & (SW_WSIZE - 1)];
+		if ((cand >= 0) && ((uint32_t)cand >= c))
+			break;
+	}
+	return (best >= SW_MIN_MATCH) ? best : 0;
+}
+
+static void sw_deflate(struct sw_worker *w, struct ddcb_cmd *cmd)
+{
+	struct zedc_asiv_defl *asiv = (struct zedc_asiv_defl *)&cmd->asiv;
+	struct zedc_asv_defl *asv = (struct zedc_asv_defl *)&cmd->asv;
+	struct sw_defl_src s;
+	struct sw_bitw bw;
+	uint8_t seq[SW_OBYTES_MAX + 1];
+	uint8_t *out_dict;
+	uint32_t in_len, i, v, n, crc, adler;
+	unsigned int k, inumbits, seq_len;
+
+	in_len = __be32_to_cpu(asiv->in_buff_len);
+	s.in = be64_to_ptr(asiv->in_buff);
+	s.dict = be64_to_ptr(asiv->in_dict);
+	s.dlen = __be32_to_cpu(asiv->in_dict_len);
+	if (s.dict == NULL)
+		s.dlen = 0;
+	if (s.dlen > SW_WSIZE) {	/* only the last 32KiB are needed */
+		s.dict += s.dlen - SW_WSIZE;
+		s.dlen = SW_WSIZE;
+	}
+	s.total = s.dlen + in_len;
+
+	memset(&bw, 0, sizeof(bw));
+	bw.out = be64_to_ptr(asiv->out_buff);
+	bw.out_len = __be32_to_cpu(asiv->out_buff_len);
+
+	if ((s.in == NULL && in_len) || (bw.out == NULL && bw.out_len)) {
+		cmd->retc = DDCB_RETC_ERROR;
+		cmd->attn = SW_ATTN_ILLEGAL_PARM;
+		return;
+	}
+
+	/* Continue the open block with the bits libzHW passed in */
+	inumbits = asiv->inumbits;
+	if (inumbits > sizeof(asiv->ibits) * 8)
+		inumbits = sizeof(asiv->ibits) * 8;
+	for (k = 0; inumbits >= 8; k++, inumbits -= 8)
+		bitw_put(&bw, asiv->ibits[k], 8);
+	if (inumbits)
+		bitw_put(&bw, asiv->ibits[k] & ((1 << inumbits) - 1), inumbits);
+
+	memset(w->head, 0xff, SW_HASH_SIZE * sizeof(*w->head));
+	for (v = 0; v < s.dlen; v++)
+		src_insert(w, &s, v);
+
+	/* Greedy LZ77 with fixed Huffman codes (RFC1951 3.2.6) */
+	for (i = 0; (i < in_len) && (bw.o < bw.out_len); ) {
+		uint32_t dist = 0;
+		unsigned int len, c;
+
+		v = s.dlen + i;
+		len = src_longest_match(w, &s, v, &dist);
+		if (len == 0) {
+			c = s.in[i];
+			bitw_put(&bw, fixed_lcode[c], fixed_llen[c]);
+			src_insert(w, &s, v);
+			i++;
+			continue;
+		}
+
+		c = len_code[len];
+		bitw_put(&bw, fixed_lcode[257 + c], fixed_llen[257 + c]);
+		bitw_put(&bw, len - len_base[c], len_extra[c]);
+
+		c = (dist <= 256) ? dist_code[dist - 1] :
+			dist_code[256 + ((dist - 1) >> 7)];
+		bitw_put(&bw, fixed_dcode[c], 5);
+		bitw_put(&bw, dist - dist_base[c], dist_extra[c]);
+
+		for (k = 0; k < len; k++)
+			src_insert(w, &s, v + k);
+		i += len;
+	}
+
+	/* Overflow bytes followed by the partial byte */
+	memcpy(seq, bw.ovf, bw.ovn);
+	seq_len = bw.ovn;
+	if (bw.bn)
+		seq[seq_len++] = (uint8_t)bw.bb;
+
+	memset(asv, 0, sizeof(*asv));
+	for (k = 0; k < seq_len; k++) {
+		if (k < ZEDC_ONUMBYTES_v1)
+			asv->obits[k] = seq[k];
+		else
+			asv->obits_extra[k - ZEDC_ONUMBYTES_v1] = seq[k];
+	}
+	asv->onumbits = bw.ovn * 8 + bw.bn;
+
+	/* New dictionary: last 32KiB of old dictionary plus input */
+	out_dict = be64_to_ptr(asiv->out_dict);
+	n = (s.dlen + i > SW_WSIZE) ? SW_WSIZE : s.dlen + i;
+	if (out_dict && (cmd->cmdopts & DDCB_OPT_DEFL_SAVE_DICT)) {
+		if (i >= n) {
+			memcpy(out_dict, s.in + i - n, n);
+		} else {
+			memcpy(out_dict, s.dict + s.dlen - (n - i), n - i);
+			memcpy(out_dict + n - i, s.in, i);
+		}
+		asv->out_dict_used = __cpu_to_be16(n);
+	}
+	asv->out_dict_offs = 0;
+
+	crc = sw_crc32(__be32_to_cpu(asiv->in_crc32), s.in, i);
+	adler = sw_adler32(__be32_to_cpu(asiv->in_adler32), s.in, i);
+
+	asv->out_crc32 = __cpu_to_be32(crc);
+	asv->out_adler32 = __cpu_to_be32(adler);
+	asv->inp_processed = __cpu_to_be32(i);
+	asv->outp_returned = __cpu_to_be32(bw.o);
+	cmd->retc = DDCB_RETC_COMPLETE;
+}
+
+/*****************************************************************************/
+/** Inflate								     */
+/*****************************************************************************/
+
+/**
+ * libzHW hands over the data in up to three areas: the header/tree
+ * of the current block, scratch bits left over from the previous
+ * DDCB and the new input buffer. Bit positions reported back are
+ * counted over the valid bits of these areas only.
+ */
+struct sw_seg {
+	const uint8_t *base;
+	uint64_t sbit;			/* first valid bit */
+	uint64_t ebit;			/* first invalid bit */
+	uint64_t lstart;		/* logical position of sbit */
+};
+
+struct sw_bitr {
+	struct sw_seg seg[3];
+	unsigned int nseg;
+	unsigned int s;			/* current segment */
+	uint64_t pp;			/* next bit to load in segment s */
+	uint64_t bb;			/* bit accumulator */
+	unsigned int bn;		/* valid bits in bb */
+	uint64_t loaded;		/* logical position after bb */
+};
+
+static void bitr_add(struct sw_bitr *r, const uint8_t *base,
+		     uint64_t sbit, uint64_t ebit)
+{
+	struct sw_seg *seg;
+	uint64_t lstart = 0;
+
+	if (ebit <= sbit)
+		return;
+	if (r->nseg) {
+		seg = &r->seg[r->nseg - 1];
+		lstart = seg->lstart + (seg->ebit - seg->sbit);
+	}
+	seg = &r->seg[r->nseg++];
+	seg->base = base;
+	seg->sbit = sbit;
+	seg->ebit = ebit;
+	seg->lstart = lstart;
+}
+
+static inline uint64_t bitr_pos(const struct sw_bitr *r)
+{
+	return r->loaded - r->bn;
+}
+
+static void bitr_seek(struct sw_bitr *r, uint64_t pos)
+{
+	unsigned int s;
+
+	for (s = 0; s < r->nseg; s++) {
+		const struct sw_seg *seg = &r->seg[s];
+
+		if (pos < seg->lstart + (seg->ebit - seg->sbit))
+			break;
+	}
+	r->s = s;
+	if (s < r->nseg)
+		r->pp = r->seg[s].sbit + (pos - r->seg[s].lstart);
+	r->bb = 0;
+	r->bn = 0;
+	r->loaded = pos;
+}
+
+static void bitr_refill(struct sw_bitr *r)
+{
+	while ((r->bn <= 56) && (r->s < r->nseg)) {
+		const struct sw_seg *seg = &r->seg[r->s];
+		unsigned int off, n;
+
+		if (r->pp >= seg->ebit) {
+			if (++r->s < r->nseg)
+				r->pp = r->seg[r->s].sbit;
+			continue;
+		}
+		off = r->pp & 7;
+		n = 8 - off;
+		if (r->pp + n > seg->ebit)
+			n = seg->ebit - r->pp;
+
+		r->bb |= (uint64_t)((seg->base[r->pp >> 3] >> off) &
+				    ((1 << n) - 1)) << r->bn;
+		r->bn += n;
+		r->pp += n;
+		r->loaded += n;
+	}
+}
+
+static inline bool bitr_need(struct sw_bitr *r, unsigned int n)
+{
+	if (r->bn < n)
+		bitr_refill(r);
+	return r->bn >= n;
+}
+
+/* Caller must have checked availability with bitr_need() */
+static inline uint32_t bitr_get(struct sw_bitr *r, unsigned int n)
+{
+	uint32_t val;
+
+	if (n == 0)
+		return 0;
+	val = (uint32_t)(r->bb & ((1ull << n) - 1));
+	r->bb >>= n;
+	r->bn -= n;
+	return val;
+}
+
+/* Skip to the next byte boundary of the original data stream */
+static void bitr_align(struct sw_bitr *r)
+{
+	uint64_t pos = bitr_pos(r), pp;
+	const struct sw_seg *seg;
+
+	bitr_seek(r, pos);
+	if (r->s >= r->nseg)
+		return;
+
+	seg = &r->seg[r->s];
+	pp = (r->pp + 7) & ~7ull;
+	if (pp > seg->ebit)
+		pp = seg->ebit;
+	bitr_seek(r, pos + (pp - r->pp));
+}
+
+#define HUFF_NEED_MORE		-1
+#define HUFF_INVALID		-2
+
+static int huff_build(struct sw_huff *h, const uint8_t *lens, unsigned int n)
+{
+	uint16_t offs[SW_MAXBITS + 2];
+	uint16_t next[SW_MAXBITS + 1];
+	unsigned int sym, len, code;
+	int left;
+
+	memset(h->count, 0, sizeof(h->count));
+	memset(h->fast, 0, sizeof(h->fast));
+	for (sym = 0; sym < n; sym++)
+		h->count[lens[sym]]++;
+	if (h->count[0] == n)
+		return 0;		/* no codes, fails on use */
+
+	left = 1;
+	for (len = 1; len <= SW_MAXBITS; len++) {
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0)
+			return HUFF_INVALID;	/* over-subscribed */
+	}
+
+	offs[1] = 0;
+	for (len = 1; len < SW_MAXBITS; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+	for (sym = 0; sym < n; sym++)
+		if (lens[sym])
+			h->symbol[offs[lens[sym]]++] = sym;
+
+	code = 0;
+	h->count[0] = 0;
+	for (len = 1; len <= SW_MAXBITS; len++) {
+		code = (code + h->count[len - 1]) << 1;
+		next[len] = code;
+	}
+	for (sym = 0; sym < n; sym++) {
+		unsigned int r, l = lens[sym];
+
+		if (l == 0 || l > SW_FAST_BITS)
+			continue;
+		for (r = bit_reverse(next[l]++, l); r < (1u << SW_FAST_BITS);
+		     r += 1 << l)
+			h->fast[r] = (sym << 4) | l;
+	}
+	return 0;
+}
+
+static int huff_decode(struct sw_bitr *r, const struct sw_huff *h)
+{
+	unsigned int len, e;
+	int code = 0, first = 0, index = 0, count;
+
+	if (r->bn < SW_MAXBITS)
+		bitr_refill(r);
+
+	e = h->fast[r->bb & ((1 << SW_FAST_BITS) - 1)];
+	if (e && ((e & 15) <= r->bn)) {
+		bitr_get(r, e & 15);
+		return e >> 4;
+	}
+
+	for (len = 1; len <= SW_MAXBITS; len++) {
+		if (len > r->bn)
+			return HUFF_NEED_MORE;
+		code |= (r->bb >> (len - 1)) & 1;
+		count = h->count[len];
+		if (code - count < first) {
+			bitr_get(r, len);
+			return h->symbol[index + (code - first)];
+		}
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return HUFF_INVALID;
+}
+
+enum sw_infl_rc {
+	INFL_OK = 0,			/* block done */
+	INFL_NEED_MORE,			/* ran out of input */
+	INFL_OUT_FULL,			/* output buffer exhausted */
+	INFL_NEED_DICT,			/* distance too far back */
+	INFL_DATA_ERROR,
+};
+
+struct sw_infl {
+	struct sw_worker *w;
+	struct sw_bitr r;
+
+	const uint8_t *dict;
+	uint32_t dlen;
+	uint8_t *out;
+	uint32_t out_len;
+	uint32_t o;
+	uint32_t ob;			/* bytes in w->obytes */
+	bool may_overflow;		/* obytes can be saved in dict */
+
+	/* current block */
+	unsigned int bfinal;
+	unsigned int btype;
+	uint64_t hdr_start;		/* logical start of header */
+	uint64_t hdr_bits;
+	uint32_t copy_len;		/* remaining stored bytes */
+	const struct sw_huff *lit;
+	const struct sw_huff *dist;
+};
+
+static int infl_header(struct sw_infl *f)
+{
+	struct sw_bitr *r = &f->r;
+	struct sw_worker *w = f->w;
+	uint8_t lens[286 + 30];
+	unsigned int hlit, hdist, hclen, i, len, rep;
+	uint32_t v;
+	int sym;
+
+	if (!bitr_need(r, 3))
+		return INFL_NEED_MORE;
+	f->bfinal = bitr_get(r, 1);
+	f->btype = bitr_get(r, 2);
+
+	switch (f->btype) {
+	case 0:				/* stored */
+		bitr_align(r);
+		if (!bitr_need(r, 32))
+			return INFL_NEED_MORE;
+		v = bitr_get(r, 32);
+		if ((v & 0xffff) != (~v >> 16))
+			return INFL_DATA_ERROR;
+		f->copy_len = v & 0xffff;
+		return INFL_OK;
+
+	case 1:				/* fixed Huffman */
+		f->lit = &fixed_lit;
+		f->dist = &fixed_dist;
+		return INFL_OK;
+
+	case 2:				/* dynamic Huffman */
+		break;
+
+	default:
+		return INFL_DATA_ERROR;
+	}
+
+	if (!bitr_need(r, 14))
+		return INFL_NEED_MORE;
+	hlit = bitr_get(r, 5) + 257;
+	hdist = bitr_get(r, 5) + 1;
+	hclen = bitr_get(r, 4) + 4;
+	if (hlit > 286 || hdist > 30)
+		return INFL_DATA_ERROR;
+
+	memset(lens, 0, 19);
+	for (i = 0; i < hclen; i++) {
+		if (!bitr_need(r, 3))
+			return INFL_NEED_MORE;
+		lens[clen_order[i]] = bitr_get(r, 3);
+	}
+	if (huff_build(&w->lit, lens, 19) < 0)
+		return INFL_DATA_ERROR;
+
+	for (i = 0; i < hlit + hdist; ) {
+		sym = huff_decode(r, &w->lit);
+		if (sym == HUFF_NEED_MORE)
+			return INFL_NEED_MORE;
+		if (sym < 0)
+			return INFL_DATA_ERROR;
+		if (sym < 16) {
+			lens[i++] = sym;
+			continue;
+		}
+		len = 0;
+		if (sym == 16) {
+			if (i == 0)
+				return INFL_DATA_ERROR;
+			len = lens[i - 1];
+			if (!bitr_need(r, 2))
+				return INFL_NEED_MORE;
+			rep = 3 + bitr_get(r, 2);
+		} else if (sym == 17) {
+			if (!bitr_need(r, 3))
+				return INFL_NEED_MORE;
+			rep = 3 + bitr_get(r, 3);
+		} else {
+			if (!bitr_need(r, 7))
+				return INFL_NEED_MORE;
+			rep = 11 + bitr_get(r, 7);
+		}
+		if (i + rep > hlit + hdist)
+			return INFL_DATA_ERROR;
+		while (rep--)
+			lens[i++] = len;
+	}
+	if (lens[256] == 0)		/* no end-of-block code */
+		return INFL_DATA_ERROR;
+
+	if (huff_build(&w->lit, lens, hlit) < 0 ||
+	    huff_build(&w->dist, lens + hlit, hdist) < 0)
+		return INFL_DATA_ERROR;
+
+	f->lit = &w->lit;
+	f->dist = &w->dist;
+	return INFL_OK;
+}
+
+static inline uint8_t infl_hist(const struct sw_infl *f, int64_t x)
+{
+	if (x < 0)
+		return f->dict[f->dlen + x];
+	if (x < f->out_len)
+		return f->out[x];
+	return f->w->obytes[x - f->out_len];
+}
+
+static void infl_copy(struct sw_infl *f, unsigned int len, uint32_t dist)
+{
+	uint64_t t = f->o;
+	unsigned int k;
+
+	if ((dist <= t) && (t + len <= f->out_len)) {
+		uint8_t *d = f->out + t;
+		const uint8_t *s = d - dist;
+
+		for (k = 0; k < len; k++)
+			d[k] = s[k];
+		f->o += len;
+		return;
+	}
+
+	for (k = 0; k < len; k++, t++) {
+		uint8_t c = infl_hist(f, (int64_t)t - dist);
+
+		if (t < f->out_len)
+			f->out[t] = c;
+		else
+			f->w->obytes[f->ob++] = c;
+	}
+	f->o = (t < f->out_len) ? t : f->out_len;
+}
+
+static int infl_stored(struct sw_infl *f)
+{
+	struct sw_bitr *r = &f->r;
+
+	while (f->copy_len) {
+		uint32_t n;
+
+		if (f->o >= f->out_len)
+			return INFL_OUT_FULL;
+
+		if ((r->bn == 0) && (r->s < r->nseg) && !(r->pp & 7)) {
+			const struct sw_seg *seg = &r->seg[r->s];
+
+			n = (seg->ebit - r->pp) / 8;
+			if (n > f->copy_len)
+				n = f->copy_len;
+			if (n > f->out_len - f->o)
+				n = f->out_len - f->o;
+			if (n == 0) {	/* end of segment */
+				bitr_refill(r);
+				if (r->bn == 0)
+					return INFL_NEED_MORE;
+				continue;
+			}
+			memcpy(f->out + f->o, seg->base + r->pp / 8, n);
+			r->pp += n * 8;
+			r->loaded += n * 8;
+		} else {
+			if (!bitr_need(r, 8))
+				return INFL_NEED_MORE;
+			f->out[f->o] = bitr_get(r, 8);
+			n = 1;
+		}
+		f->o += n;
+		f->copy_len -= n;
+	}
+	return INFL_OK;
+}
+
+static int infl_codes(struct sw_infl *f)
+{
+	struct sw_bitr *r = &f->r;
+	unsigned int len;
+	uint32_t dist;
+	uint64_t pos;
+	int sym;
+
+	for (;;) {
+		pos = bitr_pos(r);
+		sym = huff_decode(r, f->lit);
+		if (sym == HUFF_NEED_MORE)
+			return INFL_NEED_MORE;
+		if (sym < 0)
+			return INFL_DATA_ERROR;
+
+		/* With full output we can only pass an end-of-block */
+		if ((f->o >= f->out_len) && (sym != 256)) {
+			bitr_seek(r, pos);
+			return INFL_OUT_FULL;
+		}
+
+		if (sym < 256) {
+			f->out[f->o++] = sym;
+			continue;
+		}
+		if (sym == 256)
+			return INFL_OK;
+
+		sym -= 257;
+		if (sym >= 29)
+			return INFL_DATA_ERROR;
+		if (!bitr_need(r, len_extra[sym]))
+			goto need_more;
+		len = len_base[sym] + bitr_get(r, len_extra[sym]);
+
+		sym = huff_decode(r, f->dist);
+		if (sym == HUFF_NEED_MORE)
+			goto need_more;
+		if (sym < 0 || sym >= 30)
+			return INFL_DATA_ERROR;
+		if (!bitr_need(r, dist_extra[sym]))
+			goto need_more;
+		dist = dist_base[sym] + bitr_get(r, dist_extra[sym]);
+
+		if (dist > (uint64_t)f->dlen + f->o)
+			return INFL_NEED_DICT;
+
+		if (f->o + len > f->out_len && !f->may_overflow) {
+			bitr_seek(r, pos);
+			return INFL_OUT_FULL;
+		}
+		infl_copy(f, len, dist);
+	}
+
+ need_more:
+	bitr_seek(r, pos);
+	return INFL_NEED_MORE;
+}
+
+static void sw_inflate(struct sw_worker *w, struct ddcb_cmd *cmd)
+{
+	struct zedc_asiv_infl *asiv = (struct zedc_asiv_infl *)&cmd->asiv;
+	struct zedc_asv_infl *asv = (struct zedc_asv_infl *)&cmd->asv;
+	struct sw_infl f;
+	const uint8_t *in, *scratch;
+	uint32_t in_len, scratch_len, n, crc, adler;
+	uint64_t hdr_bits, hdr_ib, scratch_offs, pos = 0;
+	uint8_t *out_dict;
+	uint8_t infl_stat = 0;
+	bool in_block = false, passed_eob = false, final = false;
+	int rc = INFL_OK;
+
+	memset(&f, 0, sizeof(f));
+	f.w = w;
+
+	in = be64_to_ptr(asiv->in_buff);
+	in_len = __be32_to_cpu(asiv->in_buff_len);
+	f.out = be64_to_ptr(asiv->out_buff);
+	f.out_len = __be32_to_cpu(asiv->out_buff_len);
+	f.dict = be64_to_ptr(asiv->in_dict);
+	f.dlen = __be32_to_cpu(asiv->in_dict_len);
+	if (f.dict == NULL)
+		f.dlen = 0;
+	if (f.dlen > SW_WSIZE) {
+		f.dict += f.dlen - SW_WSIZE;
+		f.dlen = SW_WSIZE;
+	}
+	out_dict = be64_to_ptr(asiv->out_dict);
+	if (!(cmd->cmdopts & DDCB_OPT_INFL_SAVE_DICT))
+		out_dict = NULL;
+	f.may_overflow = (out_dict != NULL);
+
+	if ((in == NULL && in_len) || (f.out == NULL && f.out_len)) {
+		cmd->retc = DDCB_RETC_ERROR;
+		cmd->attn = SW_ATTN_ILLEGAL_PARM;
+		return;
+	}
+
+	/* Tree of the current block, scratch bits, new input */
+	scratch = be64_to_ptr(asiv->inp_scratch);
+	scratch_len = __be32_to_cpu(asiv->in_scratch_len);
+	hdr_bits = __be16_to_cpu(asiv->in_hdr_bits);
+	hdr_ib = asiv->hdr_ib;
+	if (scratch == NULL)
+		scratch_len = hdr_bits = 0;
+
+	scratch_offs = 0;
+	if (hdr_bits) {
+		scratch_offs = ((hdr_bits + hdr_ib + 63) & ~63ull) / 8;
+		bitr_add(&f.r, scratch, hdr_ib, hdr_ib + hdr_bits);
+	}
+	if (scratch_len > scratch_offs)
+		bitr_add(&f.r, scratch + scratch_offs, asiv->scratch_ib,
+			 (scratch_len - scratch_offs) * 8);
+	bitr_add(&f.r, in, 0, (uint64_t)in_len * 8);
+	bitr_seek(&f.r, 0);
+
+	for (;;) {
+		if (!in_block) {
+			if (final)
+				break;
+			if ((hdr_bits == 0 || passed_eob) &&
+			    (f.o >= f.out_len))
+				break;	/* stop on block boundary */
+
+			pos = bitr_pos(&f.r);
+			rc = infl_header(&f);
+			if (rc != INFL_OK) {
+				if (rc == INFL_NEED_MORE)
+					bitr_seek(&f.r, pos);
+				break;
+			}
+			f.hdr_start = pos;
+			f.hdr_bits = (f.btype == 0) ? 40 :
+				bitr_pos(&f.r) - pos;
+			in_block = true;
+		}
+
+		rc = (f.btype == 0) ? infl_stored(&f) : infl_codes(&f);
+		if (rc != INFL_OK)
+			break;
+
+		in_block = false;
+		passed_eob = true;
+		final = f.bfinal;
+	}
+
+	memset(asv, 0, sizeof(*asv));
+	if (rc == INFL_NEED_DICT) {
+		cmd->retc = DDCB_RETC_FAULT;
+		cmd->attn = SW_ATTN_NEED_DICT;
+		return;
+	}
+	if (rc == INFL_DATA_ERROR) {
+		cmd->retc = DDCB_RETC_ERROR;
+		cmd->attn = SW_ATTN_DATA_ERROR;
+		return;
+	}
+
+	pos = bitr_pos(&f.r);
+	if (pos) {
+		if (passed_eob)
+			infl_stat |= INFL_STAT_PASSED_EOB;
+		if (final)
+			infl_stat |= INFL_STAT_FINAL_EOB;
+		if (in_block) {
+			infl_stat |= f.btype << 5;
+			if (f.bfinal)
+				infl_stat |= INFL_STAT_HDR_BFINAL;
+			asv->hdr_start = __cpu_to_be32(f.hdr_start / 8);
+			asv->hdr_start_bits = f.hdr_start % 8;
+			asv->out_hdr_bits = __cpu_to_be16(f.hdr_bits);
+			asv->copyblock_len = __cpu_to_be16(f.copy_len);
+		} else if (passed_eob)
+			infl_stat |= INFL_STAT_REACHED_EOB;
+	}
+	asv->infl_stat = infl_stat;
+	asv->inp_processed = __cpu_to_be32(pos / 8);
+	asv->proc_bits = pos % 8;
+	asv->outp_returned = __cpu_to_be32(f.o);
+
+	/* New dictionary: history including data not yet returned */
+	n = f.dlen + f.o + f.ob;
+	if (n > SW_WSIZE)
+		n = SW_WSIZE;
+	if (out_dict) {
+		uint8_t *d = out_dict + n;
+		uint32_t k = (f.ob < n) ? f.ob : n;
+
+		d -= k;
+		memcpy(d, w->obytes + f.ob - k, k);
+		k = (f.o < (uint32_t)(d - out_dict)) ? f.o : d - out_dict;
+		d -= k;
+		memcpy(d, f.out + f.o - k, k);
+		k = d - out_dict;
+		memcpy(out_dict, f.dict + f.dlen - k, k);
+
+		asv->out_dict_used = __cpu_to_be16(n);
+		asv->obytes_in_dict = __cpu_to_be16(f.ob);
+	}
+
+	crc = sw_crc32(__be32_to_cpu(asiv->in_crc32), f.out, f.o);
+	crc = sw_crc32(crc, w->obytes, f.ob);
+	adler = sw_adler32(__be32_to_cpu(asiv->in_adler32), f.out, f.o);
+	adler = sw_adler32(adler, w->obytes, f.ob);
+
+	asv->out_crc32 = __cpu_to_be32(crc);
+	asv->out_adler32 = __cpu_to_be32(adler);
+	cmd->retc = DDCB_RETC_COMPLETE;
+}
+
+/*****************************************************************************/
+/** Memcopy and Echo							     */
+/*****************************************************************************/
+
+static void sw_memcopy(struct ddcb_cmd *cmd)
+{
+	struct asiv_memcpy *asiv = (struct asiv_memcpy *)&cmd->asiv;
+	struct asv_memcpy *asv = (struct asv_memcpy *)&cmd->asv;
+	const uint8_t *src = be64_to_ptr(asiv->inp_buff);
+	uint8_t *dst = be64_to_ptr(asiv->outp_buff);
+	uint32_t len = __be32_to_cpu(asiv->inp_buff_len);
+	uint32_t crc, adler;
+
+	if (len > __be32_to_cpu(asiv->outp_buff_len))
+		len = __be32_to_cpu(asiv->outp_buff_len);
+
+	if ((src == NULL || dst == NULL) && len) {
+		cmd->retc = DDCB_RETC_ERROR;
+		cmd->attn = SW_ATTN_ILLEGAL_PARM;
+		return;
+	}
+
+	memmove(dst, src, len);
+	crc = sw_crc32(__be32_to_cpu(asiv->in_crc32), src, len);
+	adler = sw_adler32(__be32_to_cpu(asiv->in_adler32), src, len);
+
+	memset(asv, 0, sizeof(*asv));
+	asv->out_crc32 = __cpu_to_be32(crc);
+	asv->out_adler32 = __cpu_to_be32(adler);
+	asv->inp_processed = __cpu_to_be32(len);
+	asv->outp_returned = __cpu_to_be32(len);
+	cmd->retc = DDCB_RETC_COMPLETE;
+}
+
+static void sw_echo(struct ddcb_cmd *cmd)
+{
+	static const uint16_t force_retc[8] = {
+		DDCB_RETC_COMPLETE, DDCB_RETC_COMPLETE, DDCB_RETC_FAULT,
+		DDCB_RETC_ERROR, DDCB_RETC_UNEXEC, DDCB_RETC_TERM,
+		DDCB_RETC_RES0, DDCB_RETC_RES1 };
+
+	if (cmd->cmdopts & _DDCB_OPT_ECHO_COPY_ALL)
+		memcpy(cmd->asv, cmd->asiv, DDCB_ASV_LENGTH);
+
+	cmd->retc = force_retc[cmd->cmdopts & 0x7];
+}
+
+/**
+ * Execute a chain of DDCBs. Like the hardware we continue with the
+ * next DDCB even if one of them fails.
+ */
+static int sw_execute_chain(struct sw_worker *w, struct ddcb_cmd *cmd)
+{
+	struct sw_card *card = w->card;
+	unsigned long long count[4] = { 0, 0, 0, 0 };
+	unsigned long long failed = 0, done = 0;
+	int rc = DDCB_OK;
+
+	for (; cmd != NULL; cmd = (struct ddcb_cmd *)
+		     (unsigned long)cmd->next_addr) {
+		cmd->retc = DDCB_RETC_PENDING;
+		cmd->attn = 0;
+		cmd->progress = 0;
+		cmd->deque_ts = get_usec();
+
+		if (cmd->cmd == DDCB_CMD_ECHO_SYNC) {
+			sw_echo(cmd);
+			count[0]++;
+		} else if ((cmd->acfunc == DDCB_ACFUNC_APP) &&
+			   (cmd->cmd == ZEDC_CMD_INFLATE)) {
+			sw_inflate(w, cmd);
+			count[1]++;
+		} else if ((cmd->acfunc == DDCB_ACFUNC_APP) &&
+			   (cmd->cmd == ZEDC_CMD_DEFLATE)) {
+			sw_deflate(w, cmd);
+			count[2]++;
+		} else if ((cmd->acfunc == DDCB_ACFUNC_APP) &&
+			   (cmd->cmd == ZCOMP_CMD_ZEDC_MEMCOPY)) {
+			sw_memcopy(cmd);
+			count[3]++;
+		} else {
+			cmd->retc = DDCB_RETC_ERROR;
+			cmd->attn = SW_ATTN_ILLEGAL_CMD;
+		}
+		cmd->cmplt_ts = get_usec();
+		done++;
+
+		if (cmd->retc != DDCB_RETC_COMPLETE) {
+			VERBOSE1("  DDCB %p cmd=%02x failed RETC=%03x "
+				 "ATTN=%04x\n", cmd, cmd->cmd, cmd->retc,
+				 cmd->attn);
+			rc = DDCB_ERR_EXEC_DDCB;
+			failed++;
+		}
+	}
+
+	pthread_mutex_lock(&card->lock);
+	card->completed_ddcbs += done;
+	card->failed_ddcbs += failed;
+	card->cmd_count[0] += count[0];
+	card->cmd_count[1] += count[1];
+	card->cmd_count[2] += count[2];
+	card->cmd_count[3] += count[3];
+	pthread_mutex_unlock(&card->lock);
+
+	return rc;
+}
+
+/*****************************************************************************/
+/** Emulated card							     */
+/*****************************************************************************/
+
+static void *sw_worker_thread(void *data)
+{
+	struct sw_worker *w = (struct sw_worker *)data;
+	struct sw_card *card = w->card;
+	struct sw_req *req;
+	uint64_t s;
+
+	pthread_mutex_lock(&card->lock);
+	while (1) {
+		while (!card->stop && (card->head == NULL))
+			pthread_cond_wait(&card->cond, &card->lock);
+
+		req = card->head;
+		if (req == NULL)	/* stop requested and queue empty */
+			break;
+		card->head = req->next;
+		if (card->head == NULL)
+			card->tail = NULL;
+		card->waiting--;
+		pthread_mutex_unlock(&card->lock);
+
+		s = get_usec();
+		req->rc = sw_execute_chain(w, req->cmd);
+		s = get_usec() - s;
+
+		if (req->done_cb != NULL) {
+			req->done_cb(req->done_priv, req->rc);
+			free(req);
+		} else
+			sem_post(&req->done);
+
+		pthread_mutex_lock(&card->lock);
+		card->work_time += s;
+	}
+	pthread_mutex_unlock(&card->lock);
+	return NULL;
+}
+
+static void __sw_stop(struct sw_card *card)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&card->lock);
+	card->stop = true;
+	pthread_cond_broadcast(&card->cond);
+	pthread_mutex_unlock(&card->lock);
+
+	for (i = 0; i < card->num_threads; i++) {
+		pthread_join(card->workers[i].tid, NULL);
+		free(card->workers[i].head);
+		free(card->workers[i].prev);
+	}
+	free(card->workers);
+	card->workers = NULL;
+	card->num_threads = 0;
+	card->stop = false;
+}
+
+static int __sw_start(struct sw_card *card)
+{
+	unsigned int i;
+	int rc;
+
+	card->workers = calloc(sw_threads, sizeof(*card->workers));
+	if (card->workers == NULL)
+		return DDCB_ERR_ENOMEM;
+
+	for (i = 0; i < sw_threads; i++) {
+		struct sw_worker *w = &card->workers[i];
+
+		w->card = card;
+		w->head = malloc(SW_HASH_SIZE * sizeof(*w->head));
+		w->prev = malloc(SW_WSIZE * sizeof(*w->prev));
+		if ((w->head == NULL) || (w->prev == NULL)) {
+			free(w->head);
+			free(w->prev);
+			rc = DDCB_ERR_ENOMEM;
+			goto err_stop;
+		}
+		rc = pthread_create(&w->tid, NULL, sw_worker_thread, w);
+		if (rc != 0) {
+			free(w->head);
+			free(w->prev);
+			rc = DDCB_ERR_CARD;
+			goto err_stop;
+		}
+		card->num_threads++;
+	}
+	return DDCB_OK;
+
+ err_stop:
+	VERBOSE0("ERROR: starting SW accelerator thread %u failed\n", i);
+	__sw_stop(card);
+	return rc;
+}
+
+static void *card_open(int card_no, unsigned int mode, int *card_rc,
+		       uint64_t appl_id, uint64_t appl_id_mask)
+{
+	int rc = DDCB_OK;
+	struct sw_card *card = &sw_card;
+	struct sw_ttx *ttx = NULL;
+
+	VERBOSE1("[%s] SW[%d] Enter mode: 0x%x\n", __func__, card_no, mode);
+
+	/* One emulated card */
+	if ((card_no != ACCEL_REDUNDANT) && (card_no != 0)) {
+		rc = DDCB_ERR_INVAL;
+		goto card_open_exit;
+	}
+	if ((SW_APP_ID & appl_id_mask) != (appl_id & appl_id_mask)) {
+		rc = DDCB_ERR_APPID;
+		goto card_open_exit;
+	}
+
+	ttx = calloc(1, sizeof(*ttx));
+	if (ttx == NULL) {
+		rc = DDCB_ERR_ENOMEM;
+		goto card_open_exit;
+	}
+	ttx->card = card;
+	ttx->card_no = card_no;
+	ttx->mode = mode;
+	ttx->verify = ttx;
+
+	pthread_mutex_lock(&card->olock);
+	if (card->clients == 0)
+		rc = __sw_start(card);
+	if (rc == DDCB_OK)
+		card->clients++;
+	pthread_mutex_unlock(&card->olock);
+
+	if (rc != DDCB_OK) {
+		free(ttx);
+		ttx = NULL;
+	}
+
+ card_open_exit:
+	if (card_rc)
+		*card_rc = rc;
+	VERBOSE1("[%s] SW[%d] Exit ttx: %p\n", __func__, card_no, ttx);
+	return ttx;
+}
+
+static int card_close(void *card_data)
+{
+	struct sw_ttx *ttx = (struct sw_ttx *)card_data;
+	struct sw_card *card;
+
+	VERBOSE1("[%s] Enter ttx: %p\n", __func__, ttx);
+	if ((ttx == NULL) || (ttx->verify != ttx))
+		return DDCB_ERR_INVAL;
+
+	card = ttx->card;
+	pthread_mutex_lock(&card->olock);
+	if (--card->clients == 0)
+		__sw_stop(card);
+	pthread_mutex_unlock(&card->olock);
+
+	VERBOSE1("[%s] Exit ttx: %p\n", __func__, ttx);
+	ttx->verify = NULL;
+	free(ttx);
+	return DDCB_OK;
+}
+
+static void __sw_enqueue(struct sw_card *card, struct sw_req *req)
+{
+	pthread_mutex_lock(&card->lock);
+	if (card->tail)
+		card->tail->next = req;
+	else
+		card->head = req;
+	card->tail = req;
+	card->waiting++;
+	pthread_cond_signal(&card->cond);
+	pthread_mutex_unlock(&card->lock);
+}
+
+static int ddcb_execute(void *card_data, struct ddcb_cmd *cmd)
+{
+	struct sw_ttx *ttx = (struct sw_ttx *)card_data;
+	struct sw_card *card;
+	struct sw_req req;
+
+	if ((ttx == NULL) || (ttx->verify != ttx) || (cmd == NULL))
+		return DDCB_ERR_INVAL;
+
+	card = ttx->card;
+	req.cmd = cmd;
+	req.rc = DDCB_OK;
+	req.done_cb = NULL;
+	req.done_priv = NULL;
+	req.next = NULL;
+	sem_init(&req.done, 0, 0);
+	__sw_enqueue(card, &req);
+
+	while ((sem_wait(&req.done) == -1) && (errno == EINTR))
+		;
+	sem_destroy(&req.done);
+
+	return req.rc;
+}
+
+static int ddcb_submit(void *card_data, struct ddcb_cmd *cmd,
+		       void (* done)(void *priv, int rc), void *priv)
+{
+	struct sw_ttx *ttx = (struct sw_ttx *)card_data;
+	struct sw_req *req;
+
+	if ((ttx == NULL) || (ttx->verify != ttx) || (cmd == NULL) ||
+	    (done == NULL))
+		return DDCB_ERR_INVAL;
+
+	req = calloc(1, sizeof(*req));
+	if (req == NULL)
+		return DDCB_ERR_ENOMEM;
+
+	req->cmd = cmd;
+	req->done_cb = done;
+	req->done_priv = priv;
+	__sw_enqueue(ttx->card, req);
+
+	return DDCB_OK;
+}
+
+static const char *_card_strerror(void *card_data __attribute__((unused)),
+				  int card_rc)
+{
+	return ddcb_strerror(card_rc);
+}
+
+static uint64_t _card_get_app_id(void *card_data __attribute__((unused)))
+{
+	return SW_APP_ID;
+}
+
+/**
+ * Time the worker threads spent executing DDCBs, in usec.
+ */
+static uint64_t _card_get_queue_work_time(void *card_data)
+{
+	struct sw_ttx *ttx = (struct sw_ttx *)card_data;
+	uint64_t work_time;
+
+	if ((ttx == NULL) || (ttx->verify != ttx))
+		return 0;
+
+	pthread_mutex_lock(&ttx->card->lock);
+	work_time = ttx->card->work_time;
+	pthread_mutex_unlock(&ttx->card->lock);
+	return work_time;
+}
+
+/**
+ * The queue work time is counted in usec.
+ */
+static uint64_t _card_get_frequency(void *card_data __attribute__((unused)))
+{
+	return 1000000;
+}
+
+static void card_dump_hardware_version(void *card_data, FILE *fp)
+{
+	struct sw_ttx *ttx = (struct sw_ttx *)card_data;
+
+	if (!(ttx && (ttx->verify == ttx)))
+		return;
+
+	fprintf(fp, "SW accelerator: app_id 0x%016llx, %u worker threads\n",
+		(long long)SW_APP_ID, ttx->card->num_threads);
+}
+
+static int card_pin_memory(void *card_data __attribute__((unused)),
+			   const void *addr __attribute__((unused)),
+			   size_t size __attribute__((unused)),
+			   int dir __attribute__((unused)))
+{
+	return DDCB_OK;
+}
+
+static int card_unpin_memory(void *card_data __attribute__((unused)),
+			     const void *addr __attribute__((unused)),
+			     size_t size __attribute__((unused)))
+{
+	return DDCB_OK;
+}
+
+static void *card_malloc(void *card_data __attribute__((unused)),
+			 size_t size)
+{
+	return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+static int card_free(void *card_data __attribute__((unused)),
+		     void *ptr,
+		     size_t size __attribute__((unused)))
+{
+	if (ptr == NULL)
+		return DDCB_OK;
+
+	free(ptr);
+	return DDCB_OK;
+}
+
+static int _accel_dump_statistics(FILE *fp)
+{
+	struct sw_card *card = &sw_card;
+
+	if ((fp == NULL) || (card->completed_ddcbs == 0))
+		return 0;
+
+	fprintf(fp, "  SW[0] threads: %u Completed DDCBs: %lld failed: %lld\n"
+		    "  Stats: %lld(echo), %lld(inflate), %lld(deflate), "
+		    "%lld(memcopy) %lld usec busy\n",
+		sw_threads, card->completed_ddcbs, card->failed_ddcbs,
+		card->cmd_count[0], card->cmd_count[1], card->cmd_count[2],
+		card->cmd_count[3], (long long)card->work_time);
+	return 0;
+}
+
+/**
+ * Requests queue up in software only if all workers are busy.
+ */
+static unsigned int card_get_waiting(void)
+{
+	struct sw_card *card = &sw_card;
+	unsigned int waiting;
+
+	pthread_mutex_lock(&card->lock);
+	waiting = card->waiting;
+	pthread_mutex_unlock(&card->lock);
+	return waiting;
+}
+
+static struct ddcb_accel_funcs accel_funcs = {
+	.card_type = DDCB_TYPE_SW,
+	.card_name = "SW",
+
+	/* functions */
+	.card_open = card_open,
+	.card_close = card_close,
+	.ddcb_execute = ddcb_execute,
+	.card_strerror = _card_strerror,
+	.card_read_reg64 = NULL,
+	.card_read_reg32 = NULL,
+	.card_write_reg64 = NULL,
+	.card_write_reg32 = NULL,
+	.card_get_app_id = _card_get_app_id,
+	.card_get_queue_work_time = _card_get_queue_work_time,
+	.card_get_frequency = _card_get_frequency,
+	.card_dump_hardware_version = card_dump_hardware_version,
+	.card_pin_memory = card_pin_memory,
+	.card_unpin_memory = card_unpin_memory,
+	.card_malloc = card_malloc,
+	.card_free = card_free,
+
+	/* statistics */
+	.dump_statistics = _accel_dump_statistics,
+	.num_open = 0,
+	.num_close = 0,
+	.num_execute = 0,
+	.time_open = 0,
+	.time_execute = 0,
+	.time_close = 0,
+
+	.priv_data = NULL,
+
+	/* extensions */
+	.ddcb_submit = ddcb_submit,
+	.card_get_waiting = card_get_waiting,
+};
+
+static void sw_tables_init(void)
+{
+	uint8_t lens[320];
+	unsigned int i, k, c;
+	uint32_t crc;
+
+	for (i = 0; i < 256; i++) {
+		for (crc = i, k = 0; k < 8; k++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+		crc_table[i] = crc;
+	}
+
+	/* Fixed literal/length codes (RFC1951 3.2.6) */
+	for (i = 0; i < 288; i++) {
+		if (i < 144) {
+			c = 0x30 + i;
+			lens[i] = 8;
+		} else if (i < 256) {
+			c = 0x190 + (i - 144);
+			lens[i] = 9;
+		} else if (i < 280) {
+			c = i - 256;
+			lens[i] = 7;
+		} else {
+			c = 0xc0 + (i - 280);
+			lens[i] = 8;
+		}
+		fixed_llen[i] = lens[i];
+		fixed_lcode[i] = bit_reverse(c, lens[i]);
+	}
+	huff_build(&fixed_lit, lens, 288);
+
+	for (i = 0; i < 30; i++) {
+		fixed_dcode[i] = bit_reverse(i, 5);
+		lens[i] = 5;
+	}
+	huff_build(&fixed_dist, lens, 30);
+
+	for (c = 0; c < 29; c++) {
+		for (i = len_base[c]; i < len_base[c] + (1u << len_extra[c]) &&
+			     i <= SW_MAX_MATCH; i++)
+			len_code[i] = c;
+	}
+	len_code[SW_MAX_MATCH] = 28;
+
+	for (c = 0; c < 30; c++) {
+		for (i = dist_base[c] - 1;
+		     i < dist_base[c] - 1 + (1u << dist_extra[c]); i++) {
+			if (i < 256)
+				dist_code[i] = c;
+			else
+				dist_code[256 + (i >> 7)] = c;
+		}
+	}
+}
+
+static void sw_card_init(void) __attribute__((constructor));
+static void sw_card_init(void)
+{
+	const char *ttt = getenv("DDCB_SW_THREADS");
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	sw_tables_init();
+
+	if ((cpus > 0) && (cpus < CONFIG_SW_THREADS))
+		sw_threads = cpus;
+	if (ttt)
+		sw_threads = strtoul(ttt, (char **) NULL, 0);
+	if (sw_threads == 0)
+		sw_threads = 1;
+	if (sw_threads > SW_THREADS_MAX)
+		sw_threads = SW_THREADS_MAX;
+
+	ddcb_register_accelerator(&accel_funcs);
+}
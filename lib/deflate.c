@@ -212,6 +212,8 @@ static void __deflateInit_state(zedc_streamp strm)
 	strm->eob_added = 0;
 	strm->trailer_added = 0;
 	strm->havedict = 0;
+	strm->skip_misses = 0;
+	strm->ddcb_busy = 0;
 
 	strm->in_hdr_scratch_len = 0;
 	strm->in_hdr_bits = 0;
@@ -267,6 +269,7 @@ int zedc_deflateInit2(zedc_streamp strm,
 	strm->method	   = method;
 	strm->memLevel	   = memLevel;
 	strm->strategy	   = strategy;
+	strm->skip_ratio   = 0;
 	__deflateInit_state(strm);
 
 	rc = zedc_format_init(strm);
@@ -303,10 +306,26 @@ int zedc_deflateSetDictionary(zedc_streamp strm,
 	return ZEDC_OK;
 }
 
+/**
+ * A pipelined DDCB still refers to the buffers and the workspace.
+ * Let it finish before they go away, its result is dropped.
+ */
+static void deflate_drain(zedc_streamp strm)
+{
+	if (!strm->ddcb_busy)
+		return;
+
+	zedc_wait_request((zedc_handle_t)strm->device, &strm->cmd);
+	strm->ddcb_busy = 0;
+}
+
 int zedc_deflateCopy(zedc_streamp dest, zedc_streamp source)
 {
 	int rc;
 
+	if (source->ddcb_busy)	/* result would go to source buffers */
+		return ZEDC_STREAM_ERROR;
+
 	memcpy(dest, source, sizeof(*dest));
 	rc = zedc_alloc_workspace(dest);
 	if (rc != ZEDC_OK)
@@ -328,6 +347,7 @@ int zedc_deflateReset(zedc_streamp strm)
 	if (!strm)
 		return ZEDC_STREAM_ERROR;
 
+	deflate_drain(strm);
 	__deflateInit_state(strm);
 
 	rc = zedc_format_init(strm);
@@ -388,10 +408,26 @@ static const uint8_t bmsk[8] = { 0xff, 0x01, 0x03, 0x07,
  *                                 = { 0x00, 0x03, 0x00 }
  *                                 = 7 + 3 + 7 = 17 bits
  */
+static void deflate_eob_bytes(uint8_t obyte, unsigned int onumbits,
+			      uint8_t eob[3])
+{
+	/* const uint8_t eob_sync[3] = { 0x80, 0x01, 0x00 }; urg, bit-order */
+
+	if (onumbits == 0) {
+		eob[0] = 0x80; /*0b10000000 */
+		eob[1] = 0x01; /*0b00000001 */
+		eob[2] = 0x00; /*0b00000000 */
+	} else {
+		eob[0] = obyte & bmsk[onumbits];
+		eob[1] = 0x03 << (onumbits - 1); /*0b00000011 ... */
+		eob[2] = 0x00; /*0b00000000 */
+	}
+}
+
 static int deflate_write_eob(struct zedc_stream_s *strm)
 {
 	struct zedc_fifo *f = &strm->out_fifo;
-	/* const uint8_t eob_sync[3] = { 0x80, 0x01, 0x00 }; urg, bit-order */
+	uint8_t eob[3];
 
 	/* Avoid adding EOBs multiple times */
 	if (strm->eob_added == 1)
@@ -401,15 +437,10 @@ static int deflate_write_eob(struct zedc_stream_s *strm)
 	if (strm->onumbits >= 8)
 		return 0;
 
-	if (strm->onumbits == 0) {
-		fifo_push(f, 0x80); /*0b10000000 */
-		fifo_push(f, 0x01); /*0b00000001 */
-		fifo_push(f, 0x00); /*0b00000000 */
-	} else {
-		fifo_push(f, strm->obyte & bmsk[strm->onumbits]);
-		fifo_push(f, 0x03 << (strm->onumbits - 1)); /*0b00000011 ... */
-		fifo_push(f, 0x00); /*0b00000000 */
-	}
+	deflate_eob_bytes(strm->obyte, strm->onumbits, eob);
+	fifo_push(f, eob[0]);
+	fifo_push(f, eob[1]);
+	fifo_push(f, eob[2]);
 
 	strm->onumbits = 0;
 	strm->eob_added = 1;
@@ -591,45 +622,32 @@ static int deflate_process_results(struct zedc_stream_s *strm,
 }
 
 /**
- * @brief	do deflate (compress)
+ * @brief	Do what is possible without hardware: header, pending
+ *		FIFO bytes, EOB and trailer.
  * @param strm	common zedc parameter set
  * @param flush	flag if pending output data should be written
+ * @param rc	result for the caller if no DDCB is needed
+ * @return	1 if a DDCB is needed, else 0
  */
-int zedc_deflate(zedc_streamp strm, int flush)
+static int deflate_need_ddcb(zedc_streamp strm, int flush, int *rc)
 {
-	int rc, p;
-	struct zedc_asiv_defl *asiv;
-	struct zedc_asv_defl *asv;
-	zedc_handle_t zedc;
-	struct ddcb_cmd *cmd;
-	struct zedc_fifo *f;
-
-	unsigned int i, tries = 1;
-	uint64_t out_dict = 0x0;
-	uint32_t out_dict_len = 0x0;
-
-	if (!strm)
-		return ZEDC_STREAM_ERROR;
-
-	f = &strm->out_fifo;
-	zedc = (zedc_handle_t)strm->device;
-	if (!zedc)
-		return ZEDC_STREAM_ERROR;
+	struct zedc_fifo *f = &strm->out_fifo;
 
 	strm->flush = flush;
-	cmd = &strm->cmd;
-	ddcb_cmd_init(cmd);
+	*rc = ZEDC_OK;
 
 	/* Add ZLIB/GZIP prefix if needed */
 	if (0 == strm->header_added) {
-		if (deflate_add_header(strm))
-			return ZEDC_STREAM_ERROR;
+		if (deflate_add_header(strm)) {
+			*rc = ZEDC_STREAM_ERROR;
+			return 0;
+		}
 	}
 
 	/* Ensure that output FIFO gets written first */
 	deflate_write_out_fifo(strm);
 	if (!output_data_avail(strm))
-		return ZEDC_OK;
+		return 0;
 
 	/* Instructed to finish and no input data: write EOB and trailer */
 	if ((strm->flush == ZEDC_FINISH) && !input_data_avail(strm)) {
@@ -639,18 +657,32 @@ int zedc_deflate(zedc_streamp strm, int flush)
 	}
 
 	/* End-Of-Block added, and written out */
-	if ((strm->eob_added) && (strm->trailer_added) && fifo_empty(f))
-		return ZEDC_STREAM_END;	/* done */
+	if ((strm->eob_added) && (strm->trailer_added) && fifo_empty(f)) {
+		*rc = ZEDC_STREAM_END;	/* done */
+		return 0;
+	}
 
 	/* Don't ask hardware if we have no output space */
 	if (!output_data_avail(strm))
-		return ZEDC_OK;
+		return 0;
 
 	/* Don't ask hardware if we have nothing to process */
 	if (!input_data_avail(strm))
-		return ZEDC_OK;
+		return 0;
 
-	/* Prepare Deflate DDCB */
+	return 1;
+}
+
+/**
+ * @brief	Prepare Deflate DDCB
+ * @param strm	common zedc parameter set
+ * @param cmd	DDCB command to set up
+ */
+static void deflate_setup_cmd(zedc_streamp strm, struct ddcb_cmd *cmd)
+{
+	zedc_handle_t zedc = (zedc_handle_t)strm->device;
+
+	ddcb_cmd_init(cmd);
 	cmd->cmd = ZEDC_CMD_DEFLATE;
 	cmd->acfunc = DDCB_ACFUNC_APP;
 	cmd->cmdopts = DDCB_OPT_DEFL_SAVE_DICT;		/* SAVE_DICT  */
@@ -695,10 +727,18 @@ int zedc_deflate(zedc_streamp strm, int flush)
 			     ATS_SET_FLAGS(struct zedc_asiv_defl, out_dict,
 					   ATS_TYPE_SGL_RDWR));
 	}
+}
+
+/**
+ * @brief	Setup ASIV part (provided in big endian byteorder)
+ * @param strm	common zedc parameter set
+ * @param asiv	ASIV in the DDCB command or in the queue slot
+ */
+static void deflate_setup_asiv(zedc_streamp strm,
+			       struct zedc_asiv_defl *asiv)
+{
+	int p;
 
-	/* Setup ASIV part (provided in big endian byteorder) */
-	asiv = (struct zedc_asiv_defl *)&cmd->asiv;
-	asv = (struct zedc_asv_defl *)&cmd->asv;
 	asiv->in_buff      = __cpu_to_be64((unsigned long)strm->next_in);
 	asiv->in_buff_len  = __cpu_to_be32(strm->avail_in);
 	asiv->out_buff     = __cpu_to_be64((unsigned long)strm->next_out);
@@ -718,14 +758,153 @@ int zedc_deflate(zedc_streamp strm, int flush)
 	asiv->inumbits = strm->onumbits;
 	asiv->in_crc32 = __cpu_to_be32(strm->crc32);
 	asiv->in_adler32 = __cpu_to_be32(strm->adler32);
+}
+
+/**
+ * @brief	Record DDCB status, complain if it failed
+ * @return	0 if successful, < 0 if failed
+ */
+static int deflate_check_ddcb(zedc_streamp strm, int rc)
+{
+	zedc_handle_t zedc = (zedc_handle_t)strm->device;
+	struct ddcb_cmd *cmd = &strm->cmd;
+
+	strm->retc = cmd->retc;
+	strm->attn = cmd->attn;
+	strm->progress = cmd->progress;
+
+	/* Check for unexecuted DDCBs too, where RETC is 0x000. */
+	if ((rc < 0) || (cmd->retc == 0x000)) {
+		pr_err("deflate failed rc=%d card_rc=%d\n"
+		       "  DDCB returned "
+		       "(RETC=%03x ATTN=%04x PROGR=%x) %s\n",
+		       rc, zedc->card_rc, cmd->retc,
+		       cmd->attn, cmd->progress,
+		       cmd->retc == 0x102 ? "" : "ERR");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief	Take over the results of a finished DDCB
+ * @param strm	common zedc parameter set
+ * @param asv	ASV in the DDCB command or in the queue slot
+ */
+static int deflate_complete(zedc_streamp strm, struct zedc_asv_defl *asv)
+{
+	int rc;
+	struct zedc_fifo *f = &strm->out_fifo;
+
+	zedc_skip_dict_learn(strm, 1, __be32_to_cpu(asv->inp_processed),
+			     __be32_to_cpu(asv->outp_returned));
+
+	/* Analyze ASV part (provided in big endian byteorder!) */
+	strm->crc32 = __be32_to_cpu(asv->out_crc32);
+	strm->adler32 = __be32_to_cpu(asv->out_adler32);
+	strm->dict_len = __be16_to_cpu(asv->out_dict_used);
+	strm->out_dict_offs = asv->out_dict_offs;
+
+	if (strm->out_dict_offs >= 16) {
+		pr_err("DICT_OFFSET too large (%u)\n", strm->out_dict_offs);
+		return ZEDC_STREAM_ERROR;
+	}
+
+	/* Post-processing of DDCB status */
+	rc  = deflate_process_results(strm, asv);
+	if (rc < 0)
+		return ZEDC_STREAM_ERROR;
+
+	/* Instructed to finish and no input data, write EOB and trailer */
+	if ((strm->flush == ZEDC_FINISH) && !input_data_avail(strm)) {
+		deflate_write_eob(strm);	/* Add EOB */
+		deflate_add_trailer(strm);	/* ZLIB/GZIP postfix */
+		deflate_write_out_fifo(strm);
+	}
+
+	/* Handle ZEDC_SYNC_FLUSH + ZEDC_PARTIAL_FLUSH the same way
+	   Testcase CDHF_03 */
+	if ((strm->flush == ZEDC_SYNC_FLUSH) ||
+		(strm->flush == ZEDC_PARTIAL_FLUSH)) {
+		deflate_sync_flush(strm);
+		deflate_write_out_fifo(strm);
+	}
+
+	/* FIX for HW290108 Testcase CDHF_06 */
+	if (strm->flush == ZEDC_FULL_FLUSH) {
+		deflate_sync_flush(strm);
+		deflate_write_out_fifo(strm);
+		strm->dict_len = 0;
+	}
+
+	/* End-Of-Block added, and written out */
+	if ((strm->eob_added) && (strm->trailer_added) && fifo_empty(f))
+		return ZEDC_STREAM_END;	/* done */
+
+	return ZEDC_OK;
+}
+
+/**
+ * @brief	do deflate (compress)
+ * @param strm	common zedc parameter set
+ * @param flush	flag if pending output data should be written
+ */
+int zedc_deflate(zedc_streamp strm, int flush)
+{
+	int rc;
+	struct zedc_asiv_defl *asiv;
+	struct zedc_asv_defl *asv;
+	zedc_handle_t zedc;
+	struct ddcb_cmd *cmd;
+	struct ddcb_slot slot = { .card_slot = NULL };
+
+	unsigned int i, tries = 1;
+	uint64_t out_dict = 0x0;
+	uint32_t out_dict_len = 0x0;
+	int skip_dict;
+	unsigned long usec = 0;
+
+	if (!strm)
+		return ZEDC_STREAM_ERROR;
+
+	zedc = (zedc_handle_t)strm->device;
+	if (!zedc || strm->ddcb_busy)
+		return ZEDC_STREAM_ERROR;
+
+	if (!deflate_need_ddcb(strm, flush, &rc))
+		return rc;
+
+	cmd = &strm->cmd;
+	deflate_setup_cmd(strm, cmd);
+
+	skip_dict = ((flush == ZEDC_FINISH) || (flush == ZEDC_FULL_FLUSH)) &&
+		zedc_skip_dict(strm, 1);
+
+	/*
+	 * Build the ASIV right in the DDCB queue slot unless we might
+	 * need to repeat the DDCB or want to dump it.
+	 */
+	if (!skip_dict && !zedc_dbg) {
+		rc = zedc_reserve_request(zedc, &slot, cmd);
+		if (rc < 0)
+			return ZEDC_STREAM_ERROR;
+
+		asiv = (struct zedc_asiv_defl *)slot.asiv;
+		asv = (struct zedc_asv_defl *)slot.asv;
+	} else {
+		asiv = (struct zedc_asiv_defl *)&cmd->asiv;
+		asv = (struct zedc_asv_defl *)&cmd->asv;
+	}
+
+	deflate_setup_asiv(strm, asiv);
 
 	/*
 	 * Optimization attempt: If we are called with Z_FINISH, and
-	 * we assume that the data will fit into the provided output
-	 * buffer, we try to run the hardware without dictionary save
-	 * function. If we do not see all data absorbed and all
-	 * available output written, we need to restart with
-	 * dictionary save option.
+	 * we predict that the data will fit into the provided output
+	 * buffer (zedc_skip_dict()), we try to run the hardware
+	 * without dictionary save function. If we do not see all
+	 * data absorbed and all available output written, we need to
+	 * restart with dictionary save option.
 	 *
 	 * The desire is to keep small transfers efficient. It will
 	 * not have significant effect if we deal with huge data
@@ -734,39 +913,29 @@ int zedc_deflate(zedc_streamp strm, int flush)
 	cmd->cmdopts |= DDCB_OPT_DEFL_SAVE_DICT;
 	tries = 1;
 
-	if ((strm->flags & ZEDC_FLG_SKIP_LAST_DICT) &&
-	    (((flush == ZEDC_FINISH) || (flush == ZEDC_FULL_FLUSH)) &&
-	     (strm->avail_out >= strm->avail_in))) {
-
+	if (skip_dict) {
 		out_dict = asiv->out_dict;
 		out_dict_len = asiv->out_dict_len;
 
 		cmd->cmdopts &= ~DDCB_OPT_DEFL_SAVE_DICT;
 		asiv->out_dict = 0x0;
 		asiv->out_dict_len = 0x0;
-		tries = 2;
+		tries = (strm->flags & ZEDC_FLG_ONE_SHOT) ? 1 : 2;
 	}
 
 	for (i = 0; i < tries; i++) {
-		zedc_asiv_defl_print(strm, zedc_dbg);
-		rc = zedc_execute_request(zedc, cmd);
-		zedc_asv_defl_print(strm, zedc_dbg);
-
-		strm->retc = cmd->retc;
-		strm->attn = cmd->attn;
-		strm->progress = cmd->progress;
-
-		/* Check for unexecuted DDCBs too, where RETC is 0x000. */
-		if ((rc < 0) || (cmd->retc == 0x000)) {
-			struct ddcb_cmd *cmd = &strm->cmd;
-
-			pr_err("deflate failed rc=%d card_rc=%d\n"
-			       "  DDCB returned "
-			       "(RETC=%03x ATTN=%04x PROGR=%x) %s\n",
-			       rc, zedc->card_rc, cmd->retc,
-			       cmd->attn, cmd->progress,
-			       cmd->retc == 0x102 ? "" : "ERR");
-
+		if (skip_dict && (i == 0))
+			usec = zedc_usec();
+
+		if (slot.card_slot == NULL) {
+			zedc_asiv_defl_print(strm, zedc_dbg);
+			rc = zedc_execute_request(zedc, cmd);
+			zedc_asv_defl_print(strm, zedc_dbg);
+		} else
+			rc = zedc_commit_request(zedc, &slot, cmd);
+
+		if (deflate_check_ddcb(strm, rc) < 0) {
+			zedc_release_request(zedc, &slot);
 			return ZEDC_STREAM_ERROR;
 		}
 
@@ -776,9 +945,8 @@ int zedc_deflate(zedc_streamp strm, int flush)
 			break;
 
 		/* What a pity, need to repeat to get back dictionary */
-		if ((strm->flags & ZEDC_FLG_SKIP_LAST_DICT) &&
-		    (((flush == ZEDC_FINISH) || (flush == ZEDC_FULL_FLUSH)) &&
-		     (strm->avail_out >= strm->avail_in))) {
+		if (skip_dict && (i + 1 < tries)) {
+			zedc_skip_dict_result(strm, 0, zedc_usec() - usec);
 			cmd->cmdopts |= DDCB_OPT_DEFL_SAVE_DICT;
 			asiv->out_dict = out_dict;
 			asiv->out_dict_len = out_dict_len;
@@ -789,50 +957,87 @@ int zedc_deflate(zedc_streamp strm, int flush)
 				__func__, cmd->retc, cmd->attn, cmd->progress);
 		}
 	}
+	if (skip_dict && (i == 0))
+		zedc_skip_dict_result(strm, 1, 0);
 
-	/* Analyze ASV part (provided in big endian byteorder!) */
-	strm->crc32 = __be32_to_cpu(asv->out_crc32);
-	strm->adler32 = __be32_to_cpu(asv->out_adler32);
-	strm->dict_len = __be16_to_cpu(asv->out_dict_used);
-	strm->out_dict_offs = asv->out_dict_offs;
+	/* One-shot: without the dictionary the stream cannot go on */
+	if (i == tries && (strm->flags & ZEDC_FLG_ONE_SHOT)) {
+		zedc_release_request(zedc, &slot);
+		return ZEDC_BUF_ERROR;
+	}
 
-	if (strm->out_dict_offs >= 16) {
-		pr_err("DICT_OFFSET too large (%u)\n", strm->out_dict_offs);
+	rc = deflate_complete(strm, asv);
+	zedc_release_request(zedc, &slot);
+	return rc;
+}
+
+/**
+ * @brief	start deflate (compress) without waiting for the DDCB
+ * @param strm	common zedc parameter set
+ * @param flush	flag if pending output data should be written
+ */
+int zedc_deflate_submit(zedc_streamp strm, int flush)
+{
+	int rc;
+	zedc_handle_t zedc;
+	struct ddcb_cmd *cmd;
+
+	if (!strm)
 		return ZEDC_STREAM_ERROR;
-	}
 
-	/* Post-processing of DDCB status */
-	rc  = deflate_process_results(strm, asv);
-	if (rc < 0)
+	zedc = (zedc_handle_t)strm->device;
+	if (!zedc || strm->ddcb_busy)
 		return ZEDC_STREAM_ERROR;
 
-	/* Instructed to finish and no input data, write EOB and trailer */
-	if ((strm->flush == ZEDC_FINISH) && !input_data_avail(strm)) {
-		deflate_write_eob(strm);	/* Add EOB */
-		deflate_add_trailer(strm);	/* ZLIB/GZIP postfix */
-		deflate_write_out_fifo(strm);
-	}
+	if (!deflate_need_ddcb(strm, flush, &rc))
+		return rc;
 
-	/* Handle ZEDC_SYNC_FLUSH + ZEDC_PARTIAL_FLUSH the same way
-	   Testcase CDHF_03 */
-	if ((strm->flush == ZEDC_SYNC_FLUSH) ||
-		(strm->flush == ZEDC_PARTIAL_FLUSH)) {
-		deflate_sync_flush(strm);
-		deflate_write_out_fifo(strm);
+	/* No skip_dict optimization, it might need a 2nd DDCB */
+	cmd = &strm->cmd;
+	deflate_setup_cmd(strm, cmd);
+	deflate_setup_asiv(strm, (struct zedc_asiv_defl *)&cmd->asiv);
+	zedc_asiv_defl_print(strm, zedc_dbg);
+
+	rc = zedc_submit_request(zedc, cmd);
+	if (rc < 0) {
+		pr_err("deflate submit failed rc=%d card_rc=%d\n",
+		       rc, zedc->card_rc);
+		return ZEDC_STREAM_ERROR;
 	}
 
-	/* FIX for HW290108 Testcase CDHF_06 */
-	if (strm->flush == ZEDC_FULL_FLUSH) {
-		deflate_sync_flush(strm);
-		deflate_write_out_fifo(strm);
-		strm->dict_len = 0;
-	}
+	strm->ddcb_busy = 1;
+	return ZEDC_OK;
+}
 
-	/* End-Of-Block added, and written out */
-	if ((strm->eob_added) && (strm->trailer_added) && fifo_empty(f))
-		return ZEDC_STREAM_END;	/* done */
+/**
+ * @brief	wait for the DDCB started by zedc_deflate_submit
+ * @param strm	common zedc parameter set
+ */
+int zedc_deflate_wait(zedc_streamp strm)
+{
+	int rc;
+	zedc_handle_t zedc;
+	struct ddcb_cmd *cmd;
 
-	return ZEDC_OK;
+	if (!strm || !strm->ddcb_busy)
+		return ZEDC_STREAM_ERROR;
+
+	zedc = (zedc_handle_t)strm->device;
+	cmd = &strm->cmd;
+
+	rc = zedc_wait_request(zedc, cmd);
+	strm->ddcb_busy = 0;
+	zedc_asv_defl_print(strm, zedc_dbg);
+
+	if (deflate_check_ddcb(strm, rc) < 0)
+		return ZEDC_STREAM_ERROR;
+
+	return deflate_complete(strm, (struct zedc_asv_defl *)&cmd->asv);
+}
+
+int zedc_deflate_busy(zedc_streamp strm)
+{
+	return strm->ddcb_busy;
 }
 
 /**
@@ -852,10 +1057,12 @@ int zedc_deflateEnd(zedc_streamp strm)
 	if (!zedc)
 		return ZEDC_STREAM_ERROR;
 
+	deflate_drain(strm);
 	while (!fifo_empty(f)) {
 		uint8_t data;
 		fifo_pop(f, &data);
-		pr_err("FIFO not empty: %02x\n", data);
+		if (!(strm->flags & ZEDC_FLG_ONE_SHOT))	/* gave up */
+			pr_err("FIFO not empty: %02x\n", data);
 	}
 
 	zedc_free_workspace(strm);
@@ -867,3 +1074,196 @@ int zedc_deflateSetHeader(zedc_streamp strm, gzedc_headerp head)
 	strm->gzip_head = head;
 	return ZEDC_OK;
 }
+
+/****************************************************************************
+ * BGZF (Blocked GNU Zip Format, used for BAM files)
+ ***************************************************************************/
+
+#define BGZF_HDR_LEN	18	/* gzip header with BC extra field */
+#define BGZF_TRL_LEN	8	/* CRC32 and ISIZE */
+#define BGZF_EOB_LEN	3	/* see deflate_eob_bytes() */
+#define BGZF_DDCB_OUT	(ZEDC_BGZF_MAX_BLOCK - BGZF_HDR_LEN -	\
+			 BGZF_TRL_LEN - BGZF_EOB_LEN)
+
+/**
+ * @brief	Add BGZF header and gzip trailer around the deflate data
+ * @param blk	block with data_len bytes deflate data behind the header
+ */
+static void bgzf_finish_block(struct zedc_bgzf_block *blk,
+			      unsigned int data_len, uint32_t crc32)
+{
+	uint8_t *p = blk->out;
+	unsigned int bsize = BGZF_HDR_LEN + data_len + BGZF_TRL_LEN;
+
+	p[0] = 0x1f;		/* ID1 */
+	p[1] = 0x8b;		/* ID2 */
+	p[2] = 0x08;		/* CM */
+	p[3] = FEXTRA;		/* FLG */
+	p[4] = p[5] = p[6] = p[7] = 0x00; /* MT */
+	p[8] = 0x00;		/* XFL */
+	p[9] = 0xff;		/* OS unknown */
+	p[10] = 6;		/* XLEN */
+	p[11] = 0;
+	p[12] = 'B';		/* SI1 */
+	p[13] = 'C';		/* SI2 */
+	p[14] = 2;		/* SLEN */
+	p[15] = 0;
+	p[16] = (bsize - 1) & 0xff; /* BSIZE: block size minus 1 */
+	p[17] = (bsize - 1) >> 8;
+
+	p += BGZF_HDR_LEN + data_len;
+	p[0] = crc32 & 0xff;
+	p[1] = (crc32 >> 8) & 0xff;
+	p[2] = (crc32 >> 16) & 0xff;
+	p[3] = (crc32 >> 24) & 0xff;
+	p[4] = blk->in_len & 0xff;
+	p[5] = (blk->in_len >> 8) & 0xff;
+	p[6] = p[7] = 0x00;
+
+	blk->out_len = bsize;
+}
+
+/**
+ * @brief	Store a block which did not compress into one BGZF block
+ */
+static void bgzf_store_block(struct zedc_bgzf_block *blk)
+{
+	uint8_t *p = blk->out + BGZF_HDR_LEN;
+
+	p[0] = 0x01;		/* BFINAL, BTYPE 00: stored */
+	p[1] = blk->in_len & 0xff;
+	p[2] = blk->in_len >> 8;
+	p[3] = ~p[1];
+	p[4] = ~p[2];
+	memcpy(p + 5, blk->in, blk->in_len);
+
+	bgzf_finish_block(blk, 5 + blk->in_len,
+			  __crc32(0, blk->in, blk->in_len));
+}
+
+/**
+ * @brief	Prepare a deflate DDCB for a self-contained block. No
+ *		dictionary goes in or out, so no workspace is needed.
+ */
+static void bgzf_setup_cmd(zedc_handle_t zedc, struct ddcb_cmd *cmd,
+			   struct zedc_bgzf_block *blk)
+{
+	struct zedc_asiv_defl *asiv = (struct zedc_asiv_defl *)&cmd->asiv;
+
+	ddcb_cmd_init(cmd);
+	cmd->cmd = ZEDC_CMD_DEFLATE;
+	cmd->acfunc = DDCB_ACFUNC_APP;
+	cmd->cmdopts = 0x0;			/* no SAVE_DICT */
+
+	/* Set DYNAMIC_HUFFMAN */
+	if (dyn_huffman_supported(zedc))
+		cmd->cmdopts |= DDCB_OPT_DEFL_IBUF_INDIR;
+
+	cmd->asiv_length = 0x70 - 0x18;	/* range for crc protection */
+	cmd->asv_length	 = 0xc0 - 0x80;
+	cmd->ats = (ATS_SET_FLAGS(struct zedc_asiv_defl, in_buff,
+				  ATS_TYPE_SGL_RD) |
+		    ATS_SET_FLAGS(struct zedc_asiv_defl, out_buff,
+				  ATS_TYPE_SGL_RDWR) |
+		    ATS_SET_FLAGS(struct zedc_asiv_defl, in_dict,
+				  ATS_TYPE_SGL_RD) |
+		    ATS_SET_FLAGS(struct zedc_asiv_defl, out_dict,
+				  ATS_TYPE_SGL_RDWR));
+
+	asiv->in_buff      = __cpu_to_be64((unsigned long)blk->in);
+	asiv->in_buff_len  = __cpu_to_be32(blk->in_len);
+	asiv->out_buff     = __cpu_to_be64((unsigned long)blk->out +
+					   BGZF_HDR_LEN);
+	asiv->out_buff_len = __cpu_to_be32(BGZF_DDCB_OUT);
+
+	asiv->ibits[0] = HDR_BTYPE_FIXED;	/* deflate header */
+	asiv->inumbits = 3;
+	asiv->in_crc32 = __cpu_to_be32(0);
+	asiv->in_adler32 = __cpu_to_be32(1);
+}
+
+/**
+ * @brief	compress blocks into BGZF blocks with one DDCB chain
+ * @param zedc	ZEDC device handle
+ * @param blk	blocks to compress, out_len is set for each of them
+ * @param n	number of blocks
+ */
+int zedc_bgzf_compress(zedc_handle_t zedc, struct zedc_bgzf_block *blk,
+		       unsigned int n)
+{
+	int rc = ZEDC_OK;
+	unsigned int i, len;
+	uint8_t eob[BGZF_EOB_LEN];
+	struct ddcb_cmd *cmd, *first = NULL, *prev = NULL;
+	struct zedc_asv_defl *asv;
+
+	if (!zedc || !blk)
+		return ZEDC_STREAM_ERROR;
+
+	for (i = 0; i < n; i++)
+		if ((blk[i].in_len > ZEDC_BGZF_BLOCK_SIZE) ||
+		    (blk[i].in_len && !blk[i].in) || !blk[i].out)
+			return ZEDC_ERR_INVAL;
+
+	cmd = calloc(n, sizeof(*cmd));
+	if (cmd == NULL)
+		return ZEDC_MEM_ERROR;
+
+	for (i = 0; i < n; i++) {
+		if (blk[i].in_len == 0)
+			continue;	/* empty block needs no DDCB */
+
+		bgzf_setup_cmd(zedc, &cmd[i], &blk[i]);
+		if (prev)
+			prev->next_addr = (unsigned long)&cmd[i];
+		else
+			first = &cmd[i];
+		prev = &cmd[i];
+	}
+
+	if (first) {
+		rc = zedc_execute_request(zedc, first);
+		if (rc < 0) {
+			pr_err("BGZF deflate chain failed rc=%d card_rc=%d\n",
+			       rc, zedc->card_rc);
+			rc = ZEDC_ERR_CARD;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (blk[i].in_len == 0) {	/* like the BGZF EOF block */
+			blk[i].out[BGZF_HDR_LEN] = 0x03;
+			blk[i].out[BGZF_HDR_LEN + 1] = 0x00;
+			bgzf_finish_block(&blk[i], 2, 0);
+			continue;
+		}
+
+		if (cmd[i].retc == 0x000) {	/* unexecuted */
+			pr_err("BGZF deflate DDCB %u failed "
+			       "(RETC=%03x ATTN=%04x PROGR=%x)\n", i,
+			       cmd[i].retc, cmd[i].attn, cmd[i].progress);
+			rc = ZEDC_ERR_CARD;
+			goto out;
+		}
+
+		/* Data which did not fit is stored */
+		asv = (struct zedc_asv_defl *)&cmd[i].asv;
+		len = __be32_to_cpu(asv->outp_returned);
+		if ((__be32_to_cpu(asv->inp_processed) != blk[i].in_len) ||
+		    (len > BGZF_DDCB_OUT) || (asv->onumbits > 7)) {
+			bgzf_store_block(&blk[i]);
+			continue;
+		}
+
+		/* Close the open block and add the final empty one */
+		deflate_eob_bytes(asv->obits[0], asv->onumbits, eob);
+		memcpy(blk[i].out + BGZF_HDR_LEN + len, eob, sizeof(eob));
+		bgzf_finish_block(&blk[i], len + sizeof(eob),
+				  __be32_to_cpu(asv->out_crc32));
+	}
+
+ out:
+	free(cmd);
+	return rc;
+}
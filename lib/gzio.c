@@ -0,0 +1,1638 @@
+/*
+ * Copyright 2017, International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * gzFile API on top of the wrapper's deflate() and inflate().
+ *
+ * The gz* functions of libz buffer 8 KiB by default and call their
+ * own deflate and inflate, so gzip files never reached the
+ * accelerator. Here a gzFile collects writes in a buffer of the
+ * hardware deflate buffer size and hands it to deflate() in one
+ * call. Reads fill a buffer of the same size for inflate().
+ * gzbuffer() overrides the size. The buffers come from
+ * zlib_dma_malloc() such that the hardware uses them without
+ * copying. Large reads and writes skip the buffers altogether.
+ *
+ * While inflate() works on one input buffer, a thread reads the
+ * next ones from the file. CONFIG_GZ_READAHEAD sets how many buffers
+ * it reads ahead.
+ *
+ * Writers can hand full buffers to a thread which runs deflate() and
+ * writes the file, such that gzwrite() does not wait for the
+ * hardware. CONFIG_GZ_WRITEBEHIND sets how many buffers may wait for
+ * it. gzflush() and gzclose() wait until all are written.
+ *
+ * The state starts with struct gzFile_s, which the gzgetc() macro of
+ * zlib.h uses. All gz* functions are implemented here. A gzFile must
+ * never reach the gz* code of libz.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <zlib.h>
+#include "zaddons.h"
+#include "wrapper.h"
+
+/*
+ * Input buffers read ahead of inflate(), 0 reads in the calling
+ * thread. Env-variable ZLIB_GZ_READAHEAD overwrites it.
+ */
+#define CONFIG_GZ_READAHEAD	2
+#define GZ_QUEUE_MAX		8	/* buffers read ahead or queued */
+
+/*
+ * Input buffers queued for the writer thread, 0 deflates in the
+ * calling thread. Env-variable ZLIB_GZ_WRITEBEHIND overwrites it.
+ */
+#define CONFIG_GZ_WRITEBEHIND	0
+
+#define GZ_KEEP		16	/* room to keep input across buffers */
+
+enum gz_mode { GZ_NONE, GZ_READ, GZ_WRITE };
+enum gz_how { GZ_LOOK, GZ_COPY, GZ_GZIP };
+
+struct gz_state {
+	struct gzFile_s x;	/* have, next, pos: used by gzgetc() */
+	enum gz_mode mode;
+	int fd;
+	char *path;		/* for error messages */
+	unsigned int want;	/* buffer size requested by gzbuffer() */
+	unsigned int size;	/* buffer size, 0 until allocated */
+	int level;
+	int strategy;
+	int direct;		/* write: 'T'; read: no gzip data seen */
+	enum gz_how how;	/* read: how to get data */
+	int init;		/* read: inflateInit2_() done */
+	off64_t start;		/* file offset of the data */
+	int eof;		/* read: no input beyond strm.avail_in */
+	int past;		/* read: tried to read past the end */
+	int seek;		/* a skip is pending */
+	off64_t skip;		/*   its length */
+	int err;
+	char *msg;
+	z_stream strm;
+
+	unsigned char *out;	/* read: 2 * size, write: size */
+	unsigned char *in;	/* write: data collected for deflate() */
+	unsigned int in_have;
+	off64_t raw;		/* write: file offset */
+
+	/*
+	 * Ring of input buffers. Read: filled by the read-ahead
+	 * thread. Write: in is buf[wr], the writer thread deflates
+	 * the buffers queued in front of it.
+	 */
+	unsigned int nbuf;
+	unsigned char *buf[GZ_QUEUE_MAX + 1];
+	unsigned int len[GZ_QUEUE_MAX + 1];
+	off64_t off[GZ_QUEUE_MAX + 1];
+	int flush[GZ_QUEUE_MAX + 1];
+	unsigned int rd;	/* next buffer for inflate()/deflate() */
+	unsigned int wr;	/* next buffer to read/fill */
+	unsigned int filled;	/* buffers ready */
+	int held;		/* buffer in use by inflate() */
+	unsigned char *cur;	/* its data */
+	off64_t cur_off;	/*   and their file offset */
+	unsigned int cur_len;	/*   and length */
+	off64_t ra_pos;		/* file offset of the next read */
+	int ra_eof;		/* reading stopped at the end or an error */
+	int ra_errno;
+	int wb;			/* write: writer thread in use */
+	int wb_err;		/*   its first error */
+	char *wb_msg;
+	int running;
+	int stop;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static unsigned int gz_readahead = CONFIG_GZ_READAHEAD;
+static unsigned int gz_writebehind = CONFIG_GZ_WRITEBEHIND;
+
+static void gz_error(struct gz_state *s, int err, const char *msg)
+{
+	/* The caller picks up errors of the writer thread */
+	if (s->running && pthread_equal(pthread_self(), s->thread)) {
+		pthread_mutex_lock(&s->mutex);
+		if (s->wb_err == Z_OK) {
+			s->wb_err = err;
+			s->wb_msg = (msg != NULL) ? strdup(msg) : NULL;
+		}
+		pthread_mutex_unlock(&s->mutex);
+		return;
+	}
+
+	free(s->msg);
+	s->msg = NULL;
+
+	/* Only fatal errors drop the data which was already inflated */
+	if ((err != Z_OK) && (err != Z_BUF_ERROR))
+		s->x.have = 0;
+
+	s->err = err;
+	if ((msg == NULL) || (err == Z_MEM_ERROR))
+		return;
+
+	if (asprintf(&s->msg, "%s: %s", s->path, msg) < 0) {
+		s->msg = NULL;
+		s->err = Z_MEM_ERROR;
+	}
+}
+
+/* Read until the buffer is full or the file ends */
+static ssize_t gz_read_full(int fd, unsigned char *buf, unsigned int size)
+{
+	ssize_t rc;
+	unsigned int got = 0;
+
+	while (got < size) {
+		rc = read(fd, buf + got, size - got);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (rc == 0)
+			break;
+		got += rc;
+	}
+	return got;
+}
+
+static int gz_write_all(struct gz_state *s, const unsigned char *buf,
+			unsigned int len)
+{
+	ssize_t rc;
+
+	while (len) {
+		rc = write(s->fd, buf, len);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			gz_error(s, Z_ERRNO, strerror(errno));
+			return -1;
+		}
+		buf += rc;
+		len -= rc;
+		s->raw += rc;
+	}
+	return 0;
+}
+
+static void *gz_readahead_thread(void *arg)
+{
+	struct gz_state *s = (struct gz_state *)arg;
+	unsigned int i;
+	ssize_t n;
+
+	pthread_mutex_lock(&s->mutex);
+	while (!s->stop && !s->ra_eof) {
+		if (s->filled + s->held == s->nbuf) {
+			pthread_cond_wait(&s->cond, &s->mutex);
+			continue;
+		}
+		i = s->wr;
+		pthread_mutex_unlock(&s->mutex);
+
+		n = gz_read_full(s->fd, s->buf[i] + GZ_KEEP, s->size);
+
+		pthread_mutex_lock(&s->mutex);
+		if (n < 0) {
+			s->ra_errno = errno;
+			s->ra_eof = 1;
+			break;
+		}
+		s->len[i] = n;
+		s->off[i] = s->ra_pos;
+		s->ra_pos += n;
+		s->wr = (i + 1) % s->nbuf;
+		s->filled++;
+		if (n < s->size)
+			s->ra_eof = 1;
+		zlib_stats_inc(&zlib_stats.gz_readahead);
+		pthread_cond_broadcast(&s->cond);
+	}
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->mutex);
+	return NULL;
+}
+
+/* Stop the read-ahead or writer thread, the writer after its queue */
+static void gz_thread_stop(struct gz_state *s)
+{
+	if (s->running) {
+		pthread_mutex_lock(&s->mutex);
+		s->stop = 1;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->mutex);
+		pthread_join(s->thread, NULL);
+		s->running = 0;
+	}
+	s->stop = 0;
+	s->ra_eof = 0;
+	s->ra_errno = 0;
+	s->rd = s->wr = s->filled = 0;
+	s->held = 0;
+}
+
+/* Get the next buffer read by the read-ahead thread, -1 if none */
+static int gz_readahead_next(struct gz_state *s)
+{
+	int i, rc;
+
+	pthread_mutex_lock(&s->mutex);
+	if (s->held) {
+		s->held = 0;
+		pthread_cond_broadcast(&s->cond);
+	}
+	if (!s->running && !s->ra_eof) {
+		rc = pthread_create(&s->thread, NULL, gz_readahead_thread, s);
+		if (rc != 0) {
+			pthread_mutex_unlock(&s->mutex);
+			pr_err("starting read-ahead failed: %s\n",
+			       strerror(rc));
+			s->nbuf = 1;	/* read synchronously */
+			return -1;
+		}
+		s->running = 1;
+	}
+	if (!s->filled && !s->ra_eof) {
+		zlib_stats_inc(&zlib_stats.gz_readahead_waits);
+		while (!s->filled && !s->ra_eof)
+			pthread_cond_wait(&s->cond, &s->mutex);
+	}
+	if (!s->filled) {
+		pthread_mutex_unlock(&s->mutex);
+		if (s->ra_errno)
+			errno = s->ra_errno;
+		return -1;
+	}
+	i = s->rd;
+	s->rd = (i + 1) % s->nbuf;
+	s->filled--;
+	s->held = 1;
+	s->eof = s->ra_eof && !s->filled;
+	pthread_mutex_unlock(&s->mutex);
+	return i;
+}
+
+/**
+ * gz_load() - Give the next input buffer to strm
+ *
+ * The bytes left in strm, at most GZ_KEEP, are moved in front of the
+ * new data. Sets eof if the file has no input after this buffer.
+ */
+static int gz_load(struct gz_state *s)
+{
+	unsigned char keep[GZ_KEEP];
+	unsigned int left = s->strm.avail_in;
+	unsigned int len;
+	ssize_t n;
+	int i = 0;
+
+	if (left)
+		memcpy(keep, s->strm.next_in, left);
+
+	if (s->nbuf > 1)
+		i = gz_readahead_next(s);
+
+	if (s->nbuf == 1) {
+		n = gz_read_full(s->fd, s->buf[0] + GZ_KEEP, s->size);
+		if (n >= 0) {
+			s->len[0] = n;
+			s->off[0] = s->ra_pos;
+			s->ra_pos += n;
+			s->eof = (n < s->size);
+		}
+		i = (n < 0) ? -1 : 0;
+	}
+
+	if (i < 0) {
+		if (s->ra_errno || (s->nbuf == 1)) {
+			gz_error(s, Z_ERRNO, strerror(errno));
+			return -1;
+		}
+		len = 0;	/* file ended at the last buffer */
+		i = s->rd;
+		s->off[i] = s->ra_pos;
+		s->eof = 1;
+	} else
+		len = s->len[i];
+
+	s->cur = s->buf[i] + GZ_KEEP - left;
+	s->cur_off = s->off[i] - left;
+	if (left)
+		memcpy(s->cur, keep, left);
+	s->strm.next_in = s->cur;
+	s->strm.avail_in = s->cur_len = left + len;
+	return 0;
+}
+
+static void gz_free(struct gz_state *s)
+{
+	unsigned int i;
+
+	if (s->size == 0)
+		return;
+
+	/* nbuf drops to 1 if the read-ahead thread does not start */
+	for (i = 0; i < ARRAY_SIZE(s->buf); i++) {
+		if (s->buf[i] != NULL)
+			zlib_dma_free(s->buf[i], GZ_KEEP + s->size);
+		s->buf[i] = NULL;
+	}
+	if (s->out != NULL)
+		zlib_dma_free(s->out, (s->mode == GZ_WRITE) ? s->size :
+			      2 * s->size);
+	s->out = s->in = NULL;
+	s->nbuf = 0;
+	s->size = 0;
+}
+
+static int gz_alloc(struct gz_state *s)
+{
+	unsigned int i;
+	int rc;
+
+	s->size = s->want;
+	s->nbuf = 1 + ((s->mode == GZ_READ) ? gz_readahead : gz_writebehind);
+	for (i = 0; i < s->nbuf; i++) {
+		s->buf[i] = zlib_dma_malloc(GZ_KEEP + s->size);
+		if (s->buf[i] == NULL)
+			goto err_out;
+	}
+
+	if (s->mode == GZ_WRITE) {
+		s->in = s->buf[0];
+		s->wb = (s->nbuf > 1);
+		if (s->direct)
+			return 0;
+
+		s->out = zlib_dma_malloc(s->size);
+		if (s->out == NULL)
+			goto err_out;
+
+		memset(&s->strm, 0, sizeof(s->strm));
+		rc = deflateInit2(&s->strm, s->level, Z_DEFLATED, MAX_WBITS + 16,
+				  8, s->strategy);
+		if (rc != Z_OK)
+			goto err_out;
+		return 0;
+	}
+
+	/* Room to gzungetc() in front of a full buffer */
+	s->out = zlib_dma_malloc(2 * s->size);
+	if (s->out == NULL)
+		goto err_out;
+	return 0;
+
+ err_out:
+	gz_free(s);
+	gz_error(s, Z_MEM_ERROR, "out of memory");
+	return -1;
+}
+
+/* Restart reading at file offset pos */
+static int gz_reset_read(struct gz_state *s, off64_t pos)
+{
+	gz_thread_stop(s);
+	if (lseek64(s->fd, pos, SEEK_SET) == -1) {
+		gz_error(s, Z_ERRNO, strerror(errno));
+		return -1;
+	}
+	s->ra_pos = pos;
+	s->strm.avail_in = 0;
+	s->cur = NULL;
+	s->x.have = 0;
+	s->eof = 0;
+	s->past = 0;
+	s->seek = 0;
+	gz_error(s, Z_OK, NULL);
+	return 0;
+}
+
+/**
+ * gz_look() - Check whether the next data is a gzip member
+ *
+ * Sets how to GZ_GZIP with inflate reset for the member or to
+ * GZ_COPY for plain data. Data which is not gzip after a gzip member
+ * is ignored. how stays GZ_LOOK at the end of the input.
+ */
+static int gz_look(struct gz_state *s)
+{
+	int rc;
+
+	if (s->size == 0 && gz_alloc(s) < 0)
+		return -1;
+
+	if ((s->strm.avail_in < 2) && !s->eof && (gz_load(s) < 0))
+		return -1;
+	if (s->strm.avail_in == 0)
+		return 0;
+
+	if ((s->strm.avail_in > 1) && (s->strm.next_in[0] == 0x1f) &&
+	    (s->strm.next_in[1] == 0x8b)) {
+		if (!s->init) {
+			rc = inflateInit2(&s->strm, MAX_WBITS + 16);
+			if (rc != Z_OK) {
+				gz_error(s, Z_MEM_ERROR, "out of memory");
+				return -1;
+			}
+			s->init = 1;
+		} else
+			inflateReset(&s->strm);
+		s->how = GZ_GZIP;
+		s->direct = 0;
+		return 0;
+	}
+
+	if (!s->direct) {
+		s->strm.avail_in = 0;
+		s->eof = 1;
+		return 0;
+	}
+	s->how = GZ_COPY;
+	return 0;
+}
+
+/**
+ * gz_decomp() - Inflate into strm.next_out until it is full
+ *
+ * Stops at the end of a gzip member and sets how to GZ_LOOK for the
+ * next one. Input ending before the member is Z_BUF_ERROR.
+ */
+static int gz_decomp(struct gz_state *s)
+{
+	int rc;
+	unsigned int in, out;
+
+	while (s->strm.avail_out) {
+		if ((s->strm.avail_in == 0) && !s->eof && (gz_load(s) < 0))
+			return -1;
+
+		in = s->strm.avail_in;
+		out = s->strm.avail_out;
+		rc = inflate(&s->strm, Z_NO_FLUSH);
+		if ((rc == Z_STREAM_ERROR) || (rc == Z_NEED_DICT)) {
+			gz_error(s, Z_STREAM_ERROR,
+				 "internal error: inflate stream corrupt");
+			return -1;
+		}
+		if (rc == Z_MEM_ERROR) {
+			gz_error(s, Z_MEM_ERROR, "out of memory");
+			return -1;
+		}
+		if (rc == Z_DATA_ERROR) {
+			gz_error(s, Z_DATA_ERROR, s->strm.msg ? s->strm.msg :
+				 "compressed data error");
+			return -1;
+		}
+		if (rc == Z_STREAM_END) {
+			s->how = GZ_LOOK;
+			break;
+		}
+		if (s->eof && (in == 0) && (out == s->strm.avail_out)) {
+			gz_error(s, Z_BUF_ERROR, "unexpected end of file");
+			break;
+		}
+	}
+	return 0;
+}
+
+/* Fill the output buffer, x.have stays 0 at the end of the data */
+static int gz_fetch(struct gz_state *s)
+{
+	unsigned int n;
+
+	for (;;) {
+		switch (s->how) {
+		case GZ_LOOK:
+			if (gz_look(s) < 0)
+				return -1;
+			if (s->how == GZ_LOOK)
+				return 0;
+			break;
+		case GZ_COPY:
+			if ((s->strm.avail_in == 0) && !s->eof &&
+			    (gz_load(s) < 0))
+				return -1;
+			n = MIN(s->strm.avail_in, 2 * s->size);
+			memcpy(s->out, s->strm.next_in, n);
+			s->strm.next_in += n;
+			s->strm.avail_in -= n;
+			s->x.next = s->out;
+			s->x.have = n;
+			return 0;
+		case GZ_GZIP:
+			s->strm.next_out = s->out;
+			s->strm.avail_out = 2 * s->size;
+			if (gz_decomp(s) < 0)
+				return -1;
+			s->x.next = s->out;
+			s->x.have = 2 * s->size - s->strm.avail_out;
+			if (s->x.have || (s->how != GZ_LOOK))
+				return 0;
+			break;	/* empty member */
+		}
+	}
+}
+
+/* Skip len bytes of uncompressed data */
+static int gz_skip(struct gz_state *s, off64_t len)
+{
+	unsigned int n;
+
+	while (len) {
+		if (s->x.have) {
+			n = (off64_t)s->x.have > len ? (unsigned int)len :
+				s->x.have;
+			s->x.have -= n;
+			s->x.next += n;
+			s->x.pos += n;
+			len -= n;
+			continue;
+		}
+		if (gz_fetch(s) < 0)
+			return -1;
+		if (s->x.have == 0)
+			break;
+	}
+	return 0;
+}
+
+static z_size_t gz_read(struct gz_state *s, unsigned char *buf,
+			z_size_t len)
+{
+	z_size_t got = 0;
+	unsigned int n;
+
+	if (len == 0)
+		return 0;
+
+	if (s->seek) {
+		s->seek = 0;
+		if (gz_skip(s, s->skip) < 0)
+			return 0;
+	}
+
+	while (len) {
+		n = (len > UINT_MAX) ? UINT_MAX : len;
+
+		if (s->x.have) {
+			n = MIN(n, s->x.have);
+			memcpy(buf, s->x.next, n);
+			s->x.next += n;
+			s->x.have -= n;
+
+		} else if ((s->how == GZ_LOOK) || (n < 2 * s->size)) {
+			if (gz_fetch(s) < 0)
+				return 0;
+			if (s->x.have == 0) {
+				s->past = 1;
+				break;
+			}
+			continue;
+
+		} else if (s->how == GZ_COPY) {
+			if ((s->strm.avail_in == 0) && !s->eof &&
+			    (gz_load(s) < 0))
+				return 0;
+			if (s->strm.avail_in == 0) {
+				s->past = 1;
+				break;
+			}
+			n = MIN(n, s->strm.avail_in);
+			memcpy(buf, s->strm.next_in, n);
+			s->strm.next_in += n;
+			s->strm.avail_in -= n;
+
+		} else {
+			/* Inflate straight into the caller's buffer */
+			s->strm.next_out = buf;
+			s->strm.avail_out = n;
+			if (gz_decomp(s) < 0)
+				return 0;
+			n -= s->strm.avail_out;
+			if ((n == 0) && (s->how != GZ_LOOK)) {
+				s->past = 1;
+				break;
+			}
+		}
+		len -= n;
+		buf += n;
+		got += n;
+		s->x.pos += n;
+	}
+	return got;
+}
+
+/* Deflate strm.next_in and write the output to the file */
+static int gz_comp(struct gz_state *s, int flush)
+{
+	int rc;
+	unsigned int have;
+
+	do {
+		s->strm.next_out = s->out;
+		s->strm.avail_out = s->size;
+		rc = deflate(&s->strm, flush);
+		if (rc == Z_STREAM_ERROR) {
+			gz_error(s, Z_STREAM_ERROR,
+				 "internal error: deflate stream corrupt");
+			return -1;
+		}
+		have = s->size - s->strm.avail_out;
+		if (have && (gz_write_all(s, s->out, have) < 0))
+			return -1;
+		if (rc == Z_BUF_ERROR)	/* nothing left to flush */
+			break;
+	} while ((s->strm.avail_out == 0) || s->strm.avail_in ||
+		 ((flush == Z_FINISH) && (rc != Z_STREAM_END)));
+
+	/* Further writes start a new member */
+	if (flush == Z_FINISH)
+		deflateReset(&s->strm);
+	return 0;
+}
+
+/* Deflate or copy one buffer to the file */
+static int gz_comp_buf(struct gz_state *s, unsigned char *buf,
+		       unsigned int len, int flush)
+{
+	if (s->direct)
+		return gz_write_all(s, buf, len);
+
+	s->strm.next_in = buf;
+	s->strm.avail_in = len;
+	return gz_comp(s, flush);
+}
+
+static void *gz_writebehind_thread(void *arg)
+{
+	struct gz_state *s = (struct gz_state *)arg;
+	unsigned int i;
+
+	pthread_mutex_lock(&s->mutex);
+	for (;;) {
+		if (!s->filled) {
+			if (s->stop)
+				break;
+			pthread_cond_wait(&s->cond, &s->mutex);
+			continue;
+		}
+		i = s->rd;
+		pthread_mutex_unlock(&s->mutex);
+
+		/* After an error the data is dropped */
+		if (s->wb_err == Z_OK)
+			gz_comp_buf(s, s->buf[i], s->len[i], s->flush[i]);
+		zlib_stats_inc(&zlib_stats.gz_writebehind);
+
+		pthread_mutex_lock(&s->mutex);
+		s->rd = (i + 1) % s->nbuf;
+		s->filled--;
+		pthread_cond_broadcast(&s->cond);
+	}
+	pthread_mutex_unlock(&s->mutex);
+	return NULL;
+}
+
+/* Take over an error of the writer thread, mutex held */
+static int gz_writebehind_check(struct gz_state *s)
+{
+	if (s->wb_err == Z_OK)
+		return 0;
+	if (s->err == Z_OK)
+		gz_error(s, s->wb_err, s->wb_msg);
+	return -1;
+}
+
+/* Wait until the writer thread wrote all queued buffers */
+static int gz_writebehind_sync(struct gz_state *s)
+{
+	int rc;
+
+	if (!s->running)
+		return 0;
+
+	pthread_mutex_lock(&s->mutex);
+	while (s->filled)
+		pthread_cond_wait(&s->cond, &s->mutex);
+	rc = gz_writebehind_check(s);
+	pthread_mutex_unlock(&s->mutex);
+	return rc;
+}
+
+/**
+ * gz_writebehind_queue() - Queue the collected data for the writer
+ *
+ * Continues with the next free buffer. Waits if all buffers are
+ * queued, which bounds the memory to nbuf buffers.
+ */
+static int gz_writebehind_queue(struct gz_state *s, int flush)
+{
+	int rc;
+
+	pthread_mutex_lock(&s->mutex);
+	if (!s->running) {
+		rc = pthread_create(&s->thread, NULL, gz_writebehind_thread, s);
+		if (rc != 0) {
+			pthread_mutex_unlock(&s->mutex);
+			pr_err("starting writer thread failed: %s\n",
+			       strerror(rc));
+			s->wb = 0;	/* deflate synchronously */
+			return -1;
+		}
+		s->running = 1;
+	}
+
+	s->len[s->wr] = s->in_have;
+	s->flush[s->wr] = flush;
+	s->wr = (s->wr + 1) % s->nbuf;
+	s->filled++;
+	pthread_cond_broadcast(&s->cond);
+
+	if (s->filled == s->nbuf) {
+		zlib_stats_inc(&zlib_stats.gz_writebehind_waits);
+		while (s->filled == s->nbuf)
+			pthread_cond_wait(&s->cond, &s->mutex);
+	}
+	rc = gz_writebehind_check(s);
+	pthread_mutex_unlock(&s->mutex);
+
+	s->in = s->buf[s->wr];
+	s->in_have = 0;
+	return rc;
+}
+
+/* Hand the collected data to deflate() or to the writer thread */
+static int gz_flush_in(struct gz_state *s, int flush)
+{
+	unsigned int have = s->in_have;
+
+	if ((have == 0) && (flush == Z_NO_FLUSH))
+		return 0;
+
+	if (s->wb && (gz_writebehind_queue(s, flush) == 0))
+		return 0;
+	if (s->err != Z_OK)
+		return -1;
+
+	s->in_have = 0;
+	return gz_comp_buf(s, s->in, have, flush);
+}
+
+/* Write len zeros for a gzseek() forward */
+static int gz_zero(struct gz_state *s, off64_t len)
+{
+	unsigned int n;
+
+	while (len) {
+		if ((s->in_have == s->size) &&
+		    (gz_flush_in(s, Z_NO_FLUSH) < 0))
+			return -1;
+		n = (off64_t)(s->size - s->in_have) > len ?
+			(unsigned int)len : s->size - s->in_have;
+		memset(s->in + s->in_have, 0, n);
+		s->in_have += n;
+		s->x.pos += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static z_size_t gz_write(struct gz_state *s, const unsigned char *buf,
+			 z_size_t len)
+{
+	z_size_t put = len;
+	unsigned int n;
+
+	if (len == 0)
+		return 0;
+
+	if ((s->size == 0) && (gz_alloc(s) < 0))
+		return 0;
+
+	if (s->seek) {
+		s->seek = 0;
+		if (gz_zero(s, s->skip) < 0)
+			return 0;
+	}
+
+	/* The writer thread needs a copy */
+	if ((len < s->size) || s->wb) {
+		while (len) {
+			if ((s->in_have == s->size) &&
+			    (gz_flush_in(s, Z_NO_FLUSH) < 0))
+				return 0;
+			n = MIN(s->size - s->in_have, len);
+			memcpy(s->in + s->in_have, buf, n);
+			s->in_have += n;
+			s->x.pos += n;
+			buf += n;
+			len -= n;
+		}
+		return put;
+	}
+
+	/* Large writes go to deflate() without copying */
+	if (gz_flush_in(s, Z_NO_FLUSH) < 0)
+		return 0;
+
+	while (len) {
+		n = (len > UINT_MAX) ? UINT_MAX : len;
+		if (gz_comp_buf(s, (unsigned char *)buf, n, Z_NO_FLUSH) < 0)
+			return 0;
+		s->x.pos += n;
+		buf += n;
+		len -= n;
+	}
+	return put;
+}
+
+static gzFile gz_open(const char *path, int fd, const char *mode)
+{
+	struct gz_state *s;
+	int oflag = 0;
+	int exclusive = 0, append = 0, cloexec = 0;
+
+	if (path == NULL)
+		return NULL;
+
+	s = calloc(1, sizeof(*s));
+	if (s == NULL)
+		return NULL;
+
+	s->want = zedc_hw_buf_size();
+	s->level = Z_DEFAULT_COMPRESSION;
+	s->strategy = Z_DEFAULT_STRATEGY;
+
+	for (; *mode; mode++) {
+		if ((*mode >= '0') && (*mode <= '9')) {
+			s->level = *mode - '0';
+			continue;
+		}
+		switch (*mode) {
+		case 'r':
+			s->mode = GZ_READ;
+			break;
+		case 'w':
+			s->mode = GZ_WRITE;
+			break;
+		case 'a':
+			s->mode = GZ_WRITE;
+			append = 1;
+			break;
+		case '+':	/* read and write is not supported */
+			free(s);
+			return NULL;
+		case 'x':
+			exclusive = 1;
+			break;
+		case 'e':
+			cloexec = 1;
+			break;
+		case 'f':
+			s->strategy = Z_FILTERED;
+			break;
+		case 'h':
+			s->strategy = Z_HUFFMAN_ONLY;
+			break;
+		case 'R':
+			s->strategy = Z_RLE;
+			break;
+		case 'F':
+			s->strategy = Z_FIXED;
+			break;
+		case 'T':
+			s->direct = 1;
+			break;
+		default:	/* 'b' and others are ignored */
+			break;
+		}
+	}
+
+	if (s->mode == GZ_NONE) {
+		free(s);
+		return NULL;
+	}
+
+	if (s->mode == GZ_READ) {
+		s->direct = 1;	/* until gzip data is found */
+		oflag = O_RDONLY;
+	} else
+		oflag = O_WRONLY | O_CREAT | (exclusive ? O_EXCL : 0) |
+			(append ? O_APPEND : O_TRUNC);
+	oflag |= O_LARGEFILE | (cloexec ? O_CLOEXEC : 0);
+
+	if (fd == -1)
+		s->path = strdup(path);
+	else if (asprintf(&s->path, "<fd:%d>", fd) < 0)
+		s->path = NULL;
+	if (s->path == NULL) {
+		free(s);
+		return NULL;
+	}
+
+	s->fd = (fd == -1) ? open(path, oflag, 0666) : fd;
+	if (s->fd == -1) {
+		free(s->path);
+		free(s);
+		return NULL;
+	}
+
+	if (append)
+		lseek64(s->fd, 0, SEEK_END);
+
+	/* Pipes cannot seek, they start at 0 */
+	s->start = lseek64(s->fd, 0, SEEK_CUR);
+	if (s->start == -1)
+		s->start = 0;
+	s->raw = s->ra_pos = s->start;
+	s->how = GZ_LOOK;
+	s->err = Z_OK;
+	pthread_mutex_init(&s->mutex, NULL);
+	pthread_cond_init(&s->cond, NULL);
+
+	pr_trace("[%p] gz_open %s mode=%s level=%d strategy=%d size=%u\n",
+		 s, s->path, (s->mode == GZ_READ) ? "read" : "write",
+		 s->level, s->strategy, s->want);
+	return (gzFile)s;
+}
+
+gzFile gzopen(const char *path, const char *mode)
+{
+	zlib_stats_inc(&zlib_stats.gzopen);
+	return gz_open(path, -1, mode);
+}
+
+gzFile gzopen64(const char *path, const char *mode)
+{
+	zlib_stats_inc(&zlib_stats.gzopen64);
+	return gz_open(path, -1, mode);
+}
+
+gzFile gzdopen(int fd, const char *mode)
+{
+	zlib_stats_inc(&zlib_stats.gzdopen);
+	if (fd == -1)
+		return NULL;
+	return gz_open("", fd, mode);
+}
+
+int gzbuffer(gzFile file, unsigned size)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	zlib_stats_inc(&zlib_stats.gzbuffer);
+	if ((s == NULL) || (s->mode == GZ_NONE))
+		return -1;
+
+	/* Too late once the buffers are allocated */
+	if (s->size != 0)
+		return -1;
+
+	if ((size << 1) < size)
+		return -1;
+	if (size < 2)
+		size = 2;
+	s->want = size;
+	return 0;
+}
+
+int gzsetparams(gzFile file, int level, int strategy)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	if ((s == NULL) || (s->mode != GZ_WRITE) || (s->err != Z_OK))
+		return Z_STREAM_ERROR;
+
+	if ((level == s->level) && (strategy == s->strategy))
+		return Z_OK;
+
+	if (s->seek) {
+		s->seek = 0;
+		if (gz_zero(s, s->skip) < 0)
+			return s->err;
+	}
+
+	if ((s->size != 0) && !s->direct) {
+		if ((gz_flush_in(s, Z_NO_FLUSH) < 0) ||
+		    (gz_writebehind_sync(s) < 0))
+			return s->err;
+		deflateParams(&s->strm, level, strategy);
+	}
+	s->level = level;
+	s->strategy = strategy;
+	return Z_OK;
+}
+
+int gzread(gzFile file, voidp buf, unsigned len)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	zlib_stats_inc(&zlib_stats.gzread);
+	if ((s == NULL) || (s->mode != GZ_READ) ||
+	    ((s->err != Z_OK) && (s->err != Z_BUF_ERROR)))
+		return -1;
+
+	if ((int)len < 0) {
+		gz_error(s, Z_STREAM_ERROR, "request does not fit in an int");
+		return -1;
+	}
+
+	len = gz_read(s, buf, len);
+	if ((len == 0) && (s->err != Z_OK) && (s->err != Z_BUF_ERROR))
+		return -1;
+	return (int)len;
+}
+
+#if ZLIB_VERNUM >= 0x1290
+z_size_t gzfread(voidp buf, z_size_t size, z_size_t nitems, gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+	z_size_t len;
+
+	zlib_stats_inc(&zlib_stats.gzread);
+	if ((s == NULL) || (s->mode != GZ_READ) ||
+	    ((s->err != Z_OK) && (s->err != Z_BUF_ERROR)))
+		return 0;
+
+	len = nitems * size;
+	if (size && (len / size != nitems)) {
+		gz_error(s, Z_STREAM_ERROR, "request does not fit in a size_t");
+		return 0;
+	}
+	return len ? gz_read(s, buf, len) / size : 0;
+}
+#endif
+
+#undef gzgetc
+int gzgetc(gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+	unsigned char c;
+
+	zlib_stats_inc(&zlib_stats.gzgetc);
+	if ((s == NULL) || (s->mode != GZ_READ) ||
+	    ((s->err != Z_OK) && (s->err != Z_BUF_ERROR)))
+		return -1;
+
+	if (s->x.have) {
+		s->x.have--;
+		s->x.pos++;
+		return *s->x.next++;
+	}
+	return (gz_read(s, &c, 1) == 1) ? c : -1;
+}
+
+int gzgetc_(gzFile file)
+{
+	return gzgetc(file);
+}
+
+int gzungetc(int c, gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	zlib_stats_inc(&zlib_stats.gzungetc);
+	if ((s == NULL) || (s->mode != GZ_READ) ||
+	    ((s->err != Z_OK) && (s->err != Z_BUF_ERROR)))
+		return -1;
+
+	if (s->seek) {
+		s->seek = 0;
+		if (gz_skip(s, s->skip) < 0)
+			return -1;
+	}
+
+	if (c < 0)
+		return -1;
+
+	if ((s->size == 0) && (gz_alloc(s) < 0))
+		return -1;
+
+	if (s->x.have == 0) {
+		s->x.have = 1;
+		s->x.next = s->out + 2 * s->size - 1;
+		s->x.next[0] = (unsigned char)c;
+		s->x.pos--;
+		s->past = 0;
+		return c;
+	}
+
+	if (s->x.have == 2 * s->size) {
+		gz_error(s, Z_DATA_ERROR, "out of room to push characters");
+		return -1;
+	}
+
+	/* Make room in front of the data */
+	if (s->x.next == s->out) {
+		unsigned char *dest = s->out + 2 * s->size - s->x.have;
+
+		memmove(dest, s->x.next, s->x.have);
+		s->x.next = dest;
+	}
+	s->x.have++;
+	s->x.next--;
+	s->x.next[0] = (unsigned char)c;
+	s->x.pos--;
+	s->past = 0;
+	return c;
+}
+
+char *gzgets(gzFile file, char *buf, int len)
+{
+	struct gz_state *s = (struct gz_state *)file;
+	unsigned char *eol;
+	unsigned int n, left;
+	char *str = buf;
+
+	zlib_stats_inc(&zlib_stats.gzgets);
+	if ((s == NULL) || (buf == NULL) || (len < 1) ||
+	    (s->mode != GZ_READ) ||
+	    ((s->err != Z_OK) && (s->err != Z_BUF_ERROR)))
+		return NULL;
+
+	if (s->seek) {
+		s->seek = 0;
+		if (gz_skip(s, s->skip) < 0)
+			return NULL;
+	}
+
+	left = (unsigned int)len - 1;
+	while (left) {
+		if ((s->x.have == 0) && (gz_fetch(s) < 0))
+			return NULL;
+		if (s->x.have == 0) {
+			s->past = 1;
+			break;
+		}
+
+		n = MIN(s->x.have, left);
+		eol = memchr(s->x.next, '\n', n);
+		if (eol != NULL)
+			n = (unsigned int)(eol - s->x.next) + 1;
+
+		memcpy(buf, s->x.next, n);
+		s->x.have -= n;
+		s->x.next += n;
+		s->x.pos += n;
+		left -= n;
+		buf += n;
+		if (eol != NULL)
+			break;
+	}
+
+	if (buf == str)
+		return NULL;
+	buf[0] = '\0';
+	return str;
+}
+
+int gzwrite(gzFile file, voidpc buf, unsigned len)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	zlib_stats_inc(&zlib_stats.gzwrite);
+	if ((s == NULL) || (s->mode != GZ_WRITE) || (s->err != Z_OK))
+		return 0;
+
+	if ((int)len < 0) {
+		gz_error(s, Z_DATA_ERROR, "requested length does not fit in int");
+		return 0;
+	}
+	return (int)gz_write(s, buf, len);
+}
+
+#if ZLIB_VERNUM >= 0x1290
+z_size_t gzfwrite(voidpc buf, z_size_t size, z_size_t nitems, gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+	z_size_t len;
+
+	zlib_stats_inc(&zlib_stats.gzwrite);
+	if ((s == NULL) || (s->mode != GZ_WRITE) || (s->err != Z_OK))
+		return 0;
+
+	len = nitems * size;
+	if (size && (len / size != nitems)) {
+		gz_error(s, Z_STREAM_ERROR, "request does not fit in a size_t");
+		return 0;
+	}
+	return len ? gz_write(s, buf, len) / size : 0;
+}
+#endif
+
+int gzputc(gzFile file, int c)
+{
+	struct gz_state *s = (struct gz_state *)file;
+	unsigned char ch = (unsigned char)c;
+
+	zlib_stats_inc(&zlib_stats.gzputc);
+	if ((s == NULL) || (s->mode != GZ_WRITE) || (s->err != Z_OK))
+		return -1;
+
+	if ((s->size != 0) && !s->seek && (s->in_have < s->size)) {
+		s->in[s->in_have++] = ch;
+		s->x.pos++;
+		return ch;
+	}
+	return (gz_write(s, &ch, 1) == 1) ? ch : -1;
+}
+
+int gzputs(gzFile file, const char *str)
+{
+	struct gz_state *s = (struct gz_state *)file;
+	size_t len;
+
+	zlib_stats_inc(&zlib_stats.gzputs);
+	if ((s == NULL) || (s->mode != GZ_WRITE) || (s->err != Z_OK))
+		return -1;
+
+	len = strlen(str);
+	if ((int)len < 0) {
+		gz_error(s, Z_STREAM_ERROR, "string length does not fit in int");
+		return -1;
+	}
+	if ((len != 0) && (gz_write(s, (const unsigned char *)str, len) == 0))
+		return -1;
+	return (int)len;
+}
+
+int gzvprintf(gzFile file, const char *format, va_list va)
+{
+	struct gz_state *s = (struct gz_state *)file;
+	unsigned int room;
+	char *str;
+	va_list ap;
+	int len;
+
+	if ((s == NULL) || (s->mode != GZ_WRITE) || (s->err != Z_OK))
+		return Z_STREAM_ERROR;
+
+	if ((s->size == 0) && (gz_alloc(s) < 0))
+		return s->err;
+
+	if (s->seek) {
+		s->seek = 0;
+		if (gz_zero(s, s->skip) < 0)
+			return s->err;
+	}
+
+	/* Format into the input buffer if it fits */
+	room = s->size - s->in_have;
+	va_copy(ap, va);
+	len = vsnprintf((char *)s->in + s->in_have, room, format, ap);
+	va_end(ap);
+	if (len < 0)
+		return Z_STREAM_ERROR;
+	if ((unsigned int)len < room) {
+		s->in_have += len;
+		s->x.pos += len;
+		return len;
+	}
+
+	str = malloc(len + 1);
+	if (str == NULL) {
+		gz_error(s, Z_MEM_ERROR, "out of memory");
+		return Z_MEM_ERROR;
+	}
+	vsnprintf(str, len + 1, format, va);
+	if (gz_write(s, (unsigned char *)str, len) == 0)
+		len = s->err;
+	free(str);
+	return len;
+}
+
+int gzprintf(gzFile file, const char *format, ...)
+{
+	int rc;
+	va_list ap;
+
+	zlib_stats_inc(&zlib_stats.gzprintf);
+	va_start(ap, format);
+	rc = gzvprintf(file, format, ap);
+	va_end(ap);
+	return rc;
+}
+
+int gzflush(gzFile file, int flush)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	zlib_stats_inc(&zlib_stats.gzflush);
+	if ((s == NULL) || (s->mode != GZ_WRITE) || (s->err != Z_OK))
+		return Z_STREAM_ERROR;
+
+	if ((flush < 0) || (flush > Z_FINISH))
+		return Z_STREAM_ERROR;
+
+	if ((s->size == 0) && (gz_alloc(s) < 0))
+		return s->err;
+
+	if (s->seek) {
+		s->seek = 0;
+		if (gz_zero(s, s->skip) < 0)
+			return s->err;
+	}
+
+	if (gz_flush_in(s, flush) == 0)
+		gz_writebehind_sync(s);
+	return s->err;
+}
+
+z_off64_t gzseek64(gzFile file, z_off64_t offset, int whence)
+{
+	struct gz_state *s = (struct gz_state *)file;
+	unsigned int n;
+
+	zlib_stats_inc(&zlib_stats.gzseek64);
+	if ((s == NULL) || (s->mode == GZ_NONE) ||
+	    ((s->err != Z_OK) && (s->err != Z_BUF_ERROR)))
+		return -1;
+
+	/* SEEK_END is not supported */
+	if ((whence != SEEK_SET) && (whence != SEEK_CUR))
+		return -1;
+
+	if (whence == SEEK_SET)
+		offset -= s->x.pos;
+	else if (s->seek)
+		offset += s->skip;
+	s->seek = 0;
+
+	/* Plain data is read at the new offset */
+	if ((s->mode == GZ_READ) && (s->how == GZ_COPY) &&
+	    (s->x.pos + offset >= 0)) {
+		if (gz_reset_read(s, s->start + s->x.pos + offset) < 0)
+			return -1;
+		s->x.pos += offset;
+		return s->x.pos;
+	}
+
+	/* Backwards reads again from the start */
+	if (offset < 0) {
+		if (s->mode != GZ_READ)
+			return -1;
+		offset += s->x.pos;
+		if (offset < 0)
+			return -1;
+		if (gzrewind(file) == -1)
+			return -1;
+	}
+
+	if (s->mode == GZ_READ) {
+		n = ((off64_t)s->x.have > offset) ? (unsigned int)offset :
+			s->x.have;
+		s->x.have -= n;
+		s->x.next += n;
+		s->x.pos += n;
+		offset -= n;
+	}
+
+	/* The rest is skipped or zero-filled with the next access */
+	if (offset) {
+		s->seek = 1;
+		s->skip = offset;
+	}
+	return s->x.pos + offset;
+}
+
+z_off_t gzseek(gzFile file, z_off_t offset, int whence)
+{
+	z_off64_t rc;
+
+	zlib_stats_inc(&zlib_stats.gzseek);
+	rc = gzseek64(file, (z_off64_t)offset, whence);
+	return (rc == (z_off_t)rc) ? (z_off_t)rc : -1;
+}
+
+int gzrewind(gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	zlib_stats_inc(&zlib_stats.gzrewind);
+	if ((s == NULL) || (s->mode != GZ_READ) ||
+	    ((s->err != Z_OK) && (s->err != Z_BUF_ERROR)))
+		return -1;
+
+	if (gz_reset_read(s, s->start) < 0)
+		return -1;
+	s->how = GZ_LOOK;
+	s->x.pos = 0;
+	return 0;
+}
+
+z_off64_t gztell64(gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	zlib_stats_inc(&zlib_stats.gztell64);
+	if ((s == NULL) || (s->mode == GZ_NONE))
+		return -1;
+	return s->x.pos + (s->seek ? s->skip : 0);
+}
+
+z_off_t gztell(gzFile file)
+{
+	z_off64_t rc;
+
+	zlib_stats_inc(&zlib_stats.gztell);
+	rc = gztell64(file);
+	return (rc == (z_off_t)rc) ? (z_off_t)rc : -1;
+}
+
+z_off64_t gzoffset64(gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	zlib_stats_inc(&zlib_stats.gzoffset64);
+	if ((s == NULL) || (s->mode == GZ_NONE))
+		return -1;
+
+	if (s->mode == GZ_WRITE) {
+		gz_writebehind_sync(s);
+		return s->raw;
+	}
+
+	/* Input read ahead does not count */
+	if (s->cur == NULL)
+		return s->ra_pos;
+	/* next_in can be in inflate's own buffer behind a member */
+	return s->cur_off + s->cur_len - s->strm.avail_in;
+}
+
+z_off_t gzoffset(gzFile file)
+{
+	z_off64_t rc;
+
+	zlib_stats_inc(&zlib_stats.gzoffset);
+	rc = gzoffset64(file);
+	return (rc == (z_off_t)rc) ? (z_off_t)rc : -1;
+}
+
+int gzeof(gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	zlib_stats_inc(&zlib_stats.gzeof);
+	if ((s == NULL) || (s->mode != GZ_READ))
+		return 0;
+	return s->past;
+}
+
+int gzdirect(gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	if (s == NULL)
+		return 0;
+
+	if ((s->mode == GZ_READ) && (s->how == GZ_LOOK) && (s->x.have == 0))
+		gz_look(s);
+	return s->direct;
+}
+
+const char *gzerror(gzFile file, int *errnum)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	zlib_stats_inc(&zlib_stats.gzerror);
+	if ((s == NULL) || (s->mode == GZ_NONE))
+		return NULL;
+
+	if (errnum != NULL)
+		*errnum = s->err;
+	if (s->err == Z_MEM_ERROR)
+		return "out of memory";
+	return (s->msg == NULL) ? "" : s->msg;
+}
+
+void gzclearerr(gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	if ((s == NULL) || (s->mode == GZ_NONE))
+		return;
+
+	if (s->mode == GZ_READ) {
+		s->eof = 0;
+		s->past = 0;
+	}
+	gz_error(s, Z_OK, NULL);
+}
+
+static void gz_destroy(struct gz_state *s)
+{
+	gz_error(s, Z_OK, NULL);
+	free(s->wb_msg);
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->mutex);
+	free(s->path);
+	free(s);
+}
+
+int gzclose_r(gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+	int rc;
+
+	if ((s == NULL) || (s->mode != GZ_READ))
+		return Z_STREAM_ERROR;
+
+	gz_thread_stop(s);
+	if (s->init)
+		inflateEnd(&s->strm);
+	gz_free(s);
+
+	rc = (s->err == Z_BUF_ERROR) ? Z_BUF_ERROR : Z_OK;
+	if (close(s->fd) == -1)
+		rc = Z_ERRNO;
+
+	gz_destroy(s);
+	return rc;
+}
+
+int gzclose_w(gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+	int rc = Z_OK;
+
+	if ((s == NULL) || (s->mode != GZ_WRITE))
+		return Z_STREAM_ERROR;
+
+	/* An empty file still gets a gzip member */
+	if ((s->size == 0) && (gz_alloc(s) < 0))
+		rc = s->err;
+
+	if (s->size != 0) {
+		if (s->seek) {
+			s->seek = 0;
+			if (gz_zero(s, s->skip) < 0)
+				rc = s->err;
+		}
+		if ((gz_flush_in(s, Z_FINISH) < 0) ||
+		    (gz_writebehind_sync(s) < 0))
+			rc = s->err;
+		gz_thread_stop(s);
+		if (!s->direct)
+			deflateEnd(&s->strm);
+		gz_free(s);
+	}
+
+	if (close(s->fd) == -1)
+		rc = Z_ERRNO;
+
+	gz_destroy(s);
+	return rc;
+}
+
+int gzclose(gzFile file)
+{
+	struct gz_state *s = (struct gz_state *)file;
+
+	zlib_stats_inc(&zlib_stats.gzclose);
+	if (s == NULL)
+		return Z_STREAM_ERROR;
+
+	return (s->mode == GZ_READ) ? gzclose_r(file) : gzclose_w(file);
+}
+
+void zedc_gz_init(void)
+{
+	char *readahead_s = getenv("ZLIB_GZ_READAHEAD");
+	char *writebehind_s = getenv("ZLIB_GZ_WRITEBEHIND");
+
+	if (readahead_s != NULL)
+		gz_readahead = str_to_num(readahead_s);
+	if (gz_readahead > GZ_QUEUE_MAX)
+		gz_readahead = GZ_QUEUE_MAX;
+
+	if (writebehind_s != NULL)
+		gz_writebehind = str_to_num(writebehind_s);
+	if (gz_writebehind > GZ_QUEUE_MAX)
+		gz_writebehind = GZ_QUEUE_MAX;
+}
@@ -18,6 +18,9 @@
 #include <stdlib.h>
 #include <malloc.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
 #include <zlib.h>
 #include <wrapper.h>
 #include <libzHW.h>
@@ -45,6 +48,52 @@
 #define CONFIG_INFLATE_BUF_SIZE	 (128 * 1024)
 #define CONFIG_DEFLATE_BUF_SIZE	 (768 * 1024)
 
+/*
+ * Buffers and workspaces of ended streams kept per card, size and
+ * memory type for the next streams. 0 disables pooling.
+ */
+#define CONFIG_POOL_DEPTH	 8
+
+/* Max. msec a stream waits for leased buffers, see ZLIB_LEASE_MAX */
+#define CONFIG_LEASE_WAIT	 10
+
+/*
+ * Caller buffers of at least this size are used by the DDCBs
+ * directly instead of copying through ibuf/obuf. Registered buffers
+ * are always used directly. 0 disables it for unregistered buffers.
+ */
+#define CONFIG_ZEROCOPY_MIN	 (256 * 1024)
+
+/*
+ * Parallel deflate (ZLIB_FLAG_PARALLEL): number of ibuf sized
+ * segments of one stream compressed at the same time. Env-variable
+ * ZLIB_PARALLEL_SEGMENTS overwrites it.
+ */
+#define CONFIG_PARALLEL_SEGMENTS 4
+
+/*
+ * Backpressure (ZLIB_FLAG_SPILL, off by default): usec a new DDCB is
+ * estimated to wait for a queue slot before new streams go to
+ * software. 0 spills as soon as any DDCB waits. Env-variable
+ * ZLIB_SPILL_WAIT overwrites it.
+ */
+#define CONFIG_SPILL_WAIT	 0
+
+/*
+ * Inflate input buffering: zlib/gzip input arriving in chunks smaller
+ * than this is collected in ibuf up to this many bytes before a DDCB
+ * is sent. 0 disables it. Env-variable ZLIB_INFLATE_WATERMARK
+ * overwrites it.
+ *
+ * Input is only collected by calls which fill the caller's output
+ * buffer from obuf, so they return with avail_out == 0 and zlib
+ * callers ask again. Any call which could return with free output
+ * space sends the collected input first. This helps readers taking
+ * the output in small pieces. Bytes behind the end of the stream are
+ * given back in next_in/avail_in.
+ */
+#define CONFIG_INFLATE_WATERMARK 0
+
 /* FIXME Ensure values are really the same for newer/older zlib versions */
 #define rc_zedc_to_libz(x) ((x))
 #define rc_libz_to_zedc(x) ((x))
@@ -57,12 +106,15 @@ struct hw_state {
 	zedc_stream h;		/* hardware compression context */
 	int rc;			/* hardware return code e.g. Z_STREAM_END */
 	unsigned int page_size;
+	int lease;		/* ibuf/obuf only allocated while in use */
 
-	/* buffering for the moment only for compression */
+	/* input buffering for deflate, and for inflate with a watermark */
 	size_t  ibuf_total;	/* total_size of ibuf_base */
 	size_t  ibuf_avail;	/* available bytes in ibuf */
 	uint8_t *ibuf_base;	/* buffer for input data */
 	uint8_t *ibuf;		/* current position in ibuf to put data */
+	uint8_t *ibuf_back;	/* inflate: input behind the end, given back */
+	size_t  ibuf_back_len;	/* bytes in ibuf_back */
 
 	size_t  obuf_total;	/* total_size of obuf_base */
 	size_t  obuf_avail;	/* available bytes in obuf */
@@ -70,10 +122,52 @@ struct hw_state {
 	uint8_t *obuf;		/* current position in obuf to put data */
 	uint8_t *obuf_next;	/* next position to read data */
 
+	/* deflate pipelining: 2nd ibuf/obuf pair for the DDCB in flight */
+	int pipeline;
+	uint8_t *ibuf_alt;	/* input of the DDCB in flight */
+	uint8_t *obuf_alt;	/* its output */
+	size_t  alt_bytes;	/* finished output not yet moved to obuf */
+
+	/* parallel deflate, see h_deflate_parallel() */
+	struct h_parallel *par;
+
 	unsigned int inflate_req;  /* # of inflates */
 	unsigned int deflate_req;  /* # of deflates */
 };
 
+enum h_segment_state {
+	SEG_IDLE,		/* collecting input or unused */
+	SEG_BUSY,		/* DDCB submitted */
+	SEG_DONE,		/* output ready to be given out */
+};
+
+struct h_segment {
+	zedc_stream h;		/* raw deflate stream of this segment */
+	enum h_segment_state state;
+	uint8_t *ibuf;		/* input, ibuf_total bytes */
+	size_t  ibuf_len;	/* collected bytes */
+	uint8_t *obuf;		/* output, obuf_total bytes */
+	uint8_t *obuf_next;	/* next byte to give out */
+	uint8_t *obuf_end;	/* end of output */
+};
+
+struct h_parallel {
+	unsigned int n;		/* number of segments */
+	unsigned int fill;	/* segment collecting input */
+	unsigned int out;	/* oldest segment, given out next */
+	const uint8_t *dict;	/* end of the last submitted input */
+	unsigned int dict_len;	/*   and how much of it to use */
+	uLong crc32;		/* combined checksums of finished segments */
+	uLong adler32;
+	unsigned long total_in;
+	int started;		/* header produced */
+	int finished;		/* trailer produced */
+	uint8_t hdr[2 * ZEDC_FIFO_SIZE]; /* header/trailer of the stream */
+	uint8_t *hdr_next;
+	uint8_t *hdr_end;
+	struct h_segment seg[];
+};
+
 /**
  * @return True if output buffer is empty, else False.
  */
@@ -99,6 +193,42 @@ static int zlib_xcheck = 1;
 static unsigned int zlib_ibuf_total = CONFIG_DEFLATE_BUF_SIZE;
 static unsigned int zlib_obuf_total = CONFIG_INFLATE_BUF_SIZE;
 
+/*
+ * Lease mode (ZLIB_FLAG_LEASE_BUFFERS): a stream holds its ibuf/obuf
+ * only while they contain data and gives them back as soon as it is
+ * drained. ZLIB_LEASE_MAX limits the bytes leased by all streams
+ * together. If the limit does not allow it within ZLIB_LEASE_WAIT
+ * msec, new streams are created in software and running streams send
+ * their DDCBs directly from/to the caller's buffers.
+ */
+static unsigned int zlib_spill_wait = CONFIG_SPILL_WAIT;
+static unsigned int zlib_inflate_watermark = CONFIG_INFLATE_WATERMARK;
+
+static unsigned long zlib_lease_max = 0;	/* 0: no limit */
+static unsigned int zlib_lease_wait = CONFIG_LEASE_WAIT;
+static unsigned long zlib_lease_bytes = 0;	/* currently leased */
+static pthread_mutex_t zlib_lease_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t zlib_lease_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Buffers registered with zlib_register_buffer() or allocated with
+ * zlib_dma_malloc(). Hardware uses them without staging copies and
+ * they are pinned only once per card handle.
+ */
+struct h_buffer {
+	struct h_buffer *next;
+	uintptr_t start;
+	uintptr_t end;
+	int writable;
+	int dma;			/* from zlib_dma_malloc() */
+	zedc_handle_t flat;		/* owner of flat DMA memory */
+};
+
+static struct h_buffer *zlib_buffers = NULL;
+static pthread_mutex_t zlib_buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long zlib_zerocopy_min = CONFIG_ZEROCOPY_MIN;
+static unsigned int zlib_parallel_segments = CONFIG_PARALLEL_SEGMENTS;
+
 #define ZEDC_CARDS_LENGTH 128
 
 /* Try to cache filehandles for faster access. Do not close them. */
@@ -201,6 +331,354 @@ static void __free(void *ptr)
 	free(ptr);
 }
 
+static inline int __lease_fits(size_t size)
+{
+	return (zlib_lease_max == 0) ||
+		(zlib_lease_bytes + size <= zlib_lease_max);
+}
+
+/**
+ * Wait up to zlib_lease_wait msec until size bytes fit under the
+ * limit. If take is set, lease them right away.
+ *
+ * @return 1 if they fit, else 0.
+ */
+static int __lease_wait(size_t size, int take)
+{
+	int rc = 0, fits;
+	struct timespec ts;
+
+	pthread_mutex_lock(&zlib_lease_mutex);
+	if (!__lease_fits(size)) {
+		zlib_stats_inc(&zlib_stats.lease_waits);
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec  += zlib_lease_wait / 1000;
+		ts.tv_nsec += (zlib_lease_wait % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		while (!__lease_fits(size) && (rc == 0))
+			rc = pthread_cond_timedwait(&zlib_lease_cond,
+						    &zlib_lease_mutex, &ts);
+	}
+	fits = __lease_fits(size);
+	if (fits && take)
+		zlib_lease_bytes += size;
+	pthread_mutex_unlock(&zlib_lease_mutex);
+
+	return fits;
+}
+
+/* Lease without looking at the limit */
+static void __lease_force(size_t size)
+{
+	pthread_mutex_lock(&zlib_lease_mutex);
+	zlib_lease_bytes += size;
+	pthread_mutex_unlock(&zlib_lease_mutex);
+}
+
+static void __lease_put(size_t size)
+{
+	pthread_mutex_lock(&zlib_lease_mutex);
+	zlib_lease_bytes -= size;
+	pthread_cond_broadcast(&zlib_lease_cond);
+	pthread_mutex_unlock(&zlib_lease_mutex);
+}
+
+/**
+ * Lease ibuf/obuf for a stream in lease mode. If we run into the
+ * limit and hardware can work on the caller's buffers instead, we
+ * give up. Flat buffers cannot be replaced, so we exceed the limit
+ * in that case.
+ *
+ * @return 0 if the stream has its buffers, -1 to bypass them.
+ */
+static int h_lease_buffers(struct hw_state *s)
+{
+	zedc_handle_t zedc = (zedc_handle_t)s->h.device;
+	size_t size = s->ibuf_total + s->obuf_total;
+
+	if (!__lease_wait(size, 1)) {
+		if (((s->h.dma_type[ZEDC_IN] & DDCB_DMA_TYPE_MASK) ==
+		     DDCB_DMA_TYPE_SGLIST) &&
+		    ((s->h.dma_type[ZEDC_OUT] & DDCB_DMA_TYPE_MASK) ==
+		     DDCB_DMA_TYPE_SGLIST)) {
+			zlib_stats_inc(&zlib_stats.lease_direct);
+			return -1;
+		}
+		__lease_force(size);
+	}
+
+	if (s->ibuf_total) {
+		s->ibuf_base = zedc_pool_alloc(zedc, s->ibuf_total,
+					       s->h.dma_type[ZEDC_IN]);
+		if (s->ibuf_base == NULL)
+			goto put_lease;
+	}
+	s->obuf_base = zedc_pool_alloc(zedc, s->obuf_total,
+				       s->h.dma_type[ZEDC_OUT]);
+	if (s->obuf_base == NULL)
+		goto free_ibuf;
+
+	s->ibuf = s->ibuf_base;
+	s->ibuf_avail = s->ibuf_total;
+	s->obuf = s->obuf_next = s->obuf_base;
+	s->obuf_avail = s->obuf_total;
+	return 0;
+
+ free_ibuf:
+	zedc_pool_free(zedc, s->ibuf_base, s->ibuf_total,
+		       s->h.dma_type[ZEDC_IN]);
+	s->ibuf_base = NULL;
+ put_lease:
+	__lease_put(size);
+	zlib_stats_inc(&zlib_stats.lease_direct);
+	return -1;
+}
+
+/**
+ * Free ibuf/obuf regardless of their content, return the lease if
+ * the stream has one.
+ */
+static void h_free_buffers(struct hw_state *s)
+{
+	zedc_handle_t zedc = (zedc_handle_t)s->h.device;
+
+	if (s->lease && (s->obuf_base != NULL))
+		__lease_put(s->ibuf_total + s->obuf_total);
+
+	zedc_pool_free(zedc, s->obuf_base, s->obuf_total,
+		       s->h.dma_type[ZEDC_OUT]);
+	zedc_pool_free(zedc, s->ibuf_base, s->ibuf_total,
+		       s->h.dma_type[ZEDC_IN]);
+	zedc_pool_free(zedc, s->obuf_alt, s->obuf_total,
+		       s->h.dma_type[ZEDC_OUT]);
+	zedc_pool_free(zedc, s->ibuf_alt, s->ibuf_total,
+		       s->h.dma_type[ZEDC_IN]);
+
+	s->ibuf_base = s->ibuf = NULL;
+	s->ibuf_alt = s->obuf_alt = NULL;
+	s->alt_bytes = 0;
+	s->ibuf_avail = s->ibuf_total;
+	s->obuf_base = s->obuf = s->obuf_next = NULL;
+	s->obuf_avail = s->obuf_total;
+}
+
+/**
+ * Lease mode: give ibuf/obuf back once they hold no data anymore.
+ */
+static void h_return_buffers(struct hw_state *s)
+{
+	if (!s->lease || (s->obuf_base == NULL))
+		return;
+
+	if ((s->ibuf != s->ibuf_base) || (s->obuf != s->obuf_next))
+		return;
+
+	h_free_buffers(s);
+}
+
+/**
+ * Find the registered buffer containing [addr, addr + size). A copy
+ * is returned, since the caller might unregister it concurrently.
+ *
+ * @return 1 if found, else 0.
+ */
+static int h_buffer_lookup(const void *addr, size_t size,
+			   struct h_buffer *buf)
+{
+	struct h_buffer *b;
+	uintptr_t start = (uintptr_t)addr;
+
+	if (zlib_buffers == NULL)	/* fast path, nothing registered */
+		return 0;
+
+	pthread_mutex_lock(&zlib_buffers_mutex);
+	for (b = zlib_buffers; b != NULL; b = b->next) {
+		if ((b->start <= start) && (start + size <= b->end)) {
+			*buf = *b;
+			pthread_mutex_unlock(&zlib_buffers_mutex);
+			return 1;
+		}
+	}
+	pthread_mutex_unlock(&zlib_buffers_mutex);
+	return 0;
+}
+
+static int h_buffer_add(void *addr, size_t size, int writable,
+			int dma, zedc_handle_t flat)
+{
+	struct h_buffer *b;
+
+	b = calloc(1, sizeof(*b));
+	if (b == NULL)
+		return Z_MEM_ERROR;
+
+	b->start = (uintptr_t)addr;
+	b->end = (uintptr_t)addr + size;
+	b->writable = writable;
+	b->dma = dma;
+	b->flat = flat;
+
+	pthread_mutex_lock(&zlib_buffers_mutex);
+	b->next = zlib_buffers;
+	zlib_buffers = b;
+	pthread_mutex_unlock(&zlib_buffers_mutex);
+	return Z_OK;
+}
+
+/**
+ * Remove buffer from the list, drop its pins.
+ *
+ * @return Z_OK or Z_STREAM_ERROR if it was not registered.
+ */
+static int h_buffer_del(const void *addr, size_t size, struct h_buffer *buf)
+{
+	struct h_buffer *b, **pb;
+
+	pthread_mutex_lock(&zlib_buffers_mutex);
+	for (pb = &zlib_buffers; (b = *pb) != NULL; pb = &b->next) {
+		if ((b->start == (uintptr_t)addr) &&
+		    (b->end == (uintptr_t)addr + size)) {
+			*pb = b->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&zlib_buffers_mutex);
+
+	if (b == NULL)
+		return Z_STREAM_ERROR;
+
+	if (b->flat == NULL)
+		zedc_unpin_cached(addr, size);
+	if (buf)
+		*buf = *b;
+	free(b);
+	return Z_OK;
+}
+
+/**
+ * Touch every page, such that they are present when the driver pins
+ * them. Writable buffers are written to get private pages.
+ */
+static void __prefault(void *addr, size_t size, int writable)
+{
+	unsigned int page_size = sysconf(_SC_PAGESIZE);
+	volatile uint8_t *p = (volatile uint8_t *)addr;
+	volatile uint8_t *end = p + size;
+
+	while (p < end) {
+		if (writable)
+			*p = *p;
+		else
+			(void)*p;
+		p = (volatile uint8_t *)(((uintptr_t)p + page_size) &
+					 ~((uintptr_t)page_size - 1));
+	}
+}
+
+int zlib_register_buffer(void *addr, size_t size, int writable)
+{
+	if ((addr == NULL) || (size == 0))
+		return Z_STREAM_ERROR;
+
+	__prefault(addr, size, writable);
+	return h_buffer_add(addr, size, writable, 0, NULL);
+}
+
+int zlib_unregister_buffer(void *addr, size_t size)
+{
+	return h_buffer_del(addr, size, NULL);
+}
+
+void *zlib_dma_malloc(size_t size)
+{
+	int err_code = 0;
+	void *ptr = NULL;
+	zedc_handle_t zedc = NULL;
+	unsigned int page_size = sysconf(_SC_PAGESIZE);
+	int flags = (zlib_inflate_flags | zlib_deflate_flags);
+
+	/*
+	 * Flat memory only works on the handle which allocated it,
+	 * which we can just guarantee for cached handles.
+	 */
+	if ((flags & ZLIB_FLAG_USE_FLAT_BUFFERS) &&
+	    (flags & ZLIB_FLAG_CACHE_HANDLES)) {
+		zedc = __zedc_open(zlib_card, zlib_accelerator,
+				   DDCB_MODE_ASYNC | DDCB_MODE_RDWR,
+				   &err_code);
+		if (zedc != NULL)
+			ptr = zedc_memalign(zedc, size, DDCB_DMA_TYPE_FLAT);
+		if (ptr == NULL)
+			zedc = NULL;
+	}
+	if (ptr == NULL) {
+		if (posix_memalign(&ptr, page_size, size) != 0)
+			return NULL;
+		__prefault(ptr, size, 1);
+	}
+
+	if (h_buffer_add(ptr, size, 1, 1, zedc) != Z_OK) {
+		if (zedc)
+			zedc_free(zedc, ptr, size, DDCB_DMA_TYPE_FLAT);
+		else
+			free(ptr);
+		return NULL;
+	}
+	return ptr;
+}
+
+void zlib_dma_free(void *ptr, size_t size)
+{
+	struct h_buffer b;
+
+	if (ptr == NULL)
+		return;
+
+	if ((h_buffer_del(ptr, size, &b) != Z_OK) || !b.dma) {
+		pr_err("%p was not allocated by zlib_dma_malloc\n", ptr);
+		return;
+	}
+	if (b.flat)
+		zedc_free(b.flat, ptr, size, DDCB_DMA_TYPE_FLAT);
+	else
+		free(ptr);
+}
+
+/**
+ * Can the DDCB use the caller's buffer directly? Flat memory only
+ * for the handle which allocated it, other memory via sglist.
+ * Registered buffers get pinned once.
+ *
+ * @return 1 if it can and sets type and registered, else 0.
+ */
+static int h_zerocopy_buf(struct hw_state *s, const void *addr, size_t size,
+			  int dir, enum zedc_mtype *type, int *registered)
+{
+	struct h_buffer b;
+	zedc_handle_t zedc = (zedc_handle_t)s->h.device;
+
+	*type = DDCB_DMA_TYPE_SGLIST;
+	*registered = h_buffer_lookup(addr, size, &b);
+	if (!*registered)
+		return 1;
+
+	if (b.flat) {
+		*type = DDCB_DMA_TYPE_FLAT;
+		return (b.flat == zedc);
+	}
+
+	if (dir && !b.writable)
+		return 0;
+
+	/* pin all of it, a failure just costs performance */
+	zedc_pin_cached(zedc, (void *)b.start, b.end - b.start, dir);
+	return 1;
+}
+
 /**
  * Theoretical maximum size of the data is worst case of 9/8
  * of the input buffer. We add one page more because our
@@ -221,6 +699,110 @@ uLong h_deflateBound(z_streamp strm __attribute__((unused)), uLong sourceLen)
 	return sourceLen * 15/8 + page_size;
 }
 
+static void h_par_free(struct hw_state *s)
+{
+	unsigned int i;
+	struct h_segment *g;
+	struct h_parallel *p = s->par;
+	zedc_handle_t zedc = (zedc_handle_t)s->h.device;
+
+	if (p == NULL)
+		return;
+
+	for (i = 0; i < p->n; i++) {
+		g = &p->seg[i];
+		if (g->h.wsp != NULL)
+			zedc_deflateEnd(&g->h);	/* waits for the DDCB */
+		if (i == 0)
+			continue;		/* buffers of the stream */
+		zedc_pool_free(zedc, g->obuf, s->obuf_total,
+			       s->h.dma_type[ZEDC_OUT]);
+		zedc_pool_free(zedc, g->ibuf, s->ibuf_total,
+			       s->h.dma_type[ZEDC_IN]);
+	}
+	free(p);
+	s->par = NULL;
+}
+
+/* Drop all segments, running DDCBs are waited for */
+static void h_par_reset(struct hw_state *s)
+{
+	unsigned int i;
+	struct h_parallel *p = s->par;
+
+	for (i = 0; i < p->n; i++) {
+		zedc_deflateReset(&p->seg[i].h);
+		p->seg[i].state = SEG_IDLE;
+		p->seg[i].ibuf_len = 0;
+	}
+	p->fill = p->out = 0;
+	p->dict = NULL;
+	p->dict_len = 0;
+	p->crc32 = 0;
+	p->adler32 = 1;
+	p->total_in = 0;
+	p->started = p->finished = 0;
+	p->hdr_next = p->hdr_end = NULL;
+}
+
+/**
+ * Parallel mode: one raw deflate stream per segment, all on the
+ * stream's card handle. In redundant mode the DDCBs go to several
+ * cards. Segment 0 uses ibuf/obuf of the stream itself.
+ */
+static int h_par_init(struct hw_state *s, int level, int memLevel,
+		      int strategy)
+{
+	int rc;
+	unsigned int i;
+	struct h_segment *g;
+	struct h_parallel *p;
+	zedc_handle_t zedc = (zedc_handle_t)s->h.device;
+	unsigned int n = MAX(zlib_parallel_segments, 2u);
+
+	p = calloc(1, sizeof(*p) + n * sizeof(p->seg[0]));
+	if (p == NULL)
+		return Z_MEM_ERROR;
+
+	s->par = p;
+	p->n = n;
+	p->adler32 = 1;
+
+	for (i = 0; i < n; i++) {
+		g = &p->seg[i];
+		g->h.device = zedc;
+		memcpy(g->h.dma_type, s->h.dma_type, sizeof(g->h.dma_type));
+		g->h.flags = s->h.flags & ~ZEDC_FLG_SKIP_LAST_DICT;
+
+		if (i == 0) {
+			g->ibuf = s->ibuf_base;
+			g->obuf = s->obuf_base;
+		} else {
+			g->ibuf = zedc_pool_alloc(zedc, s->ibuf_total,
+						  s->h.dma_type[ZEDC_IN]);
+			g->obuf = zedc_pool_alloc(zedc, s->obuf_total,
+						  s->h.dma_type[ZEDC_OUT]);
+			if ((g->ibuf == NULL) || (g->obuf == NULL)) {
+				rc = Z_MEM_ERROR;
+				goto free_par;
+			}
+		}
+
+		rc = zedc_deflateInit2(&g->h, level, Z_DEFLATED, -MAX_WBITS,
+				       memLevel, strategy);
+		if (rc != ZEDC_OK) {
+			g->h.wsp = NULL;
+			rc = rc_zedc_to_libz(rc);
+			goto free_par;
+		}
+	}
+	return Z_OK;
+
+ free_par:
+	h_par_free(s);
+	return rc;
+}
+
 int h_deflateInit2_(z_streamp strm,
 		    int level,
 		    int method,
@@ -248,6 +830,8 @@ int h_deflateInit2_(z_streamp strm,
 
 	if (zlib_deflate_flags & ZLIB_FLAG_USE_POLLING)
 		s->mode |= DDCB_MODE_POLLING;
+	if (zlib_deflate_flags & ZLIB_FLAG_USE_ADAPTIVE_POLLING)
+		s->mode |= DDCB_MODE_ADAPTIVE;
 
 	zedc = __zedc_open(s->card_no, s->card_type, s->mode, &err_code);
 	if (!zedc) {
@@ -286,10 +870,22 @@ int h_deflateInit2_(z_streamp strm,
 	if (zlib_deflate_flags & ZLIB_FLAG_OMIT_LAST_DICT)
 		s->h.flags |= ZEDC_FLG_SKIP_LAST_DICT;
 
-	if (zlib_ibuf_total) {
+	if (zlib_ibuf_total && (zlib_deflate_flags & ZLIB_FLAG_LEASE_BUFFERS)) {
+		s->lease = 1;
 		s->ibuf_total = s->ibuf_avail = zlib_ibuf_total;
-		s->ibuf_base = s->ibuf = zedc_memalign(zedc, s->ibuf_total,
-						s->h.dma_type[ZEDC_IN]);
+		s->obuf_total = s->obuf_avail =
+			h_deflateBound(strm, zlib_ibuf_total);
+
+		/* Admission: let software take it if we are short */
+		if (!__lease_wait(s->ibuf_total + s->obuf_total, 0)) {
+			zlib_stats_inc(&zlib_stats.lease_sw);
+			rc = Z_MEM_ERROR;
+			goto close_card;
+		}
+	} else if (zlib_ibuf_total) {
+		s->ibuf_total = s->ibuf_avail = zlib_ibuf_total;
+		s->ibuf_base = s->ibuf = zedc_pool_alloc(zedc, s->ibuf_total,
+						 s->h.dma_type[ZEDC_IN]);
 		if (s->ibuf_base == NULL) {
 			rc = Z_MEM_ERROR;
 			goto close_card;
@@ -299,17 +895,36 @@ int h_deflateInit2_(z_streamp strm,
 			h_deflateBound(strm, zlib_ibuf_total);
 
 		s->obuf_base = s->obuf = s->obuf_next =
-			zedc_memalign(zedc, s->obuf_total,
-				      s->h.dma_type[ZEDC_OUT]);
+			zedc_pool_alloc(zedc, s->obuf_total,
+					s->h.dma_type[ZEDC_OUT]);
 		if (s->obuf_base == NULL) {
 			rc = Z_MEM_ERROR;
 			goto free_ibuf;
 		}
+
+		if (zlib_deflate_flags & ZLIB_FLAG_PARALLEL) {
+			rc = h_par_init(s, level, memLevel, strategy);
+			if (rc != Z_OK)
+				goto free_obuf;
+
+		/* 2nd pair: collect the next chunk while the DDCB runs */
+		} else if (zlib_deflate_flags & ZLIB_FLAG_PIPELINE) {
+			s->pipeline = 1;
+			s->ibuf_alt = zedc_pool_alloc(zedc, s->ibuf_total,
+						      s->h.dma_type[ZEDC_IN]);
+			s->obuf_alt = zedc_pool_alloc(zedc, s->obuf_total,
+						      s->h.dma_type[ZEDC_OUT]);
+			if ((s->ibuf_alt == NULL) || (s->obuf_alt == NULL)) {
+				rc = Z_MEM_ERROR;
+				goto free_obuf;
+			}
+		}
 	}
 
 	hw_trace("[%p] h_deflateInit2_: card_type=%d card_no=%d "
-		 "zlib_ibuf_total=%d\n", strm, s->card_type, s->card_no,
-		 zlib_ibuf_total);
+		 "zlib_ibuf_total=%d pipeline=%d parallel=%d\n", strm,
+		 s->card_type, s->card_no, zlib_ibuf_total, s->pipeline,
+		 s->par ? s->par->n : 0);
 
 	rc = zedc_deflateInit2(&s->h, level, method, windowBits, memLevel,
 			       strategy);
@@ -324,9 +939,16 @@ int h_deflateInit2_(z_streamp strm,
 	return rc_zedc_to_libz(rc);
 
  free_obuf:
-	zedc_free(zedc, s->obuf_base, s->obuf_total, s->h.dma_type[ZEDC_OUT]);
+	h_par_free(s);
+	zedc_pool_free(zedc, s->obuf_alt, s->obuf_total,
+		       s->h.dma_type[ZEDC_OUT]);
+	zedc_pool_free(zedc, s->ibuf_alt, s->ibuf_total,
+		       s->h.dma_type[ZEDC_IN]);
+	zedc_pool_free(zedc, s->obuf_base, s->obuf_total,
+		       s->h.dma_type[ZEDC_OUT]);
  free_ibuf:
-	zedc_free(zedc, s->ibuf_base, s->ibuf_total, s->h.dma_type[ZEDC_IN]);
+	zedc_pool_free(zedc, s->ibuf_base, s->ibuf_total,
+		       s->h.dma_type[ZEDC_IN]);
  close_card:
 	__zedc_close(zedc);
  free_hw_state:
@@ -334,6 +956,35 @@ int h_deflateInit2_(z_streamp strm,
 	return rc;
 }
 
+/**
+ * Pipelining: take over the result of the DDCB which deflated
+ * ibuf_alt into obuf_alt. The output stays in obuf_alt until obuf is
+ * drained, see h_pipe_flush().
+ */
+static int h_pipe_done(z_streamp strm, struct hw_state *s, int rc)
+{
+	zedc_stream *h = &s->h;
+
+	__fixup_crc_or_adler(strm, h);
+	s->rc = rc_zedc_to_libz(rc);
+	s->alt_bytes = h->next_out - s->obuf_alt;
+
+	hw_trace("[%p]            pipelined avail_in=%d alt_bytes=%zd "
+		 "rc=%d\n", strm, h->avail_in, s->alt_bytes, rc);
+
+	if (h->avail_in != 0) {
+		pr_err("not all input absorbed! avail_in is still %d bytes\n",
+		       h->avail_in);
+		return Z_STREAM_ERROR;
+	}
+	return s->rc;
+}
+
+static int h_pipe_wait(z_streamp strm, struct hw_state *s)
+{
+	return h_pipe_done(strm, s, zedc_deflate_wait(&s->h));
+}
+
 /**
  * Implementation note: This mechanism will not work, if the caller is
  * using driver allocated memory. Currently only the device driver
@@ -350,12 +1001,25 @@ int h_deflateCopy(z_streamp dest, z_streamp source)
 	int rc = Z_OK, err_code;
 
 	s_source = (struct hw_state *)source->state;
+
+	/* Segments in flight cannot be duplicated */
+	if (s_source->par != NULL) {
+		pr_err("deflateCopy not supported for parallel deflate\n");
+		return Z_STREAM_ERROR;
+	}
+
+	/* The result of a pipelined DDCB must be in the copy too */
+	if (zedc_deflate_busy(&s_source->h) &&
+	    (h_pipe_wait(source, s_source) == Z_STREAM_ERROR))
+		return Z_STREAM_ERROR;
+
 	s_dest = calloc(1, sizeof(*s_dest));
 	if (s_dest == NULL) {
 		pr_err("Cannot get destination buffer\n");
 		return Z_MEM_ERROR;
 	}
 	memcpy(s_dest, s_source, sizeof(*s_dest));
+	s_dest->ibuf_alt = s_dest->obuf_alt = NULL;
 
 	rc = rc_zedc_to_libz(zedc_deflateCopy(&s_dest->h, &s_source->h));
 	if (rc != Z_OK) {
@@ -381,10 +1045,10 @@ int h_deflateCopy(z_streamp dest, z_streamp source)
 	 * the fill-level. Furthermore we need to copy the data over
 	 * to the new buffers.
 	 */
-	if (s_source->ibuf_total) {
+	if (s_source->ibuf_base) {
 		s_dest->ibuf_total = s_source->ibuf_total;
 		s_dest->ibuf_avail = s_source->ibuf_avail;
-		s_dest->ibuf_base = zedc_memalign(zedc, s_dest->ibuf_total,
+		s_dest->ibuf_base = zedc_pool_alloc(zedc, s_dest->ibuf_total,
 					s_dest->h.dma_type[ZEDC_IN]);
 		if (s_dest->ibuf_base == NULL) {
 			rc = Z_MEM_ERROR;
@@ -395,10 +1059,10 @@ int h_deflateCopy(z_streamp dest, z_streamp source)
 		memcpy(s_dest->ibuf_base, s_source->ibuf_base,
 		       s_source->ibuf - s_source->ibuf_base);
 	}
-	if (s_source->obuf_total) {
+	if (s_source->obuf_base) {
 		s_dest->obuf_total = s_source->obuf_total;
 		s_dest->obuf_avail = s_source->obuf_avail;
-		s_dest->obuf_base = zedc_memalign(zedc, s_dest->obuf_total,
+		s_dest->obuf_base = zedc_pool_alloc(zedc, s_dest->obuf_total,
 					s_dest->h.dma_type[ZEDC_OUT]);
 		if (s_dest->obuf_base == NULL) {
 			rc = Z_MEM_ERROR;
@@ -411,12 +1075,34 @@ int h_deflateCopy(z_streamp dest, z_streamp source)
 		memcpy(s_dest->obuf_next, s_source->obuf_next,
 		       s_dest->obuf_total - s_dest->obuf_avail);
 	}
+	if (s_source->pipeline) {
+		s_dest->ibuf_alt = zedc_pool_alloc(zedc, s_dest->ibuf_total,
+					s_dest->h.dma_type[ZEDC_IN]);
+		s_dest->obuf_alt = zedc_pool_alloc(zedc, s_dest->obuf_total,
+					s_dest->h.dma_type[ZEDC_OUT]);
+		if ((s_dest->ibuf_alt == NULL) || (s_dest->obuf_alt == NULL)) {
+			rc = Z_MEM_ERROR;
+			goto err_free_alt;
+		}
+		memcpy(s_dest->obuf_alt, s_source->obuf_alt,
+		       s_source->alt_bytes);
+	}
+	if (s_dest->lease && (s_dest->obuf_base != NULL))
+		__lease_force(s_dest->ibuf_total + s_dest->obuf_total);
 
 	dest->state = (void *)s_dest;
 	return Z_OK;
 
+ err_free_alt:
+	zedc_pool_free(zedc, s_dest->obuf_alt, s_dest->obuf_total,
+		       s_dest->h.dma_type[ZEDC_OUT]);
+	zedc_pool_free(zedc, s_dest->ibuf_alt, s_dest->ibuf_total,
+		       s_dest->h.dma_type[ZEDC_IN]);
+	zedc_pool_free(zedc, s_dest->obuf_base, s_dest->obuf_total,
+		       s_dest->h.dma_type[ZEDC_OUT]);
  err_free_ibuf_base:
-	free(s_dest->ibuf_base);
+	zedc_pool_free(zedc, s_dest->ibuf_base, s_dest->ibuf_total,
+		       s_dest->h.dma_type[ZEDC_IN]);
 	s_dest->ibuf_base = NULL;
  err_zedc_close:
 	__zedc_close(zedc);
@@ -450,9 +1136,13 @@ int h_deflateReset(z_streamp strm)
 	s->obuf_avail = s->obuf_total;
 	s->obuf       = s->obuf_base;
 	s->obuf_next  = s->obuf_base;
+	s->alt_bytes  = 0;
 	s->rc	      = Z_OK;
+	h_return_buffers(s);
+	if (s->par != NULL)
+		h_par_reset(s);
 
-	rc = zedc_deflateReset(h);
+	rc = zedc_deflateReset(h);	/* drops a pipelined DDCB */
 	__fixup_crc_or_adler(strm, h);
 
 	return rc_zedc_to_libz(rc);
@@ -595,6 +1285,50 @@ static unsigned int h_flush_obuf(z_streamp strm)
 	return obuf_bytes;
 }
 
+/**
+ * Let the DDCB work directly on the caller's buffers if both are
+ * registered or both are large enough. The caller ensures that
+ * nothing is buffered in ibuf/obuf.
+ *
+ * @return 1 if the request was done, else 0.
+ */
+static int h_deflate_zerocopy(z_streamp strm, struct hw_state *s, int flush)
+{
+	int in_reg, out_reg;
+	enum zedc_mtype in_type, out_type, saved_in, saved_out;
+	zedc_stream *h = &s->h;
+
+	if ((strm->avail_in == 0) || (strm->avail_out == 0))
+		return 0;
+
+	if (!h_zerocopy_buf(s, strm->next_in, strm->avail_in, 0,
+			    &in_type, &in_reg) ||
+	    !h_zerocopy_buf(s, strm->next_out, strm->avail_out, 1,
+			    &out_type, &out_reg))
+		return 0;
+
+	if (!(in_reg && out_reg) &&
+	    ((zlib_zerocopy_min == 0) ||
+	     (strm->avail_in < zlib_zerocopy_min) ||
+	     (strm->avail_out < zlib_zerocopy_min)))
+		return 0;
+
+	saved_in = h->dma_type[ZEDC_IN];
+	saved_out = h->dma_type[ZEDC_OUT];
+	h->dma_type[ZEDC_IN] = in_type;
+	h->dma_type[ZEDC_OUT] = out_type;
+
+	stream_zlib_to_zedc(h, strm);
+	s->rc = rc_zedc_to_libz(__deflate(strm, s, flush));
+	stream_zedc_to_zlib(strm, h);
+
+	h->dma_type[ZEDC_IN] = saved_in;
+	h->dma_type[ZEDC_OUT] = saved_out;
+
+	zlib_stats_inc(&zlib_stats.deflate_zerocopy);
+	return 1;
+}
+
 /**
  * Optimization Remarks
  *
@@ -609,28 +1343,12 @@ static unsigned int h_flush_obuf(z_streamp strm)
  * performance a lot if the input data is e.g. around 16 KiB per
  * request (zpipe.c defaults).
  */
-int h_deflate(z_streamp strm, int flush)
+static int h_deflate_buffered(z_streamp strm, struct hw_state *s, int flush)
 {
 	int rc = Z_OK, loops = 0;
-	struct hw_state *s;
-	zedc_stream *h;
+	zedc_stream *h = &s->h;
 	unsigned int obuf_bytes, ibuf_bytes;
 
-	if (strm == NULL)
-		return Z_STREAM_ERROR;
-
-	s = (struct hw_state *)strm->state;
-	if (s == NULL)
-		return Z_STREAM_ERROR;
-	h = &s->h;
-
-	if (s->ibuf_total == 0) { /* Special case: buffering fully disabled */
-		stream_zlib_to_zedc(h, strm);
-		s->rc = rc_zedc_to_libz(__deflate(strm, s, flush));
-		stream_zedc_to_zlib(strm, h);
-		return s->rc;
-	}
-
 	__prep_crc_or_adler(strm, h);
 	hw_trace("[%p] h_deflate: flush=%s avail_in=%d avail_out=%d "
 		 "ibuf_avail=%d obuf_avail=%d adler32/cr32=%08x/%08x\n",
@@ -707,16 +1425,414 @@ int h_deflate(z_streamp strm, int flush)
 		ibuf_bytes = s->ibuf - s->ibuf_base;  /* accumulated input */
 		obuf_bytes = s->obuf - s->obuf_next;  /* bytes in obuf */
 
-		if ((flush == Z_FINISH) &&	/* finishing desired */
-		    (s->rc == Z_STREAM_END) &&	/* hardware saw FEOB */
-		    (strm->avail_in == 0) &&	/* no more input from caller */
-		    (ibuf_bytes == 0) &&	/* no more input in buf */
-		    (obuf_bytes == 0))		/* no more outp data in buf */
-			return Z_STREAM_END;	/* nothing to do anymore */
+		if ((flush == Z_FINISH) &&	/* finishing desired */
+		    (s->rc == Z_STREAM_END) &&	/* hardware saw FEOB */
+		    (strm->avail_in == 0) &&	/* no more input from caller */
+		    (ibuf_bytes == 0) &&	/* no more input in buf */
+		    (obuf_bytes == 0))		/* no more outp data in buf */
+			return Z_STREAM_END;	/* nothing to do anymore */
+
+		loops++;
+	} while (strm->avail_in != 0);
+
+	return rc;
+}
+
+/**
+ * Move finished output of the pipelined DDCB to obuf once the caller
+ * took everything from there, and give out what we have.
+ */
+static void h_pipe_flush(z_streamp strm, struct hw_state *s)
+{
+	uint8_t *obuf_base;
+
+	if ((h_flush_obuf(strm) != 0) || (s->alt_bytes == 0))
+		return;
+
+	obuf_base = s->obuf_base;
+	s->obuf_base = s->obuf_next = s->obuf_alt;
+	s->obuf_alt = obuf_base;
+	s->obuf = s->obuf_base + s->alt_bytes;
+	s->obuf_avail = s->obuf_total - s->alt_bytes;
+	s->alt_bytes = 0;
+
+	h_flush_obuf(strm);
+}
+
+/**
+ * Send the collected input to hardware without waiting for it. The
+ * full ibuf becomes ibuf_alt, the caller's next data goes to the
+ * other one. obuf_alt must be empty.
+ */
+static int h_pipe_submit(z_streamp strm, struct hw_state *s, int flush)
+{
+	int rc;
+	uint8_t *ibuf_base;
+	zedc_stream *h = &s->h;
+	unsigned int ibuf_bytes = s->ibuf - s->ibuf_base;
+
+	ibuf_base = s->ibuf_base;
+	s->ibuf_base = s->ibuf = s->ibuf_alt;
+	s->ibuf_alt = ibuf_base;
+	s->ibuf_avail = s->ibuf_total;
+
+	hw_trace("[%p] h_deflate (%d): flush=%s sending %d bytes pipelined\n",
+		 strm, s->deflate_req, flush_to_str(flush), ibuf_bytes);
+
+	h->next_in = s->ibuf_alt;
+	h->avail_in = ibuf_bytes;
+	h->next_out = s->obuf_alt;
+	h->avail_out = s->obuf_total;
+
+	rc = zedc_deflate_submit(h, flush);
+	s->deflate_req++;
+	if (!zedc_deflate_busy(h))	/* done without DDCB */
+		return h_pipe_done(strm, s, rc);
+
+	return Z_OK;
+}
+
+/**
+ * Like h_deflate_buffered(), but with two ibuf/obuf pairs: while the
+ * card compresses one ibuf, the caller's data is collected into the
+ * other one. A DDCB continues the dictionary of its predecessor, so
+ * there is never more than one in flight per stream. We wait for it
+ * when the next ibuf is full, when flushing and at the end.
+ */
+static int h_deflate_pipelined(z_streamp strm, struct hw_state *s, int flush)
+{
+	int rc;
+	zedc_stream *h = &s->h;
+
+	hw_trace("[%p] h_deflate: flush=%s avail_in=%d avail_out=%d "
+		 "ibuf_avail=%d busy=%d alt_bytes=%zd\n",
+		 strm, flush_to_str(flush), strm->avail_in, strm->avail_out,
+		 (int)s->ibuf_avail, zedc_deflate_busy(h), s->alt_bytes);
+
+	do {
+		/* Collect input data ... */
+		h_read_ibuf(strm);
+
+		/* Give out what is already there */
+		h_pipe_flush(strm, s);
+		if (strm->avail_out == 0)	/* need more output space */
+			return Z_OK;
+
+		if ((flush != Z_NO_FLUSH) || (s->ibuf_avail == 0)) {
+			/* The other pair must be done and given out */
+			if (zedc_deflate_busy(h)) {
+				rc = h_pipe_wait(strm, s);
+				if (rc == Z_STREAM_ERROR)
+					return rc;
+				h_pipe_flush(strm, s);
+			}
+			if (s->alt_bytes != 0)	/* need more output space */
+				return Z_OK;
+
+			/*
+			 * If we still have more input data we must
+			 * not tell hardware to finish/flush the
+			 * compression stream.
+			 */
+			rc = h_pipe_submit(strm, s, (strm->avail_in != 0) ?
+					   Z_NO_FLUSH : flush);
+			if (rc == Z_STREAM_ERROR)
+				return rc;
+
+			/* Flushing: the caller expects the output now */
+			if ((flush != Z_NO_FLUSH) && (strm->avail_in == 0) &&
+			    zedc_deflate_busy(h)) {
+				rc = h_pipe_wait(strm, s);
+				if (rc == Z_STREAM_ERROR)
+					return rc;
+			} else if (zedc_deflate_busy(h))
+				zlib_stats_inc(&zlib_stats.deflate_pipelined);
+
+			h_pipe_flush(strm, s);
+			if (strm->avail_out == 0)
+				return Z_OK;
+		}
+
+		if ((flush == Z_FINISH) &&	/* finishing desired */
+		    (s->rc == Z_STREAM_END) &&	/* hardware saw FEOB */
+		    (strm->avail_in == 0) &&	/* no more input from caller */
+		    (s->ibuf == s->ibuf_base) && /* no more input in buf */
+		    !zedc_deflate_busy(h) &&	/* no DDCB in flight */
+		    (s->alt_bytes == 0) &&	/* no more outp data in bufs */
+		    (s->obuf == s->obuf_next))
+			return Z_STREAM_END;	/* nothing to do anymore */
+
+	} while (strm->avail_in != 0);
+
+	return Z_OK;
+}
+
+/**
+ * @return True if neither ibuf/obuf nor the pipeline hold data.
+ */
+static int h_deflate_idle(struct hw_state *s)
+{
+	return (s->ibuf == s->ibuf_base) && (s->obuf == s->obuf_next) &&
+		!zedc_deflate_busy(&s->h) && (s->alt_bytes == 0);
+}
+
+/**
+ * Produce header or trailer of the stream with its own zedc stream,
+ * which never sees any data. For the trailer it gets the combined
+ * checksums and closes the segments with an empty final block.
+ */
+static int h_par_main(z_streamp strm, struct hw_state *s, int flush)
+{
+	int rc;
+	zedc_stream *h = &s->h;
+	struct h_parallel *p = s->par;
+
+	if (flush == Z_FINISH) {
+		h->crc32 = p->crc32;
+		h->adler32 = p->adler32;
+		h->total_in = p->total_in;
+	}
+	h->next_in = NULL;
+	h->avail_in = 0;
+	h->next_out = p->hdr_next = p->hdr;
+	h->avail_out = sizeof(p->hdr);
+
+	rc = zedc_deflate(h, flush);
+	__fixup_crc_or_adler(strm, h);
+	p->hdr_end = h->next_out;
+
+	return rc_zedc_to_libz(rc);
+}
+
+/**
+ * Submit the collected input of a segment. It starts with the last
+ * 32 KiB of the previous segment as dictionary and ends with a sync
+ * flush, so the outputs can simply be concatenated.
+ */
+static int h_par_submit(z_streamp strm, struct hw_state *s, int flush)
+{
+	int rc;
+	struct h_parallel *p = s->par;
+	struct h_segment *g = &p->seg[p->fill];
+
+	hw_trace("[%p] h_deflate (%d): segment %d with %zd bytes dict=%d\n",
+		 strm, s->deflate_req, p->fill, g->ibuf_len, p->dict_len);
+
+	zedc_deflateReset(&g->h);
+	if (p->dict_len != 0)
+		zedc_deflateSetDictionary(&g->h, p->dict - p->dict_len,
+					  p->dict_len);
+
+	g->h.next_in = g->ibuf;
+	g->h.avail_in = g->ibuf_len;
+	g->h.next_out = g->obuf;
+	g->h.avail_out = s->obuf_total;
+
+	rc = zedc_deflate_submit(&g->h, Z_SYNC_FLUSH);
+	s->deflate_req++;
+	if ((rc != ZEDC_OK) || !zedc_deflate_busy(&g->h)) {
+		pr_err("segment %d not submitted rc=%d\n", p->fill, rc);
+		return Z_STREAM_ERROR;
+	}
+	zlib_stats_inc(&zlib_stats.deflate_parallel);
+
+	/* A full flush resets the dictionary */
+	p->dict = g->ibuf + g->ibuf_len;
+	p->dict_len = (flush == Z_FULL_FLUSH) ? 0 :
+		MIN(g->ibuf_len, (size_t)0x8000);
+
+	g->state = SEG_BUSY;
+	p->fill = (p->fill + 1) % p->n;
+	return Z_OK;
+}
+
+/**
+ * Wait for the oldest segment and fold its checksums into the
+ * stream's ones. Segments finish in order this way.
+ */
+static int h_par_wait(z_streamp strm, struct hw_state *s)
+{
+	int rc;
+	struct h_parallel *p = s->par;
+	struct h_segment *g = &p->seg[p->out];
+
+	rc = zedc_deflate_wait(&g->h);
+	if ((rc != ZEDC_OK) || (g->h.avail_in != 0) ||
+	    (g->h.avail_out == 0)) {
+		pr_err("segment %d failed rc=%d avail_in=%d avail_out=%d\n",
+		       p->out, rc, g->h.avail_in, g->h.avail_out);
+		return Z_STREAM_ERROR;
+	}
+	hw_trace("[%p] segment %d done: %ld -> %ld bytes\n", strm, p->out,
+		 g->h.total_in, g->h.total_out);
+
+	p->crc32 = z_crc32_combine(p->crc32, g->h.crc32, g->h.total_in);
+	p->adler32 = z_adler32_combine(p->adler32, g->h.adler32,
+				       g->h.total_in);
+	p->total_in += g->h.total_in;
+
+	g->obuf_next = g->obuf;
+	g->obuf_end = g->h.next_out;
+	g->state = SEG_DONE;
+	return Z_OK;
+}
+
+static void h_par_copy(z_streamp strm, uint8_t **from, uint8_t *end)
+{
+	unsigned int tocopy = MIN((size_t)strm->avail_out,
+				  (size_t)(end - *from));
+
+	memcpy(strm->next_out, *from, tocopy);
+	*from += tocopy;
+	strm->next_out += tocopy;
+	strm->avail_out -= tocopy;
+	strm->total_out += tocopy;
+}
+
+/**
+ * Give out header/trailer and finished segments in stream order.
+ */
+static void h_par_flush(z_streamp strm, struct hw_state *s)
+{
+	struct h_parallel *p = s->par;
+	struct h_segment *g;
+
+	h_par_copy(strm, &p->hdr_next, p->hdr_end);
+	if (p->hdr_next != p->hdr_end)
+		return;
+
+	for (g = &p->seg[p->out]; g->state == SEG_DONE;
+	     g = &p->seg[p->out]) {
+		h_par_copy(strm, &g->obuf_next, g->obuf_end);
+		if (g->obuf_next != g->obuf_end)
+			return;
+
+		g->state = SEG_IDLE;
+		g->ibuf_len = 0;
+		p->out = (p->out + 1) % p->n;
+	}
+}
+
+/**
+ * Parallel mode, pigz-style: the input is cut into ibuf sized
+ * segments, which are compressed independently and at the same time,
+ * each primed with the end of its predecessor as dictionary. Their
+ * byte aligned outputs are concatenated between the header and the
+ * trailer. CRC32/Adler32 are combined from the ones of the segments.
+ */
+static int h_deflate_parallel(z_streamp strm, struct hw_state *s, int flush)
+{
+	int rc;
+	size_t tocopy;
+	struct h_segment *g;
+	struct h_parallel *p = s->par;
+
+	if (!p->started) {
+		/* The first segment continues a preset dictionary */
+		if (s->h.havedict) {
+			p->dict = s->h.wsp->dict[0] + s->h.dict_len;
+			p->dict_len = s->h.dict_len;
+		}
+		rc = h_par_main(strm, s, Z_NO_FLUSH);
+		if (rc != Z_OK)
+			return rc;
+		p->started = 1;
+	}
+
+	while (1) {
+		/* Give out what is already there */
+		h_par_flush(strm, s);
+		if (strm->avail_out == 0)	/* need more output space */
+			return Z_OK;
+
+		g = &p->seg[p->fill];
+		if (g->state != SEG_IDLE) {	/* all segments in use */
+			if (h_par_wait(strm, s) != Z_OK)
+				return Z_STREAM_ERROR;
+			continue;
+		}
+
+		/* Collect input data ... */
+		tocopy = MIN((size_t)strm->avail_in,
+			     s->ibuf_total - g->ibuf_len);
+		memcpy(g->ibuf + g->ibuf_len, strm->next_in, tocopy);
+		g->ibuf_len += tocopy;
+		strm->next_in += tocopy;
+		strm->avail_in -= tocopy;
+		strm->total_in += tocopy;
+
+		if ((g->ibuf_len == s->ibuf_total) ||
+		    ((flush != Z_NO_FLUSH) && (g->ibuf_len != 0))) {
+			if (h_par_submit(strm, s, (strm->avail_in != 0) ?
+					 Z_NO_FLUSH : flush) != Z_OK)
+				return Z_STREAM_ERROR;
+			continue;
+		}
+		if (flush == Z_NO_FLUSH)	/* all input collected */
+			return Z_OK;
+
+		/* Flushing: everything submitted must come out */
+		if (p->seg[p->out].state == SEG_BUSY) {
+			if (h_par_wait(strm, s) != Z_OK)
+				return Z_STREAM_ERROR;
+			continue;
+		}
+		if (flush != Z_FINISH)		/* segments are sync flushed */
+			return Z_OK;
+
+		if (!p->finished) {
+			rc = h_par_main(strm, s, Z_FINISH);
+			if (rc != Z_STREAM_END)
+				return Z_STREAM_ERROR;
+			p->finished = 1;
+			continue;
+		}
+		s->rc = Z_STREAM_END;
+		return Z_STREAM_END;
+	}
+}
+
+int h_deflate(z_streamp strm, int flush)
+{
+	int rc;
+	struct hw_state *s;
+	zedc_stream *h;
+
+	if (strm == NULL)
+		return Z_STREAM_ERROR;
+
+	s = (struct hw_state *)strm->state;
+	if (s == NULL)
+		return Z_STREAM_ERROR;
+	h = &s->h;
+
+	if (s->par != NULL)
+		return h_deflate_parallel(strm, s, flush);
+
+	/* Nothing buffered: try to work on the caller's memory */
+	if (s->ibuf_total && h_deflate_idle(s) &&
+	    h_deflate_zerocopy(strm, s, flush))
+		return s->rc;
+
+	/*
+	 * Special case: buffering fully disabled, or in lease mode no
+	 * buffers available. Without leased buffers ibuf/obuf are
+	 * empty, so we can use the caller's buffers for this call.
+	 */
+	if ((s->ibuf_total == 0) ||
+	    (s->lease && (s->obuf_base == NULL) &&
+	     (h_lease_buffers(s) < 0))) {
+		stream_zlib_to_zedc(h, strm);
+		s->rc = rc_zedc_to_libz(__deflate(strm, s, flush));
+		stream_zedc_to_zlib(strm, h);
+		return s->rc;
+	}
 
-		loops++;
-	} while (strm->avail_in != 0);
+	if (s->pipeline)
+		return h_deflate_pipelined(strm, s, flush);
 
+	rc = h_deflate_buffered(strm, s, flush);
+	h_return_buffers(s);
 	return rc;
 }
 
@@ -736,10 +1852,10 @@ int h_deflateEnd(z_streamp strm)
 	h = &s->h;
 	zedc = (zedc_handle_t)h->device;
 
+	h_par_free(s);			/* before segment 0 buffers go */
 	rc = zedc_deflateEnd(h);
 
-	zedc_free(zedc, s->obuf_base, s->obuf_total, s->h.dma_type[ZEDC_OUT]);
-	zedc_free(zedc, s->ibuf_base, s->ibuf_total, s->h.dma_type[ZEDC_IN]);
+	h_free_buffers(s);
 	__zedc_close(zedc);
 	__free(s);
 	return rc_zedc_to_libz(rc);
@@ -765,6 +1881,8 @@ int h_inflateInit2_(z_streamp strm, int  windowBits,
 
 	if (zlib_inflate_flags & ZLIB_FLAG_USE_POLLING)
 		s->mode |= DDCB_MODE_POLLING;
+	if (zlib_inflate_flags & ZLIB_FLAG_USE_ADAPTIVE_POLLING)
+		s->mode |= DDCB_MODE_ADAPTIVE;
 
 	hw_trace("[%p] h_inflateInit2_: card_type=%d card_no=%d "
 		 "zlib_obuf_total=%d\n", strm, s->card_type, s->card_no,
@@ -811,17 +1929,40 @@ int h_inflateInit2_(z_streamp strm, int  windowBits,
 	if (zlib_inflate_flags & ZLIB_FLAG_OMIT_LAST_DICT)
 		s->h.flags |= ZEDC_FLG_SKIP_LAST_DICT;
 
-	/* We only use output buffering for inflate */
-	if (zlib_obuf_total) {
+	/* Input buffering only with obuf and not for raw deflate */
+	if (zlib_obuf_total && zlib_inflate_watermark && (windowBits >= 0))
+		s->ibuf_total = s->ibuf_avail = zlib_inflate_watermark;
+
+	if (zlib_obuf_total && (zlib_inflate_flags & ZLIB_FLAG_LEASE_BUFFERS)) {
+		s->lease = 1;
+		s->obuf_total = s->obuf_avail = zlib_obuf_total;
+
+		/* Admission: let software take it if we are short */
+		if (!__lease_wait(s->ibuf_total + s->obuf_total, 0)) {
+			zlib_stats_inc(&zlib_stats.lease_sw);
+			rc = Z_MEM_ERROR;
+			goto close_card;
+		}
+	} else if (zlib_obuf_total) {
 		s->obuf_total = s->obuf_avail = zlib_obuf_total;
 		s->obuf_base = s->obuf = s->obuf_next =
-			zedc_memalign(zedc, s->obuf_total,
-				      s->h.dma_type[ZEDC_OUT]);
+			zedc_pool_alloc(zedc, s->obuf_total,
+					s->h.dma_type[ZEDC_OUT]);
 
 		if (s->obuf_base == NULL) {
 			rc = Z_MEM_ERROR;
 			goto close_card;
 		}
+
+		if (s->ibuf_total) {
+			s->ibuf_base = s->ibuf =
+				zedc_pool_alloc(zedc, s->ibuf_total,
+						s->h.dma_type[ZEDC_IN]);
+			if (s->ibuf_base == NULL) {
+				rc = Z_MEM_ERROR;
+				goto free_obuf;
+			}
+		}
 	}
 
 	rc = zedc_inflateInit2(&s->h, windowBits);
@@ -836,7 +1977,10 @@ int h_inflateInit2_(z_streamp strm, int  windowBits,
 	return rc_zedc_to_libz(rc);
 
  free_obuf:
-	zedc_free(zedc, s->obuf_base, s->obuf_total, s->h.dma_type[ZEDC_OUT]);
+	zedc_pool_free(zedc, s->ibuf_base, s->ibuf_total,
+		       s->h.dma_type[ZEDC_IN]);
+	zedc_pool_free(zedc, s->obuf_base, s->obuf_total,
+		       s->h.dma_type[ZEDC_OUT]);
  close_card:
 	__zedc_close(zedc);
  free_hw_state:
@@ -867,7 +2011,10 @@ int h_inflateReset(z_streamp strm)
 	s->obuf_avail = s->obuf_total;
 	s->obuf       = s->obuf_base;
 	s->obuf_next  = s->obuf_base;
+	s->ibuf_avail = s->ibuf_total;
+	s->ibuf       = s->ibuf_base;
 	s->rc	      = Z_OK;
+	h_return_buffers(s);
 
 	if (h->tree_bits + h->pad_bits + h->scratch_ib + h->scratch_bits)
 		hw_trace("[%p] warn: (0x%x 0x%x 0x%x 0x%x)\n", strm,
@@ -904,7 +2051,10 @@ int h_inflateReset2(z_streamp strm, int windowBits)
 	s->obuf_avail = s->obuf_total;
 	s->obuf       = s->obuf_base;
 	s->obuf_next  = s->obuf_base;
+	s->ibuf_avail = s->ibuf_total;
+	s->ibuf       = s->ibuf_base;
 	s->rc	      = Z_OK;
+	h_return_buffers(s);
 
 	if (h->tree_bits + h->pad_bits + h->scratch_ib + h->scratch_bits)
 		hw_trace("[%p] warn: (0x%x 0x%x 0x%x 0x%x)\n", strm,
@@ -989,6 +2139,61 @@ int h_inflateGetHeader(z_streamp strm, gz_headerp head)
 	return rc_zedc_to_libz(rc);
 }
 
+/**
+ * Snapshot of the hardware inflate state for zlib_index_build().
+ * Only possible between two inflate() calls which left no output
+ * behind, in obuf or in the dictionary, and no input in ibuf.
+ */
+int h_inflateSnapshot(z_streamp strm, uint8_t *buf, unsigned int *len)
+{
+	zedc_stream *h;
+	struct hw_state *s;
+
+	if (strm == NULL)
+		return Z_STREAM_ERROR;
+
+	s = (struct hw_state *)strm->state;
+	if (s == NULL)
+		return Z_STREAM_ERROR;
+	h = &s->h;
+
+	if ((s->rc == Z_STREAM_END) || (output_buffer_bytes(s) != 0) ||
+	    (zedc_inflate_pending_output(h) != 0) ||
+	    (s->ibuf != s->ibuf_base))	/* consumed input still in ibuf */
+		return Z_BUF_ERROR;
+
+	return rc_zedc_to_libz(zedc_inflateSnapshot(h, buf, len));
+}
+
+int h_inflateRestore(z_streamp strm, const uint8_t *buf, unsigned int len)
+{
+	int rc;
+	zedc_stream *h;
+	struct hw_state *s;
+
+	hw_trace("[%p] h_inflateRestore len=%d\n", strm, len);
+	if (strm == NULL)
+		return Z_STREAM_ERROR;
+
+	s = (struct hw_state *)strm->state;
+	if (s == NULL)
+		return Z_STREAM_ERROR;
+	h = &s->h;
+
+	s->obuf_avail = s->obuf_total;
+	s->obuf       = s->obuf_base;
+	s->obuf_next  = s->obuf_base;
+	s->ibuf_avail = s->ibuf_total;
+	s->ibuf       = s->ibuf_base;
+	s->rc	      = Z_OK;
+	h_return_buffers(s);
+
+	rc = zedc_inflateRestore(h, buf, len);
+	__fixup_crc_or_adler(strm, h);
+
+	return rc_zedc_to_libz(rc);
+}
+
 static inline int __inflate(z_streamp strm, struct hw_state *s, int flush)
 {
 	int rc;
@@ -1383,37 +2588,64 @@ static inline int __check_stream_end(z_streamp strm)
 }
 
 /**
- * FIXME We use always the internal buffer. Using the external one
- *       results in minimal performance gain when using sgl-described
- *       buffers, but flat buffers are better anyways.
+ * Pick the DMA types for the caller's buffers and decide if the
+ * output can go straight into next_out. Registered buffers are used
+ * as they are: flat memory of our own handle or pinned plain
+ * memory. Plain output is used directly if it can take the entire
+ * obuf of a sglist stream or if it reaches ZLIB_ZEROCOPY_MIN. The
+ * caller restores h->dma_type afterwards.
+ *
+ * @return 1 if the output goes directly into next_out, else 0.
  */
-int h_inflate(z_streamp strm, int flush)
+static int h_inflate_direct(z_streamp strm, struct hw_state *s)
 {
-	int rc = Z_OK, use_internal_buffer = 1;
-	zedc_stream *h;
-	struct hw_state *s;
-	unsigned int loops = 0;
-	unsigned int obuf_bytes;
+	int reg;
+	enum zedc_mtype type;
+	zedc_stream *h = &s->h;
 
-	if (strm == NULL)
-		return Z_STREAM_ERROR;
+	/* Input is always read from the caller's buffer */
+	if ((strm->avail_in != 0) &&
+	    h_zerocopy_buf(s, strm->next_in, strm->avail_in, 0,
+			   &type, &reg) && reg)
+		h->dma_type[ZEDC_IN] = type;
 
-	s = (struct hw_state *)strm->state;
-	if (s == NULL)
-		return Z_STREAM_ERROR;
-	h = &s->h;
+	if (strm->avail_out == 0)
+		return 0;
 
-	if (s->obuf_total == 0) { /* Special case: buffering fully disabled */
-		stream_zlib_to_zedc(h, strm);
-		s->rc = rc_zedc_to_libz(__inflate(strm, s, flush));
-		stream_zedc_to_zlib(strm, h);
-		return s->rc;
+	if (!h_zerocopy_buf(s, strm->next_out, strm->avail_out, 1,
+			    &type, &reg))
+		return 0;
+
+	if (reg) {
+		h->dma_type[ZEDC_OUT] = type;
+		return 1;
 	}
 
 	/* Use internal buffer if the given output buffer is smaller */
-	if ((s->h.dma_type[ZEDC_OUT] & DDCB_DMA_TYPE_MASK) ==
-	    DDCB_DMA_TYPE_SGLIST)
-		use_internal_buffer = (s->obuf_total > strm->avail_out);
+	if (((h->dma_type[ZEDC_OUT] & DDCB_DMA_TYPE_MASK) ==
+	     DDCB_DMA_TYPE_SGLIST) && (s->obuf_total <= strm->avail_out))
+		return 1;
+
+	if ((zlib_zerocopy_min != 0) &&
+	    (strm->avail_out >= zlib_zerocopy_min)) {
+		h->dma_type[ZEDC_OUT] = DDCB_DMA_TYPE_SGLIST;
+		return 1;
+	}
+	return 0;
+}
+
+static int h_inflate_buffered(z_streamp strm, struct hw_state *s, int flush,
+			      int direct)
+{
+	int rc = Z_OK, use_internal_buffer = !direct;
+	zedc_stream *h = &s->h;
+	unsigned int loops = 0;
+	unsigned int obuf_bytes;
+
+	/* Lease mode: get obuf only if we are going to use it */
+	if (use_internal_buffer && s->lease && (s->obuf_base == NULL) &&
+	    (h_lease_buffers(s) < 0))
+		use_internal_buffer = 0;
 
 	hw_trace("[%p] h_inflate: flush=%s avail_in=%d avail_out=%d "
 		 "ibuf_avail=%d obuf_avail=%d use_int_buf=%d\n",
@@ -1596,6 +2828,198 @@ int h_inflate(z_streamp strm, int flush)
 	return rc_zedc_to_libz(rc);
 }
 
+/**
+ * Inflate input buffering: input chunks below the watermark
+ * (ibuf_total) are copied to ibuf and reported as consumed without a
+ * DDCB, but only if the output waiting in obuf fills the caller's
+ * buffer completely. Input is thus never reported consumed by a call
+ * which returns with output space left, see CONFIG_INFLATE_WATERMARK.
+ * Once the hardware saw the header of the final block, input is not
+ * collected anymore, so that data behind the end of the stream mostly
+ * stays with the caller.
+ *
+ * @return 1 if the input went to ibuf and obuf filled the output,
+ *         else 0.
+ */
+static int h_inflate_collect(z_streamp strm, struct hw_state *s, int flush)
+{
+	zedc_stream *h = &s->h;
+	unsigned int len = strm->avail_in;
+
+	if ((len == 0) || (strm->avail_out == 0) ||
+	    (s->rc == Z_STREAM_END) ||
+	    ((flush != Z_NO_FLUSH) && (flush != Z_PARTIAL_FLUSH)) ||
+	    (h->infl_stat & INFL_STAT_HDR_BFINAL) ||
+	    ((unsigned int)output_buffer_bytes(s) < strm->avail_out))
+		return 0;
+
+	/* Lease mode: get ibuf only if we are going to use it */
+	if (s->lease && (s->ibuf_base == NULL) && (h_lease_buffers(s) < 0))
+		return 0;
+
+	if (len >= s->ibuf_avail)	/* ibuf full, time for a DDCB */
+		return 0;
+
+	memcpy(s->ibuf, strm->next_in, len);
+	s->ibuf += len;
+	s->ibuf_avail -= len;
+
+	strm->next_in += len;
+	strm->avail_in = 0;
+	strm->total_in += len;
+
+	h_flush_obuf(strm);		/* fills avail_out, see above */
+	zlib_stats_inc(&zlib_stats.inflate_collected);
+	return 1;
+}
+
+/**
+ * Send the input collected in ibuf to the hardware, followed by the
+ * caller's input. The caller's input is appended to ibuf if it fits,
+ * so that both go with one DDCB. What the hardware does not take
+ * stays in ibuf for the next call. If the stream ends, the bytes
+ * behind it are given back. Older ones were reported consumed
+ * already, so next_in then points to a copy in ibuf_back, which stays
+ * valid until inflateEnd(). total_in counts the stream only.
+ */
+static int h_inflate_ibuf(z_streamp strm, struct hw_state *s, int flush)
+{
+	int rc;
+	unsigned int cur = 0, left;
+	uint8_t *back;
+	Bytef *next_in;
+	uInt avail_in;
+
+	if (strm->avail_in < s->ibuf_avail) {
+		cur = strm->avail_in;
+		memcpy(s->ibuf, strm->next_in, cur);
+		s->ibuf += cur;
+		s->ibuf_avail -= cur;
+		strm->next_in += cur;
+		strm->avail_in = 0;
+		strm->total_in += cur;
+	}
+
+	next_in = (Bytef *)strm->next_in;
+	avail_in = strm->avail_in;
+
+	strm->next_in = s->ibuf_base;
+	strm->avail_in = s->ibuf - s->ibuf_base;
+	strm->total_in -= strm->avail_in;
+
+	rc = h_inflate_buffered(strm, s, flush, 0);
+
+	left = strm->avail_in;
+	strm->total_in += left;
+	if (left)
+		memmove(s->ibuf_base, strm->next_in, left);
+	s->ibuf = s->ibuf_base + left;
+	s->ibuf_avail = s->ibuf_total - left;
+
+	strm->next_in = next_in;
+	strm->avail_in = avail_in;
+
+	if ((rc == Z_STREAM_END) && left) {
+		s->ibuf = s->ibuf_base;
+		s->ibuf_avail = s->ibuf_total;
+		strm->total_in -= left;
+
+		if (left <= cur) {	/* all of it came with this call */
+			strm->next_in -= left;
+			strm->avail_in += left;
+			return rc;
+		}
+
+		/* Older bytes: give them back together with the rest */
+		back = malloc(left + strm->avail_in);
+		if (back == NULL) {
+			pr_err("[%p] cannot give back %d bytes behind the "
+			       "end of the stream\n", strm, left);
+			return Z_MEM_ERROR;
+		}
+		memcpy(back, s->ibuf_base, left);
+		memcpy(back + left, strm->next_in, strm->avail_in);
+		free(s->ibuf_back);	/* could be next_in, copied above */
+
+		s->ibuf_back = back;
+		s->ibuf_back_len = left + strm->avail_in;
+		strm->next_in = back;
+		strm->avail_in = s->ibuf_back_len;
+		return rc;
+	}
+
+	if ((rc == Z_OK) && (left == 0) && (strm->avail_in != 0) &&
+	    (strm->avail_out != 0))
+		rc = h_inflate_buffered(strm, s, flush, 0);
+
+	return rc;
+}
+
+int h_inflate(z_streamp strm, int flush)
+{
+	int rc, direct;
+	zedc_stream *h;
+	struct hw_state *s;
+	enum zedc_mtype saved_in, saved_out;
+
+	if (strm == NULL)
+		return Z_STREAM_ERROR;
+
+	s = (struct hw_state *)strm->state;
+	if (s == NULL)
+		return Z_STREAM_ERROR;
+	h = &s->h;
+
+	saved_in = h->dma_type[ZEDC_IN];
+	saved_out = h->dma_type[ZEDC_OUT];
+	direct = h_inflate_direct(strm, s);
+
+	if (s->obuf_total == 0) { /* Special case: buffering fully disabled */
+		stream_zlib_to_zedc(h, strm);
+		s->rc = rc_zedc_to_libz(__inflate(strm, s, flush));
+		stream_zedc_to_zlib(strm, h);
+		rc = s->rc;
+	} else if (s->ibuf_total && h_inflate_collect(strm, s, flush)) {
+		rc = Z_OK;
+	} else if (s->ibuf != s->ibuf_base) {
+		/* ibuf has input which must go first, through obuf */
+		h->dma_type[ZEDC_IN] = saved_in;
+		h->dma_type[ZEDC_OUT] = saved_out;
+		rc = h_inflate_ibuf(strm, s, flush);
+		h_return_buffers(s);
+	} else {
+		if (direct)
+			zlib_stats_inc(&zlib_stats.inflate_zerocopy);
+
+		rc = h_inflate_buffered(strm, s, flush, direct);
+		h_return_buffers(s);
+	}
+
+	h->dma_type[ZEDC_IN] = saved_in;
+	h->dma_type[ZEDC_OUT] = saved_out;
+	return rc;
+}
+
+/**
+ * After the end of a stream, next_in can point to input given back in
+ * ibuf_back. Only this stream has it, so the caller must not switch to
+ * another implementation before it is consumed.
+ *
+ * @return True if next_in still points into ibuf_back.
+ */
+bool h_inflate_holds_input(z_streamp strm)
+{
+	struct hw_state *s;
+
+	if ((strm == NULL) || (strm->state == NULL))
+		return false;
+
+	s = (struct hw_state *)strm->state;
+	return (s->ibuf_back != NULL) && (strm->avail_in != 0) &&
+		(strm->next_in >= s->ibuf_back) &&
+		(strm->next_in < s->ibuf_back + s->ibuf_back_len);
+}
+
 int h_inflateEnd(z_streamp strm)
 {
 	int rc;
@@ -1621,12 +3045,131 @@ int h_inflateEnd(z_streamp strm)
 
 	rc = zedc_inflateEnd(h);
 
-	zedc_free(zedc, s->obuf_base, s->obuf_total, s->h.dma_type[ZEDC_OUT]);
-	__zedc_close((zedc_handle_t)h->device);
+	h_free_buffers(s);
+	free(s->ibuf_back);
+	__zedc_close(zedc);
 	__free(s);
 	return rc_zedc_to_libz(rc);
 }
 
+/**
+ * One-shot compress()/uncompress(): input and output are complete,
+ * so a single DDCB works on the caller's buffers directly, without
+ * ibuf/obuf and without saving the dictionary (ZEDC_FLG_ONE_SHOT).
+ * Only output left in the FIFO and the trailer take more calls,
+ * those do not need a DDCB.
+ *
+ * @return Z_OK, Z_BUF_ERROR if dest is too small or the data does
+ *         not fit into one DDCB, else an error. The caller repeats
+ *         failed ones in software.
+ */
+static int h_one_shot(int defl, Bytef *dest, uLongf *destLen,
+		      const Bytef *source, uLong sourceLen, int level)
+{
+	int rc, err_code = 0, reg;
+	int flags = defl ? zlib_deflate_flags : zlib_inflate_flags;
+	unsigned long progress;
+	struct hw_state *s;
+	zedc_stream *h;
+	zedc_handle_t zedc;
+
+	if ((sourceLen > UINT_MAX) || (*destLen > UINT_MAX))
+		return Z_BUF_ERROR;
+
+	s = calloc(1, sizeof(*s));
+	if (s == NULL)
+		return Z_MEM_ERROR;
+	h = &s->h;
+
+	s->card_type = zlib_accelerator;
+	s->card_no = zlib_card;
+	s->mode = DDCB_MODE_ASYNC | DDCB_MODE_RDWR;
+
+	if (flags & ZLIB_FLAG_USE_POLLING)
+		s->mode |= DDCB_MODE_POLLING;
+	if (flags & ZLIB_FLAG_USE_ADAPTIVE_POLLING)
+		s->mode |= DDCB_MODE_ADAPTIVE;
+
+	zedc = __zedc_open(s->card_no, s->card_type, s->mode, &err_code);
+	if (!zedc) {
+		rc = Z_STREAM_ERROR;
+		goto free_hw_state;
+	}
+	h->device = zedc;
+	h->dma_type[ZEDC_WS] = DDCB_DMA_TYPE_SGLIST;
+
+	if (!h_zerocopy_buf(s, source, sourceLen, 0,
+			    &h->dma_type[ZEDC_IN], &reg) ||
+	    !h_zerocopy_buf(s, dest, *destLen, 1,
+			    &h->dma_type[ZEDC_OUT], &reg)) {
+		rc = Z_STREAM_ERROR;
+		goto close_card;
+	}
+
+	h->flags |= ZEDC_FLG_ONE_SHOT;
+	if (zlib_xcheck)
+		h->flags |= ZEDC_FLG_CROSS_CHECK;
+	if (zedc_verbose & ZEDC_VERBOSE_DDCB)
+		h->flags |= ZEDC_FLG_DEBUG_DATA;
+
+	if (defl)
+		rc = zedc_deflateInit2(h, level, Z_DEFLATED, MAX_WBITS, 8,
+				       Z_DEFAULT_STRATEGY);
+	else
+		rc = zedc_inflateInit2(h, MAX_WBITS);
+	if (rc != ZEDC_OK) {
+		rc = rc_zedc_to_libz(rc);
+		goto close_card;
+	}
+
+	h->next_in = source;
+	h->avail_in = sourceLen;
+	h->next_out = dest;
+	h->avail_out = *destLen;
+
+	hw_trace("[%p] h_%s: level=%d sourceLen=%lu destLen=%lu\n", dest,
+		 defl ? "compress2" : "uncompress", level, sourceLen,
+		 (unsigned long)*destLen);
+	do {
+		progress = h->total_in + h->total_out;
+		rc = defl ? zedc_deflate(h, ZEDC_FINISH) :
+			zedc_inflate(h, ZEDC_FINISH);
+	} while ((rc == ZEDC_OK) && (h->total_in + h->total_out != progress));
+
+	hw_trace("[%p]   total_in=%lu total_out=%lu rc=%d\n", dest,
+		 h->total_in, h->total_out, rc);
+
+	if (rc == ZEDC_STREAM_END) {
+		*destLen = h->total_out;
+		rc = Z_OK;
+	} else if ((rc == ZEDC_OK) || (rc == ZEDC_BUF_ERROR))
+		rc = Z_BUF_ERROR;
+	else
+		rc = rc_zedc_to_libz(rc);
+
+	if (defl)
+		zedc_deflateEnd(h);
+	else
+		zedc_inflateEnd(h);
+ close_card:
+	__zedc_close(zedc);
+ free_hw_state:
+	__free(s);
+	return rc;
+}
+
+int h_compress2(Bytef *dest, uLongf *destLen, const Bytef *source,
+		uLong sourceLen, int level)
+{
+	return h_one_shot(1, dest, destLen, source, sourceLen, level);
+}
+
+int h_uncompress(Bytef *dest, uLongf *destLen, const Bytef *source,
+		 uLong sourceLen)
+{
+	return h_one_shot(0, dest, destLen, source, sourceLen, 0);
+}
+
 /**
  * ZEDC_VERBOSE:
  *   0x0000cczz
@@ -1643,6 +3186,14 @@ void zedc_hw_init(void)
 	char *obuf_s = getenv("ZLIB_OBUF_TOTAL");
 	char *card = getenv("ZLIB_CARD");
 	char *xcheck_str = getenv("ZLIB_CROSS_CHECK");
+	char *pool_s = getenv("ZLIB_POOL_DEPTH");
+	char *lease_max_s = getenv("ZLIB_LEASE_MAX");
+	char *lease_wait_s = getenv("ZLIB_LEASE_WAIT");
+	char *zerocopy_s = getenv("ZLIB_ZEROCOPY_MIN");
+	char *segments_s = getenv("ZLIB_PARALLEL_SEGMENTS");
+	char *spill_s = getenv("ZLIB_SPILL_WAIT");
+	char *watermark_s = getenv("ZLIB_INFLATE_WATERMARK");
+	unsigned int pool_depth = CONFIG_POOL_DEPTH;
 
 	ddcb_set_logfile(zlib_log);
 	zedc_set_logfile(zlib_log);
@@ -1661,6 +3212,8 @@ void zedc_hw_init(void)
 	if (accel != NULL) {
 		if (strncmp(accel, "CAPI", 4) == 0)
 			zlib_accelerator = DDCB_TYPE_CAPI;
+		else if (strncmp(accel, "SW", 2) == 0)
+			zlib_accelerator = DDCB_TYPE_SW;
 		else
 			zlib_accelerator = DDCB_TYPE_GENWQE;
 	}
@@ -1681,6 +3234,28 @@ void zedc_hw_init(void)
 	if (obuf_s != NULL)
 		zlib_obuf_total = str_to_num(obuf_s);
 
+	if (pool_s != NULL)
+		pool_depth = str_to_num(pool_s);
+	zedc_pool_set_depth(pool_depth);
+
+	if (lease_max_s != NULL)
+		zlib_lease_max = str_to_num(lease_max_s);
+
+	if (lease_wait_s != NULL)
+		zlib_lease_wait = str_to_num(lease_wait_s);
+
+	if (zerocopy_s != NULL)
+		zlib_zerocopy_min = str_to_num(zerocopy_s);
+
+	if (segments_s != NULL)
+		zlib_parallel_segments = str_to_num(segments_s);
+
+	if (spill_s != NULL)
+		zlib_spill_wait = str_to_num(spill_s);
+
+	if (watermark_s != NULL)
+		zlib_inflate_watermark = str_to_num(watermark_s);
+
 	/*
 	 * USE_FLAT_BUFFERS and CACHE_HANDLES only work for GenWQE.
 	 */
@@ -1692,6 +3267,60 @@ void zedc_hw_init(void)
 	}
 }
 
+/**
+ * zedc_hw_saturated() - Check if new streams should avoid the hardware
+ *
+ * True if DDCBs of this process wait for a free slot on the
+ * accelerator and a new one would wait at least zlib_spill_wait
+ * usec. Streams already running keep their DDCBs queued.
+ */
+bool zedc_hw_saturated(void)
+{
+	int rc;
+	unsigned int queued, waiting;
+	uint64_t wait_usec;
+
+	rc = accel_get_load(zlib_accelerator, &queued, &waiting, &wait_usec);
+	if ((rc != DDCB_OK) || (waiting == 0) || (wait_usec < zlib_spill_wait))
+		return false;
+
+	hw_trace("accelerator saturated: queued=%u waiting=%u "
+		 "wait=%llu usec\n", queued, waiting,
+		 (unsigned long long)wait_usec);
+	return true;
+}
+
+/**
+ * zedc_hw_buf_size() - Input buffer size of hardware deflate streams
+ *
+ * Callers collecting data for deflate() use it to hand over as much
+ * as one DDCB takes.
+ */
+unsigned int zedc_hw_buf_size(void)
+{
+	return zlib_ibuf_total ? zlib_ibuf_total : CONFIG_DEFLATE_BUF_SIZE;
+}
+
+/**
+ * zedc_hw_inflate_watermark() - Input collected by hardware inflate
+ *
+ * zlib/gzip streams starting with a small chunk still go to the
+ * hardware if it collects at least this many bytes per DDCB. 0 if
+ * inflate input buffering is off.
+ */
+unsigned int zedc_hw_inflate_watermark(void)
+{
+	return zlib_obuf_total ? zlib_inflate_watermark : 0;
+}
+
+void zedc_hw_stats(struct zlib_stats *s)
+{
+	zedc_pool_stats(&s->pool_hits, &s->pool_misses);
+	zedc_pin_stats(&s->pin_hits, &s->pin_misses);
+	zedc_skip_dict_stats(&s->skip_dict_hits, &s->skip_dict_misses,
+			     &s->skip_dict_wasted_usec);
+}
+
 void zedc_hw_done(void)
 {
 	unsigned int card_no;
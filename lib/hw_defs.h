@@ -22,6 +22,7 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <sys/syscall.h>   /* For SYS_xxx definitions */
+#include <sys/time.h>
 
 #include <libddcb.h>
 
@@ -38,6 +39,14 @@ static inline pid_t gettid(void)
 	return (pid_t)syscall(SYS_gettid);
 }
 
+static inline unsigned long zedc_usec(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+	return t.tv_sec * 1000000 + t.tv_usec;
+}
+
 extern int zedc_dbg;
 extern FILE *zedc_log;
 
@@ -84,6 +93,8 @@ struct zedc_dev_t {
 	int zedc_rc;		/* libzedc return codes; detailed info
 				 * in cases were we needed to return.
 				 */
+	int card_no;		/* as passed to zedc_open */
+	int card_type;
 	accel_t card;		/* Ptr. to card */
 	int card_rc;		/* libcard return codes */
 	int card_errno;
@@ -146,7 +157,35 @@ static inline int dyn_huffman_supported(zedc_handle_t zedc)
  * @param cmd	pointer to command descriptor
  */
 int zedc_execute_request(zedc_handle_t zedc, struct ddcb_cmd *cmd);
+
+/**
+ * @brief	asynchronous variant: the DDCB runs while the caller
+ *		continues, collect it with zedc_wait_request.
+ */
+int zedc_submit_request(zedc_handle_t zedc, struct ddcb_cmd *cmd);
+int zedc_wait_request(zedc_handle_t zedc, struct ddcb_cmd *cmd);
+
+/**
+ * @brief	in-place variant: the ASIV is written directly into the
+ *		DDCB queue slot and the ASV is read from there, which
+ *		avoids the copies through struct ddcb_cmd.
+ */
+int zedc_reserve_request(zedc_handle_t zedc, struct ddcb_slot *slot,
+			 struct ddcb_cmd *cmd);
+int zedc_commit_request(zedc_handle_t zedc, struct ddcb_slot *slot,
+			struct ddcb_cmd *cmd);
+void zedc_release_request(zedc_handle_t zedc, struct ddcb_slot *slot);
 int zedc_alloc_workspace(zedc_streamp strm);
+
+/**
+ * @brief	ZEDC_FLG_SKIP_LAST_DICT: predict if a Z_FINISH DDCB can
+ *		omit SAVE_DICT, learn from the ratio of finished DDCBs
+ *		and account hits and misses.
+ */
+int zedc_skip_dict(zedc_streamp strm, int defl);
+void zedc_skip_dict_learn(zedc_streamp strm, int defl, uint32_t in,
+			  uint32_t out);
+void zedc_skip_dict_result(zedc_streamp strm, int hit, unsigned long usec);
 int zedc_free_workspace(zedc_streamp strm);
 
 void zedc_asv_infl_print(zedc_streamp strm);
@@ -165,5 +204,6 @@ void zedc_asiv_defl_print(zedc_streamp strm, int dbg);
  */
 int zedc_format_init(struct zedc_stream_s *strm);
 unsigned long __adler32(unsigned long adl, const unsigned char *buf, int len);
+unsigned long __crc32(unsigned long crc, const unsigned char *buf, int len);
 
 #endif	/* __ZEDC_DEFS_H__ */
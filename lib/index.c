@@ -0,0 +1,651 @@
+/*
+ * Copyright 2017, International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Random access into compressed files.
+ *
+ * zlib_index_build() inflates a file once in hardware. Every @span
+ * bytes of output it takes a snapshot of the state the inflate DDCBs
+ * pass on to each other: the bits left in the tree/scratch area, the
+ * checksums and the dictionary. Together with the compressed offset
+ * of the next input byte and the uncompressed offset reached so far
+ * this is an access point. zlib_index_extract() restores the last
+ * access point in front of the requested data on a new stream and
+ * inflates only from there.
+ *
+ * Members of multi-member gzip files start on a fresh stream, their
+ * access points carry no state. Snapshots are deflated with the
+ * software zlib, in memory as well as in the index file.
+ *
+ * Index file, all numbers little endian:
+ *   "ZIDX", u32 version, s32 windowBits, u32 points, u64 span,
+ *   u64 uncompressed size, then per point:
+ *   u64 coffs, u64 uoffs, u32 snapshot length, u32 deflated length,
+ *   deflated snapshot.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <asm/byteorder.h>
+
+#include <zlib.h>
+#include <libzHW.h>
+#include "wrapper.h"
+
+#define IDX_SPAN		(1 * 1024 * 1024) /* default point distance */
+#define IDX_CHUNK		(256 * 1024)	  /* input per read */
+#define IDX_OBUF		(1 * 1024 * 1024) /* output while skipping */
+#define IDX_OUT_MAX		(1024 * 1024 * 1024) /* output per inflate */
+#define IDX_MAGIC		"ZIDX"
+#define IDX_VERSION		1
+#define IDX_HDR_LEN		32
+#define IDX_POINT_LEN		24
+
+struct idx_point {
+	uint64_t coffs;			/* compressed file offset */
+	uint64_t uoffs;			/* uncompressed offset */
+	uint32_t len;			/* snapshot, 0 at a member start */
+	uint32_t clen;
+	uint8_t *data;			/* deflated snapshot */
+};
+
+struct zlib_index {
+	int windowBits;
+	uint64_t span;
+	uint64_t size;			/* uncompressed size */
+	unsigned long n;
+	unsigned long max;
+	struct idx_point *pt;
+};
+
+static int idx_pread(int fd, uint8_t *buf, size_t len, uint64_t offs,
+		     size_t *got)
+{
+	ssize_t n;
+
+	*got = 0;
+	while (*got < len) {
+		n = pread(fd, buf + *got, len - *got, offs + *got);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_err("index read failed: %s\n", strerror(errno));
+			return Z_ERRNO;
+		}
+		if (n == 0)
+			break;
+		*got += n;
+	}
+	return Z_OK;
+}
+
+static int idx_read(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+	uint8_t *p = buf;
+
+	while (len) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return Z_ERRNO;
+		p += n;
+		len -= n;
+	}
+	return Z_OK;
+}
+
+static int idx_write(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+	const uint8_t *p = buf;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_err("index write failed: %s\n", strerror(errno));
+			return Z_ERRNO;
+		}
+		p += n;
+		len -= n;
+	}
+	return Z_OK;
+}
+
+static inline int is_gzip(int windowBits)
+{
+	return windowBits > 15;
+}
+
+static struct idx_point *idx_new_point(struct zlib_index *idx)
+{
+	struct idx_point *pt;
+
+	if (idx->n == idx->max) {
+		unsigned long max = idx->max ? 2 * idx->max : 64;
+
+		pt = realloc(idx->pt, max * sizeof(*pt));
+		if (pt == NULL)
+			return NULL;
+		idx->pt = pt;
+		idx->max = max;
+	}
+	pt = &idx->pt[idx->n];
+	memset(pt, 0, sizeof(*pt));
+	return pt;
+}
+
+/* Append access point, @snap is deflated in software */
+static int idx_add(struct zlib_index *idx, uint64_t coffs, uint64_t uoffs,
+		   const uint8_t *snap, unsigned int len)
+{
+	int rc;
+	z_stream zs;
+	struct idx_point *pt;
+
+	pt = idx_new_point(idx);
+	if (pt == NULL)
+		return Z_MEM_ERROR;
+
+	pt->coffs = coffs;
+	pt->uoffs = uoffs;
+	if (len) {
+		memset(&zs, 0, sizeof(zs));
+		rc = z_deflateInit2_(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				     -MAX_WBITS, 8, Z_DEFAULT_STRATEGY,
+				     ZLIB_VERSION, (int)sizeof(zs));
+		if (rc != Z_OK)
+			return rc;
+
+		pt->clen = z_deflateBound(&zs, len);
+		pt->data = malloc(pt->clen);
+		if (pt->data == NULL) {
+			z_deflateEnd(&zs);
+			return Z_MEM_ERROR;
+		}
+		zs.next_in = (uint8_t *)snap;
+		zs.avail_in = len;
+		zs.next_out = pt->data;
+		zs.avail_out = pt->clen;
+		rc = z_deflate(&zs, Z_FINISH);
+		z_deflateEnd(&zs);
+		if (rc != Z_STREAM_END) {
+			free(pt->data);
+			return Z_STREAM_ERROR;
+		}
+		pt->len = len;
+		pt->clen = zs.total_out;
+	}
+
+	idx->n++;
+	zlib_stats_inc(&zlib_stats.index_points);
+	return Z_OK;
+}
+
+/* Inflate the snapshot of @pt into @snap (ZEDC_SNAPSHOT_MAX bytes) */
+static int idx_snapshot(const struct idx_point *pt, uint8_t *snap)
+{
+	int rc;
+	z_stream zs;
+
+	if (pt->len > ZEDC_SNAPSHOT_MAX)
+		return Z_DATA_ERROR;
+
+	memset(&zs, 0, sizeof(zs));
+	rc = z_inflateInit2_(&zs, -MAX_WBITS, ZLIB_VERSION, (int)sizeof(zs));
+	if (rc != Z_OK)
+		return rc;
+
+	zs.next_in = pt->data;
+	zs.avail_in = pt->clen;
+	zs.next_out = snap;
+	zs.avail_out = pt->len;
+	rc = z_inflate(&zs, Z_FINISH);
+	z_inflateEnd(&zs);
+
+	if (rc != Z_STREAM_END || zs.total_out != pt->len)
+		return Z_DATA_ERROR;
+	return Z_OK;
+}
+
+/*
+ * After the end of a member: Z_OK if another gzip member follows in
+ * the input, Z_STREAM_END if the file ends here.
+ */
+static int idx_next_member(struct zlib_index *idx, z_stream *strm, int fd,
+			   uint8_t *in, uint64_t *pos, int *eof)
+{
+	int rc;
+	size_t n;
+
+	if (!is_gzip(idx->windowBits))
+		return Z_STREAM_END;
+
+	if (strm->avail_in == 0 && !*eof) {
+		rc = idx_pread(fd, in, IDX_CHUNK, *pos, &n);
+		if (rc != Z_OK)
+			return rc;
+		*pos += n;
+		*eof = (n == 0);
+		strm->next_in = in;
+		strm->avail_in = n;
+	}
+	if (strm->avail_in == 0)
+		return Z_STREAM_END;
+
+	/* Like gzip: ignore trailing data which is not a member */
+	if ((strm->avail_in >= 2) &&
+	    ((strm->next_in[0] != 0x1f) || (strm->next_in[1] != 0x8b)))
+		return Z_STREAM_END;
+
+	return h_inflateReset(strm);
+}
+
+int zlib_index_build(int fd, int windowBits, uint64_t span,
+		     struct zlib_index **index)
+{
+	int rc, eof = 0, flush;
+	z_stream strm;
+	uint8_t *in, *out, *snap;
+	uint64_t pos = 0, coffs, uoffs = 0, last = 0;
+	unsigned int snap_len, produced;
+	struct zlib_index *idx;
+	size_t n;
+
+	if (index == NULL)
+		return Z_STREAM_ERROR;
+	*index = NULL;
+
+	idx = calloc(1, sizeof(*idx));
+	in = malloc(IDX_CHUNK);
+	out = malloc(IDX_OBUF);
+	snap = malloc(ZEDC_SNAPSHOT_MAX);
+	if (!idx || !in || !out || !snap) {
+		rc = Z_MEM_ERROR;
+		goto free_bufs;
+	}
+	idx->windowBits = windowBits;
+	idx->span = span ? span : IDX_SPAN;
+
+	memset(&strm, 0, sizeof(strm));
+	rc = h_inflateInit2_(&strm, windowBits, ZLIB_VERSION,
+			     (int)sizeof(strm));
+	if (rc != Z_OK)
+		goto free_bufs;
+
+	rc = idx_add(idx, 0, 0, NULL, 0);
+	if (rc != Z_OK)
+		goto inflate_end;
+
+	for (;;) {
+		if (strm.avail_in == 0 && !eof) {
+			rc = idx_pread(fd, in, IDX_CHUNK, pos, &n);
+			if (rc != Z_OK)
+				break;
+			pos += n;
+			eof = (n == 0);
+			strm.next_in = in;
+			strm.avail_in = n;
+		}
+		flush = eof ? Z_FINISH : Z_NO_FLUSH;
+		strm.next_out = out;
+		strm.avail_out = IDX_OBUF;
+		rc = h_inflate(&strm, flush);
+
+		produced = IDX_OBUF - strm.avail_out;
+		uoffs += produced;
+		coffs = pos - strm.avail_in;
+
+		if (rc == Z_STREAM_END) {
+			rc = idx_next_member(idx, &strm, fd, in, &pos, &eof);
+			if (rc == Z_STREAM_END) {
+				rc = Z_OK;
+				break;
+			}
+			if (rc != Z_OK)
+				break;
+
+			coffs = pos - strm.avail_in;
+			if (uoffs - last >= idx->span) {
+				rc = idx_add(idx, coffs, uoffs, NULL, 0);
+				if (rc != Z_OK)
+					break;
+				last = uoffs;
+			}
+			continue;
+		}
+		if (rc == Z_NEED_DICT) {
+			rc = Z_DATA_ERROR;
+			break;
+		}
+		if (rc != Z_OK && rc != Z_BUF_ERROR)
+			break;
+		if (eof && strm.avail_in == 0 && produced == 0) {
+			pr_err("index: compressed data truncated\n");
+			rc = Z_DATA_ERROR;
+			break;
+		}
+
+		if ((uoffs - last >= idx->span) &&
+		    (h_inflateSnapshot(&strm, snap, &snap_len) == Z_OK)) {
+			rc = idx_add(idx, coffs, uoffs, snap, snap_len);
+			if (rc != Z_OK)
+				break;
+			last = uoffs;
+		}
+	}
+	idx->size = uoffs;
+
+ inflate_end:
+	h_inflateEnd(&strm);
+ free_bufs:
+	free(snap);
+	free(out);
+	free(in);
+	if (rc == Z_OK)
+		*index = idx;
+	else
+		zlib_index_free(idx);
+	return rc;
+}
+
+void zlib_index_free(struct zlib_index *idx)
+{
+	unsigned long i;
+
+	if (idx == NULL)
+		return;
+
+	for (i = 0; i < idx->n; i++)
+		free(idx->pt[i].data);
+	free(idx->pt);
+	free(idx);
+}
+
+unsigned long zlib_index_points(struct zlib_index *idx)
+{
+	return idx ? idx->n : 0;
+}
+
+uint64_t zlib_index_size(struct zlib_index *idx)
+{
+	return idx ? idx->size : 0;
+}
+
+int zlib_index_write(struct zlib_index *idx, int fd)
+{
+	int rc;
+	unsigned long i;
+	uint8_t hdr[IDX_HDR_LEN];
+	uint8_t rec[IDX_POINT_LEN];
+	uint32_t v32;
+	uint64_t v64;
+
+	if (idx == NULL)
+		return Z_STREAM_ERROR;
+
+	memcpy(&hdr[0], IDX_MAGIC, 4);
+	v32 = __cpu_to_le32(IDX_VERSION);
+	memcpy(&hdr[4], &v32, 4);
+	v32 = __cpu_to_le32((uint32_t)idx->windowBits);
+	memcpy(&hdr[8], &v32, 4);
+	v32 = __cpu_to_le32((uint32_t)idx->n);
+	memcpy(&hdr[12], &v32, 4);
+	v64 = __cpu_to_le64(idx->span);
+	memcpy(&hdr[16], &v64, 8);
+	v64 = __cpu_to_le64(idx->size);
+	memcpy(&hdr[24], &v64, 8);
+
+	rc = idx_write(fd, hdr, sizeof(hdr));
+	for (i = 0; (rc == Z_OK) && (i < idx->n); i++) {
+		struct idx_point *pt = &idx->pt[i];
+
+		v64 = __cpu_to_le64(pt->coffs);
+		memcpy(&rec[0], &v64, 8);
+		v64 = __cpu_to_le64(pt->uoffs);
+		memcpy(&rec[8], &v64, 8);
+		v32 = __cpu_to_le32(pt->len);
+		memcpy(&rec[16], &v32, 4);
+		v32 = __cpu_to_le32(pt->clen);
+		memcpy(&rec[20], &v32, 4);
+
+		rc = idx_write(fd, rec, sizeof(rec));
+		if (rc == Z_OK && pt->clen)
+			rc = idx_write(fd, pt->data, pt->clen);
+	}
+	return rc;
+}
+
+int zlib_index_read(int fd, struct zlib_index **index)
+{
+	int rc;
+	unsigned long i, n;
+	uint8_t hdr[IDX_HDR_LEN];
+	uint8_t rec[IDX_POINT_LEN];
+	uint32_t v32;
+	uint64_t v64;
+	struct zlib_index *idx;
+	struct idx_point *pt;
+
+	if (index == NULL)
+		return Z_STREAM_ERROR;
+	*index = NULL;
+
+	rc = idx_read(fd, hdr, sizeof(hdr));
+	if (rc != Z_OK)
+		return Z_DATA_ERROR;
+
+	memcpy(&v32, &hdr[4], 4);
+	if (memcmp(&hdr[0], IDX_MAGIC, 4) ||
+	    (__le32_to_cpu(v32) != IDX_VERSION))
+		return Z_DATA_ERROR;
+
+	idx = calloc(1, sizeof(*idx));
+	if (idx == NULL)
+		return Z_MEM_ERROR;
+
+	memcpy(&v32, &hdr[8], 4);
+	idx->windowBits = (int32_t)__le32_to_cpu(v32);
+	memcpy(&v32, &hdr[12], 4);
+	n = __le32_to_cpu(v32);
+	memcpy(&v64, &hdr[16], 8);
+	idx->span = __le64_to_cpu(v64);
+	memcpy(&v64, &hdr[24], 8);
+	idx->size = __le64_to_cpu(v64);
+
+	for (i = 0; i < n; i++) {
+		rc = idx_read(fd, rec, sizeof(rec));
+		if (rc != Z_OK) {
+			rc = Z_DATA_ERROR;
+			goto err;
+		}
+		pt = idx_new_point(idx);
+		if (pt == NULL) {
+			rc = Z_MEM_ERROR;
+			goto err;
+		}
+		memcpy(&v64, &rec[0], 8);
+		pt->coffs = __le64_to_cpu(v64);
+		memcpy(&v64, &rec[8], 8);
+		pt->uoffs = __le64_to_cpu(v64);
+		memcpy(&v32, &rec[16], 4);
+		pt->len = __le32_to_cpu(v32);
+		memcpy(&v32, &rec[20], 4);
+		pt->clen = __le32_to_cpu(v32);
+
+		if ((pt->len > ZEDC_SNAPSHOT_MAX) || (!pt->len != !pt->clen) ||
+		    (pt->clen > z_compressBound(ZEDC_SNAPSHOT_MAX)) ||
+		    (i && pt->uoffs < idx->pt[i - 1].uoffs) ||
+		    (!i && pt->uoffs != 0)) {
+			rc = Z_DATA_ERROR;
+			goto err;
+		}
+		if (pt->clen) {
+			pt->data = malloc(pt->clen);
+			if (pt->data == NULL) {
+				rc = Z_MEM_ERROR;
+				goto err;
+			}
+			idx->n++;	/* free data on error */
+			rc = idx_read(fd, pt->data, pt->clen);
+			if (rc != Z_OK) {
+				rc = Z_DATA_ERROR;
+				goto err;
+			}
+		} else
+			idx->n++;
+	}
+	if (n == 0) {
+		rc = Z_DATA_ERROR;
+		goto err;
+	}
+
+	*index = idx;
+	return Z_OK;
+
+ err:
+	zlib_index_free(idx);
+	return rc;
+}
+
+/* Last access point at or before uncompressed offset @offset */
+static struct idx_point *idx_find(struct zlib_index *idx, uint64_t offset)
+{
+	unsigned long lo = 0, hi = idx->n, mid;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->pt[mid].uoffs <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return &idx->pt[lo];
+}
+
+long zlib_index_extract(struct zlib_index *idx, int fd, uint64_t offset,
+			void *buf, size_t len)
+{
+	int rc, eof = 0, flush;
+	z_stream strm;
+	struct idx_point *pt;
+	uint8_t *in, *skip_buf = NULL, *snap = NULL;
+	uint64_t pos, skip;
+	unsigned int avail, produced;
+	size_t got = 0, n;
+
+	if (idx == NULL || buf == NULL)
+		return Z_STREAM_ERROR;
+	if (len > LONG_MAX)
+		len = LONG_MAX;
+	if (offset >= idx->size || len == 0)
+		return 0;
+
+	pt = idx_find(idx, offset);
+	pos = pt->coffs;
+	skip = offset - pt->uoffs;
+
+	in = malloc(IDX_CHUNK);
+	if (skip)
+		skip_buf = malloc(IDX_OBUF);
+	if (pt->len)
+		snap = malloc(ZEDC_SNAPSHOT_MAX);
+	if (!in || (skip && !skip_buf) || (pt->len && !snap)) {
+		rc = Z_MEM_ERROR;
+		goto free_bufs;
+	}
+
+	memset(&strm, 0, sizeof(strm));
+	rc = h_inflateInit2_(&strm, idx->windowBits, ZLIB_VERSION,
+			     (int)sizeof(strm));
+	if (rc != Z_OK)
+		goto free_bufs;
+
+	if (pt->len) {
+		rc = idx_snapshot(pt, snap);
+		if (rc == Z_OK)
+			rc = h_inflateRestore(&strm, snap, pt->len);
+		if (rc != Z_OK)
+			goto inflate_end;
+	}
+	zlib_stats_inc(&zlib_stats.index_seeks);
+
+	while (got < len) {
+		if (strm.avail_in == 0 && !eof) {
+			rc = idx_pread(fd, in, IDX_CHUNK, pos, &n);
+			if (rc != Z_OK)
+				break;
+			pos += n;
+			eof = (n == 0);
+			strm.next_in = in;
+			strm.avail_in = n;
+		}
+		flush = eof ? Z_FINISH : Z_NO_FLUSH;
+
+		if (skip) {
+			avail = MIN(skip, (uint64_t)IDX_OBUF);
+			strm.next_out = skip_buf;
+		} else {
+			avail = MIN(len - got, (size_t)IDX_OUT_MAX);
+			strm.next_out = (uint8_t *)buf + got;
+		}
+		strm.avail_out = avail;
+		rc = h_inflate(&strm, flush);
+
+		produced = avail - strm.avail_out;
+		if (skip)
+			skip -= produced;
+		else
+			got += produced;
+
+		if (rc == Z_STREAM_END) {
+			rc = idx_next_member(idx, &strm, fd, in, &pos, &eof);
+			if (rc == Z_STREAM_END) {
+				rc = Z_OK;
+				break;
+			}
+			if (rc != Z_OK)
+				break;
+			continue;
+		}
+		if (rc == Z_NEED_DICT) {
+			rc = Z_DATA_ERROR;
+			break;
+		}
+		if (rc != Z_OK && rc != Z_BUF_ERROR)
+			break;
+		if (eof && strm.avail_in == 0 && produced == 0) {
+			rc = Z_DATA_ERROR;
+			break;
+		}
+		rc = Z_OK;
+	}
+
+ inflate_end:
+	h_inflateEnd(&strm);
+ free_bufs:
+	free(snap);
+	free(skip_buf);
+	free(in);
+	return rc == Z_OK ? (long)got : rc;
+}
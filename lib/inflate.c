@@ -974,6 +974,20 @@ static int __save_buf_to_file(const char *fname, const uint8_t *buff, int len)
 	return ZEDC_OK;
 }
 
+/**
+ * @brief		Give up a DDCB which failed. If the ASIV was built
+ *			in place, keep a copy for zedc_inflateSaveBuffers().
+ */
+static void inflate_release_failed(zedc_handle_t zedc,
+				   struct ddcb_slot *slot,
+				   struct ddcb_cmd *cmd)
+{
+	if (slot->card_slot != NULL)
+		memcpy(cmd->asiv, slot->asiv, sizeof(cmd->asiv));
+
+	zedc_release_request(zedc, slot);
+}
+
 int zedc_inflateSaveBuffers(zedc_streamp strm, const char *prefix)
 {
 	int rc;
@@ -1026,6 +1040,62 @@ int zedc_inflateSaveBuffers(zedc_streamp strm, const char *prefix)
 	return ZEDC_OK;
 }
 
+static inline unsigned int one_shot_bits(const uint8_t *in, uint64_t bit,
+					 unsigned int n)
+{
+	unsigned int i, d = 0;
+
+	for (i = 0; i < n; i++, bit++)
+		d |= ((in[bit / 8] >> (bit % 8)) & 1) << i;
+	return d;
+}
+
+/**
+ * @brief	One-shot: skip empty blocks ending the stream
+ * @param in	input of the DDCB
+ * @param len	its length in bytes
+ * @param bit	bit position where the DDCB stopped
+ * @return	bit position behind the final block, 0 if anything
+ *		other than empty blocks follows
+ *
+ * A DDCB which fills the output exactly stops on the block boundary
+ * in front of the empty final block deflate writes with Z_FINISH.
+ * Without a saved dictionary it cannot be repeated, but empty fixed
+ * and stored blocks are easy to walk in software.
+ */
+static uint64_t one_shot_final_block(const uint8_t *in, uint64_t len,
+				     uint64_t bit)
+{
+	unsigned int hdr;
+
+	len *= 8;
+	while (bit + 3 <= len) {
+		hdr = one_shot_bits(in, bit, 3);
+		bit += 3;
+
+		switch (hdr >> 1) {
+		case 0x0:	/* stored: LEN 0, NLEN 0xffff */
+			bit = (bit + 7) & ~7ull;
+			if ((bit + 32 > len) ||
+			    (one_shot_bits(in, bit, 16) != 0x0000) ||
+			    (one_shot_bits(in, bit + 16, 16) != 0xffff))
+				return 0;
+			bit += 32;
+			break;
+		case 0x1:	/* fixed: EOB code only */
+			if ((bit + 7 > len) || one_shot_bits(in, bit, 7))
+				return 0;
+			bit += 7;
+			break;
+		default:
+			return 0;
+		}
+		if (hdr & 0x1)
+			return bit;
+	}
+	return 0;
+}
+
 /**
  * @brief		main function for decompression
  * @param strm		Common zedc parameter set.
@@ -1044,10 +1114,13 @@ int zedc_inflate(zedc_streamp strm, int flush)
 	struct zedc_asv_infl *asv;
 	zedc_handle_t zedc;
 	struct ddcb_cmd *cmd;
+	struct ddcb_slot slot = { .card_slot = NULL };
 
 	unsigned int i, tries = 1;
 	uint64_t out_dict = 0x0;
 	uint32_t out_dict_len = 0x0;
+	int skip_dict;
+	unsigned long usec = 0;
 
 	if (!strm)
 		return ZEDC_STREAM_ERROR;
@@ -1123,8 +1196,6 @@ int zedc_inflate(zedc_streamp strm, int flush)
 	cmd->asv_length	 = 0xc0 - 0x80;
 	cmd->ats = 0;
 	cmd->cmdopts = 0x0;
-	asiv = (struct zedc_asiv_infl *)&cmd->asiv;
-	asv = (struct zedc_asv_infl *)&cmd->asv;
 
 	/* input buffer: Use always SGL here */
 	if ((strm->dma_type[ZEDC_IN] & DDCB_DMA_TYPE_MASK) ==
@@ -1163,15 +1234,34 @@ int zedc_inflate(zedc_streamp strm, int flush)
 	if (strm->flags & ZEDC_FLG_CROSS_CHECK)
 		cmd->cmdopts |= DDCB_OPT_INFL_RAS_CHECK;	/* + RAS */
 
+	skip_dict = (flush == ZEDC_FINISH) && zedc_skip_dict(strm, 0);
+
+	/*
+	 * Build the ASIV right in the DDCB queue slot unless we might
+	 * need to repeat the DDCB or want to dump it.
+	 */
+	if (!skip_dict && !zedc_dbg) {
+		rc = zedc_reserve_request(zedc, &slot, cmd);
+		if (rc < 0)
+			return ZEDC_STREAM_ERROR;
+
+		asiv = (struct zedc_asiv_infl *)slot.asiv;
+		asv = (struct zedc_asv_infl *)slot.asv;
+	} else {
+		asiv = (struct zedc_asiv_infl *)&cmd->asiv;
+		asv = (struct zedc_asv_infl *)&cmd->asv;
+	}
+
 	/* Setup ASIV part (in big endian byteorder) */
-	set_inflate_asiv(strm, (struct zedc_asiv_infl *)&cmd->asiv);
+	set_inflate_asiv(strm, asiv);
 
 	/*
 	 * Optimization attempt: If we are called with Z_FINISH, and we
-	 * assume that the data will fit into the provided output
-	 * buffer, we try to run the hardware without dictionary save
-	 * function. If we do not see INFL_STAT_FINAL_EOB, we need to
-	 * restart with dictionary save option.
+	 * predict that the data will fit into the provided output
+	 * buffer (zedc_skip_dict()), we try to run the hardware
+	 * without dictionary save function. If we do not see
+	 * INFL_STAT_FINAL_EOB, we need to restart with dictionary save
+	 * option.
 	 *
 	 * The desire is to keep small transfers efficient. It will
 	 * not have significant effect if we deal with huge data
@@ -1180,8 +1270,7 @@ int zedc_inflate(zedc_streamp strm, int flush)
 	cmd->cmdopts |= DDCB_OPT_INFL_SAVE_DICT;	/* SAVE_DICT */
 	tries = 1;
 
-	if ((strm->flags & ZEDC_FLG_SKIP_LAST_DICT) &&
-	    (flush == ZEDC_FINISH) && (strm->avail_out > strm->avail_in * 2)) {
+	if (skip_dict) {
 		//static int count = 0;
 
 		out_dict = asiv->out_dict;
@@ -1190,7 +1279,7 @@ int zedc_inflate(zedc_streamp strm, int flush)
 		cmd->cmdopts &= ~DDCB_OPT_INFL_SAVE_DICT;
 		asiv->out_dict = 0x0;
 		asiv->out_dict_len = 0x0;
-		tries = 2;
+		tries = (strm->flags & ZEDC_FLG_ONE_SHOT) ? 1 : 2;
 
 		//if (count++ < 2)
 		//	fprintf(stderr, "[%s] Try to optimize dict transfer: "
@@ -1199,10 +1288,16 @@ int zedc_inflate(zedc_streamp strm, int flush)
 	}
 
 	for (i = 0; i < tries; i++) {
+		if (skip_dict && (i == 0))
+			usec = zedc_usec();
+
 		/* Execute inflate in HW */
-		zedc_asiv_infl_print(strm);
-		rc = zedc_execute_request(zedc, cmd);
-		zedc_asv_infl_print(strm);
+		if (slot.card_slot == NULL) {
+			zedc_asiv_infl_print(strm);
+			rc = zedc_execute_request(zedc, cmd);
+			zedc_asv_infl_print(strm);
+		} else
+			rc = zedc_commit_request(zedc, &slot, cmd);
 
 		strm->retc = cmd->retc;
 		strm->attn = cmd->attn;
@@ -1217,6 +1312,7 @@ int zedc_inflate(zedc_streamp strm, int flush)
 		    (cmd->retc == DDCB_RETC_FAULT) && (cmd->attn == 0x801A)) {
 			strm->adler32 = strm->dict_adler32;
 			pr_err("inflate ZEDC_NEED_DICT\n");
+			inflate_release_failed(zedc, &slot, cmd);
 			return ZEDC_NEED_DICT;
 		}
 
@@ -1239,6 +1335,7 @@ int zedc_inflate(zedc_streamp strm, int flush)
 			       "DDCB returned (RETC=%03x ATTN=%04x PROGR=%x) "
 			       "%s\n", rc, cmd->retc, cmd->attn, cmd->progress,
 			       cmd->retc == 0x102 ? "" : "ERR");
+			inflate_release_failed(zedc, &slot, cmd);
 			return ZEDC_STREAM_ERROR;
 		}
 
@@ -1249,8 +1346,8 @@ int zedc_inflate(zedc_streamp strm, int flush)
 		/* What a pity, we guessed wrong and need to
 		   repeat. We did not see the last byte in the last
 		   block yet! */
-		if ((strm->flags & ZEDC_FLG_SKIP_LAST_DICT) &&
-		    (flush == ZEDC_FINISH)) {
+		if (skip_dict && (i + 1 < tries)) {
+			zedc_skip_dict_result(strm, 0, zedc_usec() - usec);
 			cmd->cmdopts |= DDCB_OPT_INFL_SAVE_DICT;
 			asiv->out_dict = out_dict;
 			asiv->out_dict_len = out_dict_len;
@@ -1259,7 +1356,34 @@ int zedc_inflate(zedc_streamp strm, int flush)
 		}
 	}
 
+	if (skip_dict && (i == 0))
+		zedc_skip_dict_result(strm, 1, 0);
+
+	/* One-shot: without the dictionary the stream cannot go on */
+	if (i == tries && (strm->flags & ZEDC_FLG_ONE_SHOT)) {
+		uint64_t end = 0;
+
+		if ((asv->infl_stat & INFL_STAT_REACHED_EOB) &&
+		    (strm->pre_scratch_bits == 0) &&
+		    (__be32_to_cpu(asv->outp_returned) == strm->avail_out))
+			end = one_shot_final_block(strm->next_in,
+				strm->avail_in,
+				(uint64_t)__be32_to_cpu(asv->inp_processed) * 8 +
+				asv->proc_bits);
+		if (end == 0) {
+			zedc_release_request(zedc, &slot);
+			return ZEDC_BUF_ERROR;
+		}
+		asv->infl_stat |= INFL_STAT_FINAL_EOB;
+		asv->inp_processed = __cpu_to_be32(end / 8);
+		asv->proc_bits = end % 8;
+	}
+
 	get_inflate_asv(strm, asv);
+	zedc_release_request(zedc, &slot);
+	zedc_skip_dict_learn(strm, 0, strm->inp_processed,
+			     strm->outp_returned);
+
 	rc = post_scratch_upd(strm);
 	if (rc < 0) {
 		pr_err("inflate scratch update failed rc=%d\n", rc);
@@ -1359,6 +1483,7 @@ static void __inflateInit_state(zedc_streamp strm)
 	strm->adler32 = 1;
 	strm->eob_seen = 0;
 	strm->havedict = 0;
+	strm->skip_misses = 0;
 
 	strm->in_hdr_scratch_len = 0;
 	strm->in_hdr_bits = 0;
@@ -1422,6 +1547,7 @@ int zedc_inflateInit2(zedc_streamp strm, int windowBits)
 
 	/* initialize inflate */
 	strm->windowBits = windowBits;
+	strm->skip_ratio = 0;
 	__inflateInit_state(strm);
 
 	/* initialize Save & Restore */
@@ -1497,6 +1623,152 @@ int zedc_inflateGetDictionary(zedc_streamp strm,
 
 }
 
+/*
+ * Inflate snapshot: the state which is carried from one inflate DDCB
+ * to the next, i.e. the pending tree/scratch bits, the checksums and
+ * the dictionary. Restoring it on a fresh stream continues inflate
+ * at the input byte following the snapshot. All fields little endian,
+ * followed by scratch_len tree/scratch bytes and dict_len dictionary
+ * bytes.
+ */
+struct zedc_infl_snapshot {
+	uint8_t  version;
+	uint8_t  format;
+	uint8_t  hdr_ib;
+	uint8_t  scratch_ib;
+	uint8_t  infl_stat;
+	uint8_t  out_hdr_start_bits;
+	uint16_t scratch_len;
+	uint32_t crc32;
+	uint32_t adler32;
+	uint32_t tree_bits;
+	uint32_t pad_bits;
+	uint32_t scratch_bits;
+	uint32_t hdr_start;
+	uint16_t out_hdr_bits;
+	uint16_t copyblock_len;
+	uint16_t dict_len;
+	uint16_t rsvd;
+} __attribute__((__packed__));
+
+#define ZEDC_SNAPSHOT_VERSION	1
+
+/**
+ * @brief		Save inflate state between two DDCBs
+ * @param strm		Inflate stream
+ * @param buf		Buffer of at least ZEDC_SNAPSHOT_MAX bytes
+ * @param len		Returns the used length
+ * @return		ZEDC_OK, ZEDC_BUF_ERROR if the stream is not at
+ *			a point where it can be restarted: header not
+ *			yet removed, end of stream reached or output
+ *			still pending in the dictionary.
+ */
+int zedc_inflateSnapshot(zedc_streamp strm, uint8_t *buf, unsigned int *len)
+{
+	struct zedc_infl_snapshot *snap = (struct zedc_infl_snapshot *)buf;
+	uint8_t *p = buf + sizeof(*snap);
+	unsigned int scratch_len;
+
+	if (!strm || !buf || !len)
+		return ZEDC_STREAM_ERROR;
+
+	if (((strm->format != ZEDC_FORMAT_DEFL) &&
+	     (strm->header_state != HEADER_DONE)) || strm->eob_seen ||
+	    (strm->infl_stat & INFL_STAT_FINAL_EOB) ||
+	    (strm->obytes_in_dict != 0))
+		return ZEDC_BUF_ERROR;
+
+	scratch_len = (strm->hdr_ib + strm->tree_bits + strm->pad_bits +
+		       strm->scratch_ib + strm->scratch_bits + 7) / 8;
+	if ((scratch_len > ZEDC_TREE_LEN) || (strm->dict_len > 0x8000))
+		return ZEDC_BUF_ERROR;
+
+	memset(snap, 0, sizeof(*snap));
+	snap->version = ZEDC_SNAPSHOT_VERSION;
+	snap->format = strm->format;
+	snap->hdr_ib = strm->hdr_ib;
+	snap->scratch_ib = strm->scratch_ib;
+	snap->infl_stat = strm->infl_stat;
+	snap->out_hdr_start_bits = strm->out_hdr_start_bits;
+	snap->scratch_len = __cpu_to_le16(scratch_len);
+	snap->crc32 = __cpu_to_le32(strm->crc32);
+	snap->adler32 = __cpu_to_le32(strm->adler32);
+	snap->tree_bits = __cpu_to_le32(strm->tree_bits);
+	snap->pad_bits = __cpu_to_le32(strm->pad_bits);
+	snap->scratch_bits = __cpu_to_le32(strm->scratch_bits);
+	snap->hdr_start = __cpu_to_le32(strm->hdr_start);
+	snap->out_hdr_bits = __cpu_to_le16(strm->out_hdr_bits);
+	snap->copyblock_len = __cpu_to_le16(strm->copyblock_len);
+	snap->dict_len = __cpu_to_le16(strm->dict_len);
+
+	memcpy(p, strm->wsp->tree, scratch_len);
+	p += scratch_len;
+	memcpy(p, strm->wsp->dict[strm->wsp_page] + strm->out_dict_offs,
+	       strm->dict_len);
+	p += strm->dict_len;
+
+	*len = p - buf;
+	return ZEDC_OK;
+}
+
+/**
+ * @brief		Continue inflate from a snapshot
+ * @param strm		Stream after zedc_inflateInit2() or
+ *			zedc_inflateReset(). Its next_in must point to
+ *			the input byte which followed the snapshot.
+ * @param buf		Data from zedc_inflateSnapshot()
+ * @param len		Its length
+ * @return		ZEDC_OK or ZEDC_DATA_ERROR if buf is inconsistent
+ */
+int zedc_inflateRestore(zedc_streamp strm, const uint8_t *buf,
+			unsigned int len)
+{
+	struct zedc_infl_snapshot snap;
+	unsigned int scratch_len, dict_len;
+
+	if (!strm || !buf)
+		return ZEDC_STREAM_ERROR;
+
+	if (len < sizeof(snap))
+		return ZEDC_DATA_ERROR;
+
+	memcpy(&snap, buf, sizeof(snap));
+	scratch_len = __le16_to_cpu(snap.scratch_len);
+	dict_len = __le16_to_cpu(snap.dict_len);
+
+	if ((snap.version != ZEDC_SNAPSHOT_VERSION) ||
+	    (scratch_len > ZEDC_TREE_LEN) || (dict_len > 0x8000) ||
+	    (len != sizeof(snap) + scratch_len + dict_len))
+		return ZEDC_DATA_ERROR;
+
+	__inflateInit_state(strm);
+	strm->format = snap.format;
+	strm->header_state = HEADER_DONE;
+	strm->data_type = 0;
+
+	strm->hdr_ib = snap.hdr_ib;
+	strm->scratch_ib = snap.scratch_ib;
+	strm->infl_stat = snap.infl_stat;
+	strm->out_hdr_start_bits = snap.out_hdr_start_bits;
+	strm->crc32 = __le32_to_cpu(snap.crc32);
+	strm->adler32 = __le32_to_cpu(snap.adler32);
+	strm->tree_bits = __le32_to_cpu(snap.tree_bits);
+	strm->pad_bits = __le32_to_cpu(snap.pad_bits);
+	strm->scratch_bits = __le32_to_cpu(snap.scratch_bits);
+	strm->hdr_start = __le32_to_cpu(snap.hdr_start);
+	strm->out_hdr_bits = __le16_to_cpu(snap.out_hdr_bits);
+	strm->copyblock_len = __le16_to_cpu(snap.copyblock_len);
+
+	buf += sizeof(snap);
+	memcpy(strm->wsp->tree, buf, scratch_len);
+	buf += scratch_len;
+	memcpy(strm->wsp->dict[0], buf, dict_len);
+	strm->dict_len = dict_len;
+	strm->havedict = 1;
+
+	return ZEDC_OK;
+}
+
 /**
  * @brief		Reset inflate stream. Do not deallocate memory.
  * @param strm		Common zedc parameter set.
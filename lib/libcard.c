@@ -156,6 +156,29 @@ static struct fd_node *__fd_m_list = NULL;
 #define NUM_CARDS 16 /* max number of GenWQE cards in system */
 static unsigned int card_completed_ddcbs[NUM_CARDS] = { 0, };
 static unsigned int card_retried_ddcbs[NUM_CARDS] = { 0, };
+static uint64_t card_dispatched_bytes[NUM_CARDS] = { 0, };
+
+/* Load per card in Multi (Redundant) mode, protected by fds_mutex */
+#define CONFIG_DDCB_LOAD_BYTES	(64 * 1024) /* per request load */
+static unsigned int card_out_ddcbs[NUM_CARDS] = { 0, };	/* requests */
+static uint64_t card_out_bytes[NUM_CARDS] = { 0, };
+
+/* DDCBs retried because the card was busy, atomic */
+static unsigned int card_busy_ddcbs = 0;
+
+static inline void __busy_get(bool *busy)
+{
+	if (!*busy)
+		__atomic_add_fetch(&card_busy_ddcbs, 1, __ATOMIC_RELAXED);
+	*busy = true;
+}
+
+static inline void __busy_put(bool *busy)
+{
+	if (*busy)
+		__atomic_sub_fetch(&card_busy_ddcbs, 1, __ATOMIC_RELAXED);
+	*busy = false;
+}
 
 #if defined(CONFIG_USE_SIGNAL)
 static unsigned int card_health_signal = 0;
@@ -407,6 +430,90 @@ static int __fd_get(struct card_dev_t *dev, int *card_num)
 	return fd;
 }
 
+/*
+ * Input bytes of a DDCB chain. The application commands keep the
+ * input length at ASIV offset 8, others are counted as 0 bytes.
+ */
+static uint64_t __ddcb_chain_bytes(struct genwqe_ddcb_cmd *req)
+{
+	uint64_t bytes = 0;
+	uint32_t len;
+
+	for (; req != NULL;
+	     req = (struct genwqe_ddcb_cmd *)(unsigned long)req->next_addr) {
+		if (req->acfunc != DDCB_ACFUNC_APP)
+			continue;
+		memcpy(&len, &req->asiv[8], sizeof(len));
+		bytes += __be32_to_cpu(len);
+	}
+	return bytes;
+}
+
+/*
+ * Note: fds_mutex must be held. Get the fd of the card with the least
+ * outstanding work in multi fd (Redundant) Mode. The search starts at
+ * the current position, such that equally loaded cards take turns.
+ */
+static int __fd_m_get_least(struct card_dev_t *dev, int *card_num)
+{
+	struct fd_node *now, *best = NULL;
+	uint64_t load, best_load = UINT64_MAX;
+	int i;
+
+	now = dev->m_fd_ptr;
+	for (i = 0; (now != NULL) && (i < lib_data.fd_m_count); i++) {
+		load = card_out_bytes[now->card_num] +
+			(uint64_t)card_out_ddcbs[now->card_num] *
+			CONFIG_DDCB_LOAD_BYTES;
+		if (load < best_load) {
+			best_load = load;
+			best = now;
+		}
+		now = now->next;
+		if (NULL == now)
+			now = __fd_m_list;
+	}
+	if (best)
+		dev->m_fd_ptr = best;
+	return __fd_m_get_and_inc(dev, card_num);
+}
+
+/*
+ * Get a fd for a DDCB chain of the given size and account it as
+ * outstanding on that card, see __fd_put_load() for the release.
+ */
+static int __fd_get_load(struct card_dev_t *dev, int *card_num,
+			 uint64_t bytes)
+{
+	struct lib_data_t *ld = &lib_data;
+	int	fd;
+
+	*card_num = 0;		/* no fd in list or simulation */
+	pthread_mutex_lock(&ld->fds_mutex);
+	if (GENWQE_CARD_REDUNDANT == dev->card_no)
+		fd = __fd_m_get_least(dev, card_num);
+	else {
+		fd = dev->fd_s;	// Normal Mode, return fd_s
+		if ((dev->card_no >= 0) && (dev->card_no < NUM_CARDS))
+			*card_num = dev->card_no;
+	}
+	card_out_ddcbs[*card_num]++;
+	card_out_bytes[*card_num] += bytes;
+	card_dispatched_bytes[*card_num] += bytes;
+	pthread_mutex_unlock(&ld->fds_mutex);
+	return fd;
+}
+
+static void __fd_put_load(int card_num, uint64_t bytes)
+{
+	struct lib_data_t *ld = &lib_data;
+
+	pthread_mutex_lock(&ld->fds_mutex);
+	card_out_ddcbs[card_num]--;
+	card_out_bytes[card_num] -= bytes;
+	pthread_mutex_unlock(&ld->fds_mutex);
+}
+
 static int __m_open_add(int card_no, int mode)
 {
 	int fd;
@@ -1399,10 +1506,12 @@ int genwqe_unpin_memory(card_handle_t dev, const void *addr, size_t size)
 static int __genwqe_card_execute(card_handle_t dev,
 				 struct genwqe_ddcb_cmd *req, int func)
 {
-	int	rc, fd, fd2, card_num;
+	int	rc, fd, fd2, card_num, card_num2;
+	uint64_t bytes;
 	struct	genwqe_ddcb_cmd *cmd;
 	struct	timeval ts, te;	/* Start and End time */
 	struct lib_data_t *ld = &lib_data;
+	bool	busy = false;
 
 	if (NULL == dev)
 		return GENWQE_ERR_EXEC_DDCB;
@@ -1410,7 +1519,8 @@ static int __genwqe_card_execute(card_handle_t dev,
 		return GENWQE_ERR_EXEC_DDCB;
 
 	gettimeofday(&ts, NULL);
-	fd = __fd_get(dev, &card_num);
+	bytes = __ddcb_chain_bytes(req);
+	fd = __fd_get_load(dev, &card_num, bytes);
 	cmd = req;
 	while (cmd != NULL) {
 	retry:			/* wait until DDCB is processed */
@@ -1439,35 +1549,54 @@ static int __genwqe_card_execute(card_handle_t dev,
 					pr_warn("%s exit Timeout fault: %d "
 						"fd: %d\n",
 						__func__, errno, fd);
+					__busy_put(&busy);
+					__fd_put_load(card_num, bytes);
 					return GENWQE_ERR_EXEC_DDCB;
 				}
 
-				/* next fd from queue */
-				fd2 = __fd_get(dev, &card_num);
+				/* next fd from queue, move the load along */
+				fd2 = __fd_get_load(dev, &card_num2, bytes);
+				__fd_put_load(card_num, bytes);
+				card_num = card_num2;
 				if (fd2 != fd)	     /* if there is a new fd */
 					fd = fd2;    /* swap to new fd */
 				else
 					usleep(1000000);/* no fd in queue */
 
 				card_retried_ddcbs[card_num]++;
+				__busy_get(&busy);
 				goto retry;	     /* and retry again */
 			}
 			if (errno == EBUSY) {
 				card_retried_ddcbs[card_num]++;
+				__busy_get(&busy);
 				goto retry;
 			}
 			pr_err("%s exit fault: %d fd: %d rc: %d card_no: %d\n",
 			       __func__, errno, fd, rc, dev->card_no);
 
+			__busy_put(&busy);
+			__fd_put_load(card_num, bytes);
 			return GENWQE_ERR_EXEC_DDCB;
 		}
+		__busy_put(&busy);
 		card_completed_ddcbs[card_num]++;
 		cmd = (struct genwqe_ddcb_cmd *)(unsigned long)cmd->next_addr;
 	}
 
+	__fd_put_load(card_num, bytes);
 	return GENWQE_OK;
 }
 
+/**
+ * @brief	DDCBs of this process retried because a card was busy,
+ *		i.e. its DDCB queue was full.
+ */
+unsigned int genwqe_card_get_waiting(void)
+{
+	return __atomic_load_n(&card_busy_ddcbs, __ATOMIC_RELAXED);
+}
+
 /**
  * @brief	Execute a DDCB request with no DMA buffer translations.
  * @param card	handle returned from 'card_open()'
@@ -2120,9 +2249,11 @@ int genwqe_dump_statistics(FILE *fp)
 		    (card_retried_ddcbs[card_num] == 0))
 			continue;
 		fprintf(fp,
-			"  genwqe%u_card completed DDCBs: %5d retried: %5d\n",
+			"  genwqe%u_card completed DDCBs: %5d retried: %5d "
+			"dispatched: %lld bytes\n",
 			card_num, card_completed_ddcbs[card_num],
-			card_retried_ddcbs[card_num]);
+			card_retried_ddcbs[card_num],
+			(long long)card_dispatched_bytes[card_num]);
 	}
 #if defined(CONFIG_USE_SIGNAL)
 	fprintf(fp,"  Health SIGIO:    %d\n", card_health_signal);
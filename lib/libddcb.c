@@ -23,6 +23,7 @@
  * capable version.
  */
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -47,6 +48,7 @@
 #include <asm/byteorder.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/eventfd.h>
 #include <dirent.h>
 
 #ifndef CONFIG_DONT_USE_INOTIFY
@@ -63,6 +65,18 @@
 #  define ABS(a)	 (((a) < 0) ? -(a) : (a))
 #endif
 
+/* Outstanding asynchronous DDCB execution request */
+struct ddcb_async {
+	struct card_dev_t *card;
+	struct ddcb_cmd *cmd;
+	ddcb_callback_t cb;	/* if set, released after callback */
+	void *priv;
+	bool done;
+	int card_rc;		/* return code from lower level */
+	uint64_t stime;		/* submit time for statistics and load */
+	struct ddcb_async *next;
+};
+
 /* This is the internal structure for each Stream */
 struct card_dev_t {
 	int card_no;		/* card id: FIXEM do we need card_dev? */
@@ -72,6 +86,12 @@ struct card_dev_t {
 	int card_rc;		/* return code from lower level */
 	int card_errno;		/* errno from lower level */
 	struct ddcb_accel_funcs *accel;	 /* supported set of functions */
+
+	pthread_mutex_t alock;	/* protects the async fields below */
+	pthread_cond_t acond;	/* signalled on async completion */
+	struct ddcb_async *async; /* requests not yet reaped by poll/wait */
+	unsigned int ainflight;	/* submitted but not yet completed */
+	int efd;		/* eventfd for async completion or -1 */
 };
 
 static unsigned int ddcb_trace = 0x0;
@@ -79,7 +99,26 @@ static unsigned int ddcb_trace = 0x0;
 #define ddcb_gather_statistics(accel) \
 	(ddcb_trace & DDCB_FLAG_STATISTICS)
 
-static struct ddcb_accel_funcs *accel_list = NULL;
+/* libddcb private state of a registered accelerator type */
+struct accel_priv {
+	struct ddcb_accel_funcs *accel;
+	size_t size;			/* of the backend's table */
+	struct accel_priv *next;
+
+	/* backpressure, see accel_get_load() */
+	unsigned int num_queued;	/* DDCBs not yet completed */
+	unsigned long avg_ddcb_usec;	/* average DDCB turnaround */
+	bool track_load;		/* turnaround is measured */
+};
+
+static struct accel_priv *accel_list = NULL;
+
+/* Table member behind priv_data, NULL if the backend's table lacks it */
+#define accel_ext(accel, member)					\
+	((((struct accel_priv *)(accel)->priv_data)->size >=		\
+	  offsetof(struct ddcb_accel_funcs, member) +			\
+	  sizeof((accel)->member)) ? (accel)->member : NULL)
+
 int libddcb_verbose = 0;
 FILE *libddcb_fd_out;
 
@@ -91,13 +130,53 @@ static inline uint64_t get_usec(void)
 	return t.tv_sec * 1000000 + t.tv_usec;
 }
 
+/*
+ * Start time of a DDCB. The clock is only read for statistics or once
+ * accel_get_load() was called for this type, 0 otherwise.
+ */
+static inline uint64_t __ddcb_stime(struct ddcb_accel_funcs *accel)
+{
+	struct accel_priv *priv = accel->priv_data;
+
+	if (!ddcb_gather_statistics() &&
+	    !__atomic_load_n(&priv->track_load, __ATOMIC_RELAXED))
+		return 0;
+
+	return get_usec();
+}
+
+/* Account DDCBs from submission to completion, see accel_get_load() */
+static inline void __load_get(struct ddcb_accel_funcs *accel)
+{
+	struct accel_priv *priv = accel->priv_data;
+
+	__atomic_add_fetch(&priv->num_queued, 1, __ATOMIC_RELAXED);
+}
+
+static inline void __load_put(struct ddcb_accel_funcs *accel, uint64_t s,
+			      uint64_t e)
+{
+	struct accel_priv *priv = accel->priv_data;
+	unsigned long avg, usec;
+
+	__atomic_sub_fetch(&priv->num_queued, 1, __ATOMIC_RELAXED);
+	if (s == 0)		/* not measured */
+		return;
+
+	/* Racy update, a lost sample does not matter for an estimate */
+	usec = e - s;
+	avg = __atomic_load_n(&priv->avg_ddcb_usec, __ATOMIC_RELAXED);
+	avg = avg ? (avg * 7 + usec) / 8 : usec;
+	__atomic_store_n(&priv->avg_ddcb_usec, avg, __ATOMIC_RELAXED);
+}
+
 static struct ddcb_accel_funcs *find_accelerator(int card_type)
 {
-	struct ddcb_accel_funcs *accel;
+	struct accel_priv *priv;
 
-	for (accel = accel_list; accel != NULL; accel = accel->priv_data) {
-		if (accel->card_type == card_type)
-			return accel;
+	for (priv = accel_list; priv != NULL; priv = priv->next) {
+		if (priv->accel->card_type == card_type)
+			return priv->accel;
 	}
 	return NULL;
 }
@@ -137,6 +216,8 @@ static const char * const ddcb_errlist[] = {
 	[ABS(DDCB_ERR_ENOENT)] = "entry not found",
 	[ABS(DDCB_ERR_IRQTIMEOUT)] = "timeout waiting on irq event",
 	[ABS(DDCB_ERR_EVENTFAIL)] = "failed waiting on expected event",
+	[ABS(DDCB_ERR_SELECTFAIL)] = "select failed",
+	[ABS(DDCB_ERR_INPROGRESS)] = "ddcb execution still in progress",
 };
 
 static const int ddcb_nerr __attribute__((unused)) = ARRAY_SIZE(ddcb_errlist);
@@ -220,6 +301,9 @@ accel_t accel_open(int card_no, unsigned int card_type,
 	card->card_type = card_type;
 	card->mode = mode;
 	card->accel = accel;
+	card->efd = -1;
+	pthread_mutex_init(&card->alock, NULL);
+	pthread_cond_init(&card->acond, NULL);
 
 	if (card->accel->card_open == NULL) {
 		rc = DDCB_ERR_NOTIMPL;
@@ -253,6 +337,80 @@ accel_t accel_open(int card_no, unsigned int card_type,
 	return NULL;
 }
 
+int accel_set_limits(unsigned int card_type, unsigned int num_cards,
+		     unsigned int queue_depth)
+{
+	struct ddcb_accel_funcs *accel;
+	int (* set_limits)(unsigned int num_cards, unsigned int queue_depth);
+
+	accel = find_accelerator(card_type);
+	if (accel == NULL)
+		return DDCB_ERR_ENOENT;
+
+	set_limits = accel_ext(accel, card_set_limits);
+	if (set_limits == NULL)
+		return DDCB_ERR_NOTIMPL;
+
+	return set_limits(num_cards, queue_depth);
+}
+
+int accel_get_limits(unsigned int card_type, unsigned int *num_cards,
+		     unsigned int *queue_depth)
+{
+	struct ddcb_accel_funcs *accel;
+	int (* get_limits)(unsigned int *num_cards, unsigned int *queue_depth);
+
+	accel = find_accelerator(card_type);
+	if (accel == NULL)
+		return DDCB_ERR_ENOENT;
+
+	get_limits = accel_ext(accel, card_get_limits);
+	if (get_limits == NULL)
+		return DDCB_ERR_NOTIMPL;
+
+	return get_limits(num_cards, queue_depth);
+}
+
+/**
+ * DDCBs holding a slot are assumed to run in parallel. A waiting DDCB
+ * gets a slot once the DDCBs in front of it have drained.
+ */
+int accel_get_load(unsigned int card_type, unsigned int *queued,
+		   unsigned int *waiting, uint64_t *wait_usec)
+{
+	struct ddcb_accel_funcs *accel;
+	struct accel_priv *priv;
+	unsigned int (* get_waiting)(void);
+	unsigned int q, w = 0;
+	uint64_t avg;
+
+	accel = find_accelerator(card_type);
+	if (accel == NULL)
+		return DDCB_ERR_ENOENT;
+
+	/* From now on DDCBs are timed for the estimate */
+	priv = accel->priv_data;
+	if (!__atomic_load_n(&priv->track_load, __ATOMIC_RELAXED))
+		__atomic_store_n(&priv->track_load, true, __ATOMIC_RELAXED);
+
+	q = __atomic_load_n(&priv->num_queued, __ATOMIC_RELAXED);
+	avg = __atomic_load_n(&priv->avg_ddcb_usec, __ATOMIC_RELAXED);
+	get_waiting = accel_ext(accel, card_get_waiting);
+	if (get_waiting != NULL)
+		w = get_waiting();
+	if (w > q)		/* counted at different times */
+		w = q;
+
+	if (queued)
+		*queued = q;
+	if (waiting)
+		*waiting = w;
+	if (wait_usec)
+		*wait_usec = w ? (w + 1) * avg / ((q - w) ? (q - w) : 1) : 0;
+
+	return DDCB_OK;
+}
+
 int accel_close(accel_t card)
 {
 	int rc;
@@ -273,7 +431,23 @@ int accel_close(accel_t card)
 	if (accel->card_close == NULL)
 		return DDCB_ERR_NOTIMPL;
 
+	/* Asynchronous requests still refer to the card, drain them */
+	pthread_mutex_lock(&card->alock);
+	while (card->ainflight != 0)
+		pthread_cond_wait(&card->acond, &card->alock);
+	while (card->async != NULL) {
+		struct ddcb_async *a = card->async;
+
+		card->async = a->next;
+		free(a);
+	}
+	pthread_mutex_unlock(&card->alock);
+
 	rc = accel->card_close(card->card_data);
+	if (card->efd >= 0)
+		close(card->efd);
+	pthread_cond_destroy(&card->acond);
+	pthread_mutex_destroy(&card->alock);
 	free(card);
 
 	if (ddcb_gather_statistics()) {
@@ -309,10 +483,7 @@ int accel_ddcb_execute(accel_t card, struct ddcb_cmd *req,
 		 int *card_rc, int *card_errno)
 {
 	struct ddcb_accel_funcs *accel = card->accel;
-	uint64_t s = 0, e = 0;
-
-	if (ddcb_gather_statistics())
-		s = get_usec();
+	uint64_t s, e;
 
 	if (accel == NULL)
 		return DDCB_ERR_INVAL;
@@ -320,8 +491,12 @@ int accel_ddcb_execute(accel_t card, struct ddcb_cmd *req,
 	if (accel->ddcb_execute == NULL)
 		return DDCB_ERR_NOTIMPL;
 
+	s = __ddcb_stime(accel);
+	__load_get(accel);
 	card->card_rc = accel->ddcb_execute(card->card_data, req);
 	card->card_errno = errno;
+	e = s ? get_usec() : 0;
+	__load_put(accel, s, e);
 
 	if (card_rc != NULL)
 		*card_rc = card->card_rc;
@@ -331,7 +506,6 @@ int accel_ddcb_execute(accel_t card, struct ddcb_cmd *req,
 		return DDCB_ERR_CARD;
 
 	if (ddcb_gather_statistics()) {
-		e = get_usec();
 		pthread_mutex_lock(&accel->slock);
 		accel->num_execute++;
 		accel->time_execute += (e - s);
@@ -341,6 +515,276 @@ int accel_ddcb_execute(accel_t card, struct ddcb_cmd *req,
 	return DDCB_OK;
 }
 
+int accel_ddcb_reserve(accel_t card, struct ddcb_slot *slot,
+		       struct ddcb_cmd *req)
+{
+	struct ddcb_accel_funcs *accel = card->accel;
+	int (* reserve)(void *card_data, struct ddcb_slot *slot);
+
+	if ((accel == NULL) || (slot == NULL) || (req == NULL))
+		return DDCB_ERR_INVAL;
+
+	/* A reserved slot leads to commit and release, all three needed */
+	reserve = accel_ext(accel, ddcb_release) ? accel->ddcb_reserve : NULL;
+	if (reserve == NULL) {
+		/* Build it in req, commit executes it from there */
+		memset(req->asiv, 0, sizeof(req->asiv));
+		slot->asiv = req->asiv;
+		slot->asv = req->asv;
+		slot->card_slot = NULL;
+		return DDCB_OK;
+	}
+
+	card->card_rc = reserve(card->card_data, slot);
+	card->card_errno = errno;
+	if (card->card_rc < 0)
+		return DDCB_ERR_CARD;
+
+	return DDCB_OK;
+}
+
+int accel_ddcb_commit(accel_t card, struct ddcb_slot *slot,
+		      struct ddcb_cmd *req, int *card_rc, int *card_errno)
+{
+	struct ddcb_accel_funcs *accel = card->accel;
+	uint64_t s, e;
+
+	if (slot->card_slot == NULL)
+		return accel_ddcb_execute(card, req, card_rc, card_errno);
+
+	s = __ddcb_stime(accel);
+	__load_get(accel);
+	card->card_rc = accel->ddcb_commit(card->card_data, slot, req);
+	card->card_errno = errno;
+	e = s ? get_usec() : 0;
+	__load_put(accel, s, e);
+
+	if (card_rc != NULL)
+		*card_rc = card->card_rc;
+	if (card_errno != NULL)
+		*card_errno = card->card_errno;
+	if (card->card_rc < 0)
+		return DDCB_ERR_CARD;
+
+	if (ddcb_gather_statistics()) {
+		pthread_mutex_lock(&accel->slock);
+		accel->num_execute++;
+		accel->time_execute += (e - s);
+		pthread_mutex_unlock(&accel->slock);
+	}
+
+	return DDCB_OK;
+}
+
+void accel_ddcb_release(accel_t card, struct ddcb_slot *slot)
+{
+	struct ddcb_accel_funcs *accel = card->accel;
+
+	if (slot->card_slot != NULL)
+		accel->ddcb_release(card->card_data, slot);
+	slot->card_slot = NULL;
+}
+
+/**
+ * Completion of an asynchronous request. Called by the accelerator
+ * backend, usually from its completion thread, or directly from
+ * accel_ddcb_submit() if the backend cannot execute asynchronously.
+ */
+static void __ddcb_async_done(void *priv, int card_rc)
+{
+	struct ddcb_async *a = (struct ddcb_async *)priv;
+	struct card_dev_t *card = a->card;
+	struct ddcb_accel_funcs *accel = card->accel;
+	ddcb_callback_t cb = a->cb;	/* a is gone once reaped */
+	uint64_t e;
+
+	e = a->stime ? get_usec() : 0;
+	__load_put(accel, a->stime, e);
+	if (ddcb_gather_statistics()) {
+		pthread_mutex_lock(&accel->slock);
+		accel->num_execute++;
+		accel->time_execute += (e - a->stime);
+		pthread_mutex_unlock(&accel->slock);
+	}
+
+	if (cb != NULL)
+		cb(card, a->cmd, (card_rc < 0) ? DDCB_ERR_CARD : DDCB_OK,
+		   a->priv);
+
+	pthread_mutex_lock(&card->alock);
+	a->card_rc = card_rc;
+	a->done = true;
+	if (card->efd >= 0) {
+		uint64_t one = 1;
+		ssize_t n;
+
+		/* Fails on counter overflow only, poll will find it */
+		n = write(card->efd, &one, sizeof(one));
+		(void)n;
+	}
+	card->ainflight--;
+	pthread_cond_broadcast(&card->acond);
+	pthread_mutex_unlock(&card->alock);
+
+	if (cb != NULL)
+		free(a);
+}
+
+int accel_ddcb_submit(accel_t card, struct ddcb_cmd *req,
+		      ddcb_callback_t cb, void *priv)
+{
+	struct ddcb_accel_funcs *accel = card->accel;
+	struct ddcb_async *a, **p;
+	int (* submit)(void *card_data, struct ddcb_cmd *req,
+		       void (* done)(void *priv, int card_rc), void *priv);
+	int rc;
+
+	if (accel == NULL)
+		return DDCB_ERR_INVAL;
+
+	if (accel->ddcb_execute == NULL)
+		return DDCB_ERR_NOTIMPL;
+
+	a = calloc(1, sizeof(*a));
+	if (a == NULL)
+		return DDCB_ERR_ENOMEM;
+
+	a->card = card;
+	a->cmd = req;
+	a->cb = cb;
+	a->priv = priv;
+	a->stime = __ddcb_stime(accel);
+
+	/* Enqueue before submitting, completion might be faster */
+	pthread_mutex_lock(&card->alock);
+	if (cb == NULL) {
+		a->next = card->async;
+		card->async = a;
+	}
+	card->ainflight++;
+	pthread_mutex_unlock(&card->alock);
+	__load_get(accel);
+
+	submit = accel_ext(accel, ddcb_submit);
+	if (submit == NULL) {
+		__ddcb_async_done(a, accel->ddcb_execute(card->card_data, req));
+		return DDCB_OK;
+	}
+
+	rc = submit(card->card_data, req, __ddcb_async_done, a);
+	if (rc < 0) {
+		card->card_rc = rc;
+		card->card_errno = errno;
+		__load_put(accel, 0, 0);
+
+		pthread_mutex_lock(&card->alock);
+		for (p = &card->async; *p != NULL; p = &(*p)->next) {
+			if (*p == a) {
+				*p = a->next;
+				break;
+			}
+		}
+		card->ainflight--;
+		pthread_cond_broadcast(&card->acond);
+		pthread_mutex_unlock(&card->alock);
+
+		free(a);
+		return DDCB_ERR_CARD;
+	}
+	return DDCB_OK;
+}
+
+/**
+ * Reap a finished request. The lower level errno is not available
+ * in the completion context, we report EIO for failed requests.
+ */
+static int __ddcb_async_reap(struct card_dev_t *card, struct ddcb_async **p,
+			     int *card_rc, int *card_errno)
+{
+	struct ddcb_async *a = *p;
+
+	*p = a->next;
+	card->card_rc = a->card_rc;
+	card->card_errno = (a->card_rc < 0) ? EIO : 0;
+	free(a);
+
+	if (card_rc != NULL)
+		*card_rc = card->card_rc;
+	if (card_errno != NULL)
+		*card_errno = card->card_errno;
+	if (card->card_rc < 0)
+		return DDCB_ERR_CARD;
+
+	return DDCB_OK;
+}
+
+static struct ddcb_async **__ddcb_async_find(struct card_dev_t *card,
+					     struct ddcb_cmd *req)
+{
+	struct ddcb_async **p;
+
+	for (p = &card->async; *p != NULL; p = &(*p)->next)
+		if ((*p)->cmd == req)
+			return p;
+	return NULL;
+}
+
+int accel_ddcb_poll(accel_t card, struct ddcb_cmd *req, int *card_rc,
+		    int *card_errno)
+{
+	struct ddcb_async **p;
+	int rc;
+
+	pthread_mutex_lock(&card->alock);
+	p = __ddcb_async_find(card, req);
+	if (p == NULL)
+		rc = DDCB_ERR_ENOENT;
+	else if (!(*p)->done)
+		rc = DDCB_ERR_INPROGRESS;
+	else
+		rc = __ddcb_async_reap(card, p, card_rc, card_errno);
+	pthread_mutex_unlock(&card->alock);
+
+	return rc;
+}
+
+int accel_ddcb_wait(accel_t card, struct ddcb_cmd *req, int *card_rc,
+		    int *card_errno)
+{
+	struct ddcb_async **p;
+	int rc;
+
+	pthread_mutex_lock(&card->alock);
+	while (1) {
+		p = __ddcb_async_find(card, req);
+		if (p == NULL) {
+			rc = DDCB_ERR_ENOENT;
+			break;
+		}
+		if ((*p)->done) {
+			rc = __ddcb_async_reap(card, p, card_rc, card_errno);
+			break;
+		}
+		pthread_cond_wait(&card->acond, &card->alock);
+	}
+	pthread_mutex_unlock(&card->alock);
+
+	return rc;
+}
+
+int accel_ddcb_eventfd(accel_t card)
+{
+	int efd;
+
+	pthread_mutex_lock(&card->alock);
+	if (card->efd < 0)
+		card->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	efd = card->efd;
+	pthread_mutex_unlock(&card->alock);
+
+	return (efd < 0) ? DDCB_ERRNO : efd;
+}
+
 uint64_t accel_read_reg64(accel_t card, uint32_t offs, int *card_rc)
 {
 	struct ddcb_accel_funcs *accel = card->accel;
@@ -465,7 +909,7 @@ int accel_pin_memory(accel_t card, const void *addr, size_t size,
 	if (accel == NULL)
 		return DDCB_ERR_INVAL;
 
-	if (accel->card_write_reg32 == NULL)
+	if (accel->card_pin_memory == NULL)
 		return DDCB_ERR_NOTIMPL;
 
 	return accel->card_pin_memory(card->card_data, addr, size, dir);
@@ -523,24 +967,44 @@ int accel_dump_statistics(struct ddcb_accel_funcs *accel, FILE *fp)
 	return accel->dump_statistics(fp);
 }
 
-int ddcb_register_accelerator(struct ddcb_accel_funcs *accel)
+int ddcb_register_accelerator_size(struct ddcb_accel_funcs *accel,
+				   size_t size)
 {
 	int rc;
+	struct accel_priv *priv;
 
-	if (accel == NULL)
+	if ((accel == NULL) ||
+	    (size < offsetof(struct ddcb_accel_funcs, priv_data) +
+	     sizeof(accel->priv_data)))
 		return DDCB_ERR_INVAL;
 
+	priv = calloc(1, sizeof(*priv));
+	if (priv == NULL)
+		return DDCB_ERR_ENOMEM;
+
 	if (ddcb_gather_statistics()) {
 		rc = pthread_mutex_init(&accel->slock, NULL);
-		if (rc != 0)
+		if (rc != 0) {
+			free(priv);
 			return DDCB_ERRNO;
+		}
 	}
 
-	accel->priv_data = accel_list;
-	accel_list = accel;
+	priv->accel = accel;
+	priv->size = size;
+	priv->next = accel_list;
+	accel->priv_data = priv;
+	accel_list = priv;
 	return DDCB_OK;
 }
 
+int (ddcb_register_accelerator)(struct ddcb_accel_funcs *accel)
+{
+	return ddcb_register_accelerator_size(accel,
+			offsetof(struct ddcb_accel_funcs, priv_data) +
+			sizeof(accel->priv_data));
+}
+
 static void _init(void) __attribute__((constructor));
 
 static void _init(void)
@@ -556,9 +1020,11 @@ static void _done(void) __attribute__((destructor));
 
 static void _done(void)
 {
-	struct ddcb_accel_funcs *accel;
+	struct accel_priv *priv;
+
+	for (priv = accel_list; priv != NULL; priv = priv->next) {
+		struct ddcb_accel_funcs *accel = priv->accel;
 
-	for (accel = accel_list; accel != NULL; accel = accel->priv_data) {
 		if (accel->num_open == 0)
 			continue;
 
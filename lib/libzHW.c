@@ -32,6 +32,7 @@
 #include <sys/types.h>
 #include <asm/byteorder.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <deflate_ddcb.h>
 #include <libddcb.h>
@@ -442,6 +443,8 @@ zedc_handle_t zedc_open(int dev_no, int dev_type, int mode, int *err_code)
 	}
 	memset(zedc, 0, sizeof(*zedc));
 	zedc->mode = mode;
+	zedc->card_no = dev_no;
+	zedc->card_type = dev_type;
 
 	/* Check Appl id GZIP Version 2 */
 	if (dev_no == ACCEL_REDUNDANT) {
@@ -487,6 +490,594 @@ int zedc_execute_request(zedc_handle_t zedc, struct ddcb_cmd *cmd)
 	return rc;
 }
 
+/**
+ * @brief	start a job without waiting for it, see zedc_wait_request
+ * @param zedc	ZEDC device handle
+ * @param cmd	pointer to command descriptor, must stay valid until
+ *		zedc_wait_request returned
+ */
+int zedc_submit_request(zedc_handle_t zedc, struct ddcb_cmd *cmd)
+{
+	int rc = accel_ddcb_submit(zedc->card, cmd, NULL, NULL);
+
+	if (rc < 0)
+		zedc->card_rc = rc;
+	return rc;
+}
+
+/**
+ * @brief	wait for a job started with zedc_submit_request
+ * @param zedc	ZEDC device handle
+ * @param cmd	pointer to command descriptor
+ */
+int zedc_wait_request(zedc_handle_t zedc, struct ddcb_cmd *cmd)
+{
+	int rc = accel_ddcb_wait(zedc->card, cmd, &zedc->card_rc,
+				 &zedc->card_errno);
+
+	pr_info("  DDCB returned rc=%d card_rc=%d "
+		"(RETC=%03x ATTN=%04x PROGR=%x) %s\n",
+		rc, zedc->card_rc, cmd->retc, cmd->attn, cmd->progress,
+		cmd->retc == 0x102 ? "" : "ERR");
+
+	return rc;
+}
+
+/**
+ * @brief	reserve a DDCB slot to build the ASIV in place
+ * @param zedc	ZEDC device handle
+ * @param slot	slot to be filled in, release with zedc_release_request
+ * @param cmd	pointer to command descriptor
+ */
+int zedc_reserve_request(zedc_handle_t zedc, struct ddcb_slot *slot,
+			 struct ddcb_cmd *cmd)
+{
+	int rc = accel_ddcb_reserve(zedc->card, slot, cmd);
+
+	if (rc < 0)
+		zedc->card_rc = rc;
+	return rc;
+}
+
+/**
+ * @brief	execute a job whose ASIV was built in a reserved slot
+ * @param zedc	ZEDC device handle
+ * @param slot	slot returned by zedc_reserve_request
+ * @param cmd	pointer to command descriptor
+ */
+int zedc_commit_request(zedc_handle_t zedc, struct ddcb_slot *slot,
+			struct ddcb_cmd *cmd)
+{
+	int rc = accel_ddcb_commit(zedc->card, slot, cmd, &zedc->card_rc,
+				   &zedc->card_errno);
+
+	pr_info("  DDCB returned rc=%d card_rc=%d "
+		"(RETC=%03x ATTN=%04x PROGR=%x) %s\n",
+		rc, zedc->card_rc, cmd->retc, cmd->attn, cmd->progress,
+		cmd->retc == 0x102 ? "" : "ERR");
+
+	return rc;
+}
+
+/**
+ * @brief	give a reserved slot back once its ASV was evaluated
+ * @param zedc	ZEDC device handle
+ * @param slot	slot returned by zedc_reserve_request
+ */
+void zedc_release_request(zedc_handle_t zedc, struct ddcb_slot *slot)
+{
+	accel_ddcb_release(zedc->card, slot);
+}
+
+/*
+ * Buffer pool: streams come and go much faster than cards. Keep the
+ * staging buffers and workspaces of ended streams for the next
+ * stream on the same card instead of allocating, mapping and pinning
+ * them again. Each thread keeps a few plain (neither flat nor pinned)
+ * buffers for itself, everything else goes to a shared class per
+ * card, size and memory type. Flat and pinned buffers belong to the
+ * handle which allocated them and are only handed out to that handle
+ * again.
+ */
+#define ZEDC_POOL_CLASSES	32	/* card/size/type combinations */
+#define ZEDC_POOL_TLS		4	/* buffers cached per thread */
+
+struct zedc_pool_buf {			/* lives in the pooled buffer */
+	struct zedc_pool_buf *next;
+	zedc_handle_t owner;		/* NULL for plain memory */
+};
+
+struct zedc_pool_class {
+	int card_no;
+	int card_type;
+	size_t size;
+	enum zedc_mtype mtype;
+	unsigned int count;		/* buffers in free list */
+	struct zedc_pool_buf *free;
+};
+
+struct zedc_pool_tls {
+	struct zedc_pool_class *c;
+	void *ptr;
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct zedc_pool_class pool_classes[ZEDC_POOL_CLASSES];
+static unsigned int pool_depth = 0;	/* 0: pool disabled */
+static unsigned long pool_hits = 0;
+static unsigned long pool_misses = 0;
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+static __thread struct zedc_pool_tls pool_tls[ZEDC_POOL_TLS];
+
+static inline int __pool_plain(enum zedc_mtype mtype)
+{
+	return ((mtype & DDCB_DMA_TYPE_MASK) != DDCB_DMA_TYPE_FLAT) &&
+		!(mtype & DDCB_DMA_PIN_MEMORY);
+}
+
+static inline int __pool_match(struct zedc_pool_class *c,
+			       zedc_handle_t zedc, size_t size,
+			       enum zedc_mtype mtype)
+{
+	return (c->size == size) && (c->mtype == mtype) &&
+		(c->card_no == zedc->card_no) &&
+		(c->card_type == zedc->card_type);
+}
+
+/* Lookup or create the class for this request, pool_lock held */
+static struct zedc_pool_class *__pool_class(zedc_handle_t zedc, size_t size,
+					    enum zedc_mtype mtype)
+{
+	unsigned int i;
+	struct zedc_pool_class *c;
+
+	for (i = 0; i < ZEDC_POOL_CLASSES; i++) {
+		c = &pool_classes[i];
+		if (c->size == 0) {
+			c->card_no = zedc->card_no;
+			c->card_type = zedc->card_type;
+			c->size = size;
+			c->mtype = mtype;
+			return c;
+		}
+		if (__pool_match(c, zedc, size, mtype))
+			return c;
+	}
+	return NULL;
+}
+
+/* Thread exit: hand the thread local buffers to the shared pool */
+static void __pool_tls_done(void *data)
+{
+	unsigned int i;
+	struct zedc_pool_tls *tls = (struct zedc_pool_tls *)data;
+	struct zedc_pool_buf *b;
+
+	for (i = 0; i < ZEDC_POOL_TLS; i++) {
+		if (tls[i].ptr == NULL)
+			continue;
+
+		pthread_mutex_lock(&pool_lock);
+		if (tls[i].c->count < pool_depth) {
+			b = (struct zedc_pool_buf *)tls[i].ptr;
+			b->owner = NULL;
+			b->next = tls[i].c->free;
+			tls[i].c->free = b;
+			tls[i].c->count++;
+			tls[i].ptr = NULL;
+		}
+		pthread_mutex_unlock(&pool_lock);
+
+		free(tls[i].ptr);	/* plain memory, see zedc_free() */
+		tls[i].ptr = NULL;
+	}
+}
+
+static void __pool_key_alloc(void)
+{
+	pthread_key_create(&pool_key, __pool_tls_done);
+}
+
+/* Free buffers owned by a handle which is going to be closed */
+static void __pool_drain(zedc_handle_t zedc)
+{
+	unsigned int i;
+	struct zedc_pool_class *c;
+	struct zedc_pool_buf *b, **pb;
+
+	pthread_mutex_lock(&pool_lock);
+	for (i = 0; i < ZEDC_POOL_CLASSES; i++) {
+		c = &pool_classes[i];
+		pb = &c->free;
+		while ((b = *pb) != NULL) {
+			if (b->owner != zedc) {
+				pb = &b->next;
+				continue;
+			}
+			*pb = b->next;
+			c->count--;
+			zedc_free(zedc, b, c->size, c->mtype);
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * @brief	Set the number of buffers the pool keeps per card, size
+ *		and memory type. 0 disables pooling, which is the default.
+ */
+void zedc_pool_set_depth(unsigned int depth)
+{
+	pool_depth = depth;
+}
+
+/**
+ * @brief	Return pool hit and miss counters.
+ */
+void zedc_pool_stats(unsigned long *hits, unsigned long *misses)
+{
+	if (hits)
+		*hits = __atomic_load_n(&pool_hits, __ATOMIC_RELAXED);
+	if (misses)
+		*misses = __atomic_load_n(&pool_misses, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief	Get a DMA buffer from the pool, allocate one if the
+ *		pool has none. Return it with zedc_pool_free().
+ */
+void *zedc_pool_alloc(zedc_handle_t zedc, size_t size, enum zedc_mtype mtype)
+{
+	unsigned int i;
+	struct zedc_pool_class *c;
+	struct zedc_pool_buf *b, **pb;
+
+	if (!zedc)
+		return NULL;
+
+	if ((pool_depth == 0) || (size < sizeof(struct zedc_pool_buf)))
+		return zedc_memalign(zedc, size, mtype);
+
+	if (__pool_plain(mtype)) {
+		for (i = 0; i < ZEDC_POOL_TLS; i++) {
+			if ((pool_tls[i].ptr == NULL) ||
+			    !__pool_match(pool_tls[i].c, zedc, size, mtype))
+				continue;
+
+			b = (struct zedc_pool_buf *)pool_tls[i].ptr;
+			pool_tls[i].ptr = NULL;
+			__atomic_add_fetch(&pool_hits, 1, __ATOMIC_RELAXED);
+			return b;
+		}
+	}
+
+	pthread_mutex_lock(&pool_lock);
+	c = __pool_class(zedc, size, mtype);
+	if (c != NULL) {
+		for (pb = &c->free; (b = *pb) != NULL; pb = &b->next) {
+			if ((b->owner != NULL) && (b->owner != zedc))
+				continue;
+
+			*pb = b->next;
+			c->count--;
+			pthread_mutex_unlock(&pool_lock);
+			__atomic_add_fetch(&pool_hits, 1, __ATOMIC_RELAXED);
+			return b;
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	__atomic_add_fetch(&pool_misses, 1, __ATOMIC_RELAXED);
+	return zedc_memalign(zedc, size, mtype);
+}
+
+/**
+ * @brief	Return a buffer from zedc_pool_alloc(). It is kept for
+ *		reuse unless the pool is full.
+ */
+int zedc_pool_free(zedc_handle_t zedc, void *ptr, size_t size,
+		   enum zedc_mtype mtype)
+{
+	unsigned int i;
+	struct zedc_pool_class *c;
+	struct zedc_pool_buf *b = (struct zedc_pool_buf *)ptr;
+
+	if (!zedc)
+		return ZEDC_ERR_INVAL;
+
+	if (ptr == NULL)
+		return 0;
+
+	if ((pool_depth == 0) || (size < sizeof(struct zedc_pool_buf)))
+		return zedc_free(zedc, ptr, size, mtype);
+
+	pthread_mutex_lock(&pool_lock);
+	c = __pool_class(zedc, size, mtype);
+	pthread_mutex_unlock(&pool_lock);
+
+	if (c == NULL)
+		return zedc_free(zedc, ptr, size, mtype);
+
+	if (__pool_plain(mtype)) {
+		for (i = 0; i < ZEDC_POOL_TLS; i++) {
+			if (pool_tls[i].ptr != NULL)
+				continue;
+
+			pthread_once(&pool_once, __pool_key_alloc);
+			pthread_setspecific(pool_key, pool_tls);
+			pool_tls[i].c = c;
+			pool_tls[i].ptr = ptr;
+			return 0;
+		}
+	}
+
+	pthread_mutex_lock(&pool_lock);
+	if (c->count < pool_depth) {
+		b->owner = __pool_plain(mtype) ? NULL : zedc;
+		b->next = c->free;
+		c->free = b;
+		c->count++;
+		pthread_mutex_unlock(&pool_lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	return zedc_free(zedc, ptr, size, mtype);
+}
+
+/*
+ * Pin cache: pinning memory for DMA is expensive, so callers which
+ * use the same buffers again and again (see zlib_register_buffer())
+ * pin them once. Pins belong to the handle which did them and are
+ * kept until zedc_unpin_cached() or until the handle is closed. The
+ * least recently used pin is dropped if the cache is full. Pinning is
+ * done for whole pages only, a failure just means that the driver
+ * maps the buffer dynamically for each DDCB as before.
+ */
+#define ZEDC_PIN_CACHE		64
+
+struct zedc_pin {
+	zedc_handle_t zedc;		/* NULL: entry unused */
+	uintptr_t start;		/* page aligned */
+	uintptr_t end;
+	int dir;
+	unsigned long last_use;
+};
+
+static pthread_mutex_t pin_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct zedc_pin pin_cache[ZEDC_PIN_CACHE];
+static unsigned long pin_clock = 0;
+static unsigned long pin_hits = 0;
+static unsigned long pin_misses = 0;
+
+/* Drop a pin, pin_lock held */
+static void __pin_drop(struct zedc_pin *p)
+{
+	zedc_unpin_memory(p->zedc, (void *)p->start, p->end - p->start);
+	p->zedc = NULL;
+}
+
+/* Drop all pins of a handle which is going to be closed */
+static void __pin_drain(zedc_handle_t zedc)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&pin_lock);
+	for (i = 0; i < ZEDC_PIN_CACHE; i++)
+		if (pin_cache[i].zedc == zedc)
+			__pin_drop(&pin_cache[i]);
+	pthread_mutex_unlock(&pin_lock);
+}
+
+/**
+ * @brief	Pin memory unless it is already pinned for this handle.
+ * @param dir	0: read, 1: read and write
+ */
+int zedc_pin_cached(zedc_handle_t zedc, const void *addr, size_t size,
+		    int dir)
+{
+	int rc;
+	unsigned int i;
+	struct zedc_pin *p, *victim = NULL;
+	uintptr_t page_mask = ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1);
+	uintptr_t start = (uintptr_t)addr & page_mask;
+	uintptr_t end = ((uintptr_t)addr + size + ~page_mask) & page_mask;
+
+	if (!zedc)
+		return ZEDC_ERR_INVAL;
+
+	pthread_mutex_lock(&pin_lock);
+	pin_clock++;
+	for (i = 0; i < ZEDC_PIN_CACHE; i++) {
+		p = &pin_cache[i];
+		if ((p->zedc == zedc) && (p->start <= start) &&
+		    (p->end >= end) && (p->dir >= dir)) {
+			p->last_use = pin_clock;
+			pin_hits++;
+			pthread_mutex_unlock(&pin_lock);
+			return ZEDC_OK;
+		}
+		if ((victim == NULL) || (p->zedc == NULL) ||
+		    ((victim->zedc != NULL) &&
+		     (p->last_use < victim->last_use)))
+			victim = p;
+	}
+	pin_misses++;
+
+	if (victim->zedc != NULL)
+		__pin_drop(victim);
+
+	rc = zedc_pin_memory(zedc, (void *)start, end - start, dir);
+	if (rc == ZEDC_OK) {
+		victim->zedc = zedc;
+		victim->start = start;
+		victim->end = end;
+		victim->dir = dir;
+		victim->last_use = pin_clock;
+	}
+	pthread_mutex_unlock(&pin_lock);
+
+	return rc;
+}
+
+/**
+ * @brief	Drop the pins of all handles touching this memory. Must
+ *		be called before the memory is freed.
+ */
+void zedc_unpin_cached(const void *addr, size_t size)
+{
+	unsigned int i;
+	struct zedc_pin *p;
+	uintptr_t start = (uintptr_t)addr;
+	uintptr_t end = start + size;
+
+	pthread_mutex_lock(&pin_lock);
+	for (i = 0; i < ZEDC_PIN_CACHE; i++) {
+		p = &pin_cache[i];
+		if ((p->zedc != NULL) && (p->start < end) && (p->end > start))
+			__pin_drop(p);
+	}
+	pthread_mutex_unlock(&pin_lock);
+}
+
+/**
+ * @brief	Return pin cache hit and miss counters.
+ */
+void zedc_pin_stats(unsigned long *hits, unsigned long *misses)
+{
+	pthread_mutex_lock(&pin_lock);
+	if (hits)
+		*hits = pin_hits;
+	if (misses)
+		*misses = pin_misses;
+	pthread_mutex_unlock(&pin_lock);
+}
+
+/*
+ * Skip-last-dictionary predictor (ZEDC_FLG_SKIP_LAST_DICT)
+ *
+ * A Z_FINISH DDCB without SAVE_DICT only pays off if it completes,
+ * else it runs a second time with SAVE_DICT. Whether it completes
+ * depends on the output needed for avail_in bytes. That is predicted
+ * from the output/input ratio of earlier DDCBs: the stream's own if
+ * it has any, else the last seen in this process for inflate or
+ * deflate. A ratio going up is taken over at once, one going down
+ * only slowly, to keep misses rare. Streams which missed twice stop
+ * trying until they are reset, e.g. inflate with truncated input.
+ */
+#define SKIP_RATIO_SHIFT	12	/* ratio fixed point */
+#define SKIP_SLACK		64	/* deflate: headers, EOB, trailer */
+#define SKIP_MISSES_MAX		2
+#define SKIP_MIN_IN		256	/* smaller DDCBs do not teach */
+
+static uint32_t skip_ratio[2];		/* per process, inflate/deflate */
+static unsigned long skip_hits = 0;
+static unsigned long skip_misses = 0;
+static unsigned long skip_wasted_usec = 0;
+
+static inline uint32_t __skip_avg(uint32_t old, uint32_t ratio)
+{
+	if (old == 0 || ratio >= old)
+		return ratio;
+	return (3 * (uint64_t)old + ratio) / 4;
+}
+
+/**
+ * @brief	Decide if a Z_FINISH DDCB should omit SAVE_DICT
+ * @param defl	1 for deflate, 0 for inflate
+ * @return	1 if the DDCB is expected to complete
+ */
+int zedc_skip_dict(zedc_streamp strm, int defl)
+{
+	uint64_t ratio, need;
+
+	if (strm->flags & ZEDC_FLG_ONE_SHOT)
+		return 1;
+
+	if (!(strm->flags & ZEDC_FLG_SKIP_LAST_DICT) ||
+	    (strm->skip_misses >= SKIP_MISSES_MAX))
+		return 0;
+
+	ratio = strm->skip_ratio;
+	if (ratio == 0)
+		ratio = __atomic_load_n(&skip_ratio[defl], __ATOMIC_RELAXED);
+
+	/* Nothing learned yet: data does not expand by more than that */
+	if (ratio == 0)
+		return defl ? (strm->avail_out >= strm->avail_in) :
+			(strm->avail_out > strm->avail_in * 2);
+
+	/*
+	 * Deflate output buffers are mostly sized for the worst case,
+	 * so demand some headroom. Inflate gets exactly sized buffers
+	 * when the caller knows the size, allow for some variation.
+	 */
+	need = ((uint64_t)strm->avail_in * ratio) >> SKIP_RATIO_SHIFT;
+	if (defl)
+		need += need / 8 + SKIP_SLACK;
+	else
+		need -= need / 8;
+	return strm->avail_out >= need;
+}
+
+/**
+ * @brief	Learn from a finished DDCB
+ * @param in	input bytes it processed
+ * @param out	output bytes it returned
+ */
+void zedc_skip_dict_learn(zedc_streamp strm, int defl, uint32_t in,
+			  uint32_t out)
+{
+	uint64_t r;
+	uint32_t ratio, old;
+
+	if (in < SKIP_MIN_IN)
+		return;
+
+	r = ((uint64_t)out << SKIP_RATIO_SHIFT) / in;
+	ratio = (r > UINT32_MAX) ? UINT32_MAX : (r ? r : 1);
+	strm->skip_ratio = __skip_avg(strm->skip_ratio, ratio);
+
+	old = __atomic_load_n(&skip_ratio[defl], __ATOMIC_RELAXED);
+	__atomic_store_n(&skip_ratio[defl], __skip_avg(old, ratio),
+			 __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief	Account a DDCB which omitted SAVE_DICT
+ * @param hit	1 if it completed, 0 if it had to be repeated
+ * @param usec	its time, wasted if it was repeated
+ */
+void zedc_skip_dict_result(zedc_streamp strm, int hit, unsigned long usec)
+{
+	if (hit) {
+		__atomic_add_fetch(&skip_hits, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	strm->skip_misses++;
+	__atomic_add_fetch(&skip_misses, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&skip_wasted_usec, usec, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief	Return skip-last-dict counters: DDCBs which completed
+ *		without SAVE_DICT, DDCBs which had to be repeated and
+ *		the hardware time lost on those.
+ */
+void zedc_skip_dict_stats(unsigned long *hits, unsigned long *misses,
+			  unsigned long *wasted_usec)
+{
+	if (hits)
+		*hits = __atomic_load_n(&skip_hits, __ATOMIC_RELAXED);
+	if (misses)
+		*misses = __atomic_load_n(&skip_misses, __ATOMIC_RELAXED);
+	if (wasted_usec)
+		*wasted_usec = __atomic_load_n(&skip_wasted_usec,
+					       __ATOMIC_RELAXED);
+}
+
 /**
  * @brief	end ZEDC library accesses close all open files, free memory
  * @param zedc	pointer to the opened device descriptor
@@ -497,6 +1088,8 @@ int zedc_close(zedc_handle_t zedc)
 	if (!zedc)
 		return ZEDC_ERR_INVAL;
 
+	__pool_drain(zedc);
+	__pin_drain(zedc);
 	accel_close(zedc->card);
 	free(zedc);
 	return ZEDC_OK;
@@ -636,8 +1229,8 @@ int zedc_alloc_workspace(zedc_streamp strm)
 {
 	zedc_handle_t zedc = (zedc_handle_t)strm->device;
 
-	strm->wsp = zedc_memalign(zedc, sizeof(struct zedc_wsp),
-				  strm->dma_type[ZEDC_WS]);
+	strm->wsp = zedc_pool_alloc(zedc, sizeof(struct zedc_wsp),
+				    strm->dma_type[ZEDC_WS]);
 	if (strm->wsp == NULL)
 		return ZEDC_MEM_ERROR;
 
@@ -652,8 +1245,8 @@ int zedc_free_workspace(zedc_streamp strm)
 	int rc;
 	zedc_handle_t zedc = (zedc_handle_t)strm->device;
 
-	rc = zedc_free(zedc, strm->wsp, sizeof(struct zedc_wsp),
-		       strm->dma_type[ZEDC_WS]);
+	rc = zedc_pool_free(zedc, strm->wsp, sizeof(struct zedc_wsp),
+			    strm->dma_type[ZEDC_WS]);
 
 	strm->wsp = NULL;
 	return rc;
@@ -674,3 +1267,17 @@ unsigned long __adler32(unsigned long adler,
 	}
 	return (s2 << 16) + s1;
 }
+
+unsigned long __crc32(unsigned long crc,
+		      const unsigned char *buf, int len)
+{
+	int n, k;
+
+	crc = ~crc & 0xffffffff;
+	for (n = 0; n < len; n++) {
+		crc ^= buf[n];
+		for (k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+	return ~crc & 0xffffffff;
+}
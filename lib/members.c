@@ -0,0 +1,764 @@
+/*
+ * Copyright 2017, International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Parallel decompression of multi-member gzip files.
+ *
+ * Files written by parallel compressors or by misc/zpipe_append are
+ * sequences of complete gzip members. Each member starts with the
+ * gzip magic, so the input is cut at candidate headers into jobs of
+ * about PAR_JOB_SIZE bytes. Worker threads inflate the jobs on their
+ * own streams, which means on their own DDCB slots, or cards if
+ * ZLIB_CARD=RED is used.
+ *
+ * The magic can also show up inside compressed data. A job is
+ * therefore only used if it starts where the previous output ended,
+ * and only up to the end of its last complete member. The rest of
+ * the member is inflated sequentially and parallel processing picks
+ * up again at the next job boundary. False candidates cost time, but
+ * never produce wrong output.
+ *
+ * BGZF files, as used for BAM, carry the size of each member in a
+ * "BC" extra field. There jobs are cut exactly along the block sizes.
+ * The zlib_bgzf_* reader goes further: it indexes a BGZF buffer
+ * without inflating it and, knowing each block's ISIZE from its
+ * trailer, inflates blocks concurrently right to their final place.
+ * Each block is one inflate() call with Z_FINISH and the exact
+ * output size, i.e. one DDCB per block. With ZLIB_FLAG_OMIT_LAST_DICT,
+ * which is the default, that DDCB does not save the dictionary.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <zlib.h>
+#include "wrapper.h"
+
+#define PAR_THREADS		4		  /* default worker count */
+#define PAR_JOB_SIZE		(1 * 1024 * 1024) /* input per job */
+#define PAR_OBUF_SIZE		(4 * 1024 * 1024) /* initial job output */
+#define PAR_OBUF_MAX		(16 * 1024 * 1024) /* output kept per job */
+#define PAR_CHUNK		(128 * 1024)	  /* sequential fallback */
+#define BGZF_BATCH		16		  /* blocks per worker grab */
+#define BGZF_WINDOW		(16 * 1024 * 1024) /* zlib_bgzf_read() */
+
+struct par_job {
+	const uint8_t *in;		/* points into par_ctx.buf */
+	size_t in_len;
+	uint64_t offs;			/* file offset of in */
+	uint8_t *out;
+	size_t out_size;
+	size_t good_in;			/* up to the last complete member */
+	size_t good_out;
+	int done;
+};
+
+struct par_ctx {
+	int fd_in;
+	int fd_out;
+
+	uint8_t *buf;			/* input from file offset base */
+	size_t buf_size;
+	size_t buf_len;
+	uint64_t base;
+	int eof;
+
+	unsigned int nthreads;
+	pthread_t *tid;
+	unsigned int running;		/* threads started for this round */
+	struct par_job *job;
+	unsigned int max_jobs;
+	unsigned int njobs;
+	unsigned int next;		/* next job for a worker */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static int par_read(struct par_ctx *ctx)
+{
+	ssize_t n;
+
+	while (!ctx->eof && ctx->buf_len < ctx->buf_size) {
+		n = read(ctx->fd_in, ctx->buf + ctx->buf_len,
+			 ctx->buf_size - ctx->buf_len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_err("reading input failed: %s\n", strerror(errno));
+			return Z_ERRNO;
+		}
+		if (n == 0)
+			ctx->eof = 1;
+		ctx->buf_len += n;
+	}
+	return Z_OK;
+}
+
+static int par_write(struct par_ctx *ctx, const uint8_t *data, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(ctx->fd_out, data, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_err("writing output failed: %s\n", strerror(errno));
+			return Z_ERRNO;
+		}
+		data += n;
+		len -= n;
+	}
+	return Z_OK;
+}
+
+/**
+ * par_fill() - Move file offset @pos to the buffer start and refill
+ *
+ * Must not be called while workers use the buffer.
+ */
+static int par_fill(struct par_ctx *ctx, uint64_t pos)
+{
+	size_t skip = pos - ctx->base;
+
+	memmove(ctx->buf, ctx->buf + skip, ctx->buf_len - skip);
+	ctx->buf_len -= skip;
+	ctx->base = pos;
+
+	return par_read(ctx);
+}
+
+/* ID1, ID2, CM deflate and no reserved flag bits */
+static inline int par_is_header(const uint8_t *p, size_t len)
+{
+	return len >= 10 && p[0] == 0x1f && p[1] == 0x8b &&
+		p[2] == Z_DEFLATED && (p[3] & 0xe0) == 0;
+}
+
+/**
+ * bgzf_block_len() - Size of the BGZF block at @p
+ *
+ * Return: the size from the BC extra field, 0 if @p is not the start
+ * of a complete BGZF block.
+ */
+static size_t bgzf_block_len(const uint8_t *p, size_t len)
+{
+	size_t xlen, i, slen, bsize;
+
+	if (!par_is_header(p, len) || len < 12 || !(p[3] & 0x04))
+		return 0;		/* no FEXTRA */
+
+	xlen = p[10] | (p[11] << 8);
+	if (len < 12 + xlen)
+		return 0;
+
+	for (i = 12; i + 4 <= 12 + xlen; i += 4 + slen) {
+		slen = p[i + 2] | (p[i + 3] << 8);
+		if (p[i] != 'B' || p[i + 1] != 'C' || slen != 2)
+			continue;
+		if (i + 6 > 12 + xlen)
+			return 0;
+
+		bsize = (p[i + 4] | (p[i + 5] << 8)) + 1;
+		if (bsize < 12 + xlen + 8 || bsize > len)
+			return 0;
+		return bsize;
+	}
+	return 0;
+}
+
+/* Next candidate header at or after @from, or @len if none */
+static size_t par_scan(const uint8_t *buf, size_t from, size_t len)
+{
+	const uint8_t *p;
+
+	while (from < len) {
+		p = memchr(buf + from, 0x1f, len - from);
+		if (p == NULL)
+			break;
+		from = p - buf;
+		if (par_is_header(p, len - from))
+			return from;
+		from++;
+	}
+	return len;
+}
+
+/**
+ * par_inflate_job() - Inflate all complete members of a job
+ *
+ * Stops at the first error, on truncated input, or if the output
+ * would exceed PAR_OBUF_MAX. good_in and good_out describe what was
+ * inflated up to the end of the last complete member.
+ */
+static void par_inflate_job(struct par_job *job)
+{
+	int rc;
+	z_stream strm;
+	size_t out_len = 0, in_left;
+	uint8_t *out;
+
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit2(&strm, 31) != Z_OK)
+		return;
+
+	strm.next_in = (uint8_t *)job->in;
+	strm.avail_in = job->in_len;
+
+	while (1) {
+		if (out_len == job->out_size) {
+			if (job->out_size >= PAR_OBUF_MAX)
+				break;
+			out = realloc(job->out, job->out_size ?
+				      job->out_size * 2 : PAR_OBUF_SIZE);
+			if (out == NULL)
+				break;
+			job->out = out;
+			job->out_size = job->out_size ?
+				job->out_size * 2 : PAR_OBUF_SIZE;
+		}
+		strm.next_out = job->out + out_len;
+		strm.avail_out = job->out_size - out_len;
+		in_left = strm.avail_in;
+
+		rc = inflate(&strm, Z_NO_FLUSH);
+		out_len = job->out_size - strm.avail_out;
+
+		if (rc == Z_STREAM_END) {
+			job->good_in = job->in_len - strm.avail_in;
+			job->good_out = out_len;
+			if (strm.avail_in == 0)
+				break;
+			inflateReset(&strm);
+			continue;
+		}
+		if (rc != Z_OK && rc != Z_BUF_ERROR)
+			break;
+		if (strm.avail_in == in_left && strm.avail_out != 0)
+			break;		/* truncated, no progress */
+	}
+	inflateEnd(&strm);
+}
+
+static void *par_worker(void *arg)
+{
+	struct par_ctx *ctx = arg;
+	struct par_job *job;
+
+	pthread_mutex_lock(&ctx->mutex);
+	while (ctx->next < ctx->njobs) {
+		job = &ctx->job[ctx->next++];
+		pthread_mutex_unlock(&ctx->mutex);
+
+		par_inflate_job(job);
+		zlib_stats_inc(&zlib_stats.gunzip_jobs);
+
+		pthread_mutex_lock(&ctx->mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&ctx->cond);
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+	return NULL;
+}
+
+static void par_join(struct par_ctx *ctx)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->next = ctx->njobs;		/* skip jobs not yet started */
+	pthread_mutex_unlock(&ctx->mutex);
+
+	for (i = 0; i < ctx->running; i++)
+		pthread_join(ctx->tid[i], NULL);
+	ctx->running = 0;
+}
+
+/**
+ * par_inflate_member() - Sequentially inflate one member at @pos
+ *
+ * Used where jobs cannot help: members larger than the buffer, false
+ * candidates and output beyond PAR_OBUF_MAX. If more input must be
+ * read, the round is ended and @moved is set.
+ */
+static int par_inflate_member(struct par_ctx *ctx, uint64_t *pos,
+			      uint8_t *out, int *moved)
+{
+	int rc;
+	z_stream strm;
+	size_t in_used;
+
+	zlib_stats_inc(&zlib_stats.gunzip_fallbacks);
+	memset(&strm, 0, sizeof(strm));
+	rc = inflateInit2(&strm, 31);
+	if (rc != Z_OK)
+		return rc;
+
+	do {
+		if (*pos - ctx->base == ctx->buf_len) {
+			if (ctx->eof) {
+				rc = Z_DATA_ERROR;	/* truncated */
+				break;
+			}
+			par_join(ctx);
+			*moved = 1;
+			rc = par_fill(ctx, *pos);
+			if (rc != Z_OK)
+				break;
+		}
+		strm.next_in = ctx->buf + (*pos - ctx->base);
+		strm.avail_in = ctx->buf_len - (*pos - ctx->base);
+
+		do {
+			strm.next_out = out;
+			strm.avail_out = PAR_CHUNK;
+			rc = inflate(&strm, Z_NO_FLUSH);
+			if (rc != Z_OK && rc != Z_STREAM_END &&
+			    rc != Z_BUF_ERROR)
+				break;
+			if (par_write(ctx, out, PAR_CHUNK - strm.avail_out)) {
+				rc = Z_ERRNO;
+				break;
+			}
+		} while (rc == Z_OK && strm.avail_out == 0);
+
+		in_used = ctx->buf_len - (*pos - ctx->base) - strm.avail_in;
+		*pos += in_used;
+		if (rc == Z_BUF_ERROR && in_used == 0)
+			rc = Z_DATA_ERROR;	/* no progress */
+	} while (rc == Z_OK || rc == Z_BUF_ERROR);
+
+	if (rc == Z_NEED_DICT)
+		rc = Z_DATA_ERROR;
+	inflateEnd(&strm);
+	return rc == Z_STREAM_END ? Z_OK : rc;
+}
+
+/* Job end: along BGZF block sizes or at the next candidate header */
+static size_t par_job_end(struct par_ctx *ctx, size_t start)
+{
+	size_t end = start, n;
+
+	while ((end - start < PAR_JOB_SIZE) &&
+	       (n = bgzf_block_len(ctx->buf + end, ctx->buf_len - end)))
+		end += n;
+	if (end != start)
+		return end;
+
+	return par_scan(ctx->buf, start + MIN((size_t)PAR_JOB_SIZE,
+					      ctx->buf_len - start),
+			ctx->buf_len);
+}
+
+/* Cut the buffer into jobs, starting at file offset @pos */
+static void par_setup_jobs(struct par_ctx *ctx, uint64_t pos)
+{
+	size_t start = pos - ctx->base, end;
+	struct par_job *job;
+
+	ctx->njobs = 0;
+	while (ctx->njobs < ctx->max_jobs && start < ctx->buf_len) {
+		end = par_job_end(ctx, start);
+		if (end == ctx->buf_len && !ctx->eof)
+			break;		/* member may continue in file */
+
+		job = &ctx->job[ctx->njobs++];
+		job->in = ctx->buf + start;
+		job->in_len = end - start;
+		job->offs = ctx->base + start;
+		job->good_in = job->good_out = 0;
+		job->done = 0;
+		start = end;
+	}
+	ctx->next = 0;
+}
+
+static int par_round(struct par_ctx *ctx, uint64_t *pos, uint8_t *out)
+{
+	int rc = Z_OK, moved = 0;
+	unsigned int i;
+	struct par_job *job;
+
+	rc = par_fill(ctx, *pos);
+	if (rc != Z_OK)
+		return rc;
+	if (ctx->buf_len == 0)
+		return Z_OK;
+
+	par_setup_jobs(ctx, *pos);
+	if (ctx->njobs == 0)		/* member larger than buffer */
+		return par_inflate_member(ctx, pos, out, &moved);
+
+	pr_trace("[%p] gunzip %u jobs at %lld\n", ctx, ctx->njobs,
+		 (long long)*pos);
+
+	for (i = 0; i < ctx->nthreads && i < ctx->njobs; i++) {
+		if (pthread_create(&ctx->tid[i], NULL, par_worker, ctx))
+			break;
+		ctx->running++;
+	}
+	if (ctx->running == 0)
+		par_worker(ctx);
+
+	for (i = 0; i < ctx->njobs && !moved; i++) {
+		job = &ctx->job[i];
+		if (job->offs < *pos)
+			continue;	/* started at false candidate */
+		if (job->offs > *pos)
+			break;		/* resync in next round */
+
+		pthread_mutex_lock(&ctx->mutex);
+		while (!job->done)
+			pthread_cond_wait(&ctx->cond, &ctx->mutex);
+		pthread_mutex_unlock(&ctx->mutex);
+
+		rc = par_write(ctx, job->out, job->good_out);
+		if (rc != Z_OK)
+			break;
+		*pos += job->good_in;
+		if (job->good_in == job->in_len)
+			continue;
+
+		rc = par_inflate_member(ctx, pos, out, &moved);
+		if (rc != Z_OK)
+			break;
+	}
+	par_join(ctx);
+	return rc;
+}
+
+int zlib_gunzip_parallel(int fd_in, int fd_out, unsigned int threads)
+{
+	int rc = Z_MEM_ERROR;
+	unsigned int i;
+	uint64_t pos = 0;
+	uint8_t *out = NULL;
+	struct par_ctx *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return Z_MEM_ERROR;
+
+	ctx->fd_in = fd_in;
+	ctx->fd_out = fd_out;
+	ctx->nthreads = threads ? threads : PAR_THREADS;
+	ctx->max_jobs = 2 * ctx->nthreads;	/* keep workers busy */
+	ctx->buf_size = (ctx->max_jobs + 1) * (size_t)PAR_JOB_SIZE;
+	pthread_mutex_init(&ctx->mutex, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+
+	ctx->buf = malloc(ctx->buf_size);
+	ctx->tid = calloc(ctx->nthreads, sizeof(*ctx->tid));
+	ctx->job = calloc(ctx->max_jobs, sizeof(*ctx->job));
+	out = malloc(PAR_CHUNK);
+	if (!ctx->buf || !ctx->tid || !ctx->job || !out)
+		goto out;
+
+	do {
+		rc = par_round(ctx, &pos, out);
+	} while (rc == Z_OK && !(ctx->eof && pos == ctx->base + ctx->buf_len));
+
+ out:
+	if (ctx->job)
+		for (i = 0; i < ctx->max_jobs; i++)
+			free(ctx->job[i].out);
+	free(out);
+	free(ctx->job);
+	free(ctx->tid);
+	free(ctx->buf);
+	pthread_cond_destroy(&ctx->cond);
+	pthread_mutex_destroy(&ctx->mutex);
+	free(ctx);
+	return rc;
+}
+
+/*****************************************************************************/
+/** BGZF reader								     */
+/*****************************************************************************/
+
+struct bgzf_blk {
+	uint64_t coffs;			/* offset in the compressed buffer */
+	uint64_t uoffs;			/* offset in the uncompressed data */
+	uint32_t clen;
+	uint32_t ulen;			/* ISIZE from the trailer */
+};
+
+struct zlib_bgzf {
+	const uint8_t *buf;
+	size_t len;
+	unsigned int nthreads;
+	unsigned long nblocks;
+	struct bgzf_blk *blk;
+
+	/* current zlib_bgzf_inflate() call */
+	unsigned long next, last;	/* blocks to hand out */
+	uint8_t *out;
+	uint64_t out_base;		/* uoffs of out */
+	int rc;
+	pthread_mutex_t mutex;
+};
+
+struct zlib_bgzf *zlib_bgzf_open(const void *buf, size_t len,
+				 unsigned int threads)
+{
+	size_t offs, n;
+	uint64_t uoffs = 0;
+	unsigned long max = 0;
+	struct bgzf_blk *blk;
+	struct zlib_bgzf *bgzf;
+	const uint8_t *p = buf;
+
+	bgzf = calloc(1, sizeof(*bgzf));
+	if (bgzf == NULL)
+		return NULL;
+
+	bgzf->buf = buf;
+	bgzf->len = len;
+	bgzf->nthreads = threads ? threads : PAR_THREADS;
+	pthread_mutex_init(&bgzf->mutex, NULL);
+
+	for (offs = 0; offs < len; offs += n) {
+		n = bgzf_block_len(p + offs, len - offs);
+		if (n == 0) {
+			pr_err("no BGZF block at offset %zu\n", offs);
+			goto err;
+		}
+		if (bgzf->nblocks == max) {
+			max = max ? max * 2 : 1024;
+			blk = realloc(bgzf->blk, max * sizeof(*blk));
+			if (blk == NULL)
+				goto err;
+			bgzf->blk = blk;
+		}
+		blk = &bgzf->blk[bgzf->nblocks++];
+		blk->coffs = offs;
+		blk->clen = n;
+		blk->uoffs = uoffs;
+		blk->ulen = p[offs + n - 4] | (p[offs + n - 3] << 8) |
+			(p[offs + n - 2] << 16) |
+			((uint32_t)p[offs + n - 1] << 24);
+		uoffs += blk->ulen;
+	}
+	return bgzf;
+
+ err:
+	zlib_bgzf_close(bgzf);
+	return NULL;
+}
+
+void zlib_bgzf_close(struct zlib_bgzf *bgzf)
+{
+	if (bgzf == NULL)
+		return;
+
+	pthread_mutex_destroy(&bgzf->mutex);
+	free(bgzf->blk);
+	free(bgzf);
+}
+
+unsigned long zlib_bgzf_blocks(struct zlib_bgzf *bgzf)
+{
+	return bgzf->nblocks;
+}
+
+uint64_t zlib_bgzf_size(struct zlib_bgzf *bgzf)
+{
+	struct bgzf_blk *blk;
+
+	if (bgzf->nblocks == 0)
+		return 0;
+
+	blk = &bgzf->blk[bgzf->nblocks - 1];
+	return blk->uoffs + blk->ulen;
+}
+
+int zlib_bgzf_block(struct zlib_bgzf *bgzf, unsigned long idx,
+		    uint64_t *coffs, uint64_t *uoffs, unsigned int *ulen)
+{
+	if (idx >= bgzf->nblocks)
+		return Z_STREAM_ERROR;
+
+	if (coffs)
+		*coffs = bgzf->blk[idx].coffs;
+	if (uoffs)
+		*uoffs = bgzf->blk[idx].uoffs;
+	if (ulen)
+		*ulen = bgzf->blk[idx].ulen;
+	return Z_OK;
+}
+
+unsigned long zlib_bgzf_find(struct zlib_bgzf *bgzf, uint64_t uoffs)
+{
+	unsigned long lo = 0, hi = bgzf->nblocks, mid;
+
+	/* Last block starting at or before uoffs, skipping empty ones */
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (bgzf->blk[mid].uoffs <= uoffs)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	while (lo < bgzf->nblocks && bgzf->blk[lo].ulen == 0)
+		lo++;
+	if (lo < bgzf->nblocks &&
+	    uoffs >= bgzf->blk[lo].uoffs + bgzf->blk[lo].ulen)
+		return bgzf->nblocks;
+	return lo;
+}
+
+/* Inflate one block to its place, the stream is set up for gzip */
+static int bgzf_inflate_block(struct zlib_bgzf *bgzf, z_stream *strm,
+			      struct bgzf_blk *blk)
+{
+	int rc;
+	uInt in_left, out_left;
+
+	if (blk->ulen == 0)
+		return Z_OK;		/* e.g. the EOF marker */
+
+	rc = inflateReset(strm);
+	if (rc != Z_OK)
+		return rc;
+
+	strm->next_in = (uint8_t *)bgzf->buf + blk->coffs;
+	strm->avail_in = blk->clen;
+	strm->next_out = bgzf->out + (blk->uoffs - bgzf->out_base);
+	strm->avail_out = blk->ulen;
+
+	do {
+		in_left = strm->avail_in;
+		out_left = strm->avail_out;
+		rc = inflate(strm, Z_FINISH);
+		if ((rc == Z_OK) && (strm->avail_in == in_left) &&
+		    (strm->avail_out == out_left))
+			rc = Z_DATA_ERROR;	/* no progress */
+	} while (rc == Z_OK);
+
+	if (rc != Z_STREAM_END || strm->avail_in || strm->avail_out) {
+		pr_err("BGZF block at offset %lld: inflate rc=%d\n",
+		       (long long)blk->coffs, rc);
+		return Z_DATA_ERROR;
+	}
+	zlib_stats_inc(&zlib_stats.bgzf_blocks);
+	return Z_OK;
+}
+
+static void *bgzf_worker(void *arg)
+{
+	int rc, init_rc;
+	z_stream strm;
+	unsigned long i, first, last;
+	struct zlib_bgzf *bgzf = arg;
+
+	memset(&strm, 0, sizeof(strm));
+	rc = init_rc = inflateInit2(&strm, 31);
+
+	while (1) {
+		pthread_mutex_lock(&bgzf->mutex);
+		if (rc != Z_OK && bgzf->rc == Z_OK)
+			bgzf->rc = rc;
+		if (bgzf->rc != Z_OK)
+			bgzf->next = bgzf->last;	/* stop all */
+		first = bgzf->next;
+		last = MIN(first + BGZF_BATCH, bgzf->last);
+		bgzf->next = last;
+		pthread_mutex_unlock(&bgzf->mutex);
+
+		if (first == last)
+			break;
+		for (i = first; i < last && rc == Z_OK; i++)
+			rc = bgzf_inflate_block(bgzf, &strm, &bgzf->blk[i]);
+	}
+
+	if (init_rc == Z_OK)
+		inflateEnd(&strm);
+	return NULL;
+}
+
+int zlib_bgzf_inflate(struct zlib_bgzf *bgzf, unsigned long first,
+		      unsigned long n, void *out, size_t out_size)
+{
+	unsigned int i, running = 0;
+	unsigned long nthreads;
+	pthread_t *tid;
+
+	if (first > bgzf->nblocks || n > bgzf->nblocks - first)
+		return Z_STREAM_ERROR;
+	if (n == 0)
+		return Z_OK;
+	if (bgzf->blk[first + n - 1].uoffs + bgzf->blk[first + n - 1].ulen -
+	    bgzf->blk[first].uoffs > out_size)
+		return Z_BUF_ERROR;
+
+	bgzf->next = first;
+	bgzf->last = first + n;
+	bgzf->out = out;
+	bgzf->out_base = bgzf->blk[first].uoffs;
+	bgzf->rc = Z_OK;
+
+	nthreads = MIN((unsigned long)bgzf->nthreads,
+		       (n + BGZF_BATCH - 1) / BGZF_BATCH);
+	tid = calloc(nthreads, sizeof(*tid));
+	if (tid != NULL)
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_create(&tid[i], NULL, bgzf_worker, bgzf))
+				break;
+			running++;
+		}
+	if (running == 0)
+		bgzf_worker(bgzf);
+
+	for (i = 0; i < running; i++)
+		pthread_join(tid[i], NULL);
+	free(tid);
+
+	return bgzf->rc;
+}
+
+int zlib_bgzf_read(struct zlib_bgzf *bgzf, int fd_out)
+{
+	int rc = Z_OK;
+	unsigned long first, last;
+	uint64_t size;
+	uint8_t *out;
+	struct par_ctx ctx = { .fd_out = fd_out };
+
+	out = malloc(BGZF_WINDOW);
+	if (out == NULL)
+		return Z_MEM_ERROR;
+
+	/* Windows of whole blocks, a block is at most 64 KiB */
+	for (first = 0; rc == Z_OK && first < bgzf->nblocks; first = last) {
+		for (last = first, size = 0; last < bgzf->nblocks &&
+			     size + bgzf->blk[last].ulen <= BGZF_WINDOW; last++)
+			size += bgzf->blk[last].ulen;
+		if (last == first) {
+			rc = Z_DATA_ERROR;	/* ISIZE too large */
+			break;
+		}
+
+		rc = zlib_bgzf_inflate(bgzf, first, last - first, out, size);
+		if (rc == Z_OK)
+			rc = par_write(&ctx, out, size);
+	}
+	free(out);
+	return rc;
+}
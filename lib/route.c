@@ -0,0 +1,306 @@
+/*
+ * Copyright 2017, International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Cost model for routing streams to hardware or software.
+ *
+ * The wrapper measures the time each stream spends in init, inflate
+ * or deflate and reports it together with total_in and the length the
+ * stream was routed by when it ends or is reset. The time per KiB of
+ * total_in is averaged per size class of the routing length, so that
+ * a class predicts the streams routed under it. Inflate streams are
+ * routed by their first chunk, deflate streams by their size if all
+ * data comes with Z_FINISH. Averages are kept for hardware per
+ * direction, software inflate per class and software deflate per
+ * level and data type (text or binary). A new stream goes to the
+ * engine predicted to finish first. Hardware gets a penalty for the
+ * calls queued in front of it.
+ *
+ * The model is off by default, ZLIB_FLAG_COST_MODEL in
+ * ZLIB_INFLATE_IMPL/ZLIB_DEFLATE_IMPL turns it on.
+ *
+ * Until both engines have measured a class, the old rule decides,
+ * and the missing engine is probed once. Every ROUTE_PROBE_INTERVAL
+ * decisions of a class go to the losing engine to keep its estimate
+ * current.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <zlib.h>
+#include "wrapper.h"
+
+#define ROUTE_MIN_SHIFT		10	/* class 0: streams below 1 KiB */
+#define ROUTE_CLASSES		12	/* last class: 1 MiB and more */
+#define ROUTE_LEVELS		10
+#define ROUTE_PROBE_INTERVAL	64	/* decisions between probes */
+#define ROUTE_TYPE_PROBE	256	/* bytes checked for text */
+#define CONFIG_ROUTE_HW_SLOTS	4	/* hardware calls run in parallel */
+
+struct route_cell {
+	unsigned long ns_per_kib;	/* average stream time per KiB */
+	unsigned long samples;
+};
+
+struct route_model {
+	struct route_cell hw[ROUTE_CLASSES];
+	struct route_cell sw[ROUTE_LEVELS][2][ROUTE_CLASSES];
+	unsigned long decisions[ROUTE_CLASSES];
+};
+
+static pthread_mutex_t route_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct route_model route_model[2];	/* inflate, deflate */
+static unsigned long route_hw_call_ns;		/* average hardware call */
+static unsigned int route_hw_queued;		/* hardware calls running */
+
+static const char *route_dir[2] = { "inflate", "deflate" };
+static const char *route_type[2] = { "binary", "text" };
+
+unsigned long zlib_route_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+static unsigned int route_class(unsigned long len)
+{
+	unsigned int c = 0;
+
+	len >>= ROUTE_MIN_SHIFT;
+	while (len && (c < ROUTE_CLASSES - 1)) {
+		len >>= 1;
+		c++;
+	}
+	return c;
+}
+
+/* Lower bound of a class in KiB, class 0 starts at 0 */
+static unsigned long route_class_kib(unsigned int c)
+{
+	return c ? (1ul << (ROUTE_MIN_SHIFT + c - 1)) / 1024 : 0;
+}
+
+/* Software inflate is not split by level and type, it uses slot 0 */
+static struct route_cell *route_sw(struct route_model *m, int defl,
+				   int level, int type, unsigned int c)
+{
+	if (!defl)
+		return &m->sw[0][0][c];
+	if (level == Z_DEFAULT_COMPRESSION)
+		level = 6;
+	if ((level < 0) || (level >= ROUTE_LEVELS))
+		level = ROUTE_LEVELS - 1;
+	return &m->sw[level][type ? 1 : 0][c];
+}
+
+static void route_avg(struct route_cell *cell, unsigned long ns_per_kib)
+{
+	if (cell->samples == 0)
+		cell->ns_per_kib = ns_per_kib;
+	else
+		cell->ns_per_kib = (cell->ns_per_kib * 7 + ns_per_kib) / 8;
+	cell->samples++;
+}
+
+/**
+ * zlib_route_data_type() - Guess if the data is text
+ *
+ * Software deflate speed depends a lot on the data, hardware speed
+ * hardly. Text is data without control characters other than
+ * whitespace at the start of the stream.
+ */
+int zlib_route_data_type(const uint8_t *buf, unsigned int len)
+{
+	unsigned int i;
+
+	if (buf == NULL)
+		return 0;
+
+	len = MIN(len, (unsigned int)ROUTE_TYPE_PROBE);
+	for (i = 0; i < len; i++) {
+		if ((buf[i] < 0x20) && (buf[i] != '\t') &&
+		    (buf[i] != '\n') && (buf[i] != '\r'))
+			return 0;
+	}
+	return len != 0;
+}
+
+/**
+ * zlib_route() - Pick the engine predicted to finish a stream first
+ *
+ * @strm:           stream, for tracing only
+ * @defl:           1 for deflate, 0 for inflate
+ * @len:            bytes the stream is expected to consume
+ * @level:          deflate level
+ * @type:           see zlib_route_data_type()
+ * @dflt:           choice of the static rules
+ */
+enum zlib_impl zlib_route(z_streamp strm, int defl, unsigned long len,
+			  int level, int type, enum zlib_impl dflt)
+{
+	struct route_model *m = &route_model[defl ? 1 : 0];
+	struct route_cell *hw, *sw;
+	unsigned int c = route_class(len);
+	unsigned int queued;
+	unsigned long t_hw = 0, t_sw = 0, wait = 0, n;
+	enum zlib_impl impl;
+	bool probe = false;
+
+	pthread_mutex_lock(&route_mutex);
+	hw = &m->hw[c];
+	sw = route_sw(m, defl, level, type, c);
+	queued = __atomic_load_n(&route_hw_queued, __ATOMIC_RELAXED);
+	n = ++m->decisions[c];
+
+	if ((hw->samples == 0) || (sw->samples == 0)) {
+		struct route_cell *own = dflt ? hw : sw;
+
+		/* use the old rule, then try the other engine once */
+		impl = dflt;
+		if (own->samples) {
+			impl = !dflt;
+			probe = true;
+		}
+	} else {
+		t_hw = hw->ns_per_kib * ((len + 1023) / 1024);
+		t_sw = sw->ns_per_kib * ((len + 1023) / 1024);
+		wait = route_hw_call_ns * queued / CONFIG_ROUTE_HW_SLOTS;
+		impl = (t_hw + wait < t_sw) ? ZLIB_HW_IMPL : ZLIB_SW_IMPL;
+		if (n % ROUTE_PROBE_INTERVAL == 0) {
+			impl = !impl;
+			probe = true;
+		}
+	}
+	pthread_mutex_unlock(&route_mutex);
+
+	if (probe)
+		zlib_stats_inc(&zlib_stats.route_probes);
+	if (defl)
+		zlib_stats_inc(impl ? &zlib_stats.route_deflate_hw :
+				      &zlib_stats.route_deflate_sw);
+	else
+		zlib_stats_inc(impl ? &zlib_stats.route_inflate_hw :
+				      &zlib_stats.route_inflate_sw);
+
+	pr_trace("[%p] route %s: len=%lu class=%luKiB level=%d type=%s "
+		 "hw=%lu+%lu usec (n=%lu queued=%u) sw=%lu usec (n=%lu) "
+		 "-> %s%s\n", strm, route_dir[defl ? 1 : 0], len,
+		 route_class_kib(c), level, route_type[type ? 1 : 0],
+		 t_hw / 1000, wait / 1000, hw->samples, queued,
+		 t_sw / 1000, sw->samples, impl ? "hw" : "sw",
+		 probe ? " (probe)" : "");
+
+	return impl;
+}
+
+/**
+ * zlib_route_account() - Feed the time a stream took into the model
+ *
+ * @defl:           1 for deflate, 0 for inflate
+ * @impl:           engine which processed the stream
+ * @level:          deflate level
+ * @type:           see zlib_route_data_type()
+ * @len:            length passed to zlib_route() for the stream
+ * @bytes:          total_in of the stream
+ * @nsec:           time spent in init and inflate/deflate calls
+ */
+void zlib_route_account(int defl, enum zlib_impl impl, int level, int type,
+			unsigned long len, unsigned long bytes,
+			unsigned long nsec)
+{
+	struct route_model *m = &route_model[defl ? 1 : 0];
+	unsigned int c = route_class(len);
+	unsigned long kib = (bytes + 1023) / 1024;
+
+	if (bytes == 0)
+		return;
+
+	pthread_mutex_lock(&route_mutex);
+	route_avg(impl ? &m->hw[c] : route_sw(m, defl, level, type, c),
+		  nsec / kib);
+	pthread_mutex_unlock(&route_mutex);
+}
+
+/* Calls into the hardware in progress, the queue seen by new streams */
+void zlib_route_hw_enter(void)
+{
+	__atomic_add_fetch(&route_hw_queued, 1, __ATOMIC_RELAXED);
+}
+
+void zlib_route_hw_leave(unsigned long nsec)
+{
+	unsigned long avg;
+
+	__atomic_sub_fetch(&route_hw_queued, 1, __ATOMIC_RELAXED);
+
+	/* racy average, good enough for a penalty estimate */
+	avg = __atomic_load_n(&route_hw_call_ns, __ATOMIC_RELAXED);
+	avg = avg ? (avg * 7 + nsec) / 8 : nsec;
+	__atomic_store_n(&route_hw_call_ns, avg, __ATOMIC_RELAXED);
+}
+
+static void route_print_cell(const char *dir, const char *engine,
+			     unsigned int c, struct route_cell *cell)
+{
+	if (cell->samples == 0)
+		return;
+
+	pr_info("  route %s %s %5lu KiB: %lu ns/KiB n=%lu\n", dir, engine,
+		route_class_kib(c), cell->ns_per_kib, cell->samples);
+}
+
+/**
+ * zlib_route_print() - Print the cost model with the statistics
+ *
+ * Classes are named by their lower bound, each one covers twice its
+ * lower bound, the last one everything larger.
+ */
+void zlib_route_print(void)
+{
+	unsigned int d, c, l, t;
+	char engine[16];
+
+	pthread_mutex_lock(&route_mutex);
+	for (d = 0; d < 2; d++) {
+		struct route_model *m = &route_model[d];
+
+		for (c = 0; c < ROUTE_CLASSES; c++) {
+			route_print_cell(route_dir[d], "hw", c, &m->hw[c]);
+			for (l = 0; l < ROUTE_LEVELS; l++) {
+				for (t = 0; t < 2; t++) {
+					if (d == 0)
+						snprintf(engine, sizeof(engine),
+							 "sw");
+					else
+						snprintf(engine, sizeof(engine),
+							 "sw%u/%s", l,
+							 route_type[t]);
+					route_print_cell(route_dir[d], engine,
+							 c, &m->sw[l][t][c]);
+				}
+			}
+		}
+	}
+	if (route_hw_call_ns)
+		pr_info("  route hw call: %lu ns\n", route_hw_call_ns);
+	pthread_mutex_unlock(&route_mutex);
+}
@@ -308,171 +308,46 @@ const char *z_zlibVersion(void)
 	return (* p_zlibVersion)();
 }
 
-static gzFile (* p_gzopen)(const char *path, const char *mode);
-gzFile gzopen(const char *path, const char *mode)
-{
-	zlib_stats_inc(&zlib_stats.gzopen);
-	check_sym(p_gzopen, NULL);
-	return (* p_gzopen)(path, mode);
-}
-
-static gzFile (* p_gzdopen)(int fd, const char *mode);
-gzFile gzdopen(int fd, const char *mode)
-{
-	zlib_stats_inc(&zlib_stats.gzdopen);
-	check_sym(p_gzdopen, NULL);
-	return (* p_gzdopen)(fd, mode);
-}
-
-static int (* p_gzwrite)(gzFile file, voidpc buf, unsigned len);
-int gzwrite(gzFile file, voidpc buf, unsigned len)
-
-{
-	zlib_stats_inc(&zlib_stats.gzwrite);
-	check_sym(p_gzwrite, -1);
-	return (* p_gzwrite)(file, buf, len);
-}
-
-static int (* p_gzread)(gzFile file, voidp buf, unsigned len);
-int gzread(gzFile file, voidp buf, unsigned len)
-{
-	zlib_stats_inc(&zlib_stats.gzread);
-	check_sym(p_gzread, -1);
-	return (* p_gzread)(file, buf, len);
-}
-
-static int (* p_gzclose)(gzFile file);
-int gzclose(gzFile file)
-{
-	zlib_stats_inc(&zlib_stats.gzclose);
-	check_sym(p_gzclose, Z_STREAM_ERROR);
-	return (* p_gzclose)(file);
-}
-
-static int (* p_gzungetc)(int c, gzFile file);
-int gzungetc(int c, gzFile file)
-{
-	zlib_stats_inc(&zlib_stats.gzungetc);
-	check_sym(p_gzungetc, -1);
-	return (* p_gzungetc)(c, file);
-}
-
-static int (* p_gzflush)(gzFile file, int flush);
-int gzflush(gzFile file, int flush)
-{
-	zlib_stats_inc(&zlib_stats.gzflush);
-	check_sym(p_gzflush, Z_STREAM_ERROR);
-	return (* p_gzflush)(file, flush);
-}
-
-static int (* p_gzeof)(gzFile file);
-int gzeof(gzFile file)
-{
-	zlib_stats_inc(&zlib_stats.gzeof);
-	check_sym(p_gzeof, 0);
-	return (* p_gzeof)(file);
-}
-
-static z_off_t (* p_gztell)(gzFile file);
-z_off_t gztell(gzFile file)
-{
-	zlib_stats_inc(&zlib_stats.gztell);
-	check_sym(p_gztell, -1ll);
-	return (* p_gztell)(file);
-}
-
-static const char * (* p_gzerror)(gzFile file, int *errnum);
-const char *gzerror(gzFile file, int *errnum)
-{
-	zlib_stats_inc(&zlib_stats.gzerror);
-	check_sym(p_gzerror, NULL);
-	return (* p_gzerror)(file, errnum);
-}
-
-static z_off_t (* p_gzseek)(gzFile file, z_off_t offset, int whence);
-z_off_t gzseek(gzFile file, z_off_t offset, int whence)
-{
-	zlib_stats_inc(&zlib_stats.gzseek);
-	check_sym(p_gzseek, -1ll);
-	return (* p_gzseek)(file, offset, whence);
-}
-
-static int (* p_gzrewind)(gzFile file);
-int gzrewind(gzFile file)
-{
-	zlib_stats_inc(&zlib_stats.gzrewind);
-	check_sym(p_gzrewind, -1);
-	return (* p_gzrewind)(file);
-}
-
-static char * (* p_gzgets)(gzFile file, char *buf, int len);
-char * gzgets(gzFile file, char *buf, int len)
-{
-	zlib_stats_inc(&zlib_stats.gzgets);
-	check_sym(p_gzgets, NULL);
-	return (* p_gzgets)(file, buf, len);
-}
-
-static int (* p_gzputc)(gzFile file, int c);
-int gzputc(gzFile file, int c)
-{
-	zlib_stats_inc(&zlib_stats.gzputc);
-	check_sym(p_gzputc, -1);
-	return (* p_gzputc)(file, c);
-}
-
-/*FIXME gzgetc is potentially a macro ... */
-static int (* p_gzgetc)(gzFile file);
-#undef gzgetc
-int gzgetc(gzFile file)
-{
-	zlib_stats_inc(&zlib_stats.gzgetc);
-	check_sym(p_gzgetc, -1);
-	return (* p_gzgetc)(file);
-}
-
-static int (* p_gzputs)(gzFile file, const char *s);
-int gzputs(gzFile file, const char *s)
-{
-	zlib_stats_inc(&zlib_stats.gzputs);
-	check_sym(p_gzputs, -1);
-	return (* p_gzputs)(file, s);
-}
-
-static int (* p_gzprintf)(gzFile file, const char *format, ...);
-int gzprintf(gzFile file, const char *format, ...)
-{
-	int count;
-	va_list ap;
-
-	zlib_stats_inc(&zlib_stats.gzprintf);
-	check_sym(p_gzprintf, -1);
-
-	va_start(ap, format);
-	count = (* p_gzprintf)(file, format, ap);
-	va_end(ap);
-
-	return count;
-}
-
-static int (* p_compress)(Bytef *dest, uLongf *destLen,
-			  const Bytef *source, uLong sourceLen);
-int compress(Bytef *dest, uLongf *destLen, const Bytef *source,
-	     uLong sourceLen)
-{
-	zlib_stats_inc(&zlib_stats.compress);
-	check_sym(p_compress, Z_STREAM_ERROR);
-	return (* p_compress)(dest, destLen, source, sourceLen);
-}
-
-static int (* p_compress2)(Bytef *dest, uLongf *destLen,
-			   const Bytef *source, uLong sourceLen, int level);
-int compress2(Bytef *dest, uLongf *destLen, const Bytef *source,
-	      uLong sourceLen, int level)
+/*
+ * The compress2() and uncompress() of libz call deflate() and
+ * inflate(), which resolve to the wrapper again. The software
+ * one-shot versions are therefore built on the z_ functions, the
+ * same way libz does it.
+ */
+int z_compress2(Bytef *dest, uLongf *destLen, const Bytef *source,
+		uLong sourceLen, int level)
 {
-	zlib_stats_inc(&zlib_stats.compress2);
-	check_sym(p_compress2, Z_STREAM_ERROR);
-	return (* p_compress2)(dest, destLen, source, sourceLen, level);
+	int rc;
+	z_stream stream;
+	const uInt max = (uInt)-1;
+	uLong left = *destLen;
+
+	*destLen = 0;
+	memset(&stream, 0, sizeof(stream));
+	rc = z_deflateInit2_(&stream, level, Z_DEFLATED, MAX_WBITS, 8,
+			     Z_DEFAULT_STRATEGY, ZLIB_VERSION,
+			     (int)sizeof(stream));
+	if (rc != Z_OK)
+		return rc;
+
+	stream.next_out = dest;
+	stream.next_in = (Bytef *)source;
+	do {
+		if (stream.avail_out == 0) {
+			stream.avail_out = left > max ? max : (uInt)left;
+			left -= stream.avail_out;
+		}
+		if (stream.avail_in == 0) {
+			stream.avail_in = sourceLen > max ? max :
+				(uInt)sourceLen;
+			sourceLen -= stream.avail_in;
+		}
+		rc = z_deflate(&stream, sourceLen ? Z_NO_FLUSH : Z_FINISH);
+	} while (rc == Z_OK);
+
+	*destLen = stream.total_out;
+	z_deflateEnd(&stream);
+	return (rc == Z_STREAM_END) ? Z_OK : rc;
 }
 
 static uLong (* p_compressBound)(uLong sourceLen);
@@ -482,25 +357,57 @@ uLong z_compressBound(uLong sourceLen)
 	return (* p_compressBound)(sourceLen);
 }
 
-static int (* p_uncompress)(Bytef *dest, uLongf *destLen,
-			    const Bytef *source, uLong sourceLen);
-int uncompress(Bytef *dest, uLongf *destLen, const Bytef *source,
-	       uLong sourceLen)
+int z_uncompress(Bytef *dest, uLongf *destLen, const Bytef *source,
+		 uLong sourceLen)
 {
-	zlib_stats_inc(&zlib_stats.uncompress);
-	check_sym(p_uncompress, Z_STREAM_ERROR);
-	return (* p_uncompress)(dest, destLen, source, sourceLen);
-}
+	int rc;
+	z_stream stream;
+	const uInt max = (uInt)-1;
+	uLong left = *destLen;
+	Byte buf[1];	/* for detecting incomplete streams */
+
+	if (left == 0) {
+		left = 1;
+		dest = buf;
+	}
 
-#if ZLIB_VERNUM >= 0x1270
-static int (* p_gzbuffer)(gzFile file, unsigned size);
-int gzbuffer(gzFile file, unsigned size)
-{
-	zlib_stats_inc(&zlib_stats.gzbuffer);
-	check_sym(p_gzbuffer, -1);
-	return (* p_gzbuffer)(file, size);
+	memset(&stream, 0, sizeof(stream));
+	stream.next_in = (Bytef *)source;
+	rc = z_inflateInit2_(&stream, MAX_WBITS, ZLIB_VERSION,
+			     (int)sizeof(stream));
+	if (rc != Z_OK)
+		return rc;
+
+	stream.next_out = dest;
+	do {
+		if (stream.avail_out == 0) {
+			stream.avail_out = left > max ? max : (uInt)left;
+			left -= stream.avail_out;
+		}
+		if (stream.avail_in == 0) {
+			stream.avail_in = sourceLen > max ? max :
+				(uInt)sourceLen;
+			sourceLen -= stream.avail_in;
+		}
+		rc = z_inflate(&stream, Z_NO_FLUSH);
+	} while (rc == Z_OK);
+
+	if (dest != buf)
+		*destLen = stream.total_out;
+	else if (stream.total_out && (rc == Z_BUF_ERROR))
+		left = 1;
+
+	z_inflateEnd(&stream);
+	if (rc == Z_STREAM_END)
+		return Z_OK;
+	if (rc == Z_NEED_DICT)
+		return Z_DATA_ERROR;
+	if ((rc == Z_BUF_ERROR) && (left + stream.avail_out))
+		return Z_DATA_ERROR;
+	return rc;
 }
 
+#if ZLIB_VERNUM >= 0x1270
 static uLong (* p_adler32_combine64)(uLong adler1, uLong adler2,
 				     z_off64_t len2);
 uLong adler32_combine64(uLong adler1, uLong adler2, z_off64_t len2)
@@ -518,46 +425,6 @@ uLong crc32_combine64(uLong crc1, uLong crc2, z_off64_t len2)
 	return (* p_crc32_combine64)(crc1, crc2, len2);
 }
 
-static gzFile (* p_gzopen64)(const char *path, const char *mode);
-gzFile gzopen64(const char *path, const char *mode)
-{
-	zlib_stats_inc(&zlib_stats.gzopen64);
-	check_sym(p_gzopen64, NULL);
-	return (* p_gzopen64)(path, mode);
-}
-
-static z_off64_t (* p_gztell64)(gzFile file);
-z_off64_t gztell64(gzFile file)
-{
-	zlib_stats_inc(&zlib_stats.gztell64);
-	check_sym(p_gztell64, -1ll);
-	return (* p_gztell64)(file);
-}
-
-static z_off64_t (* p_gzseek64)(gzFile file, z_off64_t offset, int whence);
-z_off64_t gzseek64(gzFile file, z_off64_t offset, int whence)
-{
-	zlib_stats_inc(&zlib_stats.gzseek64);
-	check_sym(p_gzseek64, -1ll);
-	return (* p_gzseek64)(file, offset, whence);
-}
-
-static z_off_t (* p_gzoffset)(gzFile file);
-z_off_t gzoffset(gzFile file)
-{
-	zlib_stats_inc(&zlib_stats.gzoffset);
-	check_sym(p_gzoffset, -1ll);
-	return (* p_gzoffset)(file);
-}
-
-static z_off64_t (* p_gzoffset64)(gzFile file);
-z_off64_t gzoffset64(gzFile file)
-{
-	zlib_stats_inc(&zlib_stats.gzoffset64);
-	check_sym(p_gzoffset64, -1ll);
-	return (* p_gzoffset64)(file);
-}
-
 static const z_crc_t *(* p_get_crc_table)(void);
 const z_crc_t *get_crc_table()
 {
@@ -673,28 +540,7 @@ load_syms:
 	register_sym(inflateBack);
 	register_sym(inflateBackEnd);
 
-	register_sym(gzopen);
-	register_sym(gzdopen);
-	register_sym(gzwrite);
-	register_sym(gzread);
-	register_sym(gzclose);
-	register_sym(gzflush);
-	register_sym(gzungetc);
-	register_sym(gzeof);
-	register_sym(gztell);
-	register_sym(gzerror);
-	register_sym(gzseek);
-	register_sym(gzrewind);
-	register_sym(gzputs);
-	register_sym(gzputc);
-	register_sym(gzgetc);
-	register_sym(gzputs);
-	register_sym(gzprintf);
-
-	register_sym(compress);
-	register_sym(compress2);
 	register_sym(compressBound);
-	register_sym(uncompress);
 
 	register_sym(zError);
 	register_sym(zlibCompileFlags);
@@ -706,12 +552,6 @@ load_syms:
 
 
 #if ZLIB_VERNUM >= 0x1270
-	register_sym(gzbuffer);
-	register_sym(gzopen64);
-	register_sym(gzseek64);
-	register_sym(gztell64);
-	register_sym(gzoffset);
-	register_sym(gzoffset64);
 	register_sym(adler32_combine64);
 	register_sym(crc32_combine64);
 	register_sym(get_crc_table);
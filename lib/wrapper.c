@@ -67,7 +67,11 @@
 
 #define ZLIB_MAXDICTLEN		 (32 * 1024)
 
-/* Good values are something like 8KiB or 16KiB */
+/*
+ * Good values are something like 8KiB or 16KiB. With
+ * ZLIB_FLAG_COST_MODEL it only decides until route.c has measured
+ * both implementations for a size class.
+ */
 #define CONFIG_INFLATE_THRESHOLD (16 * 1024)  /* 0: disabled */
 
 int zlib_trace = 0x0;		/* no trace by default */
@@ -120,8 +124,55 @@ struct _internal_state {
 
 	Bytef *dictionary;	/* backlevel support for sw zlib < 1.2.8 */
 	uInt dictLength;
+
+	/* Cost model input, see route.c */
+	int route_type;		/* text or binary */
+	unsigned long route_nsec; /* time spent in this stream */
+	unsigned long route_len; /* inflate: length it was routed by */
 };
 
+static inline bool __route_enabled(int defl)
+{
+	return (defl ? zlib_deflate_flags : zlib_inflate_flags) &
+		ZLIB_FLAG_COST_MODEL;
+}
+
+/*
+ * Report a finished stream to the cost model, under the length it was
+ * routed by. Inflate streams are routed by their first chunk, deflate
+ * streams by total_in, known when all data comes with Z_FINISH.
+ * Inflate streams which were not routed are not reported.
+ */
+static void __route_account(z_streamp strm, struct _internal_state *w,
+			    int defl)
+{
+	unsigned long len = defl ? strm->total_in : w->route_len;
+
+	if (__route_enabled(defl) && len)
+		zlib_route_account(defl, w->impl, w->level, w->route_type,
+				   len, strm->total_in, w->route_nsec);
+	w->route_nsec = 0;
+	w->route_len = 0;
+}
+
+/*
+ * New streams go to software instead of queueing behind a saturated
+ * accelerator. Checked at init and again on the first data call.
+ */
+static bool __hw_saturated(z_streamp strm, int defl)
+{
+	if (!((defl ? zlib_deflate_flags : zlib_inflate_flags) &
+	      ZLIB_FLAG_SPILL))
+		return false;
+
+	if (!zedc_hw_saturated())
+		return false;
+
+	pr_trace("[%p] %s: accelerator saturated, using software\n",
+		 strm, defl ? "deflate" : "inflate");
+	return true;
+}
+
 static int has_wrapper_state(z_streamp strm)
 {
 	struct _internal_state *w;
@@ -140,6 +191,8 @@ void zlib_set_accelerator(const char *accel, int card_no)
 {
 	if (strncmp(accel, "CAPI", 4) == 0)
 		zlib_accelerator = DDCB_TYPE_CAPI;
+	else if (strncmp(accel, "SW", 2) == 0)
+		zlib_accelerator = DDCB_TYPE_SW;
 	else
 		zlib_accelerator = DDCB_TYPE_GENWQE;
 
@@ -294,6 +347,7 @@ static void _init(void)
 	/* Software is done first such that zlibVersion already work */
 	zedc_sw_init();
 	zedc_hw_init();
+	zedc_gz_init();
 }
 
 static void __deflate_update_totals(z_streamp strm)
@@ -473,6 +527,41 @@ static void __print_stats(void)
 	pr_stat(s, compress2);
 	pr_stat(s, compressBound);
 	pr_stat(s, uncompress);
+	pr_stat(s, compress_hw);
+	pr_stat(s, uncompress_hw);
+
+	zedc_hw_stats(s);
+	pr_stat(s, pool_hits);
+	pr_stat(s, pool_misses);
+	pr_stat(s, lease_waits);
+	pr_stat(s, lease_direct);
+	pr_stat(s, lease_sw);
+	pr_stat(s, pin_hits);
+	pr_stat(s, pin_misses);
+	pr_stat(s, skip_dict_hits);
+	pr_stat(s, skip_dict_misses);
+	pr_stat(s, skip_dict_wasted_usec);
+	pr_stat(s, deflate_zerocopy);
+	pr_stat(s, inflate_zerocopy);
+	pr_stat(s, inflate_collected);
+	pr_stat(s, deflate_pipelined);
+	pr_stat(s, deflate_parallel);
+	pr_stat(s, gunzip_jobs);
+	pr_stat(s, gunzip_fallbacks);
+	pr_stat(s, bgzf_blocks);
+	pr_stat(s, index_points);
+	pr_stat(s, index_seeks);
+	pr_stat(s, route_inflate_hw);
+	pr_stat(s, route_inflate_sw);
+	pr_stat(s, route_deflate_hw);
+	pr_stat(s, route_deflate_sw);
+	pr_stat(s, route_probes);
+	pr_stat(s, spill_sw);
+	pr_stat(s, gz_readahead);
+	pr_stat(s, gz_readahead_waits);
+	pr_stat(s, gz_writebehind);
+	pr_stat(s, gz_writebehind_waits);
+	zlib_route_print();
 
 	pthread_mutex_unlock(&zlib_stats_mutex);
 }
@@ -533,6 +622,7 @@ int deflateInit2_(z_streamp strm,
 {
 	int rc = Z_OK;
 	struct _internal_state *w;
+	unsigned long t0 = zlib_route_nsec();
 
 	if (strm == NULL)
 		return Z_STREAM_ERROR;
@@ -554,6 +644,12 @@ int deflateInit2_(z_streamp strm,
 	w->stream_size = stream_size;
 	w->priv_data = NULL;
 	w->impl = zlib_deflate_impl; /* try default first */
+	w->allow_switching = true;
+
+	if ((w->impl == ZLIB_HW_IMPL) && __hw_saturated(strm, 1)) {
+		zlib_stats_inc(&zlib_stats.spill_sw);
+		w->impl = ZLIB_SW_IMPL;
+	}
 
 	rc = __deflateInit2_(strm, w);
 	if (rc != Z_OK) {
@@ -561,6 +657,7 @@ int deflateInit2_(z_streamp strm,
 	} else {
 		w->priv_data = strm->state;	/* backup sublevel state */
 		strm->state = (void *)w;
+		w->route_nsec = zlib_route_nsec() - t0;
 	}
 	return rc;
 }
@@ -595,6 +692,10 @@ int deflateReset(z_streamp strm)
 		pthread_mutex_unlock(&zlib_stats_mutex);
 	}
 
+	__route_account(strm, w, 1);
+	w->allow_switching = true;
+	w->route_type = 0;
+
 	strm->state = w->priv_data;
 	rc = w->impl ? h_deflateReset(strm) :
 		       z_deflateReset(strm);
@@ -622,6 +723,7 @@ int deflateSetDictionary(z_streamp strm,
 		 (long long)z_adler32(1, dictionary, dictLength));
 
 	zlib_stats_inc(&zlib_stats.deflateSetDictionary);
+	w->allow_switching = false;
 
 	strm->state = w->priv_data;
 	rc = w->impl ? h_deflateSetDictionary(strm, dictionary, dictLength) :
@@ -648,6 +750,7 @@ int deflateSetHeader(z_streamp strm, gz_headerp head)
 
 	pr_trace("[%p] deflateSetHeader\n", strm);
 	zlib_stats_inc(&zlib_stats.deflateSetHeader);
+	w->allow_switching = false;
 
 	strm->state = w->priv_data;
 	rc = w->impl ? h_deflateSetHeader(strm, head) :
@@ -704,6 +807,8 @@ int deflateCopy(z_streamp dest, z_streamp source)
 		return Z_ERRNO;
 
 	memcpy(w_dest, w_source, sizeof(*w_dest));
+	w_dest->allow_switching = false;
+	w_dest->route_nsec = 0;
 	source->state = w_source->priv_data;
 	dest->state = NULL;	/* this needs to be created */
 
@@ -724,11 +829,85 @@ int deflateCopy(z_streamp dest, z_streamp source)
 	return rc;
 }
 
+static int __deflateEnd(z_streamp strm, struct _internal_state *w)
+{
+	int rc;
+
+	if (strm == NULL)
+		return Z_STREAM_ERROR;
+
+	if (w == NULL)
+		return Z_STREAM_ERROR;
+
+	strm->state = w->priv_data;
+	rc = w->impl ? h_deflateEnd(strm) :
+		       z_deflateEnd(strm);
+	strm->state = NULL;
+
+	return rc;
+}
+
+/**
+ * Keep deflate on the hardware? All streams move to software if the
+ * accelerator is saturated. Otherwise only data passed with Z_FINISH
+ * tells the cost model how large the stream is, so only streams
+ * compressed by a single Z_FINISH call are routed by it, before the
+ * hardware has seen any data. Only hardware streams move to software,
+ * since the caller may have sized its output buffer with the larger
+ * hardware deflateBound(). Reset streams keep their implementation.
+ */
+static enum zlib_impl __deflate_select(z_streamp strm, unsigned long len,
+				       int level, int type, int flush)
+{
+	if (__hw_saturated(strm, 1)) {
+		zlib_stats_inc(&zlib_stats.spill_sw);
+		return ZLIB_SW_IMPL;
+	}
+	if ((flush == Z_FINISH) && __route_enabled(1))
+		return zlib_route(strm, 1, len, level, type, ZLIB_HW_IMPL);
+	return ZLIB_HW_IMPL;
+}
+
+static int __deflate_route(z_streamp strm, struct _internal_state *w,
+			   int flush)
+{
+	int rc;
+
+	w->route_type = zlib_route_data_type(strm->next_in, strm->avail_in);
+
+	if (w->impl != ZLIB_HW_IMPL)
+		return Z_OK;
+
+	if (__deflate_select(strm, strm->avail_in, w->level, w->route_type,
+			     flush) == ZLIB_HW_IMPL)
+		return Z_OK;
+
+	pr_trace("[%p] deflate: avail_in=%d switching to software mode!\n",
+		 strm, strm->avail_in);
+
+	/* Free already allocated resources, but not w */
+	rc = __deflateEnd(strm, w);
+	if (rc != Z_OK)
+		goto err;
+
+	w->impl = ZLIB_SW_IMPL;
+	rc = __deflateInit2_(strm, w);
+	if (rc != Z_OK)
+		goto err;
+
+	w->priv_data = strm->state; /* backup sublevel state */
+	w->route_nsec = 0;
+ err:
+	strm->state = (void *)w;
+	return rc;
+}
+
 int deflate(z_streamp strm, int flush)
 {
 	int rc = 0;
 	struct _internal_state *w;
 	unsigned int avail_in_slot, avail_out_slot;
+	unsigned long t0 = 0, t1 = 0;
 
 	if (0 == has_wrapper_state(strm)) {
 		rc = z_deflate(strm, flush);
@@ -742,6 +921,15 @@ int deflate(z_streamp strm, int flush)
 	if (w == NULL)
 		return Z_STREAM_ERROR;
 
+	if (__route_enabled(1))
+		t0 = zlib_route_nsec();
+
+	if ((strm->total_in == 0) && (w->allow_switching)) {
+		rc = __deflate_route(strm, w, flush);
+		if (rc != Z_OK)
+			return rc;
+	}
+
 	if (zlib_gather_statistics()) {
 		pthread_mutex_lock(&zlib_stats_mutex);
 		avail_in_slot = strm->avail_in / 4096;
@@ -767,7 +955,13 @@ int deflate(z_streamp strm, int flush)
 	/* impl can only be ZLIB_HW_IMPL or ZLIB_SW_IMPL */
 	switch (w->impl) {
 	case ZLIB_HW_IMPL:
+		if (t0) {
+			t1 = zlib_route_nsec();
+			zlib_route_hw_enter();
+		}
 		rc = h_deflate(strm, flush);
+		if (t0)
+			zlib_route_hw_leave(zlib_route_nsec() - t1);
 		break;
 	case ZLIB_SW_IMPL:
 		rc = z_deflate(strm, flush);
@@ -777,7 +971,10 @@ int deflate(z_streamp strm, int flush)
 			 strm, w->impl);
 		break;
 	}
+	w->allow_switching = false;
 	strm->state = (void *)w;
+	if (t0)
+		w->route_nsec += zlib_route_nsec() - t0;
 
 	pr_trace("[%p]            flush=%s next_in=%p avail_in=%d "
 		 "next_out=%p avail_out=%d total_out=%ld crc/adler=%08lx "
@@ -788,24 +985,6 @@ int deflate(z_streamp strm, int flush)
 	return rc;
 }
 
-static int __deflateEnd(z_streamp strm, struct _internal_state *w)
-{
-	int rc;
-
-	if (strm == NULL)
-		return Z_STREAM_ERROR;
-
-	if (w == NULL)
-		return Z_STREAM_ERROR;
-
-	strm->state = w->priv_data;
-	rc = w->impl ? h_deflateEnd(strm) :
-		       z_deflateEnd(strm);
-	strm->state = NULL;
-
-	return rc;
-}
-
 uLong deflateBound(z_streamp strm, uLong sourceLen)
 {
 	int rc;
@@ -849,6 +1028,7 @@ int deflateEnd(z_streamp strm)
 		pthread_mutex_unlock(&zlib_stats_mutex);
 	}
 
+	__route_account(strm, w, 1);
 	rc = __deflateEnd(strm, w);
 
 	pr_trace("[%p] deflateEnd w=%p rc=%d\n", strm, w, rc);
@@ -977,6 +1157,7 @@ int inflateInit2_(z_streamp strm, int  windowBits,
 {
 	int rc = Z_OK;
 	struct _internal_state *w;
+	unsigned long t0 = zlib_route_nsec();
 
 	if (strm == NULL)
 		return Z_STREAM_ERROR;
@@ -999,6 +1180,11 @@ int inflateInit2_(z_streamp strm, int  windowBits,
 	w->impl = zlib_inflate_impl; /* try default first */
 	w->dictLength = 0;
 
+	if ((w->impl == ZLIB_HW_IMPL) && __hw_saturated(strm, 0)) {
+		zlib_stats_inc(&zlib_stats.spill_sw);
+		w->impl = ZLIB_SW_IMPL;
+	}
+
 	if (!z_hasGetDictionary()) {
 		w->dictionary = calloc(1, ZLIB_MAXDICTLEN);
 		if (w->dictionary == NULL) {
@@ -1013,6 +1199,8 @@ int inflateInit2_(z_streamp strm, int  windowBits,
 	else
 		goto free_dict;
 
+	w->route_nsec = zlib_route_nsec() - t0;
+
 	return rc;
 
  free_dict:
@@ -1058,6 +1246,7 @@ int inflateReset(z_streamp strm)
 		pthread_mutex_unlock(&zlib_stats_mutex);
 	}
 
+	__route_account(strm, w, 0);
 	w->allow_switching = true;
 	w->gzhead = NULL;	/* clear gz header */
 	w->dictLength = 0;	/* clear cached dictionary */
@@ -1066,6 +1255,10 @@ int inflateReset(z_streamp strm)
 	rc = (w->impl) ? h_inflateReset(strm) :
 			 z_inflateReset(strm);
 
+	/* Input behind the last stream can be held by the hardware */
+	if (w->impl && h_inflate_holds_input(strm))
+		w->allow_switching = false;
+
 	strm->total_in = 0;
 	strm->total_out = 0;
 	strm->state = (void *)w;
@@ -1103,6 +1296,7 @@ int inflateReset2(z_streamp strm, int windowBits)
 		pthread_mutex_unlock(&zlib_stats_mutex);
 	}
 
+	__route_account(strm, w, 0);
 	w->allow_switching = true;
 	w->dictLength = 0;	/* clear cached dictionary */
 
@@ -1110,6 +1304,10 @@ int inflateReset2(z_streamp strm, int windowBits)
 	rc = (w->impl) ? h_inflateReset2(strm, windowBits) :
 			 z_inflateReset2(strm, windowBits);
 
+	/* Input behind the last stream can be held by the hardware */
+	if (w->impl && h_inflate_holds_input(strm))
+		w->allow_switching = false;
+
 	strm->total_in = 0;
 	strm->total_out = 0;
 	strm->state = (void *)w;
@@ -1302,6 +1500,7 @@ int inflateEnd(z_streamp strm)
 		pthread_mutex_unlock(&zlib_stats_mutex);
 	}
 
+	__route_account(strm, w, 0);
 	rc = __inflateEnd(strm, w);
 
 	if (w->dictionary) {
@@ -1315,6 +1514,35 @@ int inflateEnd(z_streamp strm)
 	return rc;
 }
 
+/**
+ * The static rule sends streams starting with less than
+ * zlib_inflate_threshold bytes to software. With the cost model it
+ * only decides until both implementations have been measured. No
+ * stream starts on a saturated accelerator.
+ */
+static enum zlib_impl __inflate_route(z_streamp strm, enum zlib_impl cur,
+				      unsigned long len)
+{
+	enum zlib_impl impl = cur;
+
+	if (len < zlib_inflate_threshold)
+		impl = ZLIB_SW_IMPL;
+	else if (zlib_inflate_impl == ZLIB_HW_IMPL)
+		impl = ZLIB_HW_IMPL;
+
+	if (!__route_enabled(0) || (zlib_inflate_impl != ZLIB_HW_IMPL))
+		goto out;
+
+	impl = zlib_route(strm, 0, len, 0, 0, impl);
+ out:
+	if ((impl == ZLIB_HW_IMPL) && __hw_saturated(strm, 0)) {
+		if (cur == ZLIB_HW_IMPL)
+			zlib_stats_inc(&zlib_stats.spill_sw);
+		impl = ZLIB_SW_IMPL;
+	}
+	return impl;
+}
+
 int inflate(z_streamp strm, int flush)
 {
 	int rc = Z_OK;
@@ -1322,6 +1550,9 @@ int inflate(z_streamp strm, int flush)
 	unsigned int avail_in_slot, avail_out_slot;
 	uint8_t dictionary[ZLIB_MAXDICTLEN];
 	unsigned int dictLength = 0;
+	enum zlib_impl impl;
+	unsigned long t0 = 0, t1 = 0;
+	unsigned int len;
 
 	if (strm == NULL)
 		return Z_STREAM_ERROR;
@@ -1330,6 +1561,9 @@ int inflate(z_streamp strm, int flush)
 	if (w == NULL)
 		return Z_STREAM_ERROR;
 
+	if (__route_enabled(0))
+		t0 = zlib_route_nsec();
+
 	/*
 	 * Special situation triggered by strange JAVA zlib use-case:
 	 * If we do not have any data to decompress, return
@@ -1343,48 +1577,21 @@ int inflate(z_streamp strm, int flush)
 		if (strm->avail_in == 0)
 			return Z_BUF_ERROR;
 
-		if ((strm->avail_in < zlib_inflate_threshold) &&
-		    (w->impl == ZLIB_HW_IMPL)) {
-			pr_trace("[%p] inflate: avail_in=%d smaller "
-				 "%d switching to software mode!\n",
-				 strm, strm->avail_in, zlib_inflate_threshold);
-
-			rc = inflateGetDictionary(strm, dictionary,
-						  &dictLength);
-			if (rc != Z_OK)
-				goto err;
-
-			/* Free already allocated resources, but not w */
-			rc = __inflateEnd(strm, w);
-			if (rc != Z_OK)
-				goto err;
-
-			/* Enforce software here! */
-			w->impl = ZLIB_SW_IMPL;
-
-			/* Reinit but not w */
-			rc = __inflateInit2_(strm, w);
-			if (rc != Z_OK)
-				goto err;
-
-			strm->state = (void *)w;
-			if (w->gzhead != NULL)
-				inflateGetHeader(strm, w->gzhead);
+		/*
+		 * Hardware collects small chunks of zlib/gzip data up
+		 * to the watermark, so a small first chunk does not
+		 * mean a small stream.
+		 */
+		len = strm->avail_in;
+		if ((flush != Z_FINISH) && (w->windowBits >= 0))
+			len = MAX(len, zedc_hw_inflate_watermark());
 
-			if (dictLength != 0) {
-				rc = inflateSetDictionary(strm, dictionary,
-							  dictLength);
-				if (rc != Z_OK) {
-					inflateEnd(strm);
-					goto err;
-				}
-			}
-		} else if ((strm->avail_in >= zlib_inflate_threshold) &&
-			   (w->impl == ZLIB_SW_IMPL) &&
-			   (zlib_inflate_impl == ZLIB_HW_IMPL)) {
-			pr_trace("[%p] inflate: avail_in=%d bigger or equal "
-				 "%d switching to hardware mode!\n",
-				 strm, strm->avail_in, zlib_inflate_threshold);
+		impl = __inflate_route(strm, w->impl, len);
+		if (impl != w->impl) {
+			pr_trace("[%p] inflate: avail_in=%d threshold=%d "
+				 "switching to %s mode!\n", strm,
+				 strm->avail_in, zlib_inflate_threshold,
+				 impl ? "hardware" : "software");
 
 			rc = inflateGetDictionary(strm, dictionary,
 						  &dictLength);
@@ -1396,8 +1603,8 @@ int inflate(z_streamp strm, int flush)
 			if (rc != Z_OK)
 				goto err;
 
-			/* Try hardware mode here! */
-			w->impl = zlib_inflate_impl;
+			w->impl = impl;
+			w->route_nsec = 0;
 
 			/* Reinit but not w */
 			rc = __inflateInit2_(strm, w);
@@ -1417,6 +1624,7 @@ int inflate(z_streamp strm, int flush)
 				}
 			}
 		}
+		w->route_len = len;
 	}
 
 	if (zlib_gather_statistics()) {
@@ -1442,12 +1650,20 @@ int inflate(z_streamp strm, int flush)
 		 strm->total_in, strm->total_out, strm->adler);
 
 	strm->state = w->priv_data;
-	rc = w->impl ? h_inflate(strm, flush) :
-		       z_inflate(strm, flush);
+	if (w->impl && t0) {
+		t1 = zlib_route_nsec();
+		zlib_route_hw_enter();
+		rc = h_inflate(strm, flush);
+		zlib_route_hw_leave(zlib_route_nsec() - t1);
+	} else
+		rc = w->impl ? h_inflate(strm, flush) :
+			       z_inflate(strm, flush);
 
 	/* stop switching after lowlevel inflate has been called */
 	w->allow_switching = false;
 	strm->state = (void *)w;
+	if (t0)
+		w->route_nsec += zlib_route_nsec() - t0;
 
 	pr_trace("[%p]            flush=%s next_in=%p avail_in=%d "
 		 "next_out=%p avail_out=%d total_in=%ld total_out=%ld "
@@ -1493,11 +1709,126 @@ uLong zlibCompileFlags(void)
 	return z_zlibCompileFlags();
 }
 
+/*
+ * The hardware expands incompressible data more than software. A
+ * destination of compressBound() bytes lets compress() finish in one
+ * DDCB, smaller ones may have to be repeated in software.
+ */
 uLong compressBound(uLong sourceLen)
 {
 	zlib_stats_inc(&zlib_stats.compressBound);
+	if (zlib_deflate_impl != ZLIB_HW_IMPL)
+		return z_compressBound(sourceLen);
+
 	return MAX(h_deflateBound(NULL, sourceLen),
-			   z_deflateBound(NULL, sourceLen));
+		   z_deflateBound(NULL, sourceLen));
+}
+
+/**
+ * One-shot compress2()/uncompress() follow the rules of a stream
+ * passing all data with Z_FINISH: level 0, the inflate threshold,
+ * the cost model and a saturated accelerator send them to software.
+ * Input and output are complete, so anything the hardware does not
+ * finish in one DDCB, e.g. a too small dest, is simply repeated in
+ * software.
+ */
+static int __compress2(Bytef *dest, uLongf *destLen, const Bytef *source,
+		       uLong sourceLen, int level)
+{
+	int rc, type;
+	enum zlib_impl impl = zlib_deflate_impl;
+	unsigned long nsec, start = zlib_route_nsec();
+
+	type = zlib_route_data_type(source, sourceLen);
+	if (level == Z_NO_COMPRESSION)
+		impl = ZLIB_SW_IMPL;
+	if (impl == ZLIB_HW_IMPL)
+		impl = __deflate_select(NULL, sourceLen, level, type,
+					Z_FINISH);
+
+	if (impl == ZLIB_HW_IMPL) {
+		uLongf len = *destLen;
+
+		zlib_route_hw_enter();
+		rc = h_compress2(dest, &len, source, sourceLen, level);
+		nsec = zlib_route_nsec() - start;
+		zlib_route_hw_leave(nsec);
+
+		if (rc == Z_OK) {
+			zlib_stats_inc(&zlib_stats.compress_hw);
+			if (__route_enabled(1))
+				zlib_route_account(1, impl, level, type,
+						   sourceLen, sourceLen, nsec);
+			*destLen = len;
+			return rc;
+		}
+		pr_trace("compress2: sourceLen=%lu destLen=%lu rc=%d "
+			 "using software\n", sourceLen,
+			 (unsigned long)*destLen, rc);
+		impl = ZLIB_SW_IMPL;
+		start = zlib_route_nsec();
+	}
+
+	rc = z_compress2(dest, destLen, source, sourceLen, level);
+	if ((rc == Z_OK) && __route_enabled(1))
+		zlib_route_account(1, impl, level, type, sourceLen,
+				   sourceLen, zlib_route_nsec() - start);
+	return rc;
+}
+
+int compress(Bytef *dest, uLongf *destLen, const Bytef *source,
+	     uLong sourceLen)
+{
+	zlib_stats_inc(&zlib_stats.compress);
+	return __compress2(dest, destLen, source, sourceLen,
+			   Z_DEFAULT_COMPRESSION);
+}
+
+int compress2(Bytef *dest, uLongf *destLen, const Bytef *source,
+	      uLong sourceLen, int level)
+{
+	zlib_stats_inc(&zlib_stats.compress2);
+	return __compress2(dest, destLen, source, sourceLen, level);
+}
+
+int uncompress(Bytef *dest, uLongf *destLen, const Bytef *source,
+	       uLong sourceLen)
+{
+	int rc;
+	enum zlib_impl impl;
+	unsigned long nsec, start = zlib_route_nsec();
+
+	zlib_stats_inc(&zlib_stats.uncompress);
+
+	impl = __inflate_route(NULL, zlib_inflate_impl, sourceLen);
+	if (impl == ZLIB_HW_IMPL) {
+		uLongf len = *destLen;
+
+		zlib_route_hw_enter();
+		rc = h_uncompress(dest, &len, source, sourceLen);
+		nsec = zlib_route_nsec() - start;
+		zlib_route_hw_leave(nsec);
+
+		if (rc == Z_OK) {
+			zlib_stats_inc(&zlib_stats.uncompress_hw);
+			if (__route_enabled(0))
+				zlib_route_account(0, impl, 0, 0, sourceLen,
+						   sourceLen, nsec);
+			*destLen = len;
+			return rc;
+		}
+		pr_trace("uncompress: sourceLen=%lu destLen=%lu rc=%d "
+			 "using software\n", sourceLen,
+			 (unsigned long)*destLen, rc);
+		impl = ZLIB_SW_IMPL;
+		start = zlib_route_nsec();
+	}
+
+	rc = z_uncompress(dest, destLen, source, sourceLen);
+	if ((rc == Z_OK) && __route_enabled(0))
+		zlib_route_account(0, impl, 0, 0, sourceLen,
+				   sourceLen, zlib_route_nsec() - start);
+	return rc;
 }
 
 /*
@@ -173,10 +173,43 @@ struct zlib_stats {
 	unsigned long compress2;
 	unsigned long compressBound;
 	unsigned long uncompress;
+	unsigned long compress_hw;	/* one-shot calls done by hardware */
+	unsigned long uncompress_hw;
 
 	unsigned long adler32_combine64;
 	unsigned long crc32_combine64;
 	unsigned long get_crc_table;
+
+	unsigned long pool_hits;	/* DMA buffers reused */
+	unsigned long pool_misses;	/* DMA buffers allocated */
+	unsigned long lease_waits;	/* waited for leased buffers */
+	unsigned long lease_direct;	/* DDCBs on caller buffers */
+	unsigned long lease_sw;		/* streams sent to software */
+	unsigned long pin_hits;		/* registered buffers pinned */
+	unsigned long pin_misses;
+	unsigned long skip_dict_hits;	/* Z_FINISH DDCBs without SAVE_DICT */
+	unsigned long skip_dict_misses;	/*   repeated with SAVE_DICT */
+	unsigned long skip_dict_wasted_usec; /* hardware time of those */
+	unsigned long deflate_zerocopy;	/* DDCBs on caller buffers */
+	unsigned long inflate_zerocopy;	/* inflates bypassing obuf */
+	unsigned long inflate_collected; /* inflate inputs collected in ibuf */
+	unsigned long deflate_pipelined; /* DDCBs overlapping the caller */
+	unsigned long deflate_parallel;	/* segments of parallel deflate */
+	unsigned long gunzip_jobs;	/* jobs of zlib_gunzip_parallel() */
+	unsigned long gunzip_fallbacks;	/* members inflated sequentially */
+	unsigned long bgzf_blocks;	/* blocks inflated by zlib_bgzf_* */
+	unsigned long index_points;	/* access points of zlib_index_build() */
+	unsigned long index_seeks;	/* restarts of zlib_index_extract() */
+	unsigned long route_inflate_hw;	/* cost model decisions */
+	unsigned long route_inflate_sw;
+	unsigned long route_deflate_hw;
+	unsigned long route_deflate_sw;
+	unsigned long route_probes;	/*   against the prediction */
+	unsigned long spill_sw;		/* streams kept off a busy card */
+	unsigned long gz_readahead;	/* buffers read ahead for gzread() */
+	unsigned long gz_readahead_waits; /*   gzread() waited for one */
+	unsigned long gz_writebehind;	/* buffers deflated by the gz writer */
+	unsigned long gz_writebehind_waits; /*   gzwrite() waited for it */
 };
 
 extern pthread_mutex_t zlib_stats_mutex; /* mutex to protect zlib_stats */
@@ -192,6 +225,18 @@ static inline void zlib_stats_inc(unsigned long *count)
 	pthread_mutex_unlock(&zlib_stats_mutex);
 }
 
+/* Hardware/software routing, see route.c */
+unsigned long zlib_route_nsec(void);
+int zlib_route_data_type(const uint8_t *buf, unsigned int len);
+enum zlib_impl zlib_route(z_streamp strm, int defl, unsigned long len,
+			  int level, int type, enum zlib_impl dflt);
+void zlib_route_account(int defl, enum zlib_impl impl, int level, int type,
+			unsigned long len, unsigned long bytes,
+			unsigned long nsec);
+void zlib_route_hw_enter(void);
+void zlib_route_hw_leave(unsigned long nsec);
+void zlib_route_print(void);
+
 /* Hardware implementation */
 int h_deflateInit2_(z_streamp strm, int level, int method,
 		    int windowBits, int memLevel,
@@ -221,10 +266,18 @@ int h_inflateGetDictionary(z_streamp strm, Bytef *dictionary,
 			   uInt *dictLength);
 
 int h_inflateGetHeader(z_streamp strm, gz_headerp head);
+int h_inflateSnapshot(z_streamp strm, uint8_t *buf, unsigned int *len);
+int h_inflateRestore(z_streamp strm, const uint8_t *buf, unsigned int len);
 int h_deflateCopy(z_streamp dest, z_streamp source);
 
 int h_inflate(z_streamp strm, int flush);
 int h_inflateEnd(z_streamp strm);
+bool h_inflate_holds_input(z_streamp strm);
+
+int h_compress2(Bytef *dest, uLongf *destLen, const Bytef *source,
+		uLong sourceLen, int level);
+int h_uncompress(Bytef *dest, uLongf *destLen, const Bytef *source,
+		 uLong sourceLen);
 
 /* Software implementation */
 int z_deflateInit2_(z_streamp strm, int level, int method,
@@ -274,6 +327,10 @@ uLong z_crc32_combine(uLong crc1, uLong crc2, z_off_t len2);
 
 const char *z_zError(int err);
 uLong z_compressBound(uLong sourceLen);
+int z_compress2(Bytef *dest, uLongf *destLen, const Bytef *source,
+		uLong sourceLen, int level);
+int z_uncompress(Bytef *dest, uLongf *destLen, const Bytef *source,
+		 uLong sourceLen);
 
 /* PCIe trigger function. Writes to register 0x0 which normally non-sense. */
 void error_trigger(void);
@@ -281,10 +338,16 @@ void error_trigger(void);
 /* Constructors/destructors */
 void zedc_hw_init(void);
 void zedc_hw_done(void);
+void zedc_hw_stats(struct zlib_stats *s);
+bool zedc_hw_saturated(void);
+unsigned int zedc_hw_buf_size(void);
+unsigned int zedc_hw_inflate_watermark(void);
 
 void zedc_sw_init(void);
 void zedc_sw_done(void);
 
+void zedc_gz_init(void);
+
 /* Circumvention for missing prototypes */
 const char *z_zlibVersion(void);
 uLong z_zlibCompileFlags(void);
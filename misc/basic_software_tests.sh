@@ -67,6 +67,12 @@ if [ $? -ne 0 ]; then
 	exit 1
 fi
 
+inflate_watermark_test.sh
+if [ $? -ne 0 ]; then
+	echo "FAILED ${accel} CARD ${card}"
+	exit 1
+fi
+
 echo "PASSED ${accel} CARD ${card}"
 
 dmesg -T > basic_software_test.dmesg
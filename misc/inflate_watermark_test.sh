@@ -0,0 +1,91 @@
+#!/bin/bash
+#
+# Copyright 2016, International Business Machines
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+#
+# Regression test for inflate input buffering (ZLIB_INFLATE_WATERMARK):
+# a multi-member gzip file read in chunks below the watermark must
+# decompress completely, also when a member ends in collected input.
+# Uses the software DDCB backend, so no card is needed.
+#
+
+export PATH=`pwd`/tools:`pwd`/misc:$PATH
+export LD_LIBRARY_PATH=`pwd`/lib:$LD_LIBRARY_PATH
+
+export ZLIB_ACCELERATOR=SW
+export ZLIB_INFLATE_IMPL=0x01
+export ZLIB_INFLATE_WATERMARK=65536
+
+# Members of several deflate blocks: collecting stops at the last one
+members=8
+member_size=100000
+
+tmp=`mktemp -d`
+trap "rm -rf ${tmp}" EXIT
+
+function check() {
+    local rc=$?
+    local name=$1;
+
+    cmp -s ${tmp}/data ${tmp}/data.out
+    if [ $? -ne 0 -o ${rc} -ne 0 ]; then
+	echo "FAILED ${name}"
+	exit 1
+    fi
+    echo "ok ${name}"
+}
+
+echo "Build ${members} gzip members of ${member_size} bytes ..."
+cat lib/*.c lib/*.h tools/*.c misc/*.c > ${tmp}/src
+for i in `seq 0 $((members - 1))`; do
+    dd if=${tmp}/src of=${tmp}/part bs=${member_size} skip=${i} count=1 \
+	2> /dev/null
+    cat ${tmp}/part >> ${tmp}/data
+    genwqe_gzip -s -c ${tmp}/part >> ${tmp}/data.gz
+done
+
+# 1 byte chunks divide the file size: the last one is collected too
+for ibuf in 1 100 4096 30000 65535; do
+    genwqe_gunzip -i ${ibuf} -c ${tmp}/data.gz > ${tmp}/data.out
+    check "genwqe_gunzip -i ${ibuf}"
+done
+
+# Without -c the input goes away only if all members were fine
+rm -f ${tmp}/data.out
+cp ${tmp}/data.gz ${tmp}/data.out.gz
+genwqe_gunzip ${tmp}/data.out.gz
+check "genwqe_gunzip"
+
+genwqe_gunzip -P4 -c ${tmp}/data.gz > ${tmp}/data.out
+check "genwqe_gunzip -P4"
+
+for ibuf in 100 4096; do
+    gzFile_test -d -i ${ibuf} ${tmp}/data.gz ${tmp}/data.out > /dev/null
+    check "gzFile_test -d -i ${ibuf}"
+done
+
+# Read like java.util.zip.InflaterInputStream: once the input ended,
+# inflate() is not called again after a call without output. Small
+# output chunks let input be collected while obuf fills them.
+genwqe_gzip -s -c ${tmp}/data > ${tmp}/single.gz
+for args in "-i 1 -o 512" "-i 100 -o 100" "-i 4096 -o 512" \
+	    "-r -i 3000 -o 1000"; do
+    zpipe_rnd -R -d -F GZIP ${args} < ${tmp}/single.gz > ${tmp}/data.out
+    check "zpipe_rnd -R ${args}"
+done
+
+echo "PASSED inflate watermark"
+exit 0
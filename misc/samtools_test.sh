@@ -109,9 +109,10 @@ while getopts "A:C:T:Hd:t:v:h" opt; do
     esac
 done
 
+# Turn accelerator off, unless ZLIB_*_IMPL ask for the software DDCB backend
 if [ $ZLIB_ACCELERATOR = "SW" ]; then
-    export ZLIB_DEFLATE_IMPL=0x00;
-    export ZLIB_INFLATE_IMPL=0x00;
+    export ZLIB_DEFLATE_IMPL=${ZLIB_DEFLATE_IMPL:-0x00};
+    export ZLIB_INFLATE_IMPL=${ZLIB_INFLATE_IMPL:-0x00};
 fi
 
 function p8_dma_sanity_check() {
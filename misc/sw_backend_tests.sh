@@ -0,0 +1,121 @@
+#!/bin/bash
+#
+# Copyright 2016, International Business Machines
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+#
+# Execute the hardware code paths on the software DDCB backend:
+# ZLIB_ACCELERATOR=SW together with ZLIB_*_IMPL=0x01 runs DDCBs in
+# software instead of falling back to software zlib. The regular tests
+# and those of the zaddons.h extensions run once for each ZLIB_*_IMPL
+# value in impls. No card needed.
+#
+
+export PATH=`pwd`/tools:`pwd`/misc:$PATH
+export LD_LIBRARY_PATH=`pwd`/lib:$LD_LIBRARY_PATH
+
+# Checks
+if [ ! -f cantrbry.tar.gz ]; then
+	echo "We need test case data: cantrbry.tar.gz"
+	echo "Get it by using:"
+	echo "  wget http://corpus.canterbury.ac.nz/resources/cantrbry.tar.gz"
+	echo
+	exit 1
+fi
+
+accel=SW
+card=0
+export ZLIB_ACCELERATOR=${accel}	# also for tools without -A
+export ZLIB_CARD=${card}
+
+# 0x401 lease buffers, 0x801 pipelined and 0x1001 parallel deflate
+impls="0x01 0x401 0x801 0x1001"
+
+tmp=`mktemp -d`
+trap "rm -rf ${tmp}" EXIT
+
+function failed() {
+	echo "FAILED ${accel} CARD ${card} IMPL ${ZLIB_DEFLATE_IMPL}: $1"
+	exit 1
+}
+
+# Deflate ${tmp}/big in random chunks with ZLIB_DEFLATE_IMPL=$1. gzip
+# checks the output, statistic $2 must show that the feature was used.
+function check_deflate() {
+	local name="$2 IMPL $1"
+
+	rm -f ${tmp}/stats
+	ZLIB_DEFLATE_IMPL=$1 ZLIB_TRACE=0x8 ZLIB_LOGFILE=${tmp}/stats \
+		zpipe_rnd -r -i 65536 -o 65536 -F GZIP \
+		< ${tmp}/big > ${tmp}/big.gz || failed "${name}"
+	grep -q "$2" ${tmp}/stats || failed "${name}: not used"
+	gzip -d -c ${tmp}/big.gz | cmp -s - ${tmp}/big || failed "${name}"
+	echo "ok ${name}"
+}
+
+gzip -d -c cantrbry.tar.gz > ${tmp}/data
+split -n 4 ${tmp}/data ${tmp}/part.
+cat ${tmp}/data ${tmp}/data ${tmp}/data ${tmp}/data > ${tmp}/big
+
+for impl in ${impls}; do
+	export ZLIB_DEFLATE_IMPL=${impl}
+	export ZLIB_INFLATE_IMPL=${impl}
+	echo "TESTING ${accel} CARD ${card} IMPL ${impl}"
+
+	zlib_git.sh -A${accel} -C${card} -G || failed zlib_git.sh
+
+	genwqe_mt_perf -A${accel} -C${card} -M4 || failed genwqe_mt_perf
+
+	genwqe_test_gz -A${accel} -C${card} -vv -i2 -t cantrbry.tar.gz ||
+		failed genwqe_test_gz
+
+	# Multi-member file for genwqe_gunzip -P and gzFile_test
+	rm -f ${tmp}/data.gz
+	for part in ${tmp}/part.*; do
+		genwqe_gzip -c ${part} >> ${tmp}/data.gz || failed genwqe_gzip
+	done
+	genwqe_gunzip -P4 -c ${tmp}/data.gz > ${tmp}/data.out ||
+		failed "genwqe_gunzip -P4"
+	cmp -s ${tmp}/data ${tmp}/data.out || failed "genwqe_gunzip -P4"
+
+	gzFile_test -d ${tmp}/data.gz ${tmp}/data.out > /dev/null ||
+		failed gzFile_test
+	cmp -s ${tmp}/data ${tmp}/data.out || failed gzFile_test
+
+	zaddons_test -A${accel} -B${card} -t4 -d ${tmp} ${tmp}/data ||
+		failed zaddons_test
+done
+
+export ZLIB_DEFLATE_IMPL=0x01
+export ZLIB_INFLATE_IMPL=0x01
+genwqe_mt_perf -A${accel} -C${card} -M2 -P || failed "genwqe_mt_perf -P"
+
+check_deflate 0x801 deflate_pipelined
+check_deflate 0x1001 deflate_parallel
+
+# gzwrite() with a background writer thread
+rm -f ${tmp}/stats
+ZLIB_GZ_WRITEBEHIND=4 ZLIB_TRACE=0x8 ZLIB_LOGFILE=${tmp}/stats \
+	gzFile_test ${tmp}/big ${tmp}/big.gz > /dev/null ||
+	failed "gzFile_test writebehind"
+grep -q gz_writebehind ${tmp}/stats || failed "writebehind: not used"
+gzip -d -c ${tmp}/big.gz | cmp -s - ${tmp}/big ||
+	failed "gzFile_test writebehind"
+echo "ok gzFile_test writebehind"
+
+inflate_watermark_test.sh || failed inflate_watermark_test.sh
+
+echo "PASSED ${accel} CARD ${card} software DDCB backend"
+exit 0
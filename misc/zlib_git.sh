@@ -79,10 +79,10 @@ while getopts "A:C:TB:Gt:h" opt; do
     esac
 done
 
-# Turn accelerator off
+# Turn accelerator off, unless ZLIB_*_IMPL ask for the software DDCB backend
 if [ "$ZLIB_ACCELERATOR" == "SW" ]; then
-        export ZLIB_DEFLATE_IMPL=0x0
-        export ZLIB_INFLATE_IMPL=0x0
+        export ZLIB_DEFLATE_IMPL=${ZLIB_DEFLATE_IMPL:-0x0}
+        export ZLIB_INFLATE_IMPL=${ZLIB_INFLATE_IMPL:-0x0}
 fi
 
 rm -f $ZLIB_LOGFILE
@@ -39,6 +39,7 @@
 static int verbose = 0;
 static unsigned int seed = 0x1974;
 static int rnd = 0;
+static int reader = 0;
 static unsigned int CHUNK_i = 4 * 1024 * 1024; /* 16384; */
 static unsigned int CHUNK_o = 4 * 1024 * 1024; /* 16384; */
 
@@ -138,6 +139,54 @@ static int def(FILE *source, FILE *dest, int level, int strategy,
 	return Z_OK;
 }
 
+/*
+ * Decompress like a stream reader, e.g. java.util.zip.InflaterInputStream:
+ * new input is read once the previous is used up. If inflate() gave
+ * no output and the input is at its end, the stream is truncated and
+ * inflate() is not called again.
+ */
+static int inf_reader(z_stream *strm, FILE *source, FILE *dest,
+		      unsigned char *in, unsigned char *out)
+{
+	int ret = Z_OK;
+	unsigned have = 1;
+	unsigned int chunk_i, chunk_o;
+
+	while (ret != Z_STREAM_END) {
+		if (strm->avail_in == 0) {
+			chunk_i = rnd ? random() % CHUNK_i + 1 : CHUNK_i;
+			strm->avail_in = fread(in, 1, chunk_i, source);
+			if (ferror(source))
+				return Z_ERRNO;
+			strm->next_in = in;
+
+			if ((strm->avail_in == 0) && (have == 0)) {
+				fputs("zpipe_rnd: unexpected end of input\n",
+				      stderr);
+				return Z_DATA_ERROR;
+			}
+		}
+
+		chunk_o = rnd ? random() % CHUNK_o + 1 : CHUNK_o;
+		strm->avail_out = chunk_o;
+		strm->next_out = out;
+		ret = inflate(strm, Z_NO_FLUSH);
+
+		assert(ret != Z_STREAM_ERROR);	/* not clobbered */
+		switch (ret) {
+		case Z_NEED_DICT:
+		case Z_DATA_ERROR:
+		case Z_MEM_ERROR:
+			return ret;
+		}
+
+		have = chunk_o - strm->avail_out;
+		if (fwrite(out, 1, have, dest) != have || ferror(dest))
+			return Z_ERRNO;
+	}
+	return Z_OK;
+}
+
 /* Decompress from file source to file dest until stream ends or EOF.
    inf() returns Z_OK on success, Z_MEM_ERROR if memory could not be
    allocated for processing, Z_DATA_ERROR if the deflate data is
@@ -189,6 +238,14 @@ static int inf(FILE *source, FILE *dest, int windowBits,
 		}
 	}
 
+	if (reader) {
+		ret = inf_reader(&strm, source, dest, in, out);
+		(void)inflateEnd(&strm);
+		free(in);
+		free(out);
+		return ret;
+	}
+
 	/* decompress until deflate stream ends or end of file */
 	do {
 		chunk_i = rnd ? random() % CHUNK_i + 1 : CHUNK_i;
@@ -329,6 +386,7 @@ static void usage(char *prog)
 		"    [-S, --strategy <0..4>] 0: DEFAULT,\n"
 		"      1: FILTERED, 2: HUFFMAN_ONLY, 3: RLE, 4: FIXED\n"
 		"    [-r, --rnd\n"		
+		"    [-R, --reader] decompress like a stream reader\n"
 		"    [-s, --seed <seed>\n"		
 		"    [-1, --fast]\n"
 		"    [-6, --default]\n"
@@ -412,12 +470,13 @@ int main(int argc, char **argv)
 			{ "o_bufsize",   required_argument, NULL, 'o' },
 			{ "dictionary",	 required_argument, NULL, 'D' },
 			{ "rnd",	 no_argument,	    NULL, 'r' },
+			{ "reader",	 no_argument,	    NULL, 'R' },
 			{ "verbose",	 no_argument,       NULL, 'v' },
 			{ "help",	 no_argument,       NULL, 'h' },
 			{ 0,		 no_argument,       NULL, 0   },
 		};
 
-		ch = getopt_long(argc, argv, "169D:F:rs:i:o:S:dvh?",
+		ch = getopt_long(argc, argv, "169D:F:rRs:i:o:S:dvh?",
 				 long_options, &option_index);
 		if (ch == -1)    /* all params processed ? */
 			break;
@@ -445,6 +504,9 @@ int main(int argc, char **argv)
 		case 'r':
 			rnd++;
 			break;
+		case 'R':
+			reader++;
+			break;
 		case 'v':
 			verbose++;
 			break;
@@ -59,7 +59,7 @@ static void usage(const char *prog)
 {
 	printf("Usage: %s [-h] [-v, --verbose] [-C, --card <cardno>|RED]\n"
 	       "\t-C, --card <cardno> use cardno for operation (default 0)\n"
-               "\t-A, --accel <GENWQE|CAPI> select accelerator type (CAPI only for ppc64le)\n"
+               "\t-A, --accel <GENWQE|CAPI|SW> select accelerator type (CAPI only for ppc64le)\n"
 	       "\t-V, --version show software version\n"
 	       "\t-X, --cpu <cpu_number> only run on this CPU number\n"
 	       "\t-D, --debug create extended debug data on failure\n"
@@ -347,10 +347,15 @@ int main(int argc, char *argv[])
 				card_type = DDCB_TYPE_CAPI;
 				break;
 			}
+			if (strcmp(optarg, "SW") == 0) {
+				card_type = DDCB_TYPE_SW;
+				break;
+			}
 			/* use numeric card_type value */
 			card_type = strtol(optarg, (char **)NULL, 0);
 			if ((DDCB_TYPE_GENWQE != card_type) &&
-				(DDCB_TYPE_CAPI != card_type)) {
+				(DDCB_TYPE_CAPI != card_type) &&
+				(DDCB_TYPE_SW != card_type)) {
 				usage(argv[0]);
 				exit(EXIT_FAILURE);
 			}
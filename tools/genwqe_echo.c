@@ -58,7 +58,7 @@ static void usage(const char *prog)
 	       "  -h, --help\n"
 	       "  -v, --verbose\n"
 	       "  -C, --card=CARDNO|RED  Note: RED is for Card Redundant mode\n"
-	       "  -A, --accelerator-type=GENWQE|CAPI CAPI is only available "
+	       "  -A, --accelerator-type=GENWQE|CAPI|SW CAPI is only available "
 	       "for System p\n"
 	       "  -q, --quiet            quiece output\n"
 	       "  -V, --version\n"
@@ -75,6 +75,7 @@ static void usage(const char *prog)
 	       "  -i, --interval=INTERVAL_USEC\n"
 	       "  -s, --string=TESTSTRING\n"
 	       "  -p, --polling          use DDCB polling mode.\n"
+	       "  -a, --adaptive         poll while busy, wait for irq if idle.\n"
 	       "\n"
 	       "This utility sends echo DDCBs either to the service layer\n"
 	       "or other chip units. It can be used to check the cards\n"
@@ -269,6 +270,7 @@ int main(int argc, char *argv[])
 			{ "hardware-version", no_argument, NULL, 'H' },
 			{ "debug",	no_argument,	   NULL, 'D' },
 			{ "polling",	no_argument,	   NULL, 'p' },
+			{ "adaptive",	no_argument,	   NULL, 'a' },
 			{ "quiet",	no_argument,	   NULL, 'q' },
 			{ "verbose",	no_argument,       NULL, 'v' },
 			{ "help",	no_argument,	   NULL, 'h' },
@@ -276,10 +278,10 @@ int main(int argc, char *argv[])
 		};
 
 #if defined (CONFIG_BUILD_4TEST)
-		ch = getopt_long(argc, argv, "pDC:A:c:fhl:i:s:qvX:HVu:e:",
+		ch = getopt_long(argc, argv, "apDC:A:c:fhl:i:s:qvX:HVu:e:",
 				long_options, &option_index);
 #else
-		ch = getopt_long(argc, argv, "pDC:A:c:fhl:i:s:qvX:HVe:",
+		ch = getopt_long(argc, argv, "apDC:A:c:fhl:i:s:qvX:HVe:",
 				long_options, &option_index);
 #endif
 		if (ch == -1)	/* all params processed ? */
@@ -302,6 +304,10 @@ int main(int argc, char *argv[])
 				card_type = DDCB_TYPE_CAPI;
 				break;
 			}
+			if (strcmp(optarg, "SW") == 0) {
+				card_type = DDCB_TYPE_SW;
+				break;
+			}
 			card_type = strtol(optarg, (char **)NULL, 0);
 			break;
 		case 'X':
@@ -348,6 +354,9 @@ int main(int argc, char *argv[])
 		case 'p':
 			mode |= DDCB_MODE_POLLING;
 			break;
+		case 'a':
+			mode |= DDCB_MODE_ADAPTIVE;
+			break;
 		case 'q':
 			quiet++;
 			break;
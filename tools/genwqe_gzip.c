@@ -354,12 +354,14 @@ static void usage(FILE *fp, char *prog, int argc, char *argv[])
 		"  -9, --best        compress better\n"
 		"\n"
 		"Special options for testing and debugging:\n"
-		"  -A, --accelerator-type=GENWQE|CAPI CAPI is only available for System p\n"
+		"  -A, --accelerator-type=GENWQE|CAPI|SW CAPI is only available for System p\n"
 		"  -B, --card=<card_no> -1 is for automatic card selection\n"
 		"  -X, --cpu <cpu>   force to run on CPU <cpu>\n"
 		"  -s, --software    force to use software compression/decompression\n"
 		"  -i, --i_bufsize   input buffer size (%d KiB)\n"
 		"  -o, --o_bufsize   output buffer size (%d KiB)\n"
+		"  -P, --parallel[=N] inflate members of multi-member files\n"
+		"                    concurrently using N streams\n"
 		"  -N, --name=NAME   write NAME into gzip header\n"
 		"  -C, --comment=CM  write CM into gzip header\n"
 		"  -E, --extra=EXTRA write EXTRA (file) into gzip header\n"
@@ -649,6 +651,7 @@ int main(int argc, char **argv)
 	const char *suffix = "gz";
 	int force_software = 0;
 	int cpu = -1;
+	int parallel = -1;	/* streams for zlib_gunzip_parallel() */
 	unsigned char *in = NULL;
 	unsigned char *out = NULL;
 	z_stream strm;
@@ -708,11 +711,12 @@ int main(int argc, char **argv)
 			{ "comment",	 required_argument, NULL, 'C' },
 			{ "i_bufsize",   required_argument, NULL, 'i' },
 			{ "o_bufsize",   required_argument, NULL, 'o' },
+			{ "parallel",	 optional_argument, NULL, 'P' },
 			{ 0,		 no_argument,       NULL, 0   },
 		};
 
 		ch = getopt_long(argc, argv,
-				 "E:N:C:cdfqhlLsS:vV123456789?i:o:X:A:B:",
+				 "E:N:C:cdfqhlLsS:vV123456789?i:o:X:A:B:P::",
 				 long_options, &option_index);
 		if (ch == -1)    /* all params processed ? */
 			break;
@@ -800,6 +804,9 @@ int main(int argc, char **argv)
 		case 'o':
 			CHUNK_o = str_to_num(optarg);
 			break;
+		case 'P':
+			parallel = optarg ? strtol(optarg, NULL, 0) : 0;
+			break;
 		case 'L':
 			userinfo(stdout, prog, version);
 			exit(EXIT_SUCCESS);
@@ -1025,6 +1032,14 @@ int main(int argc, char **argv)
 		deflateEnd(&strm);
 	} else {
 		/* --------------- INFALTE ----------------- */
+		if (parallel >= 0) {
+			rc = zlib_gunzip_parallel(fileno(i_fp), fileno(o_fp),
+						  parallel);
+			if (Z_OK != rc)
+				zerr(rc);
+			goto err_out;
+		}
+
 		strm.avail_in = 0;
 		strm.next_in = Z_NULL;
 		rc = inflateInit2(&strm, window_bits);
@@ -35,12 +35,6 @@
 #include <libcxl.h>
 #include "afu_regs.h"
 
-/*
- * This needs to be in sync with the max number of cards supported in
- * ddcb_capi.c.
- */
-#define NUM_CARDS 4 /* max number of CAPI cards in system */
-
 static const char *version = GIT_VERSION;
 static int verbose = 0;
 static FILE *fd_out;
@@ -485,7 +479,7 @@ int main(int argc, char *argv[])
 {
 	int rc = EXIT_SUCCESS;
 	int ch;
-	unsigned int i;
+	unsigned int i, num_cards;
 	char *log_file = NULL;
 	struct mdev_ctx *mctx = &master_ctx;
 	int	dt;
@@ -574,9 +568,12 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if ((mctx->card < 0) || (mctx->card >= NUM_CARDS)) {
+	/* Same number of cards as libddcb supports, see DDCB_CARDS */
+	if (accel_get_limits(DDCB_TYPE_CAPI, &num_cards, NULL) != DDCB_OK)
+		num_cards = 4;
+	if ((mctx->card < 0) || (mctx->card >= (int)num_cards)) {
 		fprintf(stderr, "Err: %d for option -C is invalid, please provide "
-			"0..%d!\n", mctx->card, NUM_CARDS-1);
+			"0..%d!\n", mctx->card, num_cards - 1);
 		exit(EXIT_FAILURE);
 	}
 
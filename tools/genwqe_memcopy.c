@@ -126,7 +126,7 @@ static void usage(const char *prog)
 	       "  -h, --help               print usage information\n"
 	       "  -v, --verbose            verbose mode\n"
 	       "  -C, --card <cardno>      use this card for operation\n"
-	       "  -A, --accelerator-type=GENWQE|CAPI CAPI is only available "
+	       "  -A, --accelerator-type=GENWQE|CAPI|SW CAPI is only available "
 	       "for System p\n"
 	       "  -V, --version\n"
 	       "  -q, --quiet              quiece output\n"
@@ -745,9 +745,14 @@ int main(int argc, char *argv[])
 				ip.card_type = DDCB_TYPE_CAPI;
 				break;
 			}
+			if (strcmp(optarg, "SW") == 0) {
+				ip.card_type = DDCB_TYPE_SW;
+				break;
+			}
 			ip.card_type = strtol(optarg, (char **)NULL, 0);
 			if ((DDCB_TYPE_GENWQE != ip.card_type) &&
-				(DDCB_TYPE_CAPI != ip.card_type)) {
+				(DDCB_TYPE_CAPI != ip.card_type) &&
+				(DDCB_TYPE_SW != ip.card_type)) {
 				usage(argv[0]);
 				exit(EXIT_FAILURE);
 			}
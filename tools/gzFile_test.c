@@ -145,7 +145,7 @@ static void usage(FILE *fp, char *prog)
 		"\n"
 		"Special options for testing and debugging:\n"
 		"  -v, --verbose\n"
-		"  -A, --accelerator-type=GENWQE|CAPI CAPI is only available for IBM System p\n"
+		"  -A, --accelerator-type=GENWQE|CAPI|SW CAPI is only available for IBM System p\n"
 		"  -B, --card=<card_no> -1 is for automatic card selection\n"
 		"  -O, --offset=<offset> Cut out data at this byte offset.\n"
 		"  -s, --size=<size>     Cut <size> bytes out.\n"
@@ -269,6 +269,8 @@ static int do_compress(const char *i_fname, const char *o_fname,
 			pr_err("ferror %d\n", (int)len);
 			goto err_ofp;
 		}
+		if (len == 0)	/* size was a multiple of chunk_i */
+			break;
 		rc = gzwrite(ofp, buf, len);
 		if (rc == 0) {
 			pr_err("gzwrite %d\n", rc);
@@ -0,0 +1,597 @@
+/*
+ * Copyright 2016, International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test the extensions of zaddons.h on the data of a file:
+ *  - BGZF written with zedc_bgzf_compress(), read back with
+ *    zlib_bgzf_read(), zlib_bgzf_inflate() and zlib_gunzip_parallel().
+ *  - A multi-member gzip file written with deflate() is inflated with
+ *    zlib_gunzip_parallel() and indexed with zlib_index_build() for
+ *    zlib_index_extract().
+ *  - Another one written and read with gzwrite()/gzread().
+ * Not intended to use for production and example. Without a card use
+ * -A SW, the software DDCB backend.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <zlib.h>
+#include <zaddons.h>
+#include <libddcb.h>
+#include <libzHW.h>
+
+/** common error printf */
+#define pr_err(fmt, ...) do {						\
+		fprintf(stderr, "zaddons_test: " fmt, ## __VA_ARGS__);	\
+	} while (0)
+
+/** common info printf */
+#define pr_info(fmt, ...) do {						\
+		if (verbose)						\
+			fprintf(stderr, fmt, ## __VA_ARGS__);		\
+	} while (0)
+
+#define BGZF_BATCH	32	/* blocks per DDCB chain */
+#define GZ_MEMBERS	4	/* members of the gzip file */
+#define EXTRACT_LEN	4096	/* bytes read at an index offset */
+
+static const char *version = GIT_VERSION;
+static int verbose = 0;
+static const char *work_dir = "/tmp";
+static char bgzf_fname[PATH_MAX];
+static char gz_fname[PATH_MAX];
+static char gzio_fname[PATH_MAX];
+static char out_fname[PATH_MAX];
+static char idx_fname[PATH_MAX];
+
+static void usage(FILE *fp, char *prog)
+{
+	fprintf(fp, "Usage: %s [OPTION]... IN_FILE\n"
+		"\n"
+		"  -A, --accelerator-type=GENWQE|CAPI|SW\n"
+		"  -B, --card=<card_no>\n"
+		"  -t, --threads=<n>     threads for parallel inflate (0)\n"
+		"  -s, --span=<span>     index span, 0 for 1 MiB (64 KiB)\n"
+		"  -d, --dir=<dir>       directory for files (%s)\n"
+		"  -v, --verbose\n"
+		"  -V, --version\n"
+		"\n"
+		"Report bugs via https://github.com/ibm-genwqe/genwqe-user.\n"
+		"\n", prog, work_dir);
+}
+
+static uint8_t *read_file(const char *fname, size_t *len)
+{
+	FILE *fp;
+	struct stat s;
+	uint8_t *buf;
+
+	fp = fopen(fname, "r");
+	if (fp == NULL) {
+		pr_err("Cannot open %s: %s\n", fname, strerror(errno));
+		return NULL;
+	}
+	if ((fstat(fileno(fp), &s) != 0) || (s.st_size == 0)) {
+		pr_err("Cannot use %s\n", fname);
+		fclose(fp);
+		return NULL;
+	}
+	buf = malloc(s.st_size);
+	if (buf && (fread(buf, 1, s.st_size, fp) != (size_t)s.st_size)) {
+		pr_err("Cannot read %s\n", fname);
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fp);
+	*len = s.st_size;
+	return buf;
+}
+
+static int tmp_file(char *fname, const char *name)
+{
+	snprintf(fname, PATH_MAX, "%s/zaddons_%s_XXXXXX", work_dir, name);
+	return mkstemp(fname);
+}
+
+/* Compare the file behind fd with data */
+static int check_file(int fd, const uint8_t *data, size_t len,
+		      const char *what)
+{
+	uint8_t buf[64 * 1024];
+	size_t offs = 0;
+	ssize_t n;
+
+	while ((n = pread(fd, buf, sizeof(buf), offs)) > 0) {
+		if ((offs + n > len) || memcmp(buf, data + offs, n)) {
+			pr_err("FAILED %s: data differs after %zu\n",
+			       what, offs);
+			return -1;
+		}
+		offs += n;
+	}
+	if (offs != len) {
+		pr_err("FAILED %s: %zu of %zu bytes\n", what, offs, len);
+		return -1;
+	}
+	fprintf(stdout, "ok %s\n", what);
+	return 0;
+}
+
+static int check_buf(const uint8_t *buf, const uint8_t *data, size_t len,
+		     const char *what)
+{
+	if (memcmp(buf, data, len)) {
+		pr_err("FAILED %s\n", what);
+		return -1;
+	}
+	fprintf(stdout, "ok %s\n", what);
+	return 0;
+}
+
+/* zlib_gunzip_parallel() from the file fname must give data */
+static int test_gunzip_parallel(const char *fname, const uint8_t *data,
+				size_t len, unsigned int threads,
+				const char *what)
+{
+	int rc, fd_in, fd_out;
+
+	fd_in = open(fname, O_RDONLY);
+	fd_out = tmp_file(out_fname, "out");
+	if ((fd_in < 0) || (fd_out < 0)) {
+		pr_err("Cannot open files: %s\n", strerror(errno));
+		rc = -1;
+		goto out;
+	}
+	rc = zlib_gunzip_parallel(fd_in, fd_out, threads);
+	if (rc != Z_OK) {
+		pr_err("FAILED %s: zlib_gunzip_parallel rc=%d\n", what, rc);
+		rc = -1;
+		goto out;
+	}
+	rc = check_file(fd_out, data, len, what);
+ out:
+	if (fd_out >= 0) {
+		close(fd_out);
+		unlink(out_fname);
+	}
+	if (fd_in >= 0)
+		close(fd_in);
+	return rc;
+}
+
+static int bgzf_write(zedc_handle_t zedc, const uint8_t *data, size_t len,
+		      int fd)
+{
+	int rc = 0;
+	unsigned int i, n, nblocks;
+	size_t offs = 0;
+	struct zedc_bgzf_block *blk;
+	uint8_t *out;
+
+	/* one more block for the EOF marker */
+	nblocks = (len + ZEDC_BGZF_BLOCK_SIZE - 1) / ZEDC_BGZF_BLOCK_SIZE + 1;
+	blk = calloc(BGZF_BATCH, sizeof(*blk));
+	out = malloc(BGZF_BATCH * ZEDC_BGZF_MAX_BLOCK);
+	if ((blk == NULL) || (out == NULL)) {
+		rc = -1;
+		goto out;
+	}
+
+	while (nblocks) {
+		n = (nblocks < BGZF_BATCH) ? nblocks : BGZF_BATCH;
+		for (i = 0; i < n; i++) {
+			blk[i].in = data + offs;
+			blk[i].in_len = (len - offs < ZEDC_BGZF_BLOCK_SIZE) ?
+				len - offs : ZEDC_BGZF_BLOCK_SIZE;
+			blk[i].out = out + i * ZEDC_BGZF_MAX_BLOCK;
+			offs += blk[i].in_len;
+		}
+		rc = zedc_bgzf_compress(zedc, blk, n);
+		if (rc != ZEDC_OK) {
+			pr_err("zedc_bgzf_compress rc=%d\n", rc);
+			goto out;
+		}
+		for (i = 0; i < n; i++)
+			if (write(fd, blk[i].out, blk[i].out_len) !=
+			    (ssize_t)blk[i].out_len) {
+				pr_err("write: %s\n", strerror(errno));
+				rc = -1;
+				goto out;
+			}
+		nblocks -= n;
+	}
+ out:
+	free(out);
+	free(blk);
+	return rc;
+}
+
+static int test_bgzf(const uint8_t *data, size_t len, int card_no,
+		     int card_type, unsigned int threads)
+{
+	int rc = -1, err_code, fd, fd_out = -1;
+	zedc_handle_t zedc;
+	struct zlib_bgzf *bgzf = NULL;
+	uint8_t *buf = NULL, *ubuf = NULL;
+	size_t blen;
+	unsigned long idx, n;
+	uint64_t coffs, uoffs;
+	unsigned int ulen;
+
+	zedc = zedc_open(card_no, card_type, DDCB_MODE_ASYNC | DDCB_MODE_RDWR,
+			 &err_code);
+	if (zedc == NULL) {
+		pr_err("Cannot open card %d: %d\n", card_no, err_code);
+		return -1;
+	}
+
+	fd = tmp_file(bgzf_fname, "bgzf");
+	if (fd < 0) {
+		pr_err("Cannot create file: %s\n", strerror(errno));
+		goto close_zedc;
+	}
+	if (bgzf_write(zedc, data, len, fd) != 0)
+		goto close_fd;
+	close(fd);
+	fd = -1;
+
+	buf = read_file(bgzf_fname, &blen);
+	if (buf == NULL)
+		goto close_fd;
+
+	bgzf = zlib_bgzf_open(buf, blen, threads);
+	if (bgzf == NULL) {
+		pr_err("FAILED bgzf: zlib_bgzf_open\n");
+		goto close_fd;
+	}
+	pr_info("  %zu bytes in %lu BGZF blocks of %zu bytes\n", len,
+		zlib_bgzf_blocks(bgzf), blen);
+	if (zlib_bgzf_size(bgzf) != len) {
+		pr_err("FAILED bgzf: size %llu != %zu\n",
+		       (unsigned long long)zlib_bgzf_size(bgzf), len);
+		goto close_fd;
+	}
+
+	fd_out = tmp_file(out_fname, "out");
+	if (fd_out < 0)
+		goto close_fd;
+	rc = zlib_bgzf_read(bgzf, fd_out);
+	if (rc != Z_OK) {
+		pr_err("FAILED bgzf: zlib_bgzf_read rc=%d\n", rc);
+		rc = -1;
+		goto close_fd;
+	}
+	rc = check_file(fd_out, data, len, "zlib_bgzf_read");
+	if (rc != 0)
+		goto close_fd;
+
+	/* random access: the blocks around the middle */
+	rc = -1;
+	idx = zlib_bgzf_find(bgzf, len / 2);
+	n = (idx + 2 < zlib_bgzf_blocks(bgzf)) ? 2 : 1;
+	ubuf = malloc(2 * ZEDC_BGZF_BLOCK_SIZE);
+	if ((ubuf == NULL) ||
+	    (zlib_bgzf_block(bgzf, idx, &coffs, &uoffs, &ulen) != Z_OK) ||
+	    (zlib_bgzf_inflate(bgzf, idx, n, ubuf,
+			       2 * ZEDC_BGZF_BLOCK_SIZE) != Z_OK)) {
+		pr_err("FAILED zlib_bgzf_inflate block %lu\n", idx);
+		goto close_fd;
+	}
+	rc = check_buf(ubuf, data + uoffs, ulen, "zlib_bgzf_inflate");
+	if (rc != 0)
+		goto close_fd;
+
+	rc = test_gunzip_parallel(bgzf_fname, data, len, threads,
+				  "zlib_gunzip_parallel bgzf");
+ close_fd:
+	if (fd_out >= 0) {
+		close(fd_out);
+		unlink(out_fname);
+	}
+	if (bgzf)
+		zlib_bgzf_close(bgzf);
+	free(ubuf);
+	free(buf);
+	if (fd >= 0)
+		close(fd);
+	unlink(bgzf_fname);
+ close_zedc:
+	zedc_close(zedc);
+	return rc;
+}
+
+/* Write data as GZ_MEMBERS gzip members, each with one deflate() */
+static int gz_write(const uint8_t *data, size_t len)
+{
+	int rc = -1, fd, m;
+	z_stream strm;
+	size_t offs = 0, part = len / GZ_MEMBERS + 1, n;
+	uLong out_len;
+	uint8_t *out = NULL;
+
+	fd = tmp_file(gz_fname, "gz");
+	if (fd < 0)
+		return -1;
+
+	for (m = 0; m < GZ_MEMBERS; m++) {
+		n = (len - offs < part) ? len - offs : part;
+		memset(&strm, 0, sizeof(strm));
+		if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31,
+				 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			goto out;
+
+		out_len = deflateBound(&strm, n);
+		out = malloc(out_len);
+		if (out == NULL) {
+			deflateEnd(&strm);
+			goto out;
+		}
+		strm.next_in = (uint8_t *)data + offs;
+		strm.avail_in = n;
+		strm.next_out = out;
+		strm.avail_out = out_len;
+		rc = deflate(&strm, Z_FINISH);
+		deflateEnd(&strm);
+
+		out_len -= strm.avail_out;
+		if ((rc != Z_STREAM_END) ||
+		    (write(fd, out, out_len) != (ssize_t)out_len)) {
+			pr_err("FAILED deflate member %d rc=%d\n", m, rc);
+			rc = -1;
+			goto out;
+		}
+		free(out);
+		out = NULL;
+		offs += n;
+	}
+	rc = 0;
+ out:
+	free(out);
+	close(fd);
+	return rc;
+}
+
+/* gzwrite() GZ_MEMBERS members, gzread() them back */
+static int test_gz(const uint8_t *data, size_t len)
+{
+	int fd, m;
+	gzFile gz;
+	size_t offs = 0, part = len / GZ_MEMBERS + 1, n;
+	uint8_t *buf;
+	int got;
+
+	fd = tmp_file(gzio_fname, "gzio");
+	if (fd < 0)
+		return -1;
+	close(fd);
+
+	for (m = 0; m < GZ_MEMBERS; m++) {
+		n = (len - offs < part) ? len - offs : part;
+		gz = gzopen(gzio_fname, m ? "ab" : "wb");
+		if ((gz == NULL) || (gzwrite(gz, data + offs, n) != (int)n) ||
+		    (gzclose(gz) != Z_OK)) {
+			pr_err("FAILED gzwrite member %d\n", m);
+			unlink(gzio_fname);
+			return -1;
+		}
+		offs += n;
+	}
+
+	buf = malloc(len + 1);
+	gz = gzopen(gzio_fname, "rb");
+	unlink(gzio_fname);
+	if ((buf == NULL) || (gz == NULL)) {
+		if (gz)
+			gzclose(gz);
+		free(buf);
+		return -1;
+	}
+	for (offs = 0; offs <= len; offs += got) {
+		n = len + 1 - offs;	/* one more to see the end */
+		got = gzread(gz, buf + offs, (n < 100000) ? n : 100000);
+		if (got <= 0)
+			break;
+	}
+	gzclose(gz);
+	if (offs != len) {
+		pr_err("FAILED gzread: %zu of %zu bytes\n", offs, len);
+		free(buf);
+		return -1;
+	}
+	m = check_buf(buf, data, len, "gzwrite/gzread");
+	free(buf);
+	return m;
+}
+
+static int test_index(const uint8_t *data, size_t len, uint64_t span)
+{
+	int rc = -1, fd, fd_idx = -1, i;
+	struct zlib_index *idx = NULL, *idx2 = NULL;
+	uint8_t buf[EXTRACT_LEN];
+	uint64_t offs[4];
+	long n;
+
+	offs[0] = 0;
+	offs[1] = len / 3;
+	offs[2] = len / 2 + 7;
+	offs[3] = (len > EXTRACT_LEN) ? len - EXTRACT_LEN : 0;
+
+	fd = open(gz_fname, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	rc = zlib_index_build(fd, 31, span, &idx);
+	if (rc != Z_OK) {
+		pr_err("FAILED zlib_index_build rc=%d\n", rc);
+		rc = -1;
+		goto out;
+	}
+	rc = -1;
+	pr_info("  %lu access points\n", zlib_index_points(idx));
+	if (zlib_index_size(idx) != len) {
+		pr_err("FAILED zlib_index_build: size %llu != %zu\n",
+		       (unsigned long long)zlib_index_size(idx), len);
+		goto out;
+	}
+
+	/* the same extracts from a written and reloaded index */
+	fd_idx = tmp_file(idx_fname, "idx");
+	if ((fd_idx < 0) || (zlib_index_write(idx, fd_idx) != Z_OK) ||
+	    (lseek(fd_idx, 0, SEEK_SET) != 0) ||
+	    (zlib_index_read(fd_idx, &idx2) != Z_OK)) {
+		pr_err("FAILED zlib_index_write/read\n");
+		goto out;
+	}
+
+	for (i = 0; i < 8; i++) {
+		uint64_t o = offs[i % 4];
+		size_t want = (len - o < EXTRACT_LEN) ? len - o : EXTRACT_LEN;
+
+		n = zlib_index_extract((i < 4) ? idx : idx2, fd, o, buf,
+				       EXTRACT_LEN);
+		if ((n != (long)want) || memcmp(buf, data + o, want)) {
+			pr_err("FAILED zlib_index_extract at %llu: %ld\n",
+			       (unsigned long long)o, n);
+			goto out;
+		}
+	}
+	fprintf(stdout, "ok zlib_index_extract\n");
+	rc = 0;
+ out:
+	if (fd_idx >= 0) {
+		close(fd_idx);
+		unlink(idx_fname);
+	}
+	zlib_index_free(idx2);
+	zlib_index_free(idx);
+	close(fd);
+	return rc;
+}
+
+int main(int argc, char **argv)
+{
+	int rc = 0;
+	char *prog = basename(argv[0]);
+	const char *accel = "GENWQE";
+	const char *accel_env = getenv("ZLIB_ACCELERATOR");
+	int card_no = 0, card_type = DDCB_TYPE_GENWQE;
+	const char *card_no_env = getenv("ZLIB_CARD");
+	unsigned int threads = 0;
+	uint64_t span = 64 * 1024;
+	uint8_t *data;
+	size_t len;
+
+	/* Use environment variables as defaults. Command line options
+	   can than overrule this. */
+	if (accel_env != NULL)
+		accel = accel_env;
+
+	if (card_no_env != NULL)
+		card_no = atoi(card_no_env);
+
+	while (1) {
+		int ch;
+		int option_index = 0;
+		static struct option long_options[] = {
+			{ "accelerator-type", required_argument, NULL, 'A' },
+			{ "card",	 required_argument, NULL, 'B' },
+			{ "threads",	 required_argument, NULL, 't' },
+			{ "span",	 required_argument, NULL, 's' },
+			{ "dir",	 required_argument, NULL, 'd' },
+			{ "verbose",	 no_argument,	    NULL, 'v' },
+			{ "version",	 no_argument,	    NULL, 'V' },
+			{ "help",	 no_argument,	    NULL, 'h' },
+			{ 0,		 no_argument,	    NULL, 0   },
+		};
+
+		ch = getopt_long(argc, argv, "A:B:t:s:d:vVh?",
+				 long_options, &option_index);
+		if (ch == -1)	/* all params processed ? */
+			break;
+
+		switch (ch) {
+		case 'A':
+			accel = optarg;
+			break;
+		case 'B':
+			card_no = strtol(optarg, (char **)NULL, 0);
+			break;
+		case 't':
+			threads = strtoul(optarg, (char **)NULL, 0);
+			break;
+		case 's':
+			span = strtoull(optarg, (char **)NULL, 0);
+			break;
+		case 'd':
+			work_dir = optarg;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		case 'V':
+			fprintf(stdout, "%s\n", version);
+			exit(EXIT_SUCCESS);
+			break;
+		case 'h':
+		case '?':
+			usage(stdout, prog);
+			exit(EXIT_SUCCESS);
+			break;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage(stderr, prog);
+		exit(EXIT_FAILURE);
+	}
+
+	if (strncmp(accel, "CAPI", 4) == 0)
+		card_type = DDCB_TYPE_CAPI;
+	else if (strncmp(accel, "SW", 2) == 0)
+		card_type = DDCB_TYPE_SW;
+
+	zlib_set_accelerator(accel, card_no);
+	zlib_set_inflate_impl(ZLIB_HW_IMPL);
+	zlib_set_deflate_impl(ZLIB_HW_IMPL);
+
+	data = read_file(argv[optind], &len);
+	if (data == NULL)
+		exit(EXIT_FAILURE);
+
+	if ((test_bgzf(data, len, card_no, card_type, threads) != 0) ||
+	    (gz_write(data, len) != 0) ||
+	    (test_gunzip_parallel(gz_fname, data, len, threads,
+				  "zlib_gunzip_parallel gz") != 0) ||
+	    (test_index(data, len, span) != 0) ||
+	    (test_gz(data, len) != 0))
+		rc = -1;
+
+	if (gz_fname[0])
+		unlink(gz_fname);
+	free(data);
+	exit(rc ? EXIT_FAILURE : EXIT_SUCCESS);
+}
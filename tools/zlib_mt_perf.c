@@ -42,6 +42,11 @@
  *       ZLIB_INFLATE_IMPL=0x01 ./tests/zlib/tools/zlib_mt_perf -D \
  *           -i32KiB -o32KiB -f test_data.bin -c2 -t$t ; \
  *   done
+ *
+ * Check DDCB submission cost when many threads share one queue:
+ *   for t in 8 16 32 64 128 ; do \
+ *       ./tools/zlib_mt_perf -S -A CAPI -C0 -c10000 -t$t -N ; \
+ *   done
  */
 
 #include <stdio.h>
@@ -62,6 +67,7 @@
 #include <errno.h>
 #include <sys/syscall.h>
 #include "zlib.h"
+#include <libddcb.h>
 
 #if defined(MSDOS) || defined(OS2) || defined(WIN32) || defined(__CYGWIN__)
 #  include <fcntl.h>
@@ -107,6 +113,9 @@ static unsigned int infl_ndefl = 1;	// inflate
 static char i_fname[128], c_fname[128];
 static unsigned int pin_cpu_ena = 0;
 static unsigned long int time_ns_threads = 0;
+static bool submit_bench = false;	/* DDCB submission benchmark */
+static int card_no = 0;
+static int card_type = DDCB_TYPE_GENWQE;
 
 #define printfv(level, fmt, ...) do {					\
 		if ((verbose) >= (level))				\
@@ -126,6 +135,9 @@ struct thread_data {
 	unsigned long defl_time;    // ret: total time used for compression
 	unsigned long infl_total;   // ret: total bytes decompressed
 	unsigned long infl_time;    // ret: total time used for decompression
+	unsigned long ddcb_calls;   // ret: # of DDCBs submitted
+	unsigned long submit_time;  // ret: nsec spent in accel_ddcb_submit
+	unsigned long ddcb_time;    // ret: nsec from submit to completion
 
 	unsigned char *in;	// inp: pre-alloc memory ptr
 	unsigned char *out;	// inp: pro-alloc memory ptr
@@ -477,6 +489,10 @@ static void usage(char *prog)
 	       "  -i, --i_bufsize <i_bufsize>\n"
 	       "  -o, --o_bufsize <o_bufsize>\n"
 	       "  -D, --deflate - execute deflate. default: inflate\n"
+	       "  -S, --submit-bench - measure DDCB submission cost\n"
+	       "                  using <count> ECHO DDCBs per thread\n"
+	       "  -A, --accelerator-type=GENWQE|CAPI|SW  for -S\n"
+	       "  -C, --card <cardno> card to be used for -S\n"
 	       "  -f  --filename <filename>\n"
 	       "  -v  --verbose\n"
 	       "  -V  --version\n"
@@ -568,6 +584,71 @@ static void *libz_thread_infl(void *data)
 	pthread_exit(&d->thread_rc);
 }
 
+/*
+ * All threads share one card and therefore one DDCB queue. Each
+ * submits ECHO DDCBs asynchronously and waits for them. The time
+ * spent in the submit call shows how well submission scales with
+ * the number of threads.
+ */
+static void *ddcb_thread_submit(void *data)
+{
+	int rc, err_code;
+	unsigned int i;
+	struct thread_data *d = (struct thread_data *)data;
+	struct ddcb_cmd cmd;
+	accel_t card;
+	unsigned long s, e;
+
+	d->ddcb_calls = 0;
+	d->submit_time = 0;
+	d->ddcb_time = 0;
+	d->tid = gettid();
+	d->cpu = sched_getcpu();
+
+	card = accel_open(card_no, card_type, 0, &err_code, 0,
+			  DDCB_APPL_ID_IGNORE);
+	if (card == NULL) {
+		fprintf(stderr, "err: failed to open card %d type %d "
+			"(%d/%s)\n", card_no, card_type, err_code,
+			ddcb_strerror(err_code));
+		goto exit_failure;
+	}
+
+	for (i = 0; (i < count) && (exit_on_err == 0); i++) {
+		ddcb_cmd_init(&cmd);
+		cmd.acfunc = DDCB_ACFUNC_APP;
+		cmd.cmd = DDCB_CMD_ECHO_SYNC;
+		cmd.cmdopts = _DDCB_OPT_ECHO_COPY_ALL;
+		cmd.asiv_length = DDCB_ASV_LENGTH;
+		cmd.asv_length = DDCB_ASV_LENGTH;
+		cmd.asiv[0] = (uint8_t)i;
+
+		s = get_nsec();
+		rc = accel_ddcb_submit(card, &cmd, NULL, NULL);
+		e = get_nsec();
+		if (rc == DDCB_OK)
+			rc = accel_ddcb_wait(card, &cmd, NULL, NULL);
+		if (rc != DDCB_OK) {
+			fprintf(stderr, "err: DDCB failed rc=%d %s\n",
+				rc, ddcb_strerror(rc));
+			accel_close(card);
+			goto exit_failure;
+		}
+		d->submit_time += e - s;
+		d->ddcb_time += get_nsec() - s;
+		d->ddcb_calls++;
+	}
+
+	accel_close(card);
+	d->thread_rc = 0;
+	pthread_exit(&d->thread_rc);
+
+ exit_failure:
+	exit_on_err = 1;
+	d->thread_rc = -2;
+	pthread_exit(&d->thread_rc);
+}
+
 static int run_threads(struct thread_data *d, unsigned int threads)
 {
 	int rc;
@@ -582,7 +663,10 @@ static int run_threads(struct thread_data *d, unsigned int threads)
 		if ( pin_cpu_ena == 1 )
 			pin_to_cpu(i);	// pin thread to cpu
 
-		if (infl_ndefl == 1) {
+		if (submit_bench) {
+			rc = pthread_create(&d[i].thread_id, NULL,
+					&ddcb_thread_submit, &d[i]);
+		} else if (infl_ndefl == 1) {
 			rc = pthread_create(&d[i].thread_id, NULL,
 					&libz_thread_infl, &d[i]);
 		} else {
@@ -698,9 +782,50 @@ static void __print_inflate_results(struct thread_data *d,
 	}
 }
 
+static void __print_submit_results(struct thread_data *d,
+				   unsigned int threads)
+{
+	unsigned int i, error = 0;
+	unsigned long ddcb_calls = 0, submit_time = 0, ddcb_time = 0;
+
+	if (print_hdr)
+		printfv(0, "thread ;    TID ; err ; "
+			"    #ddcbs ; ns/submit ;   ns/ddcb ; time msec\n");
+
+	for (i = 0; i < threads; i++) {
+		printfv(1, "%6d ; %6ld ; %3d ; "
+			"%10ld ; %9ld ; %9ld ;\n",
+			i, (unsigned long)d[i].tid, (int)d[i].thread_rc,
+			d[i].ddcb_calls,
+			d[i].ddcb_calls ? d[i].submit_time / d[i].ddcb_calls : 0,
+			d[i].ddcb_calls ? d[i].ddcb_time / d[i].ddcb_calls : 0);
+
+		if (d[i].thread_rc != 0)
+			error = 1;
+
+		ddcb_calls += d[i].ddcb_calls;
+		submit_time += d[i].submit_time;
+		ddcb_time += d[i].ddcb_time;
+	}
+
+	printfv(0, "%6d ;    all ;     ; "
+		"%10ld ; %9ld ; %9ld ; %9ld\n", i,
+		ddcb_calls,
+		ddcb_calls ? submit_time / ddcb_calls : 0,
+		ddcb_calls ? ddcb_time / ddcb_calls : 0,
+		time_ns_threads / 1000000);
+
+	if (error == 1) {
+		fprintf(stderr, "Error: Thread failed\n");
+		return;
+	}
+}
+
 static void print_results(void)
 {
-	if (infl_ndefl)
+	if (submit_bench)
+		__print_submit_results(d, threads);
+	else if (infl_ndefl)
 		__print_inflate_results(d, threads);
 	else
 		__print_deflate_results(d, threads);
@@ -726,6 +851,9 @@ int main(int argc, char **argv)
 			{ "count",	 required_argument,  NULL, 'c' },
 			{ "filename",	 required_argument,  NULL, 'f' },
 			{ "deflate",	 no_argument,	     NULL, 'D' },
+			{ "submit-bench", no_argument,	     NULL, 'S' },
+			{ "accelerator-type", required_argument, NULL, 'A' },
+			{ "card",	 required_argument,  NULL, 'C' },
 			{ "pre-alloc-memory", no_argument,   NULL, 'P' },
 			{ "no-header",	 no_argument,	     NULL, 'N' },
 			{ "version",	 no_argument,	     NULL, 'V' },
@@ -734,7 +862,7 @@ int main(int argc, char **argv)
 			{ 0,		 no_argument,	     NULL, 0   },
 		};
 
-		ch = getopt_long(argc, argv, "Xd:f:Dc:t:i:o:NVvh?",
+		ch = getopt_long(argc, argv, "Xd:f:DSA:C:c:t:i:o:NVvh?",
 				 long_options, &option_index);
 		if (ch == -1)    /* all params processed ? */
 			break;
@@ -766,6 +894,25 @@ int main(int argc, char **argv)
 		case 'D':
 			infl_ndefl = 0;
 			break;
+		case 'S':
+			submit_bench = true;
+			break;
+		case 'A':
+			if (strcmp(optarg, "GENWQE") == 0)
+				card_type = DDCB_TYPE_GENWQE;
+			else if (strcmp(optarg, "CAPI") == 0)
+				card_type = DDCB_TYPE_CAPI;
+			else if (strcmp(optarg, "SW") == 0)
+				card_type = DDCB_TYPE_SW;
+			else
+				card_type = strtol(optarg, (char **)NULL, 0);
+			break;
+		case 'C':
+			if (strcmp(optarg, "RED") == 0)
+				card_no = ACCEL_REDUNDANT;
+			else
+				card_no = strtol(optarg, (char **)NULL, 0);
+			break;
 		case 'N':
 			print_hdr = false;
 			break;